@@ -14,6 +14,8 @@
 
 #ifndef __ASSEMBLY__
 #include <lego/string.h>
+#include <asm/alternative.h>
+#include <asm/processor-features-flags.h>
 
 /**
  *	virt_to_phys	-	map virtual addresses to physical
@@ -54,6 +56,38 @@ static inline void *phys_to_virt(phys_addr_t address)
 #define clear_page(page)	memset((page), 0, PAGE_SIZE)
 #define copy_page(to,from)	memcpy((to), (from), PAGE_SIZE)
 
+void clear_page_rep(void *page);
+void clear_page_movnti(void *page);
+void clear_page_avx2(void *page);
+void copy_page_rep(void *to, void *from);
+void copy_page_movnti(void *to, void *from);
+void copy_page_avx2(void *to, void *from);
+
+/*
+ * Clear or copy a page with non-temporal stores, which bypass the CPU
+ * cache. Use them for data that will not be read by CPU soon, so it does
+ * not push the hot working set out of cache. Plain string ops are used
+ * if the CPU has no SSE2.
+ */
+static __always_inline void clear_page_nocache(void *page)
+{
+	alternative_call(clear_page_rep, clear_page_movnti, X86_FEATURE_XMM2,
+			 "=D" (page), "0" (page)
+			 : "memory", "rax", "rcx");
+}
+
+static __always_inline void copy_page_nocache(void *to, void *from)
+{
+	alternative_call(copy_page_rep, copy_page_movnti, X86_FEATURE_XMM2,
+			 ASM_OUTPUT2("=D" (to), "=S" (from)),
+			 "0" (to), "1" (from)
+			 : "memory", "rax", "rcx", "rdx", "r8", "r9");
+}
+
+/* Multiple pages, may use AVX2. Check arch/x86/lib/copy_nocache.c */
+void clear_pages_nocache(void *page, unsigned long nr_pages);
+void copy_pages_nocache(void *to, void *from, unsigned long nr_pages);
+
 #endif /* __ASSEMBLY__ */
 
 #endif /* _ASM_X86_PAGE_H_ */
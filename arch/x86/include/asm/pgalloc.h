@@ -30,6 +30,11 @@ static inline void pmd_populate_kernel(struct mm_struct *mm,
 
 #define pmd_pgtable(pmd) pmd_page(pmd)
 
+/* Macro for the same reason as pmd_page() */
+#define pmd_populate(mm, pmd, pte)					\
+	pmd_set(pmd, __pmd(((pteval_t)page_to_pfn(pte) << PAGE_SHIFT) |	\
+			   _PAGE_TABLE))
+
 static inline void pud_populate(struct mm_struct *mm, pud_t *pud, pmd_t *pmd)
 {
 	pud_set(pud, __pud(_PAGE_TABLE | __pa(pmd)));
@@ -83,6 +83,11 @@ static inline int pmd_young(pmd_t pmd)
 	return pmd_flags(pmd) & _PAGE_ACCESSED;
 }
 
+static inline int pmd_write(pmd_t pmd)
+{
+	return pmd_flags(pmd) & _PAGE_RW;
+}
+
 static inline int pte_write(pte_t pte)
 {
 	return pte_flags(pte) & _PAGE_RW;
@@ -140,6 +145,24 @@ static inline int pmd_large(pmd_t pte)
 	return pmd_flags(pte) & _PAGE_PSE;
 }
 
+/* A pte-table pmd whose 2MB range may be cached as one pcache huge line */
+static inline int pmd_huge_line_allowed(pmd_t pmd)
+{
+	return (pmd_flags(pmd) & (_PAGE_HUGE_LINE | _PAGE_PSE)) == _PAGE_HUGE_LINE;
+}
+
+static inline int pmd_huge_line_busy(pmd_t pmd)
+{
+	return pmd_flags(pmd) & _PAGE_HUGE_LINE_BUSY;
+}
+
+/* A 2MB mapping of a pcache huge line */
+static inline int pmd_huge_line(pmd_t pmd)
+{
+	return (pmd_flags(pmd) & (_PAGE_HUGE_LINE | _PAGE_PSE)) ==
+		(_PAGE_HUGE_LINE | _PAGE_PSE);
+}
+
 /* to find an entry in a page-table-directory. */
 static inline unsigned long pud_index(unsigned long address)
 {
@@ -342,6 +365,21 @@ static inline pmd_t pmd_mknotpresent(pmd_t pmd)
 	return pmd_clear_flags(pmd, _PAGE_PRESENT | _PAGE_PROTNONE);
 }
 
+static inline pmd_t pmd_mkhuge_line(pmd_t pmd)
+{
+	return pmd_set_flags(pmd, _PAGE_HUGE_LINE);
+}
+
+static inline pmd_t pmd_mkhuge_line_busy(pmd_t pmd)
+{
+	return pmd_set_flags(pmd, _PAGE_HUGE_LINE_BUSY);
+}
+
+static inline pmd_t pmd_clear_huge_line(pmd_t pmd)
+{
+	return pmd_clear_flags(pmd, _PAGE_HUGE_LINE | _PAGE_HUGE_LINE_BUSY);
+}
+
 #define pte_pgprot(x) __pgprot(pte_flags(x))
 #define pmd_pgprot(x) __pgprot(pmd_flags(x))
 #define pud_pgprot(x) __pgprot(pud_flags(x))
@@ -358,6 +396,11 @@ static inline int pte_same(pte_t a, pte_t b)
 	return a.pte == b.pte;
 }
 
+static inline int pmd_same(pmd_t a, pmd_t b)
+{
+	return pmd_val(a) == pmd_val(b);
+}
+
 static inline int pte_present(pte_t a)
 {
 	return pte_flags(a) & (_PAGE_PRESENT | _PAGE_PROTNONE);
@@ -384,7 +427,9 @@ static inline int pmd_none(pmd_t pmd)
 
 static inline int pmd_bad(pmd_t pmd)
 {
-	return (pmd_flags(pmd) & ~_PAGE_USER) != _KERNPG_TABLE;
+	pmdval_t ignore = _PAGE_USER | _PAGE_HUGE_LINE | _PAGE_HUGE_LINE_BUSY;
+
+	return (pmd_flags(pmd) & ~ignore) != _KERNPG_TABLE;
 }
 
 /*
@@ -687,6 +732,25 @@ static inline int ptep_clear_flush_young(pte_t *ptep)
 	return ptep_test_and_clear_young(ptep);
 }
 
+static inline int pmdp_test_and_clear_young(pmd_t *pmdp)
+{
+	int ret = 0;
+
+	if (pmd_young(*pmdp))
+		ret = test_and_clear_bit(_PAGE_BIT_ACCESSED,
+					 (unsigned long *)&pmdp->pmd);
+	return ret;
+}
+
+/*
+ * Replace a pmd that hardware may update behind our back.
+ * The returned old entry has all accessed and dirty bits set so far.
+ */
+static inline pmd_t pmdp_xchg(pmd_t *pmdp, pmd_t pmd)
+{
+	return __pmd(xchg(&pmdp->pmd, pmd_val(pmd)));
+}
+
 #define flush_tlb_fix_spurious_fault(vma, address) do { } while (0)
 
 void ptdump_walk_pgd_level(pgd_t *pgd);
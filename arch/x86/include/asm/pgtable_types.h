@@ -43,6 +43,13 @@
 #define _PAGE_BIT_ZEROFILL		_PAGE_BIT_SOFTW2 /* zero-fill pcache */
 #define _PAGE_BIT_ZEROFILL_LOCKED	_PAGE_BIT_SOFTW3 /* zero-fill pcache async net in progress */
 
+/*
+ * PMD level only. Bits 9-11 are ignored by hardware in both
+ * pte-table and 2MB entries, so they do not change the walk.
+ */
+#define _PAGE_BIT_HUGE_LINE		_PAGE_BIT_SOFTW1 /* pcache huge line allowed or mapped */
+#define _PAGE_BIT_HUGE_LINE_BUSY	_PAGE_BIT_SOFTW2 /* pcache huge line fill in progress */
+
 /* If _PAGE_BIT_PRESENT is clear, we use these: */
 /* - if the user mapped it with PROT_NONE; pte_present gives true */
 #define _PAGE_BIT_PROTNONE	_PAGE_BIT_GLOBAL
@@ -77,6 +84,9 @@
 #define _PAGE_ZEROFILL		(_AT(pteval_t, 1) << _PAGE_BIT_ZEROFILL)
 #define _PAGE_ZEROFILL_LOCKED	(_AT(pteval_t, 1) << _PAGE_BIT_ZEROFILL_LOCKED)
 
+#define _PAGE_HUGE_LINE		(_AT(pteval_t, 1) << _PAGE_BIT_HUGE_LINE)
+#define _PAGE_HUGE_LINE_BUSY	(_AT(pteval_t, 1) << _PAGE_BIT_HUGE_LINE_BUSY)
+
 #define _PAGE_PKEY_MASK (_PAGE_PKEY_BIT0 | \
 			 _PAGE_PKEY_BIT1 | \
 			 _PAGE_PKEY_BIT2 | \
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Multi-page non-temporal copy and clear.
+ *
+ * AVX2 moves 128 bytes per iteration, but ymm registers belong to user,
+ * so kernel_fpu_begin() has to save the user FPU state first. That only
+ * pays off when there are a few pages to move. Otherwise, and when FPU
+ * can not be used, fall back to the page-sized movnti kernels.
+ */
+
+#include <lego/mm.h>
+#include <lego/kernel.h>
+#include <lego/profile.h>
+#include <asm/page.h>
+#include <asm/cache.h>
+#include <asm/fpu/api.h>
+#include <asm/processor-features.h>
+
+#define NOCACHE_AVX2_MIN_PAGES	(4)
+
+static inline bool nocache_use_avx2(void *to, unsigned long nr_pages)
+{
+	return nr_pages >= NOCACHE_AVX2_MIN_PAGES &&
+	       IS_ALIGNED((unsigned long)to, 32) &&
+	       boot_cpu_has(X86_FEATURE_AVX2) &&
+	       irq_fpu_usable();
+}
+
+void copy_pages_nocache(void *to, void *from, unsigned long nr_pages)
+{
+	unsigned long i;
+
+	if (nocache_use_avx2(to, nr_pages)) {
+		kernel_fpu_begin();
+		for (i = 0; i < nr_pages; i++)
+			copy_page_avx2(to + i * PAGE_SIZE, from + i * PAGE_SIZE);
+		kernel_fpu_end();
+		return;
+	}
+
+	for (i = 0; i < nr_pages; i++)
+		copy_page_nocache(to + i * PAGE_SIZE, from + i * PAGE_SIZE);
+}
+
+void clear_pages_nocache(void *page, unsigned long nr_pages)
+{
+	unsigned long i;
+
+	if (nocache_use_avx2(page, nr_pages)) {
+		kernel_fpu_begin();
+		for (i = 0; i < nr_pages; i++)
+			clear_page_avx2(page + i * PAGE_SIZE);
+		kernel_fpu_end();
+		return;
+	}
+
+	for (i = 0; i < nr_pages; i++)
+		clear_page_nocache(page + i * PAGE_SIZE);
+}
+
+#ifdef CONFIG_PROFILING_BOOT
+void *memcpy_erms(void *to, const void *from, size_t len);
+
+/* Copy 4MB, larger than most L2, while a 256KB working set stays hot */
+#define NOCACHE_BENCH_ORDER	(10)
+#define NOCACHE_BENCH_HOT_ORDER	(6)
+
+static void bench_memcpy(void *to, void *from)
+{
+	memcpy(to, from, PAGE_SIZE);
+}
+
+static void bench_memcpy_erms(void *to, void *from)
+{
+	memcpy_erms(to, from, PAGE_SIZE);
+}
+
+struct nocache_bench {
+	const char	*name;
+	void		(*copy)(void *to, void *from);
+	int		feature;
+	bool		fpu;
+};
+
+static struct nocache_bench nocache_benches[] = {
+	{ "memcpy",	 bench_memcpy,		-1,			false },
+	{ "memcpy_erms", bench_memcpy_erms,	X86_FEATURE_ERMS,	false },
+	{ "movnti",	 copy_page_movnti,	X86_FEATURE_XMM2,	false },
+	{ "avx2",	 copy_page_avx2,	X86_FEATURE_AVX2,	true  },
+};
+
+static unsigned long hot_set_sum;
+
+/* Touch every cacheline of the hot set, return the time it takes */
+static u64 touch_hot_set(void *hot, unsigned long size)
+{
+	unsigned long i, sum = 0;
+	u64 start;
+
+	start = profile_clock();
+	for (i = 0; i < size; i += L1_CACHE_BYTES)
+		sum += READ_ONCE(*(unsigned long *)(hot + i));
+	start = profile_clock() - start;
+
+	WRITE_ONCE(hot_set_sum, sum);
+	return start;
+}
+
+/*
+ * For each copy kernel, report the copy cost per page, and how long it
+ * takes to walk the hot set after the copy. A higher number means the
+ * copy pushed more of the hot set out of CPU cache.
+ */
+void profile_copy_nocache(void)
+{
+	unsigned long nr_pages = 1UL << NOCACHE_BENCH_ORDER;
+	unsigned long hot_size = PAGE_SIZE << NOCACHE_BENCH_HOT_ORDER;
+	struct nocache_bench *b;
+	void *src, *dst, *hot;
+	unsigned long i;
+	u64 start, copy_ns, hot_ns, base_ns;
+
+	src = (void *)__get_free_pages(GFP_KERNEL, NOCACHE_BENCH_ORDER);
+	dst = (void *)__get_free_pages(GFP_KERNEL, NOCACHE_BENCH_ORDER);
+	hot = (void *)__get_free_pages(GFP_KERNEL, NOCACHE_BENCH_HOT_ORDER);
+	if (!src || !dst || !hot) {
+		pr_info("Boot profile: copy_nocache: no memory\n");
+		goto out;
+	}
+
+	memset(src, 0x5a, nr_pages * PAGE_SIZE);
+	memset(dst, 0, nr_pages * PAGE_SIZE);
+	memset(hot, 1, hot_size);
+
+	touch_hot_set(hot, hot_size);
+	base_ns = touch_hot_set(hot, hot_size);
+	pr_info("Boot profile: copy_nocache: %lu pages, hot set %lu KB, hot walk %llu ns\n",
+		nr_pages, hot_size >> 10, base_ns);
+
+	for (b = nocache_benches; b < nocache_benches + ARRAY_SIZE(nocache_benches); b++) {
+		if (b->feature >= 0 && !boot_cpu_has(b->feature))
+			continue;
+
+		touch_hot_set(hot, hot_size);
+
+		start = profile_clock();
+		if (b->fpu)
+			kernel_fpu_begin();
+		for (i = 0; i < nr_pages; i++)
+			b->copy(dst + i * PAGE_SIZE, src + i * PAGE_SIZE);
+		if (b->fpu)
+			kernel_fpu_end();
+		copy_ns = profile_clock() - start;
+
+		hot_ns = touch_hot_set(hot, hot_size);
+
+		pr_info("Boot profile: copy_nocache: %-12s %6llu ns/page, hot walk after %8llu ns\n",
+			b->name, copy_ns / nr_pages, hot_ns);
+	}
+
+out:
+	if (hot)
+		free_pages((unsigned long)hot, NOCACHE_BENCH_HOT_ORDER);
+	if (dst)
+		free_pages((unsigned long)dst, NOCACHE_BENCH_ORDER);
+	if (src)
+		free_pages((unsigned long)src, NOCACHE_BENCH_ORDER);
+}
+#endif /* CONFIG_PROFILING_BOOT */
@@ -52,6 +52,7 @@ static inline long COUNTER_nr_bytes_rx(void)
 }
 
 void dump_ib_stats(void);
+void reset_ib_stats(void);
 #else
 static inline long COUNTER_nr_ib_send_reply(void)
 {
@@ -73,6 +74,11 @@ static inline long COUNTER_nr_bytes_rx(void)
 static inline void dump_ib_stats(void)
 {
 
+}
+
+static inline void reset_ib_stats(void)
+{
+
 }
 #endif
 
@@ -82,6 +88,32 @@ struct fit_sglist {
 	int len;
 };
 
+/*
+ * Max number of pieces for ibapi_send_reply_iov(),
+ * QPs have 16 send SGEs and the FIT header takes one.
+ */
+#define FIT_MAX_IOV	15
+
+/*
+ * Handle of an outstanding ibapi_send_reply_async() request.
+ * Owned by caller, must stay valid until the request completes.
+ */
+struct fit_async_req {
+	int		reply_ready;	/* written by FIT polling thread */
+	int		reply_indicator_index;
+	int		target_node;
+	int		connection_id;
+	int		max_ret_size;
+	int		ret;		/* reply length once done */
+	bool		done;
+	u32		opcode;		/* first word of message */
+	unsigned long	start_time;
+	unsigned long long start_ns;
+	void		*caller;
+	/* Message header, read by HCA after post returns */
+	unsigned long	header[4];
+};
+
 void ibapi_free_recv_buf(void *input_buf);
 
 /* IMM related */
@@ -113,6 +145,24 @@ int ibapi_multicast_send_reply_timeout(int num_nodes, int *target_node,
 				struct fit_sglist *sglist, struct fit_sglist *output_msg,
 				int max_ret_size, int if_use_ret_phys_addr, unsigned long timeout_sec);
 
+int ibapi_send_reply_async(int target_node, void *addr, int size, void *ret_addr,
+			   int max_ret_size, int if_use_ret_phys_addr,
+			   struct fit_async_req *req);
+int ibapi_send_reply_iov(int target_node, struct fit_sglist *iov, int nr_iov,
+			 void *ret_addr, int max_ret_size, int if_use_ret_phys_addr,
+			 unsigned long timeout_sec);
+int ibapi_send_reply_iov_async(int target_node, struct fit_sglist *iov, int nr_iov,
+			       void *ret_addr, int max_ret_size, int if_use_ret_phys_addr,
+			       struct fit_async_req *req);
+int ibapi_poll_reply(struct fit_async_req *req);
+int ibapi_wait_reply(struct fit_async_req *req, unsigned long timeout_sec);
+int ibapi_wait_reply_sleep(struct fit_async_req *req, unsigned long timeout_sec);
+int ibapi_abandon_reply(struct fit_async_req *req);
+int ibapi_abandon_reply_free(struct fit_async_req *req, void *ret_buf);
+int ibapi_wait_any_reply(struct fit_async_req **reqs, int nr,
+			 unsigned long timeout_sec);
+
+int ibapi_max_msg_size(void);
 int ibapi_get_node_id(void);
 int ibapi_num_connected_nodes(void);
 
@@ -166,6 +216,35 @@ static inline int ibapi_receive_message(unsigned int designed_port, void *ret_ad
 					int receive_size, uintptr_t *descriptor)
 { return -EIO; }
 
+static inline int ibapi_send_reply_async(int target_node, void *addr, int size,
+					 void *ret_addr, int max_ret_size,
+					 int if_use_ret_phys_addr,
+					 struct fit_async_req *req)
+{ return -EIO; }
+static inline int ibapi_send_reply_iov(int target_node, struct fit_sglist *iov,
+				       int nr_iov, void *ret_addr, int max_ret_size,
+				       int if_use_ret_phys_addr, unsigned long timeout_sec)
+{ return -EIO; }
+static inline int ibapi_send_reply_iov_async(int target_node, struct fit_sglist *iov,
+					     int nr_iov, void *ret_addr, int max_ret_size,
+					     int if_use_ret_phys_addr,
+					     struct fit_async_req *req)
+{ return -EIO; }
+static inline int ibapi_poll_reply(struct fit_async_req *req)
+{ return -EIO; }
+static inline int ibapi_wait_reply(struct fit_async_req *req, unsigned long timeout_sec)
+{ return -EIO; }
+static inline int ibapi_wait_reply_sleep(struct fit_async_req *req, unsigned long timeout_sec)
+{ return -EIO; }
+static inline int ibapi_abandon_reply(struct fit_async_req *req)
+{ return -EIO; }
+static inline int ibapi_abandon_reply_free(struct fit_async_req *req, void *ret_buf)
+{ return -EIO; }
+static inline int ibapi_wait_any_reply(struct fit_async_req **reqs, int nr,
+				       unsigned long timeout_sec)
+{ return -EIO; }
+
+static inline int ibapi_max_msg_size(void) {return 0; }
 static inline int ibapi_get_node_id(void) {return 0; }
 static inline int ibapi_num_connected_nodes(void) {return 0; };
 static inline int ibapi_sock_send_message(int target_node, int port, int if_internal_port, void *addr, int size, unsigned long timeout_sec, int if_userspace) {return 0; };
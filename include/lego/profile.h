@@ -39,11 +39,16 @@ static inline unsigned long long profile_clock(void)
 
 /* Arch-specific */
 void profile_tlb_shootdown(void);
+void profile_copy_nocache(void);
 
 #ifdef CONFIG_PROFILING_BOOT
 void boot_time_profile(void);
+void boot_profile_parallel(const char *name, unsigned int nr_workers,
+			   u64 wall_ns, u64 cpu_ns);
 #else
 static inline void boot_time_profile(void) { }
+static inline void boot_profile_parallel(const char *name, unsigned int nr_workers,
+					 u64 wall_ns, u64 cpu_ns) { }
 #endif
 
 /*
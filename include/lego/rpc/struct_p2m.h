@@ -48,6 +48,32 @@ struct p2m_flush_msg {
 
 void handle_p2m_flush_one(struct p2m_flush_msg *msg, struct thpool_buffer *tb);
 
+/*
+ * P2M_PCACHE_FLUSH_BATCH
+ *
+ * Multiple dirty lines, all homed at the same memory.
+ * Each line only carries its dirty chunks, as described by @dirty.
+ * Chunks of all lines are packed into @data, in order.
+ * Memory replies the number of lines it failed to write.
+ */
+struct p2m_flush_batch_msg {
+	struct common_header	header;
+	__u32			nr_lines;
+	struct {
+		__u32		pid;
+		__u64		user_va;
+		DECLARE_BITMAP(dirty, PCACHE_LINE_NR_CHUNKS);
+	} lines[PCACHE_FLUSH_BATCH_MAX];
+	char			data[PCACHE_FLUSH_BATCH_MAX * PCACHE_LINE_SIZE];
+};
+
+#define P2M_FLUSH_BATCH_MSG_SIZE(nr_chunks)				\
+	(offsetof(struct p2m_flush_batch_msg, data) +			\
+	 (nr_chunks) * PCACHE_CHUNK_SIZE)
+
+void handle_p2m_flush_batch(struct p2m_flush_batch_msg *msg,
+			    struct thpool_buffer *tb);
+
 /*
  * P2M_MISS
  */
@@ -79,6 +105,36 @@ struct p2m_pcache_miss_reply_struct {
 void handle_p2m_pcache_miss(struct p2m_pcache_miss_msg *msg,
 			    struct thpool_buffer *b);
 
+/*
+ * P2M_PCACHE_MISS_BATCH
+ *
+ * Multiple lines of the same thread group, all homed at the same memory.
+ * Memory replies with per-line status, followed by the lines themselves,
+ * both in the order of missing_vaddr[]. A line is only valid if its status
+ * is 0. If the whole request fails, the reply is a single int.
+ */
+
+struct p2m_pcache_miss_batch_msg {
+	struct common_header	header;
+	__u32			pid;
+	__u32			tgid;
+	__u32			flags;
+	__u32			nr_lines;
+	__u64			missing_vaddr[PCACHE_MISS_BATCH_MAX];
+};
+
+struct p2m_pcache_miss_batch_reply {
+	__u32	status[PCACHE_MISS_BATCH_MAX];
+	char	data[PCACHE_MISS_BATCH_MAX][PCACHE_LINE_SIZE];
+};
+
+#define PCACHE_MISS_BATCH_REPLY_SIZE(nr)				\
+	(offsetof(struct p2m_pcache_miss_batch_reply, data) +		\
+	 (nr) * PCACHE_LINE_SIZE)
+
+void handle_p2m_pcache_miss_batch(struct p2m_pcache_miss_batch_msg *msg,
+				  struct thpool_buffer *tb);
+
 struct p2m_replica_msg {
 	struct common_header	header;
 	struct replica_log	log;
@@ -214,6 +214,7 @@ asmlinkage long setitimer(int which, struct timeval __user *value,
 
 /* Lego only */
 asmlinkage long sys_checkpoint_process(pid_t pid);
+asmlinkage long sys_fit_stat(int cmd);
 
 /* x86-64 only */
 asmlinkage long sys_arch_prctl(int, unsigned long);
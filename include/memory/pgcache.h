@@ -17,6 +17,8 @@
 #include <memory/task.h>
 #include <memory/thread_pool.h>
 #include <lego/types.h>
+#include <lego/mutex.h>
+#include <lego/radixtree.h>
 
 #ifdef CONFIG_DEBUG_PAGE_CACHE
 #define pgcache_debug(fmt, ...) 			\
@@ -29,15 +31,22 @@ static inline void pgcache_debug(const char *fmt, ...) {  }
 #define PGCACHE_HASH_BITS	10
 #define PGCACHE_PREFETCH_ORDER	6 /* How many pages to read to page cache while cache miss */
 
+#define CL_SHIFT		(PAGE_SHIFT + PGCACHE_PREFETCH_ORDER)
 #define CL_SIZE			(PAGE_SIZE*(1 << PGCACHE_PREFETCH_ORDER))
 #define POS_MASK		~(CL_SIZE - 1)
 #define aligned_pos(x)		x & POS_MASK
 #define chunk_offset(x)		x & (~POS_MASK)
 
+#define PGCACHE_RA_MAX_WINDOW	8	/* Max cachelines to read ahead per file */
+#define PGCACHE_RA_MAX_PENDING	32	/* Max prefetched cachelines not accessed yet */
+
+struct pgcache_ra;
+struct lego_pgcache_file;
+
 struct lego_pgcache_struct {
 
 	loff_t			pos;		/* aligned pos */
-	char 			filepath[MAX_FILENAME_LENGTH];
+	struct lego_pgcache_file *file;		/* file it belongs to */
 	u32 			real_len;	/* real length is likely to be smaller than
 						 * cacheline size if file size is small */
 	spinlock_t 		lock;		/* lock to protect lego_pgcache_struct */
@@ -46,8 +55,6 @@ struct lego_pgcache_struct {
 
 	unsigned int 		storage_node;	/* cached result of storage node of this cacheline */
 
-	struct hlist_node 	link;
-	
 	struct list_head 	dirtylist;
 	
 	struct list_head 	stack_s;	/* list of lirs_stack_s */
@@ -56,6 +63,8 @@ struct lego_pgcache_struct {
 
 	void 			*cached_pages;	/* cached file blocks */
 
+	struct pgcache_ra	*ra;		/* in-flight readahead load */
+	struct list_head	ra_list;	/* prefetched, not accessed yet */
 };
 
 struct lego_pgcache_file {
@@ -67,20 +76,37 @@ struct lego_pgcache_file {
 	spinlock_t 		dirtylist_lock;
 
 	unsigned int 		storage_node;		/* will be used later */
+
+	struct list_head	list;			/* on list of all files */
+
+	/*
+	 * Cachelines of this file, indexed by pos >> CL_SHIFT.
+	 * mutex protects them and the readahead state below,
+	 * and serializes page cache read/write/fault of this file.
+	 */
+	struct radix_tree_root	lines;
+	struct mutex		mutex;
+
+	/* readahead state */
+	loff_t			ra_next;		/* line following the last read one */
+	loff_t			ra_end;			/* end of lines already prefetched */
+	unsigned int		ra_window;		/* nr of lines to read ahead */
 };
 
 /* alloc.c */
-struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
-		unsigned int storage_node);
+void *alloc_pgcache_pages(void);
+void free_pgcache_pages(void *pages);
+struct lego_pgcache_struct *__alloc_pgcache(struct lego_pgcache_file *file,
+		loff_t pos);
 void __free_pgcache_locked(struct lego_pgcache_struct *pgc);
 void __free_pgcache_struct(struct lego_pgcache_struct *pgc);
 
-/* hlist.c */
-int ht_insert_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
-void ht_remove_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
+/* index.c */
+int insert_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
+void remove_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
 void free_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
 struct lego_pgcache_struct *							\
-	find_lego_pgcache_struct(char *filepath, loff_t pos);
+	find_lego_pgcache_struct(struct lego_pgcache_file *file, loff_t pos);
 int drop_pgcache(void);
 
 /* dirtylist.c */
@@ -91,6 +117,7 @@ int ht_insert_lego_pgcache_file(struct lego_pgcache_file *file);
 void ht_remove_lego_pgcache_file(struct lego_pgcache_file *file);
 void free_lego_pgcache_file(struct lego_pgcache_file *file);
 struct lego_pgcache_file *find_lego_pgcache_file(char *filepath);
+void for_each_lego_pgcache_file(void (*fn)(struct lego_pgcache_file *file));
 
 void mark_lego_pgcache_dirty(struct lego_pgcache_struct *pgc,			\
 			struct lego_pgcache_file *file);
@@ -107,10 +134,14 @@ ssize_t lego_pgcache_read(struct lego_task_struct *tsk, char *f_name,		\
 ssize_t lego_pgcache_write(struct lego_task_struct *tsk, char *f_name,	\
 		unsigned int storage_node, char __user *buf,			\
 		size_t count, loff_t *pos);
+unsigned long lego_pgcache_get_page(char *f_name, unsigned int storage_node,	\
+		loff_t pos);
+void pgcache_ra_cancel(struct lego_pgcache_struct *pgc);
 
 /* eviction.c */
+/* Caller holds pgc->file->mutex */
 void update_lirs_structure(struct lego_pgcache_struct *pgc);
-void pgcache_evict_one(void);
+bool pgcache_evict_one(struct lego_pgcache_file *cur);
 
 ssize_t get_file_size_from_storage(char *filepath, unsigned int storage_node);
 
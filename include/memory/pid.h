@@ -19,4 +19,6 @@ int __must_check ht_insert_lego_task(struct lego_task_struct *tsk);
 struct lego_task_struct *
 find_lego_task_by_pid(unsigned int node, unsigned int pid);
 
+void __init lego_task_table_init(void);
+
 #endif /* _LEGO_MEMORY_PID_H_ */
@@ -15,7 +15,9 @@
 enum memory_manager_stat_item {
 	/* Handler */
 	HANDLE_PCACHE_MISS,
+	HANDLE_PCACHE_MISS_BATCH,
 	HANDLE_PCACHE_FLUSH,
+	HANDLE_PCACHE_FLUSH_BATCH,
 	HANDLE_PCACHE_REPLICA,
 	HANDLE_P2M_MMAP,
 	HANDLE_P2M_MUNMAP,
@@ -28,6 +30,15 @@ enum memory_manager_stat_item {
 
 	NR_BATCHED_LOG_FLUSH,
 
+	NR_THPOOL_BUFFER_FULL,
+	NR_THPOOL_BUSY_REPLY,
+	NR_THPOOL_DEFERRED_OVERFLOW,
+
+	PGCACHE_SYNC_LOAD,
+	PGCACHE_RA_ISSUED,
+	PGCACHE_RA_HIT,
+	PGCACHE_RA_WASTE,
+
 	NR_MEMORY_MANAGER_STAT_ITEMS,
 };
 
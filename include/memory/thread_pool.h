@@ -11,6 +11,7 @@
 #define _MEM_THREAD_POOL_H_
 
 #include <lego/list.h>
+#include <lego/atomic.h>
 #include <lego/sched.h>
 #include <lego/spinlock.h>
 #include <lego/comp_common.h>
@@ -18,8 +19,15 @@
 /*
  * This is the maximum reply buffer size.
  * Retrict your reply size to below the limit.
+ *
+ * Most replies are a few bytes, so each thpool buffer only has
+ * a THPOOL_TX_INLINE_SIZE tx area. Handlers that need more must
+ * use thpool_buffer_tx_large(), which lends them the per-worker
+ * THPOOL_TX_SIZE area. A worker handles one request at a time,
+ * thus it never waits for the large buffer.
  */
 #define THPOOL_TX_SIZE		(PAGE_SIZE * 1024)
+#define THPOOL_TX_INLINE_SIZE	(PAGE_SIZE)
 
 #define NR_THPOOL_BUFFER	(256)
 
@@ -36,26 +44,59 @@ struct tw_padding {
 #define QUEUING_STAT_STRIDE_NS	(QUEUING_STAT_STRIDE_US*1000)
 #define QUEUING_STAT_ENTRIES	(40)
 
+/*
+ * Requests are queued by class. Idle workers drain URGENT requests
+ * from all workers before they look at any NORMAL one, so data-plane
+ * requests never wait behind a slow control-plane one (e.g. fork).
+ */
+enum thpool_queue_class {
+	THPOOL_QUEUE_URGENT,		/* pcache miss, flush, etc. */
+	THPOOL_QUEUE_NORMAL,		/* everything else */
+
+	NR_THPOOL_QUEUES,
+};
+
+/*
+ * There are only NR_THPOOL_BUFFER buffers in total,
+ * thus a queue of this size can never overflow.
+ */
+#define THPOOL_QUEUE_SIZE	(NR_THPOOL_BUFFER)
+#define THPOOL_QUEUE_MASK	(THPOOL_QUEUE_SIZE - 1)
+
+struct thpool_queue_slot {
+	unsigned long		seq;
+	struct thpool_buffer	*tb;
+};
+
+/*
+ * Bounded lock-free MPMC ring.
+ * Producers are the FIT polling threads, consumers are the owner
+ * worker and any idle worker stealing from it. Each slot carries a
+ * sequence number telling whether it is ready to be filled or drained.
+ */
+struct thpool_queue {
+	unsigned long		head;
+	TW_PADDING(_pad_head);
+	unsigned long		tail;
+	TW_PADDING(_pad_tail);
+	struct thpool_queue_slot slots[THPOOL_QUEUE_SIZE];
+};
+
 /* This structure describes a worker thread */
 struct thpool_worker {
-	/*
-	 * This counter is updated while the list
-	 * is updated. And they are updated under @lock.
-	 * Thus a simple int will do.
-	 *
-	 * Besides, the top three fields will always be
-	 * updated together, so aggregate them into one
-	 * standalone cache line.
-	 */
 	int			cpu;
-	int			nr_queued;
-	spinlock_t		lock;
-	struct list_head	work_head;
+	atomic_t		nr_queued;
 	struct task_struct	*task;
 	TW_PADDING(_pad1);
 
+	struct thpool_queue	queues[NR_THPOOL_QUEUES];
+
+	/* Lent to the handled buffer by thpool_buffer_tx_large() */
+	void			*large_tx;
+
 	/* for debug usage */
 	unsigned long		nr_handled;
+	unsigned long		nr_stolen;
 	unsigned long		total_queuing_delay_ns;
 	unsigned long		max_queuing_delay_ns;
 	unsigned long		min_queuing_delay_ns;
@@ -79,17 +120,17 @@ static inline int cpu_thpool_worker(struct thpool_worker *tw)
 
 static inline int nr_queued_thpool_worker(struct thpool_worker *tw)
 {
-	return tw->nr_queued;
+	return atomic_read(&tw->nr_queued);
 }
 
 static inline void inc_queued_thpool_worker(struct thpool_worker *tw)
 {
-	tw->nr_queued++;
+	atomic_inc(&tw->nr_queued);
 }
 
 static inline void dec_queued_thpool_worker(struct thpool_worker *tw)
 {
-	tw->nr_queued--;
+	atomic_dec(&tw->nr_queued);
 }
 
 struct tb_padding {
@@ -101,9 +142,9 @@ struct thpool_buffer {
 	unsigned long		flags;
 	unsigned long		time_enqueue_ns;
 	unsigned long		time_dequeue_ns;
-	struct list_head	next;
 
 	void			*fit_rx;
+	int			fit_rx_size;
 	void			*fit_ctx;
 	void			*fit_imm;
 	int			fit_node_id;
@@ -116,14 +157,23 @@ struct thpool_buffer {
 	void			*private_tx;
 	int			tx_size;
 
+	/*
+	 * @tx points to @tx_inline, or to @large_tx
+	 * if largeTX flag is set. @large_tx is set by the
+	 * worker that handles this buffer.
+	 */
+	void			*tx;
+	void			*large_tx;
+
 	THPOOL_PADDING(_pad1);
-	char			tx[THPOOL_TX_SIZE];
+	char			tx_inline[THPOOL_TX_INLINE_SIZE];
 };
 
 enum thpool_buffer_flags {
 	THPOOL_BUFFER_used,
 	THPOOL_BUFFER_noreply,
 	THPOOL_BUFFER_privateTX,
+	THPOOL_BUFFER_largeTX,
 
 	NR_THPOOL_BUFFER_FLAGS,
 };
@@ -166,13 +216,25 @@ static inline void __ClearThpoolBuffer##uname(struct thpool_buffer *p)	\
 	__CLEAR_THPOOL_BUFFER_FLAGS(uname, lname)
 
 THPOOL_BUFFER_FLAGS(Used, used)
+
+/* Buffers are taken by both polling thread and workers */
+static inline int TestSetThpoolBufferUsed(struct thpool_buffer *p)
+{
+	return test_and_set_bit(THPOOL_BUFFER_used, &p->flags);
+}
 THPOOL_BUFFER_FLAGS(Noreply, noreply)
 THPOOL_BUFFER_FLAGS(PrivateTX, privateTX)
+THPOOL_BUFFER_FLAGS(LargeTX, largeTX)
 
 static inline void tb_set_tx_size(struct thpool_buffer *tb, int size)
 {
-	if (unlikely(size >= THPOOL_TX_SIZE))
-		panic("Size: %d\n", size);
+	int limit = THPOOL_TX_INLINE_SIZE;
+
+	if (ThpoolBufferPrivateTX(tb) || ThpoolBufferLargeTX(tb))
+		limit = THPOOL_TX_SIZE;
+
+	if (unlikely(size > limit))
+		panic("Size: %d limit: %d\n", size, limit);
 	tb->tx_size = size;
 }
 
@@ -202,11 +264,33 @@ static inline void *thpool_buffer_rx(struct thpool_buffer *tb)
 	return tb->fit_rx;
 }
 
+static inline int thpool_buffer_rx_size(struct thpool_buffer *tb)
+{
+	return tb->fit_rx_size;
+}
+
 static inline void *thpool_buffer_tx(struct thpool_buffer *tb)
 {
 	return tb->tx;
 }
 
+/*
+ * Switch to the large tx area. Must be called before
+ * anything is written into thpool_buffer_tx().
+ */
+static inline void *thpool_buffer_tx_large(struct thpool_buffer *tb)
+{
+	tb->tx = tb->large_tx;
+	__SetThpoolBufferLargeTX(tb);
+	return tb->tx;
+}
+
+static inline void tb_reset_tx(struct thpool_buffer *tb)
+{
+	tb->tx = tb->tx_inline;
+	__ClearThpoolBufferLargeTX(tb);
+}
+
 void handle_bad_request(struct common_header *hdr, u64 desc);
 
 #ifdef CONFIG_COUNTER_THPOOL
@@ -233,8 +317,10 @@ static inline int max_queued_thpool_worker(struct thpool_worker *tw)
 
 static inline void update_max_queued_thpool_worker(struct thpool_worker *tw)
 {
-	if (tw->nr_queued > tw->max_nr_queued)
-		tw->max_nr_queued = tw->nr_queued;
+	int nr_queued = nr_queued_thpool_worker(tw);
+
+	if (nr_queued > tw->max_nr_queued)
+		tw->max_nr_queued = nr_queued;
 }
 
 static inline void
@@ -291,6 +377,11 @@ static inline void inc_thpool_worker_nr_handled(struct thpool_worker *tw)
 	tw->nr_handled++;
 }
 
+static inline void inc_thpool_worker_nr_stolen(struct thpool_worker *tw)
+{
+	tw->nr_stolen++;
+}
+
 #else
 static inline int thpool_worker_in_handler(struct thpool_worker *tw) { return 0; }
 static inline void set_in_handler_thpool_worker(struct thpool_worker *tw) { }
@@ -310,9 +401,12 @@ static inline void thpool_buffer_enqueue_time(struct thpool_buffer *tb) { }
 static inline void add_thpool_worker_total_queuing(struct thpool_worker *tw, unsigned long diff_ns) { }
 
 static inline void inc_thpool_worker_nr_handled(struct thpool_worker *tw) { }
+static inline void inc_thpool_worker_nr_stolen(struct thpool_worker *tw) { }
 #endif /* CONFIG_COUNTER_THPOOL */
 
 void fit_ack_reply_callback(struct thpool_buffer *b);
+void fit_busy_reply_callback(void *fit_ctx, void *fit_imm, int node_id, int offset);
+bool fit_request_is_noreply(void *fit_imm);
 void thpool_callback(void *fit_ctx, void *fit_imm,
 		     void *rx, int rx_size, int node_id, int fit_offset);
 
@@ -330,6 +330,19 @@ pcache_set_to_first_pcache_meta(struct pcache_set *pset)
 	return pcache_meta_map + offset;
 }
 
+/**
+ * pcache_set_way_to_pcache_meta
+ * @pset: pcache set in question
+ * @way: way index within @pset
+ *
+ * Given a @pset and a @way, return the pcache meta of that way.
+ */
+static inline struct pcache_meta *
+pcache_set_way_to_pcache_meta(struct pcache_set *pset, unsigned int way)
+{
+	return pcache_set_to_first_pcache_meta(pset) + way * nr_cachesets;
+}
+
 /**
  * pcache_meta_to_pa
  * @pcm: pcache meta in question
@@ -460,7 +473,7 @@ user_vaddr_to_pcache_set(unsigned long uvaddr)
 
 static inline unsigned long pcache_meta_to_pfn(struct pcache_meta *pcm)
 {
-	return ((unsigned long)pcache_meta_to_pa(pcm)) >> PCACHE_LINE_SIZE_SHIFT;
+	return ((unsigned long)pcache_meta_to_pa(pcm)) >> PAGE_SHIFT;
 }
 
 static inline pte_t pcache_mk_pte(struct pcache_meta *pcm, pgprot_t pgprot)
@@ -468,6 +481,17 @@ static inline pte_t pcache_mk_pte(struct pcache_meta *pcm, pgprot_t pgprot)
 	return pfn_pte(pcache_meta_to_pfn(pcm), pgprot);
 }
 
+/*
+ * Create a 2MB pmd entry that maps @pcm and the following lines.
+ * @pcm must be the head of a huge line.
+ */
+static inline pmd_t pcache_mk_pmd(struct pcache_meta *pcm, pgprot_t pgprot)
+{
+	pmd_t pmd = pfn_pmd(pcache_meta_to_pfn(pcm), pgprot);
+
+	return pmd_mkhuge_line(pmd_mkhuge(pmd));
+}
+
 /*
  * Create and return a new pte,
  * use the same pgprot attributes with @old_pte
@@ -550,11 +574,23 @@ enum piggyback_options {
 /* Allocate one pcache line from the pset @address maps to */
 struct pcache_meta *pcache_alloc(unsigned long address,
 				 enum piggyback_options piggyback);
+struct pcache_meta *pcache_alloc_noevict(unsigned long address);
+
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
+struct pcache_meta *pcache_alloc_zeroed(unsigned long address);
+#else
+static inline struct pcache_meta *pcache_alloc_zeroed(unsigned long address)
+{
+	return NULL;
+}
+#endif
 
 int pcache_flush_one(struct pcache_meta *pcm);
 void clflush_one(struct task_struct *tsk, unsigned long user_va, void *cache_addr);
-void __clflush_one(pid_t tgid, unsigned long user_va,
-		   unsigned int m_nid, unsigned int rep_nid, void *cache_addr);
+void clflush_range(struct task_struct *tsk, unsigned long user_va,
+		   void *cache_addr, unsigned int nr_lines);
+int __clflush_one(pid_t tgid, unsigned long user_va,
+		  unsigned int m_nid, unsigned int rep_nid, void *cache_addr);
 
 /* eviction */
 int pcache_evict_line(struct pcache_set *pset, unsigned long address,
@@ -657,7 +693,29 @@ int common_do_fill_page(struct mm_struct *mm, unsigned long address,
 			unsigned long flags, fill_func_t fill_func, void *arg,
 			enum rmap_caller caller, enum piggyback_options piggyback);
 
+/*
+ * Fill multiple lines with one P2M_PCACHE_MISS_BATCH round-trip.
+ * Caller sets @nr_lines, @address[], @pcm[] and provides @reply.
+ * Upon return, @filled[i] tells if line i has valid data.
+ */
+struct p2m_pcache_miss_batch_reply;
+
+struct pcache_fill_batch {
+	unsigned int				nr_lines;
+	unsigned long				address[PCACHE_MISS_BATCH_MAX];
+	struct pcache_meta			*pcm[PCACHE_MISS_BATCH_MAX];
+	bool					filled[PCACHE_MISS_BATCH_MAX];
+	struct p2m_pcache_miss_batch_reply	*reply;
+};
+
+int pcache_fill_remote_batch(struct task_struct *tsk, int dst_nid,
+			     struct pcache_fill_batch *fb, unsigned long flags);
+
 #include <processor/pcache_victim.h>
 #include <processor/pcache_evict.h>
+#include <processor/pcache_prefetch.h>
+#include <processor/pcache_writeback.h>
+#include <processor/pcache_delta.h>
+#include <processor/pcache_huge.h>
 
 #endif /* _LEGO_PROCESSOR_PCACHE_H_ */
@@ -34,4 +34,14 @@
 
 #define PCACHE_LINE_NR_PAGES		(PCACHE_LINE_SIZE / PAGE_SIZE)
 
+/* Granularity of sub-line dirty tracking */
+#define PCACHE_CHUNK_SIZE		(64)
+#define PCACHE_LINE_NR_CHUNKS		(PCACHE_LINE_SIZE / PCACHE_CHUNK_SIZE)
+
+/* Max lines carried by one P2M_PCACHE_MISS_BATCH */
+#define PCACHE_MISS_BATCH_MAX		(16)
+
+/* Max lines carried by one P2M_PCACHE_FLUSH_BATCH */
+#define PCACHE_FLUSH_BATCH_MAX		(8)
+
 #endif /* _LEGO_PROCESSOR_PCACHE_CONFIG_H_ */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Sub-line dirty tracking, used to flush only dirty chunks of a line.
+ */
+
+#ifndef _LEGO_PROCESSOR_PCACHE_DELTA_H_
+#define _LEGO_PROCESSOR_PCACHE_DELTA_H_
+
+#include <lego/bitmap.h>
+#include <processor/pcache_types.h>
+
+struct fit_sglist;
+
+int pcache_dirty_to_iov(void *line, unsigned long *dirty, int *nr_chunks,
+			struct fit_sglist *iov, int room);
+
+#ifdef CONFIG_PCACHE_DELTA_FLUSH
+
+#define PCACHE_DELTA_NR_TWINS \
+	((unsigned long)CONFIG_PCACHE_DELTA_NR_TWINS)
+
+void *pcache_twin(struct pcache_meta *pcm);
+void pcache_twin_alloc(struct pcache_meta *pcm);
+void pcache_twin_free(struct pcache_meta *pcm);
+bool pcache_twin_unchanged(struct pcache_meta *pcm);
+int pcache_delta_dirty_map(struct pcache_meta *pcm, unsigned long *dirty);
+void __init alloc_pcache_twin_map(void);
+
+/*
+ * Called after a line is filled, before its pte is set.
+ * Content equals memory at this point. Write faults take the twin
+ * right away, read faults map the line read-only, and the twin is
+ * taken at the first write (pcache_do_wp_page()).
+ */
+static inline pte_t
+pcache_delta_fill_pte(struct pcache_meta *pcm, pte_t entry, unsigned long flags)
+{
+	if (flags & FAULT_FLAG_WRITE) {
+		pcache_twin_alloc(pcm);
+		return entry;
+	}
+
+	SetPcacheTwinable(pcm);
+	return pte_wrprotect(entry);
+}
+
+/* Called before a write-protected pte of @pcm is upgraded to RW */
+static inline void pcache_delta_wp_reuse(struct pcache_meta *pcm)
+{
+	if (TestClearPcacheTwinable(pcm))
+		pcache_twin_alloc(pcm);
+}
+#else
+static inline void *pcache_twin(struct pcache_meta *pcm) { return NULL; }
+static inline void pcache_twin_free(struct pcache_meta *pcm) { }
+static inline bool pcache_twin_unchanged(struct pcache_meta *pcm) { return false; }
+static inline int
+pcache_delta_dirty_map(struct pcache_meta *pcm, unsigned long *dirty)
+{
+	bitmap_fill(dirty, PCACHE_LINE_NR_CHUNKS);
+	return PCACHE_LINE_NR_CHUNKS;
+}
+static inline void alloc_pcache_twin_map(void) { }
+static inline pte_t
+pcache_delta_fill_pte(struct pcache_meta *pcm, pte_t entry, unsigned long flags)
+{
+	return entry;
+}
+static inline void pcache_delta_wp_reuse(struct pcache_meta *pcm) { }
+#endif /* CONFIG_PCACHE_DELTA_FLUSH */
+
+#endif /* _LEGO_PROCESSOR_PCACHE_DELTA_H_ */
@@ -107,6 +107,8 @@ struct pcache_meta *evict_find_line_lru(struct pcache_set *pset);
 void kevict_sweepd_lru(void);
 
 #else
+static inline int pset_nr_lru(struct pcache_set *pset) { return 0; }
+
 static inline void
 add_to_lru_list(struct pcache_meta *pcm, struct pcache_set *pset) { }
 static inline void
@@ -152,9 +154,30 @@ static inline struct pcache_meta *
 evict_find_line_random(struct pcache_set *pset) { BUG(); }
 #endif /* EVICT_RANDOM */
 
+/*
+ * Eviction Algorithm
+ * 	CLOCK and CLOCK-Pro
+ */
+#ifdef CONFIG_PCACHE_EVICT_CLOCK
+struct pcache_meta *evict_find_line_clock(struct pcache_set *pset);
+#else
+static inline struct pcache_meta *
+evict_find_line_clock(struct pcache_set *pset) { BUG(); }
+#endif /* EVICT_CLOCK */
+
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+void pcache_clock_free(struct pcache_meta *pcm);
+#else
+static inline void pcache_clock_free(struct pcache_meta *pcm) { }
+#endif
+
 #ifdef CONFIG_PCACHE_EVICTION_PERSET_LIST
 void pset_remove_eviction(struct pcache_set *pset,
 			  struct pcache_meta *pcm, int nr_added);
+struct pset_eviction_entry *
+pset_detach_eviction(struct pcache_set *pset, struct pcache_meta *pcm);
+void pset_remove_eviction_entry(struct pcache_set *pset,
+				struct pset_eviction_entry *pee);
 int evict_line_perset_list(struct pcache_set *pset, struct pcache_meta *pcm,
 			   enum piggyback_options piggyback);
 void __init alloc_pcache_perset_map(void);
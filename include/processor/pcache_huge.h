@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Pcache huge lines: 2MB regions mapped by a single pmd.
+ */
+
+#ifndef _LEGO_PROCESSOR_PCACHE_HUGE_H_
+#define _LEGO_PROCESSOR_PCACHE_HUGE_H_
+
+#include <lego/sched.h>
+#include <processor/pcache_types.h>
+
+#define PCACHE_HUGE_LINE_SIZE		(PMD_SIZE)
+#define PCACHE_HUGE_LINE_MASK		(PMD_MASK)
+#define PCACHE_HUGE_LINE_NR_LINES	(PMD_SIZE / PCACHE_LINE_SIZE)
+
+#ifdef CONFIG_PCACHE_HUGE_LINE
+
+/*
+ * Number of ways that can hold huge lines, counting from the last way.
+ * 0 means huge lines are disabled at runtime.
+ */
+extern unsigned int pcache_huge_nr_ways;
+
+static inline bool pcache_huge_way(unsigned int way)
+{
+	return way >= PCACHE_ASSOCIATIVITY - pcache_huge_nr_ways;
+}
+
+struct pcache_meta *pcache_alloc_way(struct pcache_set *pset, unsigned int way);
+
+int pcache_add_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+			 unsigned long address, struct mm_struct *owner_mm,
+			 struct task_struct *owner_process,
+			 enum rmap_caller caller);
+void pcache_remove_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+			     unsigned long address, struct mm_struct *owner_mm);
+void pcache_split_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+			    unsigned long address, struct mm_struct *owner_mm,
+			    pte_t *page_table);
+
+int pcache_huge_fault(struct mm_struct *mm, unsigned long address,
+		      pmd_t *pmd, unsigned long flags);
+int pcache_split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address);
+void pcache_zap_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address);
+void pcache_huge_disallow(struct mm_struct *mm, pmd_t *pmd);
+int pcache_madvise_huge(struct task_struct *tsk, unsigned long start,
+			size_t len, int behavior);
+int __init pcache_huge_init(void);
+#else
+static inline bool pcache_huge_way(unsigned int way) { return false; }
+static inline int pcache_huge_fault(struct mm_struct *mm, unsigned long address,
+				    pmd_t *pmd, unsigned long flags)
+{
+	return -ENOSYS;
+}
+static inline int
+pcache_split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	return 0;
+}
+static inline void
+pcache_zap_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address) { }
+static inline void pcache_huge_disallow(struct mm_struct *mm, pmd_t *pmd) { }
+static inline int pcache_madvise_huge(struct task_struct *tsk, unsigned long start,
+				      size_t len, int behavior)
+{
+	return 0;
+}
+static inline int pcache_huge_init(void) { return 0; }
+#endif /* CONFIG_PCACHE_HUGE_LINE */
+
+#endif /* _LEGO_PROCESSOR_PCACHE_HUGE_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_PROCESSOR_PCACHE_PREFETCH_H_
+#define _LEGO_PROCESSOR_PCACHE_PREFETCH_H_
+
+#include <lego/sched.h>
+#include <processor/pcache_types.h>
+
+#ifdef CONFIG_PCACHE_PREFETCH
+
+#define PCACHE_PREFETCH_MIN_DEPTH	(2)
+#define PCACHE_PREFETCH_MAX_DEPTH	(CONFIG_PCACHE_PREFETCH_MAX_DEPTH)
+
+/* Strides larger than this (in lines) are treated as random access */
+#define PCACHE_PREFETCH_MAX_STRIDE	(16)
+
+/* Max windows a single thread can have in flight */
+#define PCACHE_PREFETCH_MAX_INFLIGHT	(2)
+
+/*
+ * A prefetch window submitted by a faulting thread,
+ * and consumed by the kprefetchd thread.
+ */
+struct pcache_prefetch_work {
+	unsigned long		flags;
+	struct task_struct	*tsk;
+	unsigned long		start;		/* first line to prefetch */
+	long			stride;		/* in bytes */
+	unsigned int		nr_lines;
+} ____cacheline_aligned;
+
+enum pcache_prefetch_work_flags {
+	PREFETCH_WORK_used,
+
+	NR_PREFETCH_WORK_FLAGS,
+};
+
+static inline int PrefetchWorkUsed(const struct pcache_prefetch_work *p)
+{
+	return test_bit(PREFETCH_WORK_used, (void *)&p->flags);
+}
+
+static inline void SetPrefetchWorkUsed(struct pcache_prefetch_work *p)
+{
+	set_bit(PREFETCH_WORK_used, (void *)&p->flags);
+}
+
+static inline void ClearPrefetchWorkUsed(struct pcache_prefetch_work *p)
+{
+	clear_bit(PREFETCH_WORK_used, (void *)&p->flags);
+}
+
+void pcache_prefetch_detect(struct task_struct *tsk, unsigned long address);
+void pcache_prefetch_fork(struct task_struct *new);
+void pcache_prefetch_thread_exit(struct task_struct *tsk);
+int __init pcache_prefetch_init(void);
+#else
+static inline void
+pcache_prefetch_detect(struct task_struct *tsk, unsigned long address) { }
+static inline void pcache_prefetch_fork(struct task_struct *new) { }
+static inline void pcache_prefetch_thread_exit(struct task_struct *tsk) { }
+static inline int pcache_prefetch_init(void) { return 0; }
+#endif /* CONFIG_PCACHE_PREFETCH */
+
+#endif /* _LEGO_PROCESSOR_PCACHE_PREFETCH_H_ */
@@ -33,6 +33,19 @@ enum pcache_event_item {
 	PCACHE_CLFLUSH_FAIL,
 	PCACHE_CLFLUSH_PIGGYBACK_FB,
 
+	/* Async writeback engine, perset list specific */
+	PCACHE_WB_SUBMITTED,		/* nr of lines handed to writeback */
+	PCACHE_WB_FALLBACK_BUSY,	/* nr of sync flush due to per-node limit */
+	PCACHE_WB_FALLBACK_NOENTRY,	/* nr of sync flush due to empty pool */
+	PCACHE_WB_BATCH,		/* nr of P2M_PCACHE_FLUSH_BATCH sent */
+	PCACHE_WB_RETRY,		/* nr of failed batches sent again */
+
+	/* Sub-line dirty tracking */
+	PCACHE_DELTA_TWIN_ALLOC,	/* nr of twins taken */
+	PCACHE_DELTA_TWIN_FAIL,		/* nr of lines without twin due to empty pool */
+	PCACHE_DELTA_CLEAN,		/* nr of dirty lines that match their twin */
+	PCACHE_DELTA_CHUNKS,		/* nr of chunks sent by batched/delta flush */
+
 	/*
 	 * Write-protection fault
 	 */
@@ -43,10 +56,16 @@ enum pcache_event_item {
 	PCACHE_FAULT_CONCUR_EVICTION,	/* nr of faults due to concurrent eviction */
 
 	PCACHE_FAULT_FILL_ZEROFILL,	/* nr of zero fill + async net */
+	PCACHE_ZEROFILL_POOL_HIT,	/* nr of zero fill using pre-zeroed line */
+	PCACHE_ZEROFILL_POOL_REFILL,	/* nr of lines zeroed by kzerofilld */
+	PCACHE_ZEROFILL_AROUND,		/* nr of lines zero filled by fault-around */
 	PCACHE_FAULT_FILL_FROM_MEMORY,	/* nr of pcache fill from remote memory */
 	PCACHE_FAULT_FILL_FROM_MEMORY_PIGGYBACK,
 	PCACHE_FAULT_FILL_FROM_MEMORY_PIGGYBACK_FB,
 	PCACHE_FAULT_FILL_FROM_VICTIM,	/* nr of pcache fill from victim cache */
+	PCACHE_FILL_BATCH,		/* nr of batched fill requests */
+	PCACHE_FILL_BATCH_LINES,	/* nr of lines filled by batched requests */
+	PCACHE_ALLOC_FREE_RACE,		/* lost a free way to a concurrent alloc */
 
 	/*
 	 * pcache eviction stat
@@ -93,10 +112,42 @@ enum pcache_event_item {
 	PCACHE_VICTIM_FLUSH_ASYNC_RUN,	/* nr of times async victim_flushd got running */
 	PCACHE_VICTIM_FLUSH_SYNC,	/* nr of times sync flush is invoked */
 
+	/*
+	 * Prefetch activities
+	 * accuracy = useful / filled
+	 */
+	PCACHE_PREFETCH_TRIGGERED,	/* nr of prefetch windows submitted */
+	PCACHE_PREFETCH_DROPPED,	/* nr of windows dropped due to throttling */
+	PCACHE_PREFETCH_ISSUED,		/* nr of lines requested from memory */
+	PCACHE_PREFETCH_FILLED,		/* nr of lines filled into pcache */
+	PCACHE_PREFETCH_SKIPPED,	/* nr of lines already present or being evicted */
+	PCACHE_PREFETCH_NO_SLOT,	/* nr of lines dropped because set is full */
+	PCACHE_PREFETCH_FAIL,		/* nr of lines memory failed to serve */
+	PCACHE_PREFETCH_USEFUL,		/* nr of prefetched lines consumed by stream */
+	PCACHE_PREFETCH_LATE,		/* nr of demand misses within an issued window */
+
+	/*
+	 * Huge lines, each is 2MB mapped by one pmd
+	 */
+	PCACHE_HUGE_FAULT,		/* nr of faults on huge line regions */
+	PCACHE_HUGE_FILL,		/* nr of huge lines filled */
+	PCACHE_HUGE_FILL_ZEROFILL,	/* nr of huge lines that are all zerofill */
+	PCACHE_HUGE_FALLBACK,		/* nr of huge faults fell back to normal lines */
+	PCACHE_HUGE_EVICT,		/* nr of huge lines evicted */
+	PCACHE_HUGE_EVICT_DIRTY,	/* nr of huge lines flushed at eviction */
+	PCACHE_HUGE_SECOND_CHANCE,	/* nr of referenced huge lines skipped */
+	PCACHE_HUGE_SPLIT,		/* nr of huge lines split into normal lines */
+	PCACHE_HUGE_ZAP,		/* nr of huge lines unmapped */
+
 	PCACHE_SWEEP_RUN,		/* nr of whole pcache sweep runned */
 	PCACHE_SWEEP_NR_PSET,		/* nr of pset that have been sweeped */
 	PCACHE_SWEEP_NR_MOVED_PCM,	/* nr of moved pcache lines */
 
+	PCACHE_CLOCK_SCAN,		/* nr of lines passed by clock hand */
+	PCACHE_CLOCK_SECOND_CHANCE,	/* nr of referenced lines skipped */
+	PCACHE_CLOCK_PROMOTE,		/* nr of cold lines promoted to hot */
+	PCACHE_CLOCK_DEMOTE,		/* nr of hot lines demoted to cold */
+
 	PCACHE_MREMAP_PSET_SAME,
 	PCACHE_MREMAP_PSET_DIFF,
 
@@ -126,6 +177,11 @@ static inline void inc_pcache_event(enum pcache_event_item item)
 	atomic_long_inc(&pcache_event_stats.event[item]);
 }
 
+static inline void add_pcache_event(enum pcache_event_item item, long nr)
+{
+	atomic_long_add(nr, &pcache_event_stats.event[item]);
+}
+
 static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit)
 {
 	if (doit)
@@ -178,6 +234,7 @@ static inline long pcache_used(void)
 
 #else
 static inline void inc_pcache_event(enum pcache_event_item i) { }
+static inline void add_pcache_event(enum pcache_event_item i, long nr) { }
 static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit) { }
 static inline unsigned long pcache_event(enum pcache_event_item i) { return 0; }
 static inline void mod_pset_event(int i, struct pcache_set *pset,
@@ -101,14 +101,25 @@ struct pset_padding {
  *
  * FAT NOTE:
  * If you add anything here, do not forget to check if this
- * new field needs to be initialized in init_pcache_set_map().
+ * new field needs to be initialized in init_pcache_set().
  */
 struct pcache_set {
 	unsigned long		flags;
 
-	/* This links all FREE pcache lines within pset */
-	struct list_head	free_head;
-	spinlock_t		free_lock;
+	/*
+	 * One bit per way, set if that way is FREE.
+	 * Allocation and free are done with atomic bitops,
+	 * so the miss path never spins on a per-set lock.
+	 */
+	DECLARE_BITMAP(free_map, PCACHE_ASSOCIATIVITY);
+
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
+	/*
+	 * One bit per way, set if that way is FREE and all-zero.
+	 * A subset of free_map. Cleared when the way is allocated.
+	 */
+	DECLARE_BITMAP(zero_map, PCACHE_ASSOCIATIVITY);
+#endif
 
 	/*
 	 * Eviction Algorithms Specific
@@ -122,6 +133,14 @@ struct pcache_set {
 	spinlock_t		lru_lock;
 #endif
 
+#ifdef CONFIG_PCACHE_EVICT_CLOCK
+	PSET_PADDING(_pad_clock_hand)
+	atomic_t		clock_hand;
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+	atomic_t		nr_hot;
+#endif
+#endif
+
 	/*
 	 * Eviction Mechanism Specific
 	 */
@@ -197,7 +216,7 @@ struct pcm_pad {
  *
  * FAT NOTE:
  * If you add anything here, do not forget to check if this
- * new field needs to be initialized in init_pcache_meta_map().
+ * new field needs to be initialized in init_pcache_meta().
  */
 struct pcache_meta {
 	/*
@@ -208,9 +227,6 @@ struct pcache_meta {
 	atomic_t		mapcount;
 	atomic_t		_refcount;
 
-	/* This is linked to pset free_head */
-	struct list_head	free_list;
-
 	struct list_head	rmap;
 	struct piggyback_info	pb;
 
@@ -230,13 +246,19 @@ enum rmap_caller {
 	RMAP_COW,
 	RMAP_FORK,
 	RMAP_MREMAP_SLOWPATH,
+	RMAP_PREFETCH,
+	RMAP_HUGE_FILL,
+	RMAP_HUGE_SPLIT,
 
 	NR_RMAP_CALLER,
 };
 
 struct pcache_rmap {
 	unsigned long		flags;
-	pte_t			*page_table;
+	union {
+		pte_t		*page_table;
+		pmd_t		*pmd;		/* RmapHuge */
+	};
 	struct mm_struct	*owner_mm;
 	struct task_struct	*owner_process;
 	enum rmap_caller	caller;
@@ -256,6 +278,7 @@ enum pcache_rmap_flags {
 	PCACHE_RMAP_reserved,
 	PCACHE_RMAP_kmalloced,
 	PCACHE_RMAP_used,
+	PCACHE_RMAP_huge,
 
 	NR_PCACHE_RMAP_FLAGS
 };
@@ -300,6 +323,7 @@ static inline int TestClearRmap##uname(struct pcache_rmap *p)		\
 RMAP_FLAGS(Reserved, reserved)
 RMAP_FLAGS(Kmalloced, kmalloced)
 RMAP_FLAGS(Used, used)
+RMAP_FLAGS(Huge, huge)
 
 /*
  * struct pcache_set flags
@@ -380,6 +404,24 @@ PSET_FLAGS(Sweeping, sweeping)
  * 			A following pcache_alloc from the same CPU, with
  * 			ENABLE_PIGGYBACK will get it. Check piggyback.h
  *
+ * PC_twinable:		Pcacheline is mapped read-only and was never written
+ * 			since filled. Its twin will be taken at first write.
+ * 			Only used by CONFIG_PCACHE_DELTA_FLUSH.
+ *
+ * PC_hot:		Pcacheline is in the hot group of CLOCK-Pro.
+ * PC_test:		Pcacheline was referenced once within its test period.
+ * 			Both only used by CONFIG_PCACHE_EVICT_CLOCK_PRO.
+ *
+ * PC_zeroed:		Pcacheline was all-zero when allocated, so zerofill can
+ * 			skip clearing it. Only meaningful until it is filled.
+ * 			Only used by CONFIG_PCACHE_ZEROFILL_POOL.
+ *
+ * PC_huge:		Pcacheline is part of a 2MB huge line, which is the same
+ * 			way of 512 consecutive sets and is mapped by one pmd.
+ * 			Only the head line has rmap, and huge lines are never
+ * 			picked by the eviction algorithms.
+ * 			Only used by CONFIG_PCACHE_HUGE_LINE.
+ *
  * Hack: remember to update the pcacheflag_names array in debug file.
  *
  * 1) PC_valid is more like the traditional cache valid bit. It is set when
@@ -393,6 +435,11 @@ enum pcache_meta_bits {
 	PC_writeback,
 	PC_piggyback,
 	PC_piggyback_cached,
+	PC_twinable,
+	PC_hot,
+	PC_test,
+	PC_zeroed,
+	PC_huge,
 
 	__NR_PCLBITS,
 };
@@ -469,6 +516,11 @@ PCACHE_META_BITS(Reclaim, reclaim)
 PCACHE_META_BITS(Writeback, writeback)
 PCACHE_META_BITS(Piggyback, piggyback)
 PCACHE_META_BITS(PiggybackCached, piggyback_cached)
+PCACHE_META_BITS(Twinable, twinable)
+PCACHE_META_BITS(Hot, hot)
+PCACHE_META_BITS(Test, test)
+PCACHE_META_BITS(Zeroed, zeroed)
+PCACHE_META_BITS(Huge, huge)
 
 /*
  * Flags checked when a pcache is freed.
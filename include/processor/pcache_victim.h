@@ -14,11 +14,16 @@
 #ifndef _LEGO_PROCESSOR_PCACHE_VICTIM_H_
 #define _LEGO_PROCESSOR_PCACHE_VICTIM_H_
 
+#include <lego/log2.h>
 #include <lego/completion.h>
 
 #define VICTIM_NR_ENTRIES \
 	((unsigned int)CONFIG_PCACHE_EVICTION_VICTIM_NR_ENTRIES)
 
+/* Buckets of the (tgid, address) index, twice the number of entries */
+#define VICTIM_HASH_BITS	(ilog2(VICTIM_NR_ENTRIES) + 1)
+#define VICTIM_HASH_SIZE	(1U << VICTIM_HASH_BITS)
+
 struct victim_padding {
 	char x[0];
 } ____cacheline_aligned_in_smp;
@@ -63,6 +68,11 @@ struct pcache_victim_hit_entry {
 	unsigned int		m_nid;
 	unsigned int		rep_nid;
 	struct list_head	next;
+
+	/* Link in the (tgid, address) index */
+	struct hlist_node	hnode;
+	unsigned int		bucket;
+	struct pcache_victim_meta *victim;
 };
 
 struct victim_flush_job {
@@ -149,7 +159,7 @@ static inline int victim_ref_freeze(struct pcache_victim_meta *v, int count)
 	return ret;
 }
 
-extern struct pcache_victim_meta pcache_victim_meta_map[VICTIM_NR_ENTRIES];
+extern struct pcache_victim_meta *pcache_victim_meta_map;
 extern void *pcache_victim_data_map;
 
 /*
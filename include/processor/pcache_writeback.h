@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Asynchronous dirty line write-back, used by per-set eviction list.
+ */
+
+#ifndef _LEGO_PROCESSOR_PCACHE_WRITEBACK_H_
+#define _LEGO_PROCESSOR_PCACHE_WRITEBACK_H_
+
+#include <lego/list.h>
+#include <lego/spinlock.h>
+#include <lego/fit_ibapi.h>
+#include <processor/pcache_types.h>
+
+#ifdef CONFIG_PCACHE_WRITEBACK_ASYNC
+
+#define PCACHE_WB_NR_ENTRIES \
+	((unsigned int)CONFIG_PCACHE_WRITEBACK_NR_ENTRIES)
+#define PCACHE_WB_MAX_PER_NODE \
+	((int)CONFIG_PCACHE_WRITEBACK_MAX_PER_NODE)
+#define PCACHE_WB_NR_INFLIGHT \
+	((unsigned int)CONFIG_PCACHE_WRITEBACK_NR_INFLIGHT)
+
+/* Times a failed batch is sent again, synchronously */
+#define PCACHE_WB_MAX_RETRY	3
+
+/*
+ * One dirty line waiting to be written back.
+ * The line content is copied out, so the pcache line itself
+ * can be reused right after eviction. The copy is sent in place.
+ */
+struct pcache_wb_entry {
+	struct list_head		next;
+	struct pcache_set		*pset;
+	struct pset_eviction_entry	*pee;	/* removed once flushed */
+	pid_t				tgid;
+	unsigned long			user_va;
+	unsigned int			m_nid;
+	unsigned int			rep_nid;
+	int				nr_chunks;
+	DECLARE_BITMAP(dirty, PCACHE_LINE_NR_CHUNKS);
+	void				*data;
+};
+
+struct p2m_flush_batch_msg;
+
+/*
+ * One P2M_PCACHE_FLUSH_BATCH message in flight.
+ * @msg only has the header part, line data is sent from the entries.
+ */
+struct pcache_wb_batch {
+	struct fit_async_req		req;
+	struct p2m_flush_batch_msg	*msg;
+	struct fit_sglist		iov[FIT_MAX_IOV];
+	int				nr_iov;
+	struct pcache_wb_entry		*entries[PCACHE_FLUSH_BATCH_MAX];
+	int				nr;
+	int				nr_chunks;
+	int				reply;
+	unsigned long			start_time;
+	bool				done;
+};
+
+/*
+ * Per-memory-node coalescing queue.
+ * @nr_pending counts both queued and in-flight entries.
+ *
+ * @batches is a ring owned by kwritebackd. Batches are posted and
+ * retired in FIFO order, so @nr_completed only grows.
+ */
+struct pcache_wb_queue {
+	spinlock_t			lock;
+	struct list_head		head;
+	atomic_t			nr_pending;
+	unsigned long			nr_submitted;
+	unsigned long			nr_completed;
+	struct pcache_wb_batch		*batches;
+	unsigned int			batch_head;
+	unsigned int			batch_tail;
+} ____cacheline_aligned_in_smp;
+
+int pcache_writeback_submit(struct pcache_set *pset, struct pcache_meta *pcm);
+void pcache_writeback_drain(void);
+int __init pcache_writeback_init(void);
+#else
+static inline int
+pcache_writeback_submit(struct pcache_set *pset, struct pcache_meta *pcm)
+{
+	return -ENOSYS;
+}
+static inline void pcache_writeback_drain(void) { }
+static inline int pcache_writeback_init(void) { return 0; }
+#endif /* CONFIG_PCACHE_WRITEBACK_ASYNC */
+
+#endif /* _LEGO_PROCESSOR_PCACHE_WRITEBACK_H_ */
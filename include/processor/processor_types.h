@@ -21,6 +21,25 @@
 
 #ifdef CONFIG_COMP_PROCESSOR
 
+#ifdef CONFIG_PCACHE_PREFETCH
+/*
+ * Per-thread pcache access pattern detector state.
+ * Only touched by the owner thread at pgfault time, except
+ * @nr_inflight, which is also decremented by kprefetchd.
+ */
+struct pcache_prefetch_info {
+	unsigned long	last_addr;	/* line aligned uva of last miss */
+	long		stride;		/* in bytes, can be negative */
+	unsigned int	depth;		/* current window size, in lines */
+
+	/* The last issued window: [window_start, frontier) along @stride */
+	unsigned long	window_start;
+	unsigned long	frontier;
+
+	atomic_t	nr_inflight;	/* submitted but unfinished windows */
+};
+#endif
+
 /*
  * If you add anything to structure, please check if these fields
  * need to be initlizaed in the init_task.c
@@ -52,6 +71,10 @@ struct processor_manager {
 #endif
 
 	struct vnode_struct *virtual_node;
+
+#ifdef CONFIG_PCACHE_PREFETCH
+	struct pcache_prefetch_info prefetch;
+#endif
 };
 
 #define UNSET_HOME_NODE		(INT_MAX)
@@ -133,4 +133,10 @@ static inline void submit_zerofill_notify_work(struct task_struct *p,
 static inline int pcache_zerofill_notify_init(void) { return 0; };
 #endif
 
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
+int __init pcache_zerofill_pool_init(void);
+#else
+static inline int pcache_zerofill_pool_init(void) { return 0; }
+#endif
+
 #endif /* _LEGO_PROCESSOR_ZEROFILL_H_ */
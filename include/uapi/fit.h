@@ -30,4 +30,8 @@ struct fit_machine_info {
  */
 #define FIT_MAX_TIMEOUT_SEC	CONFIG_FIT_MAX_RPC_TIMEOUT_SEC
 
+/* Commands of fit_stat syscall */
+#define FIT_STAT_DUMP		0
+#define FIT_STAT_RESET		1
+
 #endif /* _LEGO_UAPI_FIT_H_ */
@@ -7,7 +7,10 @@
  * (at your option) any later version.
  */
 
+#include <lego/mmap.h>
+#include <lego/sched.h>
 #include <lego/syscalls.h>
+#include <processor/pcache.h>
 
 /*
  * The madvise(2) system call.
@@ -69,5 +72,11 @@ SYSCALL_DEFINE3(madvise, unsigned long, start, size_t, len_in, int, behavior)
 {
 	syscall_enter("start: %#lx, len_in: %#lx, behavior: %d\n",
 		start, len_in, behavior);
+
+	switch (behavior) {
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+		return pcache_madvise_huge(current, start, len_in, behavior);
+	}
 	return 0;
 }
@@ -17,4 +17,20 @@ void boot_time_profile(void)
 	WARN_ON(system_state != SYSTEM_RUNNING);
 
 	profile_tlb_shootdown();
+	profile_copy_nocache();
+}
+
+/*
+ * Report a boot step which is split among @nr_workers.
+ * @cpu_ns is the time summed over all workers, which is about
+ * what the step would take if it runs on one CPU.
+ */
+void boot_profile_parallel(const char *name, unsigned int nr_workers,
+			   u64 wall_ns, u64 cpu_ns)
+{
+	u64 saved = cpu_ns > wall_ns ? cpu_ns - wall_ns : 0;
+
+	pr_info("Boot profile: %s: %u workers, wall %llu us, serial %llu us, saved %llu us\n",
+		name, nr_workers, wall_ns / NSEC_PER_USEC, cpu_ns / NSEC_PER_USEC,
+		saved / NSEC_PER_USEC);
 }
@@ -777,6 +777,13 @@ asmlinkage long sys_poll(struct pollfd __user *ufds, unsigned int nfds,
 }
 #endif /* Socket SYSCALL */
 
+#ifndef CONFIG_FIT
+SYSCALL_DEFINE1(fit_stat, int, cmd)
+{
+	return -ENOSYS;
+}
+#endif
+
 #ifndef CONFIG_EPOLL
 SYSCALL_DEFINE1(epoll_create1, int, flags)
 {
@@ -32,6 +32,23 @@ struct info_struct {
 	char msg[MAX_RXBUF_SIZE];
 };
 
+/*
+ * Each worker receives and handles requests on its own.
+ * Receiving is serialized by storage_rx_mutex: FIT copies a message out
+ * of the ring after dropping its queue lock, and then acks up to that
+ * message. Concurrent receivers could ack past a message another one
+ * is still copying, and the sender would overwrite it.
+ */
+struct storage_worker {
+	int			id;
+	void			*rxbuf;
+	void			*txbuf;
+	struct task_struct	*task;
+};
+
+static struct storage_worker storage_workers[STORAGE_NR_WORKERS];
+static DEFINE_MUTEX(storage_rx_mutex);
+
 static void handle_bad_request(u32 opcode, uintptr_t desc)
 {
 	int retbuf;
@@ -46,7 +63,8 @@ static void handle_bad_request(u32 opcode, uintptr_t desc)
 static char __user *ubuf;
 #endif
 
-static void storage_dispatch(void *msg, uintptr_t desc)
+static void storage_dispatch(struct storage_worker *worker,
+			     void *msg, uintptr_t desc)
 {
 	u32 *opcode;
 	void *payload;
@@ -74,7 +92,7 @@ static void storage_dispatch(void *msg, uintptr_t desc)
 
 	case M2S_READ:
 		inc_storage_stat(HANDLE_REPLICA_READ);
-		handle_read_request(payload, desc);
+		handle_read_request(payload, desc, worker->txbuf);
 		break;
 	case M2S_WRITE:
 		inc_storage_stat(HANDLE_REPLICA_WRITE);
@@ -124,16 +142,16 @@ static void storage_dispatch(void *msg, uintptr_t desc)
 }
 
 #if 1
-static bool in_handler;
+static atomic_t nr_in_handler = ATOMIC_INIT(0);
 
 static inline void set_in_handler(void)
 {
-	in_handler = true;
+	atomic_inc(&nr_in_handler);
 }
 
 static inline void clear_in_handler(void)
 {
-	in_handler = false;
+	atomic_dec(&nr_in_handler);
 }
 
 static int storage_self_monitor(void *unused)
@@ -142,7 +160,8 @@ static int storage_self_monitor(void *unused)
 
 	interval_sec = 30;
 	while (1) {
-		pr_info("%s(): in_handler=%d\n", __func__, in_handler);
+		pr_info("%s(): nr_in_handler=%d\n", __func__,
+			atomic_read(&nr_in_handler));
 		print_storage_manager_stats();
 
 		set_current_state(TASK_UNINTERRUPTIBLE);
@@ -175,34 +194,48 @@ static inline int init_self_monitor(void)
 }
 #endif
 
-static int storage_manager(void *unused)
+static int storage_manager(void *_worker)
 {
+	struct storage_worker *worker = _worker;
 	int retlen, reply;
 	void *msg;
 	uintptr_t desc;
 
-	msg = kmalloc(MAX_RXBUF_SIZE, GFP_KERNEL);
-	if (!msg) {
-		WARN_ON(1);
-		return -ENOMEM;
-	}
-
+	msg = worker->rxbuf;
 	while(1) {
+		mutex_lock(&storage_rx_mutex);
 		retlen = ibapi_receive_message(0, msg, MAX_RXBUF_SIZE, &desc);
+		mutex_unlock(&storage_rx_mutex);
 
 		if (unlikely(retlen >= MAX_RXBUF_SIZE)) {
 			WARN(1, "retlen=%d MAX_RETBUF_SIZE=%lu", retlen, MAX_RXBUF_SIZE);
 			reply = -EFAULT;
 			ibapi_reply_message(&reply, sizeof(reply), desc);
+			continue;
 		}
 
 		set_in_handler();
-		storage_dispatch(msg, desc);
+		storage_dispatch(worker, msg, desc);
 		clear_in_handler();
 	}
 	return 0;
 }
 
+static int init_storage_worker(struct storage_worker *worker, int id)
+{
+	worker->id = id;
+
+	/* Both buffers are DMA mapped by FIT, they must be kmalloc'ed */
+	worker->rxbuf = kmalloc(MAX_RXBUF_SIZE, GFP_KERNEL);
+	worker->txbuf = kmalloc(STORAGE_TX_SIZE, GFP_KERNEL);
+	if (!worker->rxbuf || !worker->txbuf) {
+		kfree(worker->rxbuf);
+		kfree(worker->txbuf);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 extern int fit_state;
 
 /*
@@ -211,10 +244,11 @@ extern int fit_state;
  * to do so. That further means the insmod thread will never return...
  *
  * For non-storage-intensive workload, you can disable this.
+ * Since the mmap'ed ubuf is shared, only one worker is used then.
  */
 static int __init init_storage_server(void)
 {
-	int ret = 0;
+	int i __maybe_unused, ret = 0;
 	struct task_struct *tsk __maybe_unused;
 	unsigned long populate __maybe_unused;
 
@@ -223,16 +257,33 @@ static int __init init_storage_server(void)
 		return -EIO;
 	}
 
+	storage_file_cache_init();
+
 #ifndef STORAGE_BYPASS_PAGE_CACHE
-	tsk = kthread_run(storage_manager, NULL, "lego-storaged");
-	if (IS_ERR(tsk)) {
-		pr_err("ERROR: Fail to create lego_storaged\n");
-		return PTR_ERR(tsk);
+	for (i = 0; i < STORAGE_NR_WORKERS; i++) {
+		ret = init_storage_worker(&storage_workers[i], i);
+		if (ret) {
+			pr_err("ERROR: No memory for lego_storaged%d\n", i);
+			return ret;
+		}
+
+		tsk = kthread_run(storage_manager, &storage_workers[i],
+				  "lego-storaged%d", i);
+		if (IS_ERR(tsk)) {
+			pr_err("ERROR: Fail to create lego_storaged%d\n", i);
+			return PTR_ERR(tsk);
+		}
+		storage_workers[i].task = tsk;
 	}
 #else
+	ret = init_storage_worker(&storage_workers[0], 0);
+	if (ret)
+		return ret;
+
 	ubuf = (char __user *)do_mmap_pgoff(NULL, 0, MAX_RXBUF_SIZE,
 			PROT_READ | PROT_WRITE, MAP_SHARED, 0, &populate);
-	storage_manager(NULL);
+	storage_workers[0].task = current;
+	storage_manager(&storage_workers[0]);
 #endif
 
 	ret = init_self_monitor();
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Cache of opened files used by read/write requests.
+ *
+ * Memory sends file I/O in small chunks, and each chunk used to do a
+ * filp_open() and filp_close(). Here we keep the most recently used
+ * files open, keyed by (path, open flags). The cache owns one reference
+ * of each cached file, and every user gets its own via get_file().
+ * Thus an evicted file stays valid until its last user is done.
+ *
+ * Unlink and rename invalidate the name before and after the operation.
+ * Each invalidation bumps file_cache_gen, and a file opened across a
+ * bump is returned without being cached, since it may be the old inode.
+ */
+
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+
+#include "storage.h"
+#include "common.h"
+#include "stat.h"
+
+#define FILE_CACHE_HASH_BITS	6
+
+/* Flags that only matter at open time */
+#define FILE_CACHE_OPEN_ONLY_FLAGS	(O_CREAT | O_TRUNC | O_EXCL)
+
+struct storage_file {
+	struct hlist_node	link;
+	struct list_head	lru;
+	struct file		*filp;
+	int			flags;
+	char			fileName[MAX_FILE_NAME];
+};
+
+static struct storage_file file_cache_map[STORAGE_NR_CACHED_FILES];
+static DEFINE_HASHTABLE(file_cache_ht, FILE_CACHE_HASH_BITS);
+static LIST_HEAD(file_cache_lru);
+static LIST_HEAD(file_cache_free);
+static DEFINE_SPINLOCK(file_cache_lock);
+static unsigned long file_cache_gen;
+
+static inline int file_cache_flags(int flags)
+{
+	return flags & ~FILE_CACHE_OPEN_ONLY_FLAGS;
+}
+
+static inline u32 file_cache_key(const char *name, int flags)
+{
+	return jhash(name, strlen(name), flags);
+}
+
+static struct storage_file *
+__file_cache_lookup(const char *name, int flags, u32 key)
+{
+	struct storage_file *sf;
+
+	hash_for_each_possible(file_cache_ht, sf, link, key) {
+		if (sf->flags == flags && !strcmp(sf->fileName, name))
+			return sf;
+	}
+	return NULL;
+}
+
+/* Unhash @sf, the caller closes the returned file outside the lock */
+static struct file *__file_cache_remove(struct storage_file *sf)
+{
+	struct file *filp = sf->filp;
+
+	hash_del(&sf->link);
+	list_move(&sf->lru, &file_cache_free);
+	sf->filp = NULL;
+	return filp;
+}
+
+/**
+ * storage_file_get
+ * @rq: the request which describes file name and flags
+ *
+ * Return an opened file for @rq. It must be released by storage_file_put().
+ * Opens with O_TRUNC or O_EXCL always go to the filesystem.
+ */
+struct file *storage_file_get(request *rq)
+{
+	struct storage_file *sf;
+	struct file *filp, *victim = NULL;
+	unsigned long gen;
+	int flags;
+	u32 key;
+
+	flags = file_cache_flags(rq->flags);
+	key = file_cache_key(rq->fileName, flags);
+
+	spin_lock(&file_cache_lock);
+	if (!(rq->flags & (O_TRUNC | O_EXCL))) {
+		sf = __file_cache_lookup(rq->fileName, flags, key);
+		if (sf) {
+			filp = get_file(sf->filp);
+			list_move(&sf->lru, &file_cache_lru);
+			spin_unlock(&file_cache_lock);
+
+			inc_storage_stat(FILE_CACHE_HIT);
+			return filp;
+		}
+	}
+	gen = file_cache_gen;
+	spin_unlock(&file_cache_lock);
+
+	inc_storage_stat(FILE_CACHE_MISS);
+	filp = local_file_open(rq);
+	if (IS_ERR(filp))
+		return filp;
+
+	spin_lock(&file_cache_lock);
+	/* An unlink or rename ran meanwhile, this may be the old inode */
+	if (gen != file_cache_gen) {
+		spin_unlock(&file_cache_lock);
+		return filp;
+	}
+
+	/* Someone else opened it concurrently, or this is a fresh O_TRUNC */
+	sf = __file_cache_lookup(rq->fileName, flags, key);
+	if (sf)
+		victim = __file_cache_remove(sf);
+
+	if (list_empty(&file_cache_free)) {
+		sf = list_last_entry(&file_cache_lru, struct storage_file, lru);
+		BUG_ON(victim);
+		victim = __file_cache_remove(sf);
+	}
+
+	sf = list_first_entry(&file_cache_free, struct storage_file, lru);
+	sf->filp = get_file(filp);
+	sf->flags = flags;
+	strlcpy(sf->fileName, rq->fileName, MAX_FILE_NAME);
+	hash_add(file_cache_ht, &sf->link, key);
+	list_move(&sf->lru, &file_cache_lru);
+	spin_unlock(&file_cache_lock);
+
+	if (victim)
+		local_file_close(victim);
+	return filp;
+}
+
+void storage_file_put(struct file *filp)
+{
+	fput(filp);
+}
+
+/*
+ * Drop all cached files opened by @name, and keep files being opened
+ * right now out of the cache. Called both before and after @name is
+ * unlinked or renamed, so a later open does not get the old inode.
+ */
+void storage_file_invalidate(const char *name)
+{
+	struct storage_file *sf, *n;
+	struct file *victims[STORAGE_NR_CACHED_FILES];
+	int i, nr = 0;
+
+	spin_lock(&file_cache_lock);
+	file_cache_gen++;
+	list_for_each_entry_safe(sf, n, &file_cache_lru, lru) {
+		if (!strcmp(sf->fileName, name))
+			victims[nr++] = __file_cache_remove(sf);
+	}
+	spin_unlock(&file_cache_lock);
+
+	for (i = 0; i < nr; i++)
+		local_file_close(victims[i]);
+}
+
+void storage_file_cache_init(void)
+{
+	int i;
+
+	for (i = 0; i < STORAGE_NR_CACHED_FILES; i++) {
+		INIT_HLIST_NODE(&file_cache_map[i].link);
+		list_add(&file_cache_map[i].lru, &file_cache_free);
+	}
+}
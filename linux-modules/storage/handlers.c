@@ -26,7 +26,11 @@ request constuct_request(int uid, char *fileName, fmode_t permission, ssize_t le
 	return rq;
 }
 
-ssize_t handle_read_request(void *payload, uintptr_t desc)
+/*
+ * @txbuf is the reply buffer owned by the calling worker, it is used if
+ * the reply fits STORAGE_TX_SIZE. Larger replies fall back to kmalloc.
+ */
+ssize_t handle_read_request(void *payload, uintptr_t desc, void *txbuf)
 {
 	struct m2s_read_write_payload *m2s_rq;
 	//int metadata_entry, user_entry;
@@ -49,11 +53,15 @@ ssize_t handle_read_request(void *payload, uintptr_t desc)
 		goto err;
 	}
 
-	retbuf = kmalloc(len_retbuf, GFP_KERNEL);
-	if (unlikely(!retbuf)) {
-		pr_info("No memory for read retbuf, request [%lu].\n", m2s_rq->len);
-		ret = -ENOMEM;
-		goto err;
+	if (likely(len_retbuf <= STORAGE_TX_SIZE))
+		retbuf = txbuf;
+	else {
+		retbuf = kmalloc(len_retbuf, GFP_KERNEL);
+		if (unlikely(!retbuf)) {
+			pr_info("No memory for read retbuf, request [%lu].\n", m2s_rq->len);
+			ret = -ENOMEM;
+			goto err;
+		}
 	}
 
 	retval = (ssize_t *) retbuf;
@@ -71,21 +79,22 @@ ssize_t handle_read_request(void *payload, uintptr_t desc)
 	} */ /*enable in future*/
 	*retval = 0;
 
-	filp = local_file_open(&rq);
+	filp = storage_file_get(&rq);
 	if (IS_ERR(filp)){
 		*retval = PTR_ERR(filp);
 		goto out_reply;
 	}
 
 	*retval = local_file_read(filp, (char __user *)readbuf, rq.len, &rq.offset);
-	local_file_close(filp);
+	storage_file_put(filp);
 	//yield_access(metadata_entry, user_entry); //enable in future
 	//pr_info("Content in readbuf is [%s]\n", readbuf);
 
 out_reply:
 	ret = *retval;
 	ibapi_reply_message(retbuf, len_retbuf, desc);
-	kfree(retbuf);
+	if (retbuf != txbuf)
+		kfree(retbuf);
 	return ret;
 
 err:
@@ -120,13 +129,13 @@ ssize_t handle_write_request(void *payload, uintptr_t desc)
 	}*/ //enable in future
 	retval = 0;
 
-	filp = local_file_open(&rq);
+	filp = storage_file_get(&rq);
 	if (IS_ERR(filp)){
 		retval = PTR_ERR(filp);
 		goto out_reply;
 	}
 	retval = local_file_write(filp, (const char __user *)writebuf, rq.len, &rq.offset);
-	local_file_close(filp);
+	storage_file_put(filp);
 	//yield_access(metadata_entry, user_entry); //enable in future
 
 out_reply:
@@ -226,7 +235,10 @@ long handle_unlink_request(void *payload, uintptr_t desc)
 	struct p2s_unlink_struct *unlink = payload;
 	long ret;
 
+	/* Again after it, a concurrent read may have cached it meanwhile */
+	storage_file_invalidate(unlink->filename);
 	ret = do_unlink(unlink->filename);
+	storage_file_invalidate(unlink->filename);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
 	return ret;
@@ -355,7 +367,12 @@ long handle_rename_request(void *payload, uintptr_t desc)
 	struct p2s_rename_struct *__payload = payload;
 	long ret;
 
+	/* Again after it, a concurrent read may have cached them meanwhile */
+	storage_file_invalidate(__payload->oldname);
+	storage_file_invalidate(__payload->newname);
 	ret = do_rename(__payload->oldname, __payload->newname);
+	storage_file_invalidate(__payload->oldname);
+	storage_file_invalidate(__payload->newname);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
 	return ret;
@@ -29,6 +29,8 @@ static const char *const storage_manager_stat_text[] = {
 	"handle_replica_vma",
 	"handle_replica_read",
 	"handle_replica_write",
+	"file_cache_hit",
+	"file_cache_miss",
 };
 
 void print_storage_manager_stats(void)
@@ -15,6 +15,8 @@ enum storage_manager_stat_item {
 	HANDLE_REPLICA_VMA,
 	HANDLE_REPLICA_READ,
 	HANDLE_REPLICA_WRITE,
+	FILE_CACHE_HIT,
+	FILE_CACHE_MISS,
 
 	NR_STORAGE_MANAGER_STAT_ITEMS,
 };
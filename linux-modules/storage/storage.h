@@ -29,6 +29,19 @@
 
 #define MAX_SIZE		2 
 
+/* Number of lego-storaged threads serving requests */
+#define STORAGE_NR_WORKERS	4
+
+/* Number of files kept open by file_cache.c */
+#define STORAGE_NR_CACHED_FILES	64
+
+/*
+ * Size of the reply buffer each worker keeps around.
+ * It fits the reply of one memory pgcache line load: CL_SIZE
+ * (64 pages, include/memory/pgcache.h) plus the ssize_t retval.
+ */
+#define STORAGE_TX_SIZE		(64 * PAGE_SIZE + sizeof(ssize_t))
+
 
 struct linux_dirent;
 
@@ -83,10 +96,16 @@ long do_getdents(const char *pathname, struct linux_dirent *dirent,
 long do_readlink(const char *pathname, char *buf, int bufsiz);
 long do_rename(char *oldname, char *newname);
 
+/* file_cache.c */
+struct file *storage_file_get(request *);
+void storage_file_put(struct file *);
+void storage_file_invalidate(const char *);
+void storage_file_cache_init(void);
+
 /* handler.c */
 int handle_open_request(void *, uintptr_t);
 ssize_t handle_write_request(void *, uintptr_t);
-ssize_t handle_read_request(void *, uintptr_t);
+ssize_t handle_read_request(void *, uintptr_t, void *);
 int handle_stat_request(void *, uintptr_t);
 int handle_access_request(void *, uintptr_t);
 long handle_truncate_request(void *, uintptr_t);
@@ -50,11 +50,14 @@ static DEFINE_COMPLETION(thpool_init_completion);
 
 /*
  * Pre-allocated thpool buffer
- * TB_HEAD points the current available buffer
+ * TB_HEAD points where the search for a free buffer starts
  */
 static int TB_HEAD __cacheline_aligned;
 static struct thpool_buffer *thpool_buffer_map __read_mostly;
 
+/* Per-worker large tx area, see thpool_buffer_tx_large() */
+static void *thpool_large_tx_map __read_mostly;
+
 static inline int thpool_worker_id(struct thpool_worker *worker)
 {
 	return worker - thpool_worker_map;
@@ -65,65 +68,305 @@ static inline int thpool_buffer_ix(struct thpool_buffer *buffer)
 	return buffer - thpool_buffer_map;
 }
 
+static void init_thpool_queue(struct thpool_queue *q)
+{
+	int i;
+
+	q->head = 0;
+	q->tail = 0;
+	for (i = 0; i < THPOOL_QUEUE_SIZE; i++) {
+		q->slots[i].seq = i;
+		q->slots[i].tb = NULL;
+	}
+}
+
+/*
+ * A slot at position @pos is free when its seq equals @pos,
+ * and holds a buffer when its seq equals @pos + 1.
+ */
+static void thpool_queue_push(struct thpool_queue *q, struct thpool_buffer *tb)
+{
+	struct thpool_queue_slot *slot;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = READ_ONCE(q->tail);
+	for (;;) {
+		slot = &q->slots[pos & THPOOL_QUEUE_MASK];
+		seq = smp_load_acquire(&slot->seq);
+		diff = (long)seq - (long)pos;
+
+		if (diff == 0) {
+			if (cmpxchg(&q->tail, pos, pos + 1) == pos)
+				break;
+		} else
+			BUG_ON(diff < 0);	/* more buffers than slots */
+		pos = READ_ONCE(q->tail);
+	}
+
+	slot->tb = tb;
+	smp_store_release(&slot->seq, pos + 1);
+}
+
+static struct thpool_buffer *thpool_queue_pop(struct thpool_queue *q)
+{
+	struct thpool_queue_slot *slot;
+	struct thpool_buffer *tb;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = READ_ONCE(q->head);
+	for (;;) {
+		slot = &q->slots[pos & THPOOL_QUEUE_MASK];
+		seq = smp_load_acquire(&slot->seq);
+		diff = (long)seq - (long)(pos + 1);
+
+		if (diff == 0) {
+			if (cmpxchg(&q->head, pos, pos + 1) == pos)
+				break;
+		} else if (diff < 0)
+			return NULL;		/* empty */
+		pos = READ_ONCE(q->head);
+	}
+
+	tb = slot->tb;
+	smp_store_release(&slot->seq, pos + THPOOL_QUEUE_SIZE);
+	return tb;
+}
+
+static inline bool thpool_queue_empty(struct thpool_queue *q)
+{
+	return READ_ONCE(q->head) == READ_ONCE(q->tail);
+}
+
 static inline void
-enqueue_tail_thpool_worker(struct thpool_worker *worker, struct thpool_buffer *buffer)
+enqueue_tail_thpool_worker(struct thpool_worker *worker, struct thpool_buffer *buffer,
+			   enum thpool_queue_class class)
 {
-	spin_lock(&worker->lock);
-	list_add_tail(&buffer->next, &worker->work_head);
-	/*
-	 * This is not necessary but will do no harm.
-	 * Since we are running on x86 TSO.
-	 *
-	 * We want to make sure the update of above list
-	 * fields can be _seen_ by others before the counter
-	 * is seen by others. Because the worker thread check
-	 * the counter first, then check/dequeue list.
-	 */
-	smp_wmb();
+	thpool_queue_push(&worker->queues[class], buffer);
 	inc_queued_thpool_worker(worker);
 	update_max_queued_thpool_worker(worker);
-	spin_unlock(&worker->lock);
 }
 
 static inline struct thpool_buffer *
-__dequeue_head_thpool_worker(struct thpool_worker *worker)
+dequeue_head_thpool_worker(struct thpool_worker *worker,
+			   enum thpool_queue_class class)
 {
 	struct thpool_buffer *buffer;
 
-	buffer = list_entry(worker->work_head.next, struct thpool_buffer, next);
-	list_del(&buffer->next);
-	dec_queued_thpool_worker(worker);
+	if (thpool_queue_empty(&worker->queues[class]))
+		return NULL;
 
+	buffer = thpool_queue_pop(&worker->queues[class]);
+	if (buffer)
+		dec_queued_thpool_worker(worker);
 	return buffer;
 }
 
+/*
+ * Steal one request of @class from other workers.
+ * Start from the next worker so thieves spread out.
+ */
+static struct thpool_buffer *
+steal_thpool_worker(struct thpool_worker *thief, enum thpool_queue_class class)
+{
+	struct thpool_worker *victim;
+	struct thpool_buffer *buffer;
+	int i, idx;
+
+	idx = thpool_worker_id(thief);
+	for (i = 1; i < NR_THPOOL_WORKERS; i++) {
+		victim = thpool_worker_map + (idx + i) % NR_THPOOL_WORKERS;
+
+		buffer = dequeue_head_thpool_worker(victim, class);
+		if (buffer) {
+			inc_thpool_worker_nr_stolen(thief);
+			return buffer;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drain URGENT requests from everybody before NORMAL ones,
+ * and always prefer our own queue within the same class.
+ */
+static struct thpool_buffer *
+dequeue_thpool_worker(struct thpool_worker *worker)
+{
+	struct thpool_buffer *buffer;
+	int class;
+
+	for (class = 0; class < NR_THPOOL_QUEUES; class++) {
+		buffer = dequeue_head_thpool_worker(worker, class);
+		if (buffer)
+			return buffer;
+
+		buffer = steal_thpool_worker(worker, class);
+		if (buffer)
+			return buffer;
+	}
+	return NULL;
+}
+
+/*
+ * Buffers are freed out of order, since workers steal and requests
+ * take different time. Thus we take the next free one instead of
+ * waiting for the next one in ring order.
+ *
+ * Return NULL if all buffers are in use.
+ */
 static inline struct thpool_buffer *
-alloc_thpool_buffer(void)
+try_alloc_thpool_buffer(void)
 {
 	struct thpool_buffer *tb;
-	int idx;
+	int i, idx;
 
-	idx = TB_HEAD % NR_THPOOL_BUFFER;
-	tb = thpool_buffer_map + idx;
-	TB_HEAD++;
+	for (i = 0; i < NR_THPOOL_BUFFER; i++) {
+		idx = (TB_HEAD + i) % NR_THPOOL_BUFFER;
+		tb = thpool_buffer_map + idx;
 
-	/*
-	 * Buffer allocation is a simple ring.
-	 * If the warning is triggered, it basically means:
-	 * - buffer is not big enough
-	 * - handler are too slow
-	 */
-	while (ThpoolBufferUsed(tb)) {
-		WARN_ON_ONCE(1);
-		cpu_relax();
+		if (!ThpoolBufferUsed(tb) && !TestSetThpoolBufferUsed(tb)) {
+			TB_HEAD = idx + 1;
+			return tb;
+		}
 	}
+	return NULL;
+}
 
-	__SetThpoolBufferUsed(tb);
-	return tb;
+/*
+ * Requests that arrived while all buffers were in use.
+ *
+ * The polling thread must not wait for a buffer: handlers may be
+ * waiting for replies that only the polling thread can deliver.
+ * The payload stays in the FIT ring until the request is acked,
+ * so only its descriptor is kept here. Workers pick them up once
+ * they free a buffer.
+ *
+ * Once the ring is nearly full, requests that expect a reply are
+ * bounced with a busy reply and their senders try again later.
+ * Requests from ibapi_send() can not be bounced, they may use the
+ * last NR_THPOOL_DEFERRED_NOREPLY slots, and spill over to a list
+ * beyond that. Spilled ones move into the ring as it drains, so the
+ * ring always holds the oldest requests.
+ */
+struct thpool_deferred {
+	void			*fit_ctx;
+	void			*fit_imm;
+	void			*fit_rx;
+	int			fit_rx_size;
+	int			fit_node_id;
+	int			fit_offset;
+	struct list_head	overflow;
+};
+
+#define NR_THPOOL_DEFERRED		(1024)
+#define NR_THPOOL_DEFERRED_NOREPLY	(128)
+
+static struct thpool_deferred thpool_deferred_ring[NR_THPOOL_DEFERRED];
+static unsigned int thpool_deferred_head, thpool_deferred_tail;
+static LIST_HEAD(thpool_deferred_overflow);
+static DEFINE_SPINLOCK(thpool_deferred_lock);
+
+static inline bool thpool_deferred_empty(void)
+{
+	/* The overflow list is only used when the ring is full */
+	return READ_ONCE(thpool_deferred_head) == READ_ONCE(thpool_deferred_tail);
+}
+
+static inline void __thpool_defer_ring(struct thpool_deferred *d)
+{
+	thpool_deferred_ring[thpool_deferred_tail % NR_THPOOL_DEFERRED] = *d;
+	thpool_deferred_tail++;
 }
 
 /*
- * Choose a worker based on request types
+ * Queue @d in the ring. Return false if there is no room for it,
+ * requests that expect a reply leave the reserved slots alone.
+ */
+static bool thpool_defer(struct thpool_deferred *d, bool noreply)
+{
+	unsigned int limit = NR_THPOOL_DEFERRED;
+	bool queued = false;
+
+	if (!noreply)
+		limit -= NR_THPOOL_DEFERRED_NOREPLY;
+
+	spin_lock(&thpool_deferred_lock);
+	if (thpool_deferred_tail - thpool_deferred_head < limit) {
+		__thpool_defer_ring(d);
+		queued = true;
+	}
+	spin_unlock(&thpool_deferred_lock);
+	return queued;
+}
+
+/* Queue a kmalloc'ed @d that did not fit into the ring */
+static void thpool_defer_overflow(struct thpool_deferred *d)
+{
+	bool queued = false;
+
+	spin_lock(&thpool_deferred_lock);
+	if (thpool_deferred_tail - thpool_deferred_head < NR_THPOOL_DEFERRED) {
+		/* Drained meanwhile, so the list is empty too */
+		__thpool_defer_ring(d);
+		queued = true;
+	} else
+		list_add_tail(&d->overflow, &thpool_deferred_overflow);
+	spin_unlock(&thpool_deferred_lock);
+
+	if (queued)
+		kfree(d);
+}
+
+static bool thpool_undefer(struct thpool_deferred *d)
+{
+	struct thpool_deferred *o = NULL;
+	bool found = false;
+
+	spin_lock(&thpool_deferred_lock);
+	if (thpool_deferred_head != thpool_deferred_tail) {
+		*d = thpool_deferred_ring[thpool_deferred_head % NR_THPOOL_DEFERRED];
+		thpool_deferred_head++;
+		found = true;
+
+		o = list_first_entry_or_null(&thpool_deferred_overflow,
+					     struct thpool_deferred, overflow);
+		if (o) {
+			list_del(&o->overflow);
+			__thpool_defer_ring(o);
+		}
+	}
+	spin_unlock(&thpool_deferred_lock);
+
+	kfree(o);
+	return found;
+}
+
+static inline enum thpool_queue_class
+thpool_buffer_class(struct thpool_buffer *r)
+{
+	struct common_header *hdr;
+
+	hdr = to_common_header(thpool_buffer_rx(r));
+	switch (hdr->opcode) {
+	case P2M_PCACHE_MISS:
+	case P2M_PCACHE_MISS_BATCH:
+	case P2M_PCACHE_FLUSH:
+	case P2M_PCACHE_FLUSH_BATCH:
+	case P2M_PCACHE_ZEROFILL:
+	case P2M_PCACHE_REPLICA:
+		return THPOOL_QUEUE_URGENT;
+	default:
+		return THPOOL_QUEUE_NORMAL;
+	}
+}
+
+/*
+ * Choose a worker in round-robin fashion.
+ * Idle workers will steal if the chosen one is busy.
+ * Workers dispatching deferred requests may race on TW_HEAD,
+ * which only skews the rotation.
  */
 static inline struct thpool_worker *
 select_thpool_worker(struct thpool_buffer *r)
@@ -137,6 +380,51 @@ select_thpool_worker(struct thpool_buffer *r)
 	return tw;
 }
 
+static void thpool_dispatch(struct thpool_buffer *b, struct thpool_deferred *d)
+{
+	struct thpool_worker *w;
+
+	b->fit_rx = d->fit_rx;
+	b->fit_rx_size = d->fit_rx_size;
+	b->fit_ctx = d->fit_ctx;
+	b->fit_imm = d->fit_imm;
+	b->fit_offset = d->fit_offset;
+	b->fit_node_id = d->fit_node_id;
+
+	/*
+	 * Select a worker thread and pass the buffer
+	 * to it. The worker should do ACK and REPLY.
+	 */
+	thpool_buffer_enqueue_time(b);
+	w = select_thpool_worker(b);
+	enqueue_tail_thpool_worker(w, b, thpool_buffer_class(b));
+}
+
+/*
+ * Hand deferred requests over to free buffers.
+ * Called by whoever deferred or freed a buffer last, after a full
+ * barrier, so a request is never left behind with buffers free.
+ */
+static void thpool_dispatch_deferred(void)
+{
+	struct thpool_deferred d;
+	struct thpool_buffer *b;
+
+	while (!thpool_deferred_empty()) {
+		b = try_alloc_thpool_buffer();
+		if (!b)
+			return;
+
+		/* Raced with others, give it back and check again */
+		if (!thpool_undefer(&d)) {
+			ClearThpoolBufferUsed(b);
+			smp_mb__after_atomic();
+			continue;
+		}
+		thpool_dispatch(b, &d);
+	}
+}
+
 static void thpool_worker_handler(struct thpool_worker *worker,
 				  struct thpool_buffer *buffer)
 {
@@ -177,10 +465,18 @@ static void thpool_worker_handler(struct thpool_worker *worker,
 		inc_mm_stat(HANDLE_PCACHE_MISS);
 		handle_p2m_pcache_miss(msg, buffer);
 		break;
+	case P2M_PCACHE_MISS_BATCH:
+		inc_mm_stat(HANDLE_PCACHE_MISS_BATCH);
+		handle_p2m_pcache_miss_batch(msg, buffer);
+		break;
 	case P2M_PCACHE_FLUSH:
 		inc_mm_stat(HANDLE_PCACHE_FLUSH);
 		handle_p2m_flush_one(msg, buffer);
 		break;
+	case P2M_PCACHE_FLUSH_BATCH:
+		inc_mm_stat(HANDLE_PCACHE_FLUSH_BATCH);
+		handle_p2m_flush_batch(msg, buffer);
+		break;
 	case P2M_PCACHE_ZEROFILL:
 		handle_p2m_zerofill(msg, buffer);
 		break;
@@ -357,62 +653,62 @@ static int thpool_worker_func(void *_worker)
 
 	preempt_disable();
 	while (1) {
-		/* Check comments on enqueue */
-		while (!nr_queued_thpool_worker(w))
+		b = dequeue_thpool_worker(w);
+		if (!b) {
 			cpu_relax();
-
-		spin_lock(&w->lock);
-		while (!list_empty(&w->work_head)) {
-			b = __dequeue_head_thpool_worker(w);
-			spin_unlock(&w->lock);
-
-			/*
-			 * Update queuing stats
-			 *
-			 * HACK!!! The operations below except thpool_worker_handler()
-			 * are for debugging/tracing purpose. The will be compiled
-			 * away if disable CONFIG_COUNTER_THPOOL.
-			 */
-			thpool_buffer_dequeue_time(b);
-			queuing_delay = thpool_buffer_queuing_delay(b);
-			add_thpool_worker_total_queuing(w, queuing_delay);
-
-			set_in_handler_thpool_worker(w);
-			set_wip_buffer_thpool_worker(w, b);
-
-			PROFILE_START(thpool_worker_handler);
-
-			/* Invoke the real handler */
-			tb_reset_tx_size(b);
-			tb_reset_private_tx(b);
-			thpool_worker_handler(w, b);
-
-			/*
-			 * Leave this BUG_ON checking to catch
-			 * buggy handlers.
-			 */
-			BUG_ON(!b->tx_size);
-			PROFILE_LEAVE(thpool_worker_handler);
-
-			/*
-			 * Callback to FIT layer to perform the
-			 * last two steps: ACK, and REPLY.
-			 */
-			PROFILE_START(thpool_worker_fit_ack_reply);
-			fit_ack_reply_callback(b);
-			PROFILE_LEAVE(thpool_worker_fit_ack_reply);
-
-			clear_wip_buffer_thpool_worker(w);
-			clear_in_handler_thpool_worker(w);
-
-			/* Return buffer to free pool */
-			__ClearThpoolBufferNoreply(b);
-			__ClearThpoolBufferUsed(b);
-
-			inc_thpool_worker_nr_handled(w);
-			spin_lock(&w->lock);
+			continue;
 		}
-		spin_unlock(&w->lock);
+
+		/*
+		 * Update queuing stats
+		 *
+		 * HACK!!! The operations below except thpool_worker_handler()
+		 * are for debugging/tracing purpose. The will be compiled
+		 * away if disable CONFIG_COUNTER_THPOOL.
+		 */
+		thpool_buffer_dequeue_time(b);
+		queuing_delay = thpool_buffer_queuing_delay(b);
+		add_thpool_worker_total_queuing(w, queuing_delay);
+
+		set_in_handler_thpool_worker(w);
+		set_wip_buffer_thpool_worker(w, b);
+
+		PROFILE_START(thpool_worker_handler);
+
+		/* Invoke the real handler */
+		b->large_tx = w->large_tx;
+		tb_reset_tx(b);
+		tb_reset_tx_size(b);
+		tb_reset_private_tx(b);
+		thpool_worker_handler(w, b);
+
+		/*
+		 * Leave this BUG_ON checking to catch
+		 * buggy handlers.
+		 */
+		BUG_ON(!b->tx_size);
+		PROFILE_LEAVE(thpool_worker_handler);
+
+		/*
+		 * Callback to FIT layer to perform the
+		 * last two steps: ACK, and REPLY.
+		 */
+		PROFILE_START(thpool_worker_fit_ack_reply);
+		fit_ack_reply_callback(b);
+		PROFILE_LEAVE(thpool_worker_fit_ack_reply);
+
+		clear_wip_buffer_thpool_worker(w);
+		clear_in_handler_thpool_worker(w);
+
+		/* Return buffer to free pool */
+		__ClearThpoolBufferNoreply(b);
+		ClearThpoolBufferUsed(b);
+
+		/* Pairs with the barrier after deferring a request */
+		smp_mb__after_atomic();
+		thpool_dispatch_deferred();
+
+		inc_thpool_worker_nr_handled(w);
 	}
 	preempt_enable();
 
@@ -429,46 +725,80 @@ unsigned long nr_thpool_reqs;
 void thpool_callback(void *fit_ctx, void *fit_imm,
 		     void *rx, int rx_size, int node_id, int fit_offset)
 {
+	struct thpool_deferred d = {
+		.fit_ctx	= fit_ctx,
+		.fit_imm	= fit_imm,
+		.fit_rx		= rx,
+		.fit_rx_size	= rx_size,
+		.fit_node_id	= node_id,
+		.fit_offset	= fit_offset,
+	};
 	struct thpool_buffer *b;
-	struct thpool_worker *w;
+	bool noreply;
 
-	b = alloc_thpool_buffer();
-	b->fit_rx = rx;
-	b->fit_ctx = fit_ctx;
-	b->fit_imm = fit_imm;
-	b->fit_offset = fit_offset;
-	b->fit_node_id = node_id;
-
-	/*
-	 * Select a worker thread and pass the buffer
-	 * to it. The worker should do ACK and REPLY.
-	 */
-	thpool_buffer_enqueue_time(b);
-	w = select_thpool_worker(b);
-	enqueue_tail_thpool_worker(w, b);
 	nr_thpool_reqs++;
+
+	/* Do not overtake deferred ones */
+	if (likely(thpool_deferred_empty())) {
+		b = try_alloc_thpool_buffer();
+		if (likely(b)) {
+			thpool_dispatch(b, &d);
+			return;
+		}
+	}
+
+	inc_mm_stat(NR_THPOOL_BUFFER_FULL);
+	noreply = fit_request_is_noreply(fit_imm);
+	if (unlikely(!thpool_defer(&d, noreply))) {
+		struct thpool_deferred *o = NULL;
+
+		/* Push back on the sender instead of waiting for room */
+		if (!noreply) {
+			inc_mm_stat(NR_THPOOL_BUSY_REPLY);
+			fit_busy_reply_callback(fit_ctx, fit_imm, node_id, fit_offset);
+			return;
+		}
+
+		o = kmalloc(sizeof(*o), GFP_KERNEL);
+		if (unlikely(!o)) {
+			pr_err_once("thpool: OOM, drop request from node %d\n", node_id);
+			fit_busy_reply_callback(fit_ctx, fit_imm, node_id, fit_offset);
+			return;
+		}
+		*o = d;
+		inc_mm_stat(NR_THPOOL_DEFERRED_OVERFLOW);
+		thpool_defer_overflow(o);
+	}
+
+	/* Pairs with the barrier after freeing a buffer */
+	smp_mb();
+	thpool_dispatch_deferred();
 }
 
 /* Create worker and polling threads */
 void __init thpool_init(void)
 {
-	int i;
+	int i, j;
 	struct task_struct *p;
 	struct thpool_worker *worker;
 
+	BUILD_BUG_ON(!is_power_of_2(THPOOL_QUEUE_SIZE));
+
 	TW_HEAD = 0;
 	for (i = 0; i < NR_THPOOL_WORKERS; i++) {
 		worker = &thpool_worker_map[i];
 
-		worker->nr_queued = 0;
+		atomic_set(&worker->nr_queued, 0);
 		worker->max_nr_queued = 0;
 		worker->flags = 0;
 		worker->nr_handled = 0;
+		worker->nr_stolen = 0;
+		worker->large_tx = thpool_large_tx_map + i * THPOOL_TX_SIZE;
 		worker->total_queuing_delay_ns = 0;
 		worker->max_queuing_delay_ns = 0;
 		worker->min_queuing_delay_ns = ULONG_MAX;
-		INIT_LIST_HEAD(&worker->work_head);
-		spin_lock_init(&worker->lock);
+		for (j = 0; j < NR_THPOOL_QUEUES; j++)
+			init_thpool_queue(&worker->queues[j]);
 		memset(worker->queuing_stats, 0, sizeof(worker->queuing_stats));
 
 		init_completion(&thpool_init_completion);
@@ -491,6 +821,7 @@ void __init memory_component_init(void)
 #endif
 
 	gmm_init();
+	lego_task_table_init();
 
 	/* Register exec binary handlers */
 	exec_init();
@@ -510,7 +841,6 @@ void __init memory_component_init(void)
 void __init memory_manager_early_init(void)
 {
 	u64 size;
-	int i;
 
 	size = NR_THPOOL_BUFFER * sizeof(struct thpool_buffer);
 
@@ -520,16 +850,19 @@ void __init memory_manager_early_init(void)
 
 	TB_HEAD = 0;
 	memset(thpool_buffer_map, 0, size);
-	for (i = 0; i < NR_THPOOL_BUFFER; i++) {
-		struct thpool_buffer *tb;
-
-		tb = thpool_buffer_map + i;
-		INIT_LIST_HEAD(&tb->next);
-	}
 
 	pr_debug("Memory: thpool_buffer [%p - %#Lx] %Lx bytes nr:%d size:%zu\n",
 		thpool_buffer_map, (unsigned long)(thpool_buffer_map) + size, size,
 		NR_THPOOL_BUFFER, sizeof(struct thpool_buffer));
+
+	size = NR_THPOOL_WORKERS * THPOOL_TX_SIZE;
+	thpool_large_tx_map = memblock_virt_alloc(size, PAGE_SIZE);
+	if (!thpool_large_tx_map)
+		panic("Unable to allocate thpool large tx array!");
+
+	pr_debug("Memory: thpool_large_tx [%p - %#Lx] %Lx bytes nr:%d\n",
+		thpool_large_tx_map, (unsigned long)(thpool_large_tx_map) + size, size,
+		NR_THPOOL_WORKERS);
 }
 
 struct hb_cached {
@@ -604,10 +937,11 @@ void print_thpool_stats(void)
 		pr_info("Watchdog:\n"
 			"    worker[%d]\n"
 			"        max_nr_queued=%d current_nr_queued=%d in_handler=%s\n"
-			"        nr_handled=%lu nr_thpool_reqs=%lu\n"
+			"        nr_handled=%lu nr_stolen=%lu nr_thpool_reqs=%lu\n"
 			"        total_queuing_ns: %lu avg_queuing_ns:%lu max_queuing_ns: %lu min_queuing_ns: %lu\n",
-			i, max_queued_thpool_worker(tw), tw->nr_queued, thpool_worker_in_handler(tw) ? "YES" : "NO",
-			tw->nr_handled, nr_thpool_reqs,
+			i, max_queued_thpool_worker(tw), nr_queued_thpool_worker(tw),
+			thpool_worker_in_handler(tw) ? "YES" : "NO",
+			tw->nr_handled, tw->nr_stolen, nr_thpool_reqs,
 			tw->total_queuing_delay_ns, tw->nr_handled ? (tw->total_queuing_delay_ns / tw->nr_handled) : 0,
 			tw->max_queuing_delay_ns, tw->min_queuing_delay_ns);
 
@@ -64,7 +64,10 @@ void handle_p2m_read(struct p2m_read_write_payload *payload,
 	 * - P side will chunk the read() based on THPOOL_TX_SIZE
 	 * - tb_set_tx_size() will check against THPOOL_TX_SIZE
 	 */
-	retbuf = thpool_buffer_tx(tb);
+	if (sizeof(*retbuf) + count > THPOOL_TX_INLINE_SIZE)
+		retbuf = thpool_buffer_tx_large(tb);
+	else
+		retbuf = thpool_buffer_tx(tb);
 	buf = (char *)retbuf + sizeof(retval);
 	tb_set_tx_size(tb, sizeof(retval) + count);
 
@@ -324,7 +324,7 @@ void handle_m2m_fork(struct m2m_fork_struct *payload,
 	vma_debug("%s, nid: %d, parent_pid: %d, child_pid: %d, prcsr_nid: %d",
 		   __func__, nid, parent_pid, child_pid, prcsr_nid);
 
-	reply = thpool_buffer_tx(tb);
+	reply = thpool_buffer_tx_large(tb);
 	memset(reply, 0, sizeof(*reply));
 	tb_set_tx_size(tb, sizeof(int));
 
@@ -611,7 +611,7 @@ void handle_p2m_fork(struct p2m_fork_struct *payload,
 	fork_debug("nid:%u,pid:%u,tgid:%u,parent_tgid:%u",
 		nid, payload->pid, tgid, parent_tgid);
 
-	reply = thpool_buffer_tx(tb);
+	reply = thpool_buffer_tx_large(tb);
 	memset(reply, 0, sizeof(*reply));
 	tb_set_tx_size(tb, sizeof(int));
 
@@ -15,6 +15,7 @@
 #include <lego/profile.h>
 #include <lego/fit_ibapi.h>
 #include <lego/ratelimit.h>
+#include <lego/bitmap.h>
 #include <lego/checksum.h>
 #include <lego/profile.h>
 #include <lego/comp_memory.h>
@@ -75,44 +76,51 @@ static void pcache_miss_error(u32 retval, struct lego_task_struct *p,
  *
  * Both of them are valid page fault in traditional concept.
  * We need to establish mapping (e.g. page table) here in memory component.
+ *
+ * Caller must hold mmap_sem for read.
  */
 DEFINE_PROFILE_POINT(pcache_miss_find_vma)
 
-static int common_handle_p2m_miss(struct lego_task_struct *p,
-				  u64 vaddr, u32 flags, unsigned long *new_page)
+static int __common_handle_p2m_miss(struct lego_task_struct *p,
+				    u64 vaddr, u32 flags, unsigned long *new_page)
 {
 	struct vm_area_struct *vma;
 	struct lego_mm_struct *mm = p->mm;
 	int ret;
 	PROFILE_POINT_TIME(pcache_miss_find_vma)
 
-	down_read(&mm->mmap_sem);
-
 	PROFILE_START(pcache_miss_find_vma);
 	vma = find_vma(mm, vaddr);
 	PROFILE_LEAVE(pcache_miss_find_vma);
 
 	if (unlikely(!vma)) {
-		pr_info("fail to find vma\n");
+		if (!(flags & FAULT_FLAG_PREFETCH))
+			pr_info("fail to find vma\n");
 		ret = VM_FAULT_SIGSEGV;
-		goto unlock;
+		goto out;
 	}
 
 	/* VMAs except stack */
 	if (likely(vma->vm_start <= vaddr))
 		goto good_area;
 
+	/* Speculative prefetch should never grow the stack */
+	if (unlikely(flags & FAULT_FLAG_PREFETCH)) {
+		ret = VM_FAULT_SIGSEGV;
+		goto out;
+	}
+
 	/* stack? */
 	if (unlikely(!(vma->vm_flags & VM_GROWSDOWN))) {
 		pr_info("not a stack\n");
 		ret = VM_FAULT_SIGSEGV;
-		goto unlock;
+		goto out;
 	}
 
 	if (unlikely(expand_stack(vma, vaddr))) {
 		pr_info("fail to expand stack\n");
 		ret = VM_FAULT_SIGSEGV;
-		goto unlock;
+		goto out;
 	}
 
 	/*
@@ -123,7 +131,18 @@ static int common_handle_p2m_miss(struct lego_task_struct *p,
 	 */
 good_area:
 	ret = handle_lego_mm_fault(vma, vaddr, flags, new_page, NULL);
-unlock:
+out:
+	return ret;
+}
+
+static int common_handle_p2m_miss(struct lego_task_struct *p,
+				  u64 vaddr, u32 flags, unsigned long *new_page)
+{
+	struct lego_mm_struct *mm = p->mm;
+	int ret;
+
+	down_read(&mm->mmap_sem);
+	ret = __common_handle_p2m_miss(p, vaddr, flags, new_page);
 	up_read(&mm->mmap_sem);
 	return ret;
 }
@@ -143,6 +162,18 @@ static void do_handle_p2m_zerofill_miss(struct lego_task_struct *p,
 	tb_set_tx_size(tb, sizeof(int));
 }
 
+/*
+ * Prefetch and batched requests are speculative, and may well fall outside
+ * any vma. Processor just drops the line, there is nothing worth dumping.
+ */
+static void pcache_miss_error_quiet(u32 retval, struct thpool_buffer *tb)
+{
+	int *reply = thpool_buffer_tx(tb);
+
+	*reply = retval;
+	tb_set_tx_size(tb, sizeof(*reply));
+}
+
 static void do_handle_p2m_pcache_miss(struct lego_task_struct *p,
 				      u64 vaddr, u32 flags,
 				      struct thpool_buffer *tb)
@@ -157,7 +188,10 @@ static void do_handle_p2m_pcache_miss(struct lego_task_struct *p,
 		else if (ret & (VM_FAULT_SIGBUS | VM_FAULT_SIGSEGV))
 			ret = RET_ESIGSEGV;
 
-		pcache_miss_error(ret, p, vaddr, tb);
+		if (flags & FAULT_FLAG_PREFETCH)
+			pcache_miss_error_quiet(ret, tb);
+		else
+			pcache_miss_error(ret, p, vaddr, tb);
 		return;
 	}
 
@@ -195,7 +229,9 @@ void handle_p2m_flush_one(struct p2m_flush_msg *msg, struct thpool_buffer *tb)
 	ret = get_user_pages(p, msg->user_va, 1, 0, &dst_page, NULL);
 	up_read(&p->mm->mmap_sem);
 	if (likely(ret == 1)) {
-		memcpy((void *)dst_page, msg->pcacheline, PCACHE_LINE_SIZE);
+		/* Not read until the next miss, keep it out of CPU cache */
+		copy_pages_nocache((void *)dst_page, msg->pcacheline,
+				   PCACHE_LINE_NR_PAGES);
 		reply = 0;
 	} else
 		reply = -EFAULT;
@@ -206,6 +242,101 @@ out:
 	PROFILE_LEAVE(handle_flush);
 }
 
+DEFINE_PROFILE_POINT(handle_flush_batch)
+
+/*
+ * Check @msg against the @rx_size bytes received: the header of
+ * nr_lines lines, followed by exactly their dirty chunks.
+ */
+static bool p2m_flush_batch_valid(struct p2m_flush_batch_msg *msg, int rx_size)
+{
+	unsigned long nr_chunks = 0;
+	int i;
+
+	if (unlikely(rx_size < (int)P2M_FLUSH_BATCH_MSG_SIZE(0) ||
+		     msg->nr_lines > PCACHE_FLUSH_BATCH_MAX))
+		return false;
+
+	for (i = 0; i < msg->nr_lines; i++)
+		nr_chunks += bitmap_weight(msg->lines[i].dirty, PCACHE_LINE_NR_CHUNKS);
+
+	return P2M_FLUSH_BATCH_MSG_SIZE(nr_chunks) == rx_size;
+}
+
+/*
+ * Processor counterpart: pcache writeback engine.
+ * Consecutive lines of the same process share one mmap_sem acquisition.
+ */
+void handle_p2m_flush_batch(struct p2m_flush_batch_msg *msg,
+			    struct thpool_buffer *tb)
+{
+	struct lego_task_struct *p = NULL;
+	unsigned long dst_page;
+	void *src = msg->data;
+	int i, bit, ret, src_nid, nr_failed = 0;
+	PROFILE_POINT_TIME(handle_flush_batch)
+
+	src_nid = to_common_header(msg)->src_nid;
+	if (unlikely(!p2m_flush_batch_valid(msg, thpool_buffer_rx_size(tb)))) {
+		pr_err("%s(): bad msg from node %d, nr_lines: %u, size: %d\n",
+			__func__, src_nid, msg->nr_lines, thpool_buffer_rx_size(tb));
+		nr_failed = -EINVAL;
+		goto out;
+	}
+
+	PROFILE_START(handle_flush_batch);
+	for (i = 0; i < msg->nr_lines; i++) {
+		unsigned long *dirty = msg->lines[i].dirty;
+		pid_t pid = msg->lines[i].pid;
+		int nr_chunks;
+
+		nr_chunks = bitmap_weight(dirty, PCACHE_LINE_NR_CHUNKS);
+		if (!nr_chunks)
+			continue;
+
+		if (!p || p->pid != pid) {
+			if (p)
+				up_read(&p->mm->mmap_sem);
+
+			p = find_lego_task_by_pid(src_nid, pid);
+			if (unlikely(!p)) {
+				nr_failed++;
+				src += nr_chunks * PCACHE_CHUNK_SIZE;
+				continue;
+			}
+			down_read(&p->mm->mmap_sem);
+		}
+
+		ret = get_user_pages(p, msg->lines[i].user_va, 1, 0, &dst_page, NULL);
+		if (unlikely(ret != 1)) {
+			nr_failed++;
+			src += nr_chunks * PCACHE_CHUNK_SIZE;
+			continue;
+		}
+
+		/* Whole line, not read until the next miss */
+		if (nr_chunks == PCACHE_LINE_NR_CHUNKS) {
+			copy_pages_nocache((void *)dst_page, src, PCACHE_LINE_NR_PAGES);
+			src += PCACHE_LINE_SIZE;
+			continue;
+		}
+
+		/* Apply the delta */
+		for_each_set_bit(bit, dirty, PCACHE_LINE_NR_CHUNKS) {
+			memcpy((void *)dst_page + bit * PCACHE_CHUNK_SIZE, src,
+			       PCACHE_CHUNK_SIZE);
+			src += PCACHE_CHUNK_SIZE;
+		}
+	}
+	if (p)
+		up_read(&p->mm->mmap_sem);
+	PROFILE_LEAVE(handle_flush_batch);
+
+out:
+	*(int *)thpool_buffer_tx(tb) = nr_failed;
+	tb_set_tx_size(tb, sizeof(int));
+}
+
 /*
  * Processor counterpart: __pcache_do_fill_page().
  * Check how we fill the information.
@@ -234,7 +365,8 @@ static void do_piggyback_flush(void *_msg, unsigned int src_nid,
 	up_read(&flush_task->mm->mmap_sem);
 
 	if (likely(ret == 1))
-		memcpy((void *)dst_page, flush_msg->pcacheline, PCACHE_LINE_SIZE);
+		copy_pages_nocache((void *)dst_page, flush_msg->pcacheline,
+				   PCACHE_LINE_NR_PAGES);
 	else
 		WARN_ON_ONCE(1);
 }
@@ -317,3 +449,72 @@ void handle_p2m_zerofill(struct p2m_zerofill_msg *msg,
 	handle_zerofill_debug("O nid:%u pid:%u tgid:%u flags:%x vaddr:%#Lx",
 		src_nid, msg->pid, tgid, flags, vaddr);
 }
+
+DEFINE_PROFILE_POINT(handle_miss_batch)
+
+/*
+ * Processor counterpart: pcache_fill_remote_batch().
+ * All lines are handled within one mmap_sem acquisition. Since each line
+ * lives in its own page, they are copied into the reply instead of being
+ * sent from the page directly like the single-line case.
+ */
+void handle_p2m_pcache_miss_batch(struct p2m_pcache_miss_batch_msg *msg,
+				  struct thpool_buffer *tb)
+{
+	struct p2m_pcache_miss_batch_reply *reply = thpool_buffer_tx_large(tb);
+	u32 tgid, flags, nr_lines;
+	unsigned int src_nid;
+	struct lego_task_struct *p;
+	int i, ret;
+	PROFILE_POINT_TIME(handle_miss_batch)
+
+	src_nid  = to_common_header(msg)->src_nid;
+	tgid     = msg->tgid;
+	flags    = msg->flags;
+	nr_lines = msg->nr_lines;
+
+	handle_pcache_debug("I nid:%u pid:%u tgid:%u flags:%x nr:%u vaddr:%#Lx",
+		src_nid, msg->pid, tgid, flags, nr_lines, msg->missing_vaddr[0]);
+
+	if (unlikely(!nr_lines || nr_lines > PCACHE_MISS_BATCH_MAX)) {
+		pcache_miss_error_quiet(RET_EINVAL, tb);
+		return;
+	}
+
+	p = find_lego_task_by_pid(src_nid, tgid);
+	if (unlikely(!p)) {
+		pcache_miss_error_quiet(RET_ESRCH, tb);
+		return;
+	}
+
+	PROFILE_START(handle_miss_batch);
+	down_read(&p->mm->mmap_sem);
+	for (i = 0; i < nr_lines; i++) {
+		u64 vaddr = msg->missing_vaddr[i];
+		unsigned long new_page;
+
+		if (unlikely(fault_in_kernel_space(vaddr))) {
+			reply->status[i] = RET_EFAULT;
+			continue;
+		}
+
+		ret = __common_handle_p2m_miss(p, vaddr, flags, &new_page);
+		if (unlikely(ret & VM_FAULT_ERROR)) {
+			if (ret & VM_FAULT_OOM)
+				reply->status[i] = RET_ENOMEM;
+			else
+				reply->status[i] = RET_ESIGSEGV;
+			continue;
+		}
+
+		memcpy(reply->data[i], (void *)new_page, PCACHE_LINE_SIZE);
+		reply->status[i] = 0;
+	}
+	up_read(&p->mm->mmap_sem);
+	PROFILE_LEAVE(handle_miss_batch);
+
+	tb_set_tx_size(tb, PCACHE_MISS_BATCH_REPLY_SIZE(nr_lines));
+
+	handle_pcache_debug("O nid:%u pid:%u tgid:%u flags:%x nr:%u vaddr:%#Lx",
+		src_nid, msg->pid, tgid, flags, nr_lines, msg->missing_vaddr[0]);
+}
@@ -18,6 +18,7 @@
 #include <memory/pid.h>
 #include <memory/vm.h>
 #include <memory/file_types.h>
+#include <memory/pgcache.h>
 
 #ifdef CONFIG_DEBUG_M2S_READ_WRITE
 #define m2s_debug(fmt, ...)					\
@@ -103,13 +104,17 @@ ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name,
 			const char *buf, size_t count, loff_t *pos)
 {
 	u32 len_msg, *opcode;
-	void *msg, *content;
+	void *msg;
 	ssize_t retval;
 	struct m2s_read_write_payload *payload;
+	struct fit_sglist iov[2];
 	int retlen;
 
-	/* msg = opcode + payload + send_buffer */
-	len_msg = sizeof(*opcode) + sizeof(*payload) + count;
+	/*
+	 * msg = opcode + payload
+	 * send_buffer is sent in place, after msg
+	 */
+	len_msg = sizeof(*opcode) + sizeof(*payload);
 	msg = kmalloc(len_msg, GFP_KERNEL);
 	if (!msg)
 		return -ENOMEM;
@@ -124,16 +129,16 @@ ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name,
 	payload->offset = *pos;
 	strncpy(payload->filename, f_name, MAX_FILENAME_LENGTH);
 
-	content = msg + sizeof(*opcode) + sizeof(*payload);
-
-	//lego_copy_from_user(tsk, content, buf, count);
-	memcpy(content, buf, count);
+	iov[0].addr = msg;
+	iov[0].len = len_msg;
+	iov[1].addr = (void *)buf;
+	iov[1].len = count;
 
 	m2s_debug("f_name:[%s] len:%#lx offset:%#Lx",
 		payload->filename, payload->len, payload->offset);
 
-	retlen = ibapi_send_reply_imm(STORAGE_NODE, msg, len_msg,
-				&retval, sizeof(retval), false);
+	retlen = ibapi_send_reply_iov(STORAGE_NODE, iov, count ? 2 : 1,
+				      &retval, sizeof(retval), false, 0);
 
 	if (unlikely(retlen != sizeof(retval)))
 		retval = -EIO;
@@ -152,6 +157,46 @@ static ssize_t storage_write(struct lego_task_struct *tsk, struct lego_file *fil
 	return __storage_write(tsk, file->filename, buf, count, pos);
 }
 
+#ifdef CONFIG_MEM_PAGE_CACHE
+/*
+ * Fault through memory page cache. Read-only mappings share the cached
+ * page with all other processes, the pte holds one page reference.
+ *
+ * Writable mappings get a private copy at fault time, instead of COW
+ * later: processor flushes dirty lines into the mapped page directly,
+ * there is no write-protect fault that could break the sharing.
+ *
+ * Return 0 if page cache can not help.
+ */
+static unsigned long storage_vma_fault_pgcache(struct vm_area_struct *vma,
+					       struct vm_fault *vmf)
+{
+	struct lego_file *file = vma->vm_file;
+	unsigned long page, private;
+	loff_t pos;
+
+	pos = vmf->pgoff << PAGE_SHIFT;
+	page = lego_pgcache_get_page(file->filename, STORAGE_NODE, pos);
+	if (unlikely(!page))
+		return 0;
+
+	if (!(vma->vm_flags & VM_WRITE) && !(vmf->flags & FAULT_FLAG_WRITE))
+		return page;
+
+	private = __get_free_page(GFP_KERNEL);
+	if (likely(private))
+		copy_page((void *)private, (void *)page);
+	free_page(page);
+	return private;
+}
+#else
+static inline unsigned long
+storage_vma_fault_pgcache(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	return 0;
+}
+#endif
+
 static int storage_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct lego_task_struct *tsk;
@@ -160,6 +205,12 @@ static int storage_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	loff_t pos;
 	unsigned long page;
 
+	page = storage_vma_fault_pgcache(vma, vmf);
+	if (likely(page)) {
+		vmf->page = page;
+		return 0;
+	}
+
 	page = __get_free_page(GFP_KERNEL);
 	if (unlikely(!page))
 		return VM_FAULT_OOM;
@@ -38,7 +38,9 @@ static int m2mm_status_report(void *_unused)
 		manager_meminfo(&info);
 		r.totalram = info.totalram;
 		r.freeram = info.freeram;
-		r.nr_request = mm_stat(HANDLE_PCACHE_MISS) + mm_stat(HANDLE_PCACHE_FLUSH);
+		r.nr_request = mm_stat(HANDLE_PCACHE_MISS) + mm_stat(HANDLE_PCACHE_FLUSH) +
+			       mm_stat(HANDLE_PCACHE_MISS_BATCH) +
+			       mm_stat(HANDLE_PCACHE_FLUSH_BATCH);
 
 		//pr_info("%s(): r.nr_req:%lu mm_stat:%lu\n", __func__, r.nr_request, mm_stat(HANDLE_PCACHE_MISS));
 		ibapi_send_reply_timeout(CONFIG_GMM_NODEID, &r, sizeof(r),
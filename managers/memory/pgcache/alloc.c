@@ -7,22 +7,54 @@
  * (at your option) any later version.
  */
 
+#include <lego/mm.h>
 #include <lego/slab.h>
 #include <memory/pgcache.h>
 
-struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
-		unsigned int storage_node)
+#define NR_PGCACHE_PAGES	(1 << PGCACHE_PREFETCH_ORDER)
+
+/*
+ * Cached pages can be mapped into user processes one by one,
+ * thus each of them has its own refcount, like split_page().
+ * A page still mapped somewhere outlives its cacheline.
+ */
+void *alloc_pgcache_pages(void)
+{
+	struct page *page;
+	int i;
+
+	page = alloc_pages(GFP_KERNEL | __GFP_ZERO, PGCACHE_PREFETCH_ORDER);
+	if (unlikely(!page))
+		return NULL;
+
+	for (i = 1; i < NR_PGCACHE_PAGES; i++)
+		set_page_refcounted(page + i);
+	return page_address(page);
+}
+
+void free_pgcache_pages(void *pages)
+{
+	int i;
+
+	if (!pages)
+		return;
+
+	for (i = 0; i < NR_PGCACHE_PAGES; i++)
+		free_page((unsigned long)pages + i * PAGE_SIZE);
+}
+
+struct lego_pgcache_struct *__alloc_pgcache(struct lego_pgcache_file *file,
+		loff_t pos)
 {
 	struct lego_pgcache_struct *pgc;
 
 	pgc = kmalloc(sizeof(struct lego_pgcache_struct), GFP_KERNEL);
-	if (unlikely(!pgc)) {
-		return ERR_PTR(-ENOMEM);
-	}
+	if (unlikely(!pgc))
+		return NULL;
 
-	strcpy(pgc->filepath, filepath);
+	pgc->file = file;
 	pgc->pos = aligned_pos(pos);
-	pgc->storage_node = storage_node;
+	pgc->storage_node = file->storage_node;
 
 	/* mark new allocated pgcache as empty */
 	pgc->real_len = 0;
@@ -31,28 +63,33 @@ struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
 	INIT_LIST_HEAD(&pgc->dirtylist);
 	INIT_LIST_HEAD(&pgc->stack_s);
 	INIT_LIST_HEAD(&pgc->stack_q);
+	INIT_LIST_HEAD(&pgc->ra_list);
+	pgc->ra = NULL;
 
 	/* init pgc lock */
 	spin_lock_init(&pgc->lock);
 
-	pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
-			PGCACHE_PREFETCH_ORDER);
+	pgc->cached_pages = alloc_pgcache_pages();
+	if (unlikely(!pgc->cached_pages)) {
+		kfree(pgc);
+		return NULL;
+	}
 
 	pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
-			pgc, pgc->pos, pgc->cached_pages, pgc->filepath);
+			pgc, pgc->pos, pgc->cached_pages, file->filepath);
 
 	return pgc;
 }
 
 void __free_pgcache_locked(struct lego_pgcache_struct *pgc)
 {
-	free_pages((unsigned long)pgc->cached_pages, PGCACHE_PREFETCH_ORDER);
+	free_pgcache_pages(pgc->cached_pages);
 	pgc->cached_pages = NULL;
 	//kfree(pgc);
 }
 
 void __free_pgcache_struct(struct lego_pgcache_struct *pgc)
 {
-	free_pages((unsigned long)pgc->cached_pages, PGCACHE_PREFETCH_ORDER);
+	free_pgcache_pages(pgc->cached_pages);
 	kfree(pgc);
 }
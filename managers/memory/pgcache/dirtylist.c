@@ -19,6 +19,10 @@
 static DEFINE_SPINLOCK(hash_dirtylists_lock);
 static DEFINE_HASHTABLE(hash_dirtylists, PGCACHE_HASH_BITS);
 
+/* All files ever inserted, they are never freed */
+static LIST_HEAD(pgcache_files);
+static DEFINE_MUTEX(pgcache_files_mutex);
+
 static unsigned int get_key(char *str)
 {
 	unsigned int seed = 131;
@@ -52,6 +56,10 @@ struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,
 	INIT_LIST_HEAD(&file->head);
 	spin_lock_init(&file->dirtylist_lock);
 
+	INIT_LIST_HEAD(&file->list);
+	INIT_RADIX_TREE(&file->lines, GFP_KERNEL);
+	mutex_init(&file->mutex);
+
 	return file;
 }
 
@@ -76,6 +84,12 @@ int ht_insert_lego_pgcache_file(struct lego_pgcache_file *file)
 	hash_add(hash_dirtylists, &file->hlink, key);
 	spin_unlock(&hash_dirtylists_lock);
 
+	/* Not the first insert if it is renamed */
+	mutex_lock(&pgcache_files_mutex);
+	if (list_empty(&file->list))
+		list_add_tail(&file->list, &pgcache_files);
+	mutex_unlock(&pgcache_files_mutex);
+
 	return 0;
 }
 
@@ -137,6 +151,17 @@ struct lego_pgcache_file *find_lego_pgcache_file(char *filepath)
 	return NULL;
 }
 
+/* Call @fn on every file, @fn is allowed to sleep */
+void for_each_lego_pgcache_file(void (*fn)(struct lego_pgcache_file *file))
+{
+	struct lego_pgcache_file *file;
+
+	mutex_lock(&pgcache_files_mutex);
+	list_for_each_entry(file, &pgcache_files, list)
+		fn(file);
+	mutex_unlock(&pgcache_files_mutex);
+}
+
 void mark_lego_pgcache_dirty(struct lego_pgcache_struct *pgc,
 		struct lego_pgcache_file *file)
 {
@@ -177,8 +202,7 @@ void make_lego_pgcache_clean(struct lego_pgcache_struct *pgc)
 		return;
 	}
 
-	file = find_lego_pgcache_file(pgc->filepath);
-	BUG_ON(!file);
+	file = pgc->file;
 
 	spin_lock(&file->dirtylist_lock);
 
@@ -83,15 +83,33 @@ retry:
 	goto retry;
 }
 
-/* TODO: Mark lock sequence, adjust lock range */
-void pgcache_evict_one(void)
+/*
+ * Evict the oldest HIR cacheline whose file is not busy elsewhere.
+ * Freeing a line of another file is only safe with that file's mutex,
+ * its readers and writers use cached_pages without pgcache_lirs_lock.
+ * Caller holds @cur->mutex and pgcache_lirs_lock.
+ *
+ * Return true if a cacheline was evicted.
+ */
+bool pgcache_evict_one(struct lego_pgcache_file *cur)
 {
 	struct lego_pgcache_struct *victim;
+	struct lego_pgcache_file *file;
+	bool found = false;
+
+	list_for_each_entry(victim, &lirs_stack_q, stack_q) {
+		if (victim->file == cur || mutex_trylock(&victim->file->mutex)) {
+			found = true;
+			break;
+		}
+	}
+	if (!found)
+		return false;
 
-	victim = head_entry(victim, &lirs_stack_q, stack_q);
+	file = victim->file;
 
 	pgcache_debug("victim: %p, filepath: %s, pos: %Lx",		\
-		victim, victim->filepath, victim->pos);
+		victim, file->filepath, victim->pos);
 
 	/* flush the dirty cacheline */
 	make_lego_pgcache_clean(victim);
@@ -103,6 +121,10 @@ void pgcache_evict_one(void)
 	 */
 	__free_pgcache_locked(victim);
 	remove_from_stack_q_locked(victim);
+
+	if (file != cur)
+		mutex_unlock(&file->mutex);
+	return true;
 }
 
 void update_lirs_structure(struct lego_pgcache_struct *pgc)
@@ -173,10 +195,10 @@ void update_lirs_structure(struct lego_pgcache_struct *pgc)
 	goto unlock;
 
 eviction:
-	if (atomic_read(&hir_credit) > MAX_HIR_CACHELINES) {
-		pgcache_evict_one();
+	/* All candidates busy: stay over the limit until next access */
+	if (atomic_read(&hir_credit) > MAX_HIR_CACHELINES &&
+	    pgcache_evict_one(pgc->file))
 		atomic_dec(&hir_credit);
-	}
 unlock:
 	spin_unlock(&pgcache_lirs_lock);
 	return;
@@ -46,37 +46,26 @@ out:
 	return ret;
 }
 
+/*
+ * Cachelines point to their file, and are indexed within it,
+ * so only the file itself needs to be renamed.
+ */
 static void __do_page_cache_rename(char *oldname, char *newname)
 {
-	size_t len = 0;
-	loff_t curr = 0;
 	struct lego_pgcache_file *pgfile = find_lego_pgcache_file(oldname);
-	loff_t stride = 1 << PGCACHE_PREFETCH_ORDER;
 
 	/* file has not been touched yet */
 	if (unlikely(!pgfile))
 		return;
 
-	len = file_size_read(pgfile);
-	while (curr < len) {
-		struct lego_pgcache_struct *pgc =
-				find_lego_pgcache_struct(oldname, curr);
-
-		if (pgc) {
-			ht_remove_lego_pgcache_struct(pgc);
-			memset(pgc->filepath, 0, MAX_FILENAME_LENGTH);
-			strncpy(pgc->filepath, newname, MAX_FILENAME_LENGTH);
-			ht_insert_lego_pgcache_struct(pgc);
-		}
-		curr += stride;
-	}
-
 	/*
 	 * rename pgfile
 	 */
 	ht_remove_lego_pgcache_file(pgfile);
+	mutex_lock(&pgfile->mutex);
 	memset(pgfile->filepath, 0, MAX_FILENAME_LENGTH);
 	strncpy(pgfile->filepath, newname, MAX_FILENAME_LENGTH);
+	mutex_unlock(&pgfile->mutex);
 	ht_insert_lego_pgcache_file(pgfile);
 }
 
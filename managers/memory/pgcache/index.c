@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016-2017 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Cacheline index
+ *
+ * Each file indexes its own cachelines by a radix tree, keyed by the
+ * cacheline number within the file. A file is looked up by path once
+ * per request, and everything below it goes by the file pointer.
+ * Callers must hold file->mutex.
+ */
+
+#include <lego/kernel.h>
+#include <lego/radixtree.h>
+#include <lego/comp_memory.h>
+#include <memory/pgcache.h>
+
+static inline unsigned long pgcache_index(loff_t pos)
+{
+	return pos >> CL_SHIFT;
+}
+
+/* Return -EEXIST if the line is already there */
+int insert_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+{
+	BUG_ON(!pgc || !pgc->file);
+
+	pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
+			pgc, pgc->pos, pgc->cached_pages, pgc->file->filepath);
+
+	return radix_tree_insert(&pgc->file->lines, pgcache_index(pgc->pos), pgc);
+}
+
+void remove_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+{
+	BUG_ON(!pgc || !pgc->file);
+	radix_tree_delete(&pgc->file->lines, pgcache_index(pgc->pos));
+}
+
+void free_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+{
+	BUG_ON(!pgc || !pgc->file);
+
+	if (!radix_tree_delete_item(&pgc->file->lines,
+				    pgcache_index(pgc->pos), pgc)) {
+		WARN(1, "Fail to find pgc->(filepath:%s,pos:%Ld)\n",
+			pgc->file->filepath, pgc->pos);
+		return;
+	}
+	__free_pgcache_struct(pgc);
+}
+
+struct lego_pgcache_struct *
+	find_lego_pgcache_struct(struct lego_pgcache_file *file, loff_t pos)
+{
+	struct lego_pgcache_struct *pgc;
+
+	pgc = radix_tree_lookup(&file->lines, pgcache_index(pos));
+
+	pgcache_debug("pgc:%p, pos:%Ld, filepath: %s",		\
+			pgc, aligned_pos(pos), file->filepath);
+
+	return pgc;
+}
+
+static void drop_pgcache_file(struct lego_pgcache_file *file)
+{
+	struct lego_pgcache_struct *pgc;
+	struct radix_tree_iter iter;
+	void **slot;
+
+	mutex_lock(&file->mutex);
+	for (;;) {
+		/* Deleting may free the node under iteration, restart */
+		pgc = NULL;
+		radix_tree_for_each_slot(slot, &file->lines, &iter, 0) {
+			pgc = *slot;
+			break;
+		}
+		if (!pgc)
+			break;
+
+		/* Wait for in-flight readahead before freeing its line */
+		pgcache_ra_cancel(pgc);
+
+		radix_tree_delete(&file->lines, iter.index);
+		__free_pgcache_struct(pgc);
+	}
+	file->ra_next = 0;
+	file->ra_end = 0;
+	file->ra_window = 0;
+	mutex_unlock(&file->mutex);
+}
+
+int drop_pgcache(void)
+{
+	for_each_lego_pgcache_file(drop_pgcache_file);
+	pr_info("Successfully drop lego pgcache.\n");
+	return 0;
+}
@@ -11,39 +11,21 @@
 #include <lego/slab.h>
 #include <lego/hashtable.h>
 #include <lego/mm.h>
+#include <lego/mutex.h>
 #include <lego/fit_ibapi.h>
 #include <lego/comp_common.h>
 #include <lego/comp_memory.h>
 #include <lego/comp_storage.h>
 #include <memory/vm.h>
 #include <memory/file_ops.h>
+#include <memory/stat.h>
 
 #include <memory/pgcache.h>
 
-ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
+static void pgcache_fill_load_msg(void *msg, char *f_name, loff_t pos, u32 count)
 {
-	u32 len_msg, len_ret, *opcode;
-	void *msg, *retbuf, *content;
-	ssize_t retval, *retval_ptr;
 	struct m2s_read_write_payload *payload;
-	u32 count = 0;
-
-	len_msg = sizeof(*opcode) + sizeof(*payload);
-	msg = kmalloc(len_msg, GFP_KERNEL);
-	if (!msg)
-		return -ENOMEM;
-
-	/* retbuf = retval + content */
-	count = CL_SIZE;
-	len_ret = sizeof(retval) + count;
-	retbuf = kmalloc(len_ret, GFP_KERNEL);
-	if(!retbuf) {
-		kfree(msg);
-		return -ENOMEM;
-	}
-
-	pgcache_debug("pages:%p, offset:%Lx, count:%u, f_name: %s",					\
-				pgc->cached_pages, pgc->pos, count, f_name);
+	u32 *opcode;
 
 	opcode = msg;
 	*opcode = M2S_READ;
@@ -52,15 +34,24 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	payload->uid = 0;		/* legacy, unused */
 	payload->flags = O_RDONLY;
 	payload->len = count;
-	payload->offset = pgc->pos;
+	payload->offset = pos;
 	strcpy(payload->filename, f_name);
+}
+
+/* Copy a M2S_READ reply into @pgc, return the nr of bytes been read */
+static ssize_t pgcache_copy_load_reply(struct lego_pgcache_struct *pgc,
+				       void *retbuf, u32 count)
+{
+	ssize_t retval, *retval_ptr;
+	void *content;
 
-	ibapi_send_reply_imm(pgc->storage_node, msg, len_msg, retbuf, len_ret, false);
 	/* The first 8 bytes are the nr of bytes been read */
 	retval_ptr = retbuf;
 	retval = *retval_ptr;
 
 	BUG_ON(retval > count);
+	if (unlikely(retval < 0))
+		return retval;
 
 	/* The left is the content itself */
 	content = retbuf + sizeof(*retval_ptr);
@@ -70,12 +61,309 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	pgc->real_len = retval;
 	spin_unlock(&pgc->lock);
 
+	return retval;
+}
+
+ssize_t pgcache_load(struct lego_pgcache_struct *pgc)
+{
+	u32 len_msg, len_ret;
+	void *msg, *retbuf;
+	ssize_t retval;
+	u32 count = 0;
+	int ret;
+
+	len_msg = sizeof(u32) + sizeof(struct m2s_read_write_payload);
+	msg = kmalloc(len_msg, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	/* retbuf = retval + content */
+	count = CL_SIZE;
+	len_ret = sizeof(retval) + count;
+	retbuf = kmalloc(len_ret, GFP_KERNEL);
+	if(!retbuf) {
+		kfree(msg);
+		return -ENOMEM;
+	}
+
+	pgcache_debug("pages:%p, offset:%Lx, count:%u, f_name: %s",					\
+				pgc->cached_pages, pgc->pos, count, pgc->file->filepath);
+
+	pgcache_fill_load_msg(msg, pgc->file->filepath, pgc->pos, count);
+	ret = ibapi_send_reply_imm(pgc->storage_node, msg, len_msg, retbuf, len_ret, false);
+	if (likely(ret >= (int)sizeof(retval)))
+		retval = pgcache_copy_load_reply(pgc, retbuf, count);
+	else
+		retval = -EIO;
+	inc_mm_stat(PGCACHE_SYNC_LOAD);
+
 	kfree(msg);
 	kfree(retbuf);
 
 	return retval;
 }
 
+/* Allocate a cacheline and insert it into the index of @file */
+static struct lego_pgcache_struct *
+new_cacheline(struct lego_pgcache_file *file, loff_t pos)
+{
+	struct lego_pgcache_struct *pgc;
+
+	pgc = __alloc_pgcache(file, pos);
+	if (unlikely(!pgc))
+		return NULL;
+
+	if (unlikely(insert_lego_pgcache_struct(pgc))) {
+		__free_pgcache_struct(pgc);
+		return NULL;
+	}
+	return pgc;
+}
+
+/*
+ * Readahead
+ *
+ * Each file remembers the cacheline right after the last one it read.
+ * Reading exactly that line doubles the readahead window of the file,
+ * up to PGCACHE_RA_MAX_WINDOW cachelines. Reading any other line halves
+ * it, so random readers soon stop prefetching.
+ *
+ * Lines within the window are posted to storage asynchronously, and
+ * inserted into the file index at once. The first access of such a line
+ * waits for its reply, if it is still in flight, and copies it in.
+ * Prefetched lines do not join LIRS before they are accessed. They are
+ * kept on pgcache_ra_pending instead, and if too many of them pile up,
+ * the oldest one is given up as waste.
+ *
+ * pgc->ra and the readahead state of a file are protected by file->mutex.
+ * pgcache_ra_lock only protects the pending list.
+ */
+struct pgcache_ra {
+	struct fit_async_req	req;
+	void			*msg;
+	void			*retbuf;
+};
+
+static DEFINE_SPINLOCK(pgcache_ra_lock);
+static LIST_HEAD(pgcache_ra_pending);
+static unsigned int nr_pgcache_ra_pending;
+
+static void free_pgcache_ra(struct pgcache_ra *ra)
+{
+	kfree(ra->msg);
+	kfree(ra->retbuf);
+	kfree(ra);
+}
+
+static int pgcache_load_async(struct lego_pgcache_struct *pgc)
+{
+	struct pgcache_ra *ra;
+	u32 len_msg, len_ret;
+	int ret;
+
+	ra = kmalloc(sizeof(*ra), GFP_KERNEL);
+	if (!ra)
+		return -ENOMEM;
+
+	len_msg = sizeof(u32) + sizeof(struct m2s_read_write_payload);
+	len_ret = sizeof(ssize_t) + CL_SIZE;
+	ra->msg = kmalloc(len_msg, GFP_KERNEL);
+	ra->retbuf = kmalloc(len_ret, GFP_KERNEL);
+	if (!ra->msg || !ra->retbuf) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	pgcache_fill_load_msg(ra->msg, pgc->file->filepath, pgc->pos, CL_SIZE);
+	ret = ibapi_send_reply_async(pgc->storage_node, ra->msg, len_msg,
+				     ra->retbuf, len_ret, false, &ra->req);
+	if (ret)
+		goto out_free;
+
+	pgc->ra = ra;
+	return 0;
+
+out_free:
+	free_pgcache_ra(ra);
+	return ret;
+}
+
+/*
+ * Wait for the readahead reply of @pgc, and fill the cacheline with it.
+ * Return the nr of bytes been read, negative if the reply is bad.
+ */
+static ssize_t pgcache_ra_complete(struct lego_pgcache_struct *pgc)
+{
+	struct pgcache_ra *ra = pgc->ra;
+	ssize_t retval = -EIO;
+	int ret;
+
+	if (!ra)
+		return 0;
+	pgc->ra = NULL;
+
+	/* Only file->mutex is held */
+	ret = ibapi_wait_reply_sleep(&ra->req, 0);
+	if (unlikely(ret == -ETIMEDOUT)) {
+		/* A late reply still lands in retbuf, FIT frees it after that */
+		ret = ibapi_abandon_reply_free(&ra->req, ra->retbuf);
+		if (ret == -ETIMEDOUT)
+			ra->retbuf = NULL;
+	}
+	if (likely(ret >= (int)sizeof(ssize_t)))
+		retval = pgcache_copy_load_reply(pgc, ra->retbuf, CL_SIZE);
+
+	free_pgcache_ra(ra);
+	return retval;
+}
+
+/* Take @pgc off the pending list, return false if it was not there */
+static bool pgcache_ra_detach(struct lego_pgcache_struct *pgc)
+{
+	bool pending = false;
+
+	spin_lock(&pgcache_ra_lock);
+	if (!list_empty(&pgc->ra_list)) {
+		list_del_init(&pgc->ra_list);
+		nr_pgcache_ra_pending--;
+		pending = true;
+	}
+	spin_unlock(&pgcache_ra_lock);
+
+	return pending;
+}
+
+/*
+ * Stop tracking @pgc as prefetched, before it is freed.
+ * Its reply buffer must not be freed under a pending RDMA.
+ * Caller holds pgc->file->mutex.
+ */
+void pgcache_ra_cancel(struct lego_pgcache_struct *pgc)
+{
+	if (!pgcache_ra_detach(pgc))
+		return;
+
+	pgcache_ra_complete(pgc);
+	inc_mm_stat(PGCACHE_RA_WASTE);
+}
+
+/*
+ * Give up the oldest prefetched line that nobody accessed.
+ * Lines of files busy elsewhere are skipped.
+ * Caller holds @cur->mutex.
+ */
+static bool pgcache_ra_reclaim_one(struct lego_pgcache_file *cur)
+{
+	struct lego_pgcache_struct *pgc, *victim = NULL;
+	struct lego_pgcache_file *file;
+
+	spin_lock(&pgcache_ra_lock);
+	list_for_each_entry(pgc, &pgcache_ra_pending, ra_list) {
+		if (pgc->file == cur || mutex_trylock(&pgc->file->mutex)) {
+			victim = pgc;
+			break;
+		}
+	}
+	spin_unlock(&pgcache_ra_lock);
+
+	if (!victim)
+		return false;
+
+	file = victim->file;
+	pgcache_ra_cancel(victim);
+	remove_lego_pgcache_struct(victim);
+	__free_pgcache_struct(victim);
+
+	if (file != cur)
+		mutex_unlock(&file->mutex);
+	return true;
+}
+
+/*
+ * Look up a cacheline, finish its readahead if it is the first access.
+ * A prefetched line that failed to load is dropped, and NULL returned,
+ * so that the caller loads it again.
+ */
+static struct lego_pgcache_struct *
+lookup_cacheline(struct lego_pgcache_file *file, loff_t pos)
+{
+	struct lego_pgcache_struct *pgc;
+
+	pgc = find_lego_pgcache_struct(file, pos);
+	if (pgc && pgcache_ra_detach(pgc)) {
+		if (unlikely(pgcache_ra_complete(pgc) < 0)) {
+			/* Not in LIRS yet, nobody else knows it */
+			free_lego_pgcache_struct(pgc);
+			return NULL;
+		}
+		inc_mm_stat(PGCACHE_RA_HIT);
+	}
+	return pgc;
+}
+
+static void pgcache_ra_one(struct lego_pgcache_file *file, loff_t pos)
+{
+	struct lego_pgcache_struct *pgc;
+
+	if (find_lego_pgcache_struct(file, pos))
+		return;
+
+	if (READ_ONCE(nr_pgcache_ra_pending) >= PGCACHE_RA_MAX_PENDING &&
+	    !pgcache_ra_reclaim_one(file))
+		return;
+
+	pgc = new_cacheline(file, pos);
+	if (unlikely(!pgc))
+		return;
+
+	if (pgcache_load_async(pgc)) {
+		remove_lego_pgcache_struct(pgc);
+		__free_pgcache_struct(pgc);
+		return;
+	}
+
+	spin_lock(&pgcache_ra_lock);
+	list_add_tail(&pgc->ra_list, &pgcache_ra_pending);
+	nr_pgcache_ra_pending++;
+	spin_unlock(&pgcache_ra_lock);
+	inc_mm_stat(PGCACHE_RA_ISSUED);
+}
+
+/*
+ * Update readahead state of @file for a read at @pos,
+ * and prefetch the lines newly covered by its window.
+ */
+static void pgcache_readahead(struct lego_pgcache_file *file, loff_t pos)
+{
+	loff_t cur = aligned_pos(pos);
+	loff_t start, end, f_end;
+
+	/* Still within the same line */
+	if (cur + CL_SIZE == file->ra_next)
+		return;
+
+	if (cur == file->ra_next) {
+		if (file->ra_window < PGCACHE_RA_MAX_WINDOW)
+			file->ra_window = file->ra_window ? file->ra_window * 2 : 1;
+	} else {
+		file->ra_window /= 2;
+		file->ra_end = 0;
+	}
+	file->ra_next = cur + CL_SIZE;
+
+	if (!file->ra_window)
+		return;
+
+	f_end = file_size_read(file);
+	end = min_t(loff_t, cur + (file->ra_window + 1) * CL_SIZE, f_end);
+	start = max(file->ra_next, file->ra_end);
+
+	for (; start < end; start += CL_SIZE)
+		pgcache_ra_one(file, start);
+
+	file->ra_end = max(file->ra_end, start);
+}
+
 ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
 {
 	u32 len_msg, *opcode;
@@ -96,7 +384,7 @@ ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
 	payload->flags = O_WRONLY;
 	payload->len = pgc->real_len;
 	payload->offset = pgc->pos;
-	strcpy(payload->filename, pgc->filepath);
+	strcpy(payload->filename, pgc->file->filepath);
 
 	content = msg + sizeof(*opcode) + sizeof(*payload);
 
@@ -129,7 +417,8 @@ static unsigned int __nr_cachelines(loff_t pos, size_t count)
 }
 
 /* prepare one cacheline
- * return pgc
+ * return pgc, NULL if there is no memory or loading it failed.
+ * A line that failed to load is not kept.
  */
 static struct lego_pgcache_struct *
 prepare_cacheline(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval)
@@ -137,24 +426,34 @@ prepare_cacheline(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval)
 	struct lego_pgcache_struct *pgc;
 	char *f_name = file->filepath;
 
-	pgc = find_lego_pgcache_struct(f_name, pos);
+	pgc = lookup_cacheline(file, pos);
 	if (!pgc) {
-		pgc = __alloc_pgcache(f_name, pos, file->storage_node);
+		pgc = new_cacheline(file, pos);
 		if (unlikely(!pgc))
 			return NULL;
 
 		pgcache_debug("alloc cachedline: %p", pgc->cached_pages);
 
-		*retval = pgcache_load(f_name, pgc);
-		ht_insert_lego_pgcache_struct(pgc);
+		*retval = pgcache_load(pgc);
+		if (unlikely(*retval < 0)) {
+			/* Not in LIRS yet, nobody else knows it */
+			free_lego_pgcache_struct(pgc);
+			return NULL;
+		}
 		return pgc;
 	}
 
 	/* no-residental HIR pages */
 	if (!pgc->cached_pages) {
-		pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,	\
-			PGCACHE_PREFETCH_ORDER);
-		*retval = pgcache_load(f_name, pgc);
+		pgc->cached_pages = alloc_pgcache_pages();
+		if (unlikely(!pgc->cached_pages))
+			return NULL;
+		*retval = pgcache_load(pgc);
+		if (unlikely(*retval < 0)) {
+			/* Back to non-residental, as it was */
+			__free_pgcache_locked(pgc);
+			return NULL;
+		}
 	}
 
 	pgcache_debug("f_name: %s, cacheline:%p", f_name, pgc->cached_pages);
@@ -173,23 +472,23 @@ prepare_cacheline_fast(struct lego_pgcache_file *file, loff_t pos, ssize_t *retv
 	char *f_name = file->filepath;
 
 	printk_once("%s()\n", __func__);
-	pgc = find_lego_pgcache_struct(f_name, pos);
+	pgc = lookup_cacheline(file, pos);
 	if (!pgc) {
-		pgc = __alloc_pgcache(f_name, pos, file->storage_node);
+		pgc = new_cacheline(file, pos);
 		if (unlikely(!pgc))
 			return NULL;
 
 		pgcache_debug("alloc cachedline fast: %p", pgc->cached_pages);
 
 		*retval = CL_SIZE;
-		ht_insert_lego_pgcache_struct(pgc);
 		return pgc;
 	}
 
 	/* no-residental HIR pages */
 	if (!pgc->cached_pages) {
-		pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,	\
-			PGCACHE_PREFETCH_ORDER);
+		pgc->cached_pages = alloc_pgcache_pages();
+		if (unlikely(!pgc->cached_pages))
+			return NULL;
 		*retval = CL_SIZE;
 	}
 
@@ -202,26 +501,22 @@ prepare_cacheline_fast(struct lego_pgcache_file *file, loff_t pos, ssize_t *retv
 static int prepare_two_cachelines(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval,
 		struct lego_pgcache_struct **pgc1, struct lego_pgcache_struct **pgc2)
 {
-	char *f_name = file->filepath;
-
-	*pgc1 = find_lego_pgcache_struct(f_name, pos);
+	*pgc1 = lookup_cacheline(file, pos);
 	if (!(*pgc1)) {
-		*pgc1 = __alloc_pgcache(f_name, pos, file->storage_node);
+		*pgc1 = new_cacheline(file, pos);
 		if (unlikely(!(*pgc1)))
 			return -ENOMEM;
 
-		*retval = pgcache_load(f_name, *pgc1);
-		ht_insert_lego_pgcache_struct(*pgc1);
+		*retval = pgcache_load(*pgc1);
 	}
 
-	*pgc2 = find_lego_pgcache_struct(f_name, pos);
+	*pgc2 = lookup_cacheline(file, pos);
 	if (!(*pgc2)) {
-		*pgc2 = __alloc_pgcache(f_name, pos, file->storage_node);
+		*pgc2 = new_cacheline(file, pos);
 		if (unlikely(!(*pgc2)))
 			return -ENOMEM;
 
-		*retval = pgcache_load(f_name, *pgc2);
-		ht_insert_lego_pgcache_struct(*pgc2);
+		*retval = pgcache_load(*pgc2);
 	}
 
 	return 0;
@@ -237,16 +532,17 @@ ssize_t __read_from_one_cacheline(struct lego_task_struct *tsk,
 	char *f_name = file->filepath;
 
 	pgc = prepare_cacheline(file, *pos, &retval);
+
+	/* NOMEM for caching */
+	if (unlikely(!pgc))
+		return __storage_read(tsk, f_name, buf, count, pos);
+
 	ckoff = chunk_offset(*pos);
 
 	/* read count cannot be satified */
 	if (unlikely(ckoff + count > pgc->real_len))
 		len = pgc->real_len - ckoff;
 
-	/* NOMEM for caching */
-	if (unlikely(!pgc))
-		return __storage_read(tsk, f_name, buf, count, pos);
-
 
 	pgcache_debug("pgcache vaddr: %p, content: [%s]", pgc->cached_pages + ckoff,
 			(char *) pgc->cached_pages + ckoff);
@@ -261,6 +557,7 @@ ssize_t __read_from_one_cacheline(struct lego_task_struct *tsk,
 	memcpy(buf, pgc->cached_pages + ckoff, len);
 
 	update_lirs_structure(pgc);
+	pgcache_readahead(file, *pos);
 
 	return len;
 }
@@ -325,6 +622,28 @@ out:
 	return retval;
 }
 
+static struct lego_pgcache_file *
+get_lego_pgcache_file(char *f_name, unsigned int storage_node)
+{
+	struct lego_pgcache_file *file;
+
+	file = find_lego_pgcache_file(f_name);
+	if (file)
+		return file;
+
+	file = lego_pgcache_file_open(f_name, storage_node);
+	if (unlikely(IS_ERR(file)))
+		return file;
+
+	/* Someone else opened it meanwhile */
+	if (unlikely(ht_insert_lego_pgcache_file(file) == -EEXIST)) {
+		kfree(file);
+		file = find_lego_pgcache_file(f_name);
+		BUG_ON(!file);
+	}
+	return file;
+}
+
 /*
  * lego_pgcache_read: load from storage side, perform pgcache read
  * caller: handle_p2m_read
@@ -340,27 +659,26 @@ ssize_t lego_pgcache_read(struct lego_task_struct *tsk, char *f_name,
 {
 	unsigned int nr_cachelines;
 	struct lego_pgcache_file *file;
+	ssize_t ret;
 
 	nr_cachelines = __nr_cachelines(*pos, count);
 
 	BUG_ON(nr_cachelines > 2);
 
-	file = find_lego_pgcache_file(f_name);
-	if (!file) {
-		file = lego_pgcache_file_open(f_name, storage_node);
-		/* NO memory for allocating file struct and page cache */
-		if (unlikely(IS_ERR(file))) {
-			return -ENOMEM;
-		}
-		ht_insert_lego_pgcache_file(file);
-	}
+	file = get_lego_pgcache_file(f_name, storage_node);
+	/* NO memory for allocating file struct and page cache */
+	if (unlikely(IS_ERR(file)))
+		return -ENOMEM;
 
-	if (likely(nr_cachelines == 1)) {
-		return __read_from_one_cacheline(tsk, file, buf, count, pos);
-	}
+	mutex_lock(&file->mutex);
+	if (likely(nr_cachelines == 1))
+		ret = __read_from_one_cacheline(tsk, file, buf, count, pos);
+	else
+		/* two cachelines case */
+		ret = __read_from_two_cachelines(tsk, file, buf, count, pos);
+	mutex_unlock(&file->mutex);
 
-	/* two cachelines case */
-	return __read_from_two_cachelines(tsk, file, buf, count, pos);
+	return ret;
 }
 
 /* Write operations */
@@ -491,26 +809,67 @@ ssize_t lego_pgcache_write(struct lego_task_struct *tsk, char *f_name,
 {
 	unsigned int nr_cachelines;
 	struct lego_pgcache_file *file;
+	ssize_t ret;
 
 	printk_once("cl_size = %lu\n", CL_SIZE);
 	nr_cachelines = __nr_cachelines(*pos, count);
 
 	BUG_ON(nr_cachelines > 2);
 
-	file = find_lego_pgcache_file(f_name);
-	if (!file) {
-		file = lego_pgcache_file_open(f_name, storage_node);
-		/* NO memory for allocating file struct and page cache */
-		if (unlikely(IS_ERR(file))) {
-			return -ENOMEM;
-		}
-		ht_insert_lego_pgcache_file(file);
-	}
+	file = get_lego_pgcache_file(f_name, storage_node);
+	/* NO memory for allocating file struct and page cache */
+	if (unlikely(IS_ERR(file)))
+		return -ENOMEM;
 
-	if (likely(nr_cachelines == 1)) {
-		return __write_to_one_cacheline(tsk, file, buf, count, pos);
+	mutex_lock(&file->mutex);
+	if (likely(nr_cachelines == 1))
+		ret = __write_to_one_cacheline(tsk, file, buf, count, pos);
+	else
+		/* two cachelines case */
+		ret = __write_to_two_cachelines(tsk, file, buf, count, pos);
+	mutex_unlock(&file->mutex);
+
+	return ret;
+}
+
+/*
+ * lego_pgcache_get_page: get the cached page of a file-backed mmap fault
+ * caller: storage_vma_fault
+ * @f_name: full pathname of targetted file
+ * @storage_node: hosted storage homenode
+ * @pos: page aligned offset within the file
+ *
+ * A miss loads the whole cacheline from storage, later faults on its
+ * neighbours are served from memory. Bytes beyond file end are zero.
+ *
+ * return value: kernel virtual address of the page, with one reference
+ * held for the caller. 0 if there is no memory for caching, or the line
+ * can not be loaded from storage. Caller then reads storage directly.
+ */
+unsigned long lego_pgcache_get_page(char *f_name, unsigned int storage_node,
+				    loff_t pos)
+{
+	struct lego_pgcache_file *file;
+	struct lego_pgcache_struct *pgc;
+	unsigned long page;
+	ssize_t retval;
+
+	file = get_lego_pgcache_file(f_name, storage_node);
+	if (unlikely(IS_ERR(file)))
+		return 0;
+
+	mutex_lock(&file->mutex);
+	pgc = prepare_cacheline(file, pos, &retval);
+	if (unlikely(!pgc)) {
+		mutex_unlock(&file->mutex);
+		return 0;
 	}
 
-	/* two cachelines case */
-	return __write_to_two_cachelines(tsk, file, buf, count, pos);
+	page = (unsigned long)pgc->cached_pages + (chunk_offset(pos) & PAGE_MASK);
+	get_page(virt_to_page(page));
+	update_lirs_structure(pgc);
+	pgcache_readahead(file, pos);
+	mutex_unlock(&file->mutex);
+
+	return page;
 }
@@ -16,7 +16,9 @@ struct memory_manager_stat memory_manager_stats;
 static const char *const memory_manager_stat_text[] = {
 	/* Handler group */
 	"handle_pcache_miss",
+	"handle_pcache_miss_batch",
 	"handle_pcache_flush",
+	"handle_pcache_flush_batch",
 	"handle_pcache_replica",
 	"handle_p2m_mmap",
 	"handle_p2m_munmap",
@@ -29,7 +31,18 @@ static const char *const memory_manager_stat_text[] = {
 	"handle_write",
 
 	/* replication */
-	"nr_batched_log_flush"
+	"nr_batched_log_flush",
+
+	/* thpool */
+	"nr_thpool_buffer_full",
+	"nr_thpool_busy_reply",
+	"nr_thpool_deferred_overflow",
+
+	/* pgcache */
+	"pgcache_sync_load",
+	"pgcache_ra_issued",
+	"pgcache_ra_hit",
+	"pgcache_ra_waste",
 };
 
 #ifdef CONFIG_COUNTER_MEMORY_HANDLER
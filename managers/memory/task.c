@@ -9,7 +9,8 @@
 
 #include <lego/kernel.h>
 #include <lego/slab.h>
-#include <lego/hashtable.h>
+#include <lego/hash.h>
+#include <lego/percpu.h>
 #include <lego/spinlock.h>
 #include <lego/comp_memory.h>
 
@@ -17,37 +18,74 @@
 #include <memory/pid.h>
 #include <memory/task.h>
 
+/*
+ * The (node, pid) -> task table is looked up by every pcache miss
+ * and flush, from all thpool workers concurrently. Each bucket has
+ * its own lock, so lookups of different tasks never contend.
+ */
 #define PID_ARRAY_HASH_BITS	10
+#define PID_ARRAY_HASH_SIZE	(1 << PID_ARRAY_HASH_BITS)
+
+struct task_hash_bucket {
+	spinlock_t		lock;
+	struct hlist_head	head;
+} ____cacheline_aligned;
 
-static DEFINE_HASHTABLE(node_pid_hash, PID_ARRAY_HASH_BITS);
-static DEFINE_SPINLOCK(hashtable_lock);
+static struct task_hash_bucket node_pid_hash[PID_ARRAY_HASH_SIZE];
 
-static int getKey(unsigned int node, unsigned int pid)
+/*
+ * Per-cpu lookaside cache of the last lookup.
+ * A worker normally serves a burst of requests from the same thread.
+ *
+ * Every removal from the table bumps @task_table_gen, which
+ * invalidates all cached entries. A cached entry is only trusted
+ * if the generation has not changed since it was filled.
+ */
+struct task_lookaside {
+	unsigned int		node;
+	unsigned int		pid;
+	unsigned long		gen;
+	struct lego_task_struct	*tsk;
+};
+
+static DEFINE_PER_CPU(struct task_lookaside, task_lookaside);
+static atomic_long_t task_table_gen = ATOMIC_LONG_INIT(1);
+
+static inline struct task_hash_bucket *
+node_pid_to_bucket(unsigned int node, unsigned int pid)
 {
-        return node*10000+pid*10;
+	u64 key = ((u64)node << 32) | pid;
+
+	return &node_pid_hash[hash_64(key, PID_ARRAY_HASH_BITS)];
 }
 
-int __must_check ht_insert_lego_task(struct lego_task_struct *tsk)
+static struct lego_task_struct *
+__find_lego_task(struct task_hash_bucket *b, unsigned int node, unsigned int pid)
 {
 	struct lego_task_struct *p;
-	unsigned int key;
-	unsigned int node, pid;
+
+	hlist_for_each_entry(p, &b->head, link) {
+		if (likely(p->pid == pid && p->node == node))
+			return p;
+	}
+	return NULL;
+}
+
+int __must_check ht_insert_lego_task(struct lego_task_struct *tsk)
+{
+	struct task_hash_bucket *b;
 
 	BUG_ON(!tsk || !tsk->pid);
 
-	pid = tsk->pid;
-	node = tsk->node;
-	key = getKey(node, pid);
+	b = node_pid_to_bucket(tsk->node, tsk->pid);
 
-	spin_lock(&hashtable_lock);
-	hash_for_each_possible(node_pid_hash, p, link, key) {
-		if (unlikely(p->pid == pid && p->node ==node)) {
-			spin_unlock(&hashtable_lock);
-			return -EEXIST;
-		}
+	spin_lock(&b->lock);
+	if (unlikely(__find_lego_task(b, tsk->node, tsk->pid))) {
+		spin_unlock(&b->lock);
+		return -EEXIST;
 	}
-	hash_add(node_pid_hash, &tsk->link, key);
-	spin_unlock(&hashtable_lock);
+	hlist_add_head(&tsk->link, &b->head);
+	spin_unlock(&b->lock);
 
 	return 0;
 }
@@ -75,26 +113,27 @@ void free_lego_task_struct(struct lego_task_struct *tsk)
 
 void free_lego_task(struct lego_task_struct *tsk)
 {
-	unsigned int node, pid, key;
-	struct lego_task_struct *p;
+	struct task_hash_bucket *b;
+	unsigned int node, pid;
 
 	BUG_ON(!tsk);
 	BUG_ON(!hash_hashed(&tsk->link));
 
 	node = tsk->node;
 	pid = tsk->pid;
-	key = getKey(node, pid);
-
-	spin_lock(&hashtable_lock);
-	hash_for_each_possible(node_pid_hash, p, link, key) {
-		if (likely(p->node == node && p->pid == pid)) {
-			hash_del(&p->link);
-			spin_unlock(&hashtable_lock);
-			kfree(tsk);
-			return;
-		}
+	b = node_pid_to_bucket(node, pid);
+
+	spin_lock(&b->lock);
+	if (likely(__find_lego_task(b, node, pid) == tsk)) {
+		hash_del(&tsk->link);
+		spin_unlock(&b->lock);
+
+		/* Invalidate all lookaside entries before it goes away */
+		atomic_long_inc(&task_table_gen);
+		kfree(tsk);
+		return;
 	}
-	spin_unlock(&hashtable_lock);
+	spin_unlock(&b->lock);
 	WARN(1, "fail to find tsk->(node:%u,pid:%u)\n", node, pid);
 }
 
@@ -102,35 +141,63 @@ struct lego_task_struct *
 find_lego_task_by_pid(unsigned int node, unsigned int pid)
 {
 	struct lego_task_struct *tsk;
-	unsigned int key;
+	struct task_hash_bucket *b;
+	struct task_lookaside *la;
+	unsigned long gen;
 
 	if (unlikely(!pid))
 		return NULL;
 
-	key = getKey(node, pid);
-	spin_lock(&hashtable_lock);
-	hash_for_each_possible(node_pid_hash, tsk, link, key) {
-		if (likely(tsk->pid == pid && tsk->node == node)) {
-			spin_unlock(&hashtable_lock);
-			return tsk;
-		}
-        }
-        spin_unlock(&hashtable_lock);
+	gen = atomic_long_read(&task_table_gen);
+	la = &get_cpu_var(task_lookaside);
+	if (likely(la->gen == gen && la->node == node && la->pid == pid)) {
+		tsk = la->tsk;
+		put_cpu_var(task_lookaside);
+		return tsk;
+	}
 
-	return NULL;
+	b = node_pid_to_bucket(node, pid);
+	spin_lock(&b->lock);
+	tsk = __find_lego_task(b, node, pid);
+	spin_unlock(&b->lock);
+
+	if (likely(tsk)) {
+		la->node = node;
+		la->pid = pid;
+		la->gen = gen;
+		la->tsk = tsk;
+	}
+	put_cpu_var(task_lookaside);
+
+	return tsk;
 }
 
 void dump_lego_tasks(void)
 {
+	struct task_hash_bucket *b;
 	struct lego_task_struct *p;
 	int i;
 
-	spin_lock(&hashtable_lock);
 	pr_info("----- Start Dump Tasks\n");
-	hash_for_each(node_pid_hash, i, p, link) {
-		pr_info("  node:%u comm: %s pid: %u vnode_id: %u parent_pid:%u home_node: %u\n",
-			p->node, p->comm, p->pid, p->vnode_id, p->parent_pid, p->home_node);
+	for (i = 0; i < PID_ARRAY_HASH_SIZE; i++) {
+		b = &node_pid_hash[i];
+
+		spin_lock(&b->lock);
+		hlist_for_each_entry(p, &b->head, link) {
+			pr_info("  node:%u comm: %s pid: %u vnode_id: %u parent_pid:%u home_node: %u\n",
+				p->node, p->comm, p->pid, p->vnode_id, p->parent_pid, p->home_node);
+		}
+		spin_unlock(&b->lock);
 	}
 	pr_info("----- Finish Dump Tasks\n");
-	spin_unlock(&hashtable_lock);
+}
+
+void __init lego_task_table_init(void)
+{
+	int i;
+
+	for (i = 0; i < PID_ARRAY_HASH_SIZE; i++) {
+		spin_lock_init(&node_pid_hash[i].lock);
+		INIT_HLIST_HEAD(&node_pid_hash[i].head);
+	}
 }
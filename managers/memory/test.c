@@ -32,10 +32,14 @@
 
 void handle_p2m_test(struct p2m_test_msg *msg, struct thpool_buffer *tb)
 {
+	if (msg->reply_len > THPOOL_TX_INLINE_SIZE)
+		thpool_buffer_tx_large(tb);
 	tb_set_tx_size(tb, msg->reply_len);
 }
 
 void handle_p2m_test_noreply(struct p2m_test_msg *msg, struct thpool_buffer *tb)
 {
+	if (msg->reply_len > THPOOL_TX_INLINE_SIZE)
+		thpool_buffer_tx_large(tb);
 	tb_set_tx_size(tb, msg->reply_len);
 }
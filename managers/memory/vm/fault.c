@@ -66,9 +66,15 @@ static int __do_fault(struct lego_mm_struct *mm, struct vm_area_struct *vma,
 		if (flags & FAULT_FLAG_WRITE)
 			entry = pte_mkwrite(pte_mkdirty(entry));
 		pte_set(page_table, entry);
+		vmf.page = 0;
 	}
 
 	lego_pte_unlock(page_table, ptl);
+
+	/* Lost the race, drop our reference (may be a shared page) */
+	if (unlikely(vmf.page))
+		free_page(vmf.page);
+
 	if (mapping_flags)
 		*mapping_flags = PCACHE_MAPPING_FILE;
 	return 0;
@@ -40,6 +40,9 @@ static int exec_mmap(void)
 	old_mm = current->mm;
 	mm_release(tsk, old_mm);
 
+	/* Wait for any pending pcache activities */
+	pcache_thread_exit(tsk);
+
 	/*
 	 * We should do this before changing mm,
 	 * because pcache_process_exit() needs old_mm to clean up
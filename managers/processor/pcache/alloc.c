@@ -96,22 +96,138 @@ static inline void pcache_free_check(struct pcache_meta *pcm)
 	pcache_free_check_bad(pcm);
 }
 
+/*
+ * Free ways are tracked by pset->free_map. Both sides are lock-free:
+ * free does an atomic set_bit, allocation claims a way with
+ * test_and_clear_bit and retries if it lost the race.
+ */
 static inline void
-__enqueue_free_list_head(struct pcache_meta *pcm, struct pcache_set *pset)
+__enqueue_free_way(struct pcache_meta *pcm, struct pcache_set *pset)
+{
+	set_bit(pcache_meta_to_way(pcm), pset->free_map);
+}
+
+/*
+ * Each CPU starts scanning at a different way, so that concurrent
+ * faults on the same hot set do not all fight for the same bit.
+ */
+static inline struct pcache_meta *
+__dequeue_any_free_way(struct pcache_set *pset)
+{
+	unsigned int way;
+
+	way = smp_processor_id() % PCACHE_ASSOCIATIVITY;
+	for (;;) {
+		way = find_next_bit(pset->free_map, PCACHE_ASSOCIATIVITY, way);
+		if (way >= PCACHE_ASSOCIATIVITY) {
+			way = find_first_bit(pset->free_map, PCACHE_ASSOCIATIVITY);
+			if (way >= PCACHE_ASSOCIATIVITY)
+				return NULL;
+		}
+
+		if (likely(test_and_clear_bit(way, pset->free_map)))
+			break;
+		inc_pcache_event(PCACHE_ALLOC_FREE_RACE);
+	}
+	return pcache_set_way_to_pcache_meta(pset, way);
+}
+
+#if defined(CONFIG_PCACHE_ZEROFILL_POOL) || defined(CONFIG_PCACHE_HUGE_LINE)
+/*
+ * Same as above, but only claim ways among @candidates, which is
+ * a private snapshot of part of free_map. A way that was taken by
+ * others is dropped from the snapshot, so this always terminates.
+ */
+static inline struct pcache_meta *
+__dequeue_way_among(struct pcache_set *pset, unsigned long *candidates)
+{
+	unsigned int way;
+
+	way = smp_processor_id() % PCACHE_ASSOCIATIVITY;
+	for (;;) {
+		way = find_next_bit(candidates, PCACHE_ASSOCIATIVITY, way);
+		if (way >= PCACHE_ASSOCIATIVITY) {
+			way = find_first_bit(candidates, PCACHE_ASSOCIATIVITY);
+			if (way >= PCACHE_ASSOCIATIVITY)
+				return NULL;
+		}
+
+		if (likely(test_and_clear_bit(way, pset->free_map)))
+			break;
+		__clear_bit(way, candidates);
+		inc_pcache_event(PCACHE_ALLOC_FREE_RACE);
+	}
+	return pcache_set_way_to_pcache_meta(pset, way);
+}
+
+/*
+ * Leave pre-zeroed ways to zerofill, and huge line ways to huge lines.
+ * Return false if there is no free way other than those.
+ */
+static inline bool
+__preferred_free_ways(struct pcache_set *pset, unsigned long *candidates)
+{
+	bitmap_copy(candidates, pset->free_map, PCACHE_ASSOCIATIVITY);
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
+	bitmap_andnot(candidates, candidates, pset->zero_map, PCACHE_ASSOCIATIVITY);
+#endif
+#ifdef CONFIG_PCACHE_HUGE_LINE
+	if (pcache_huge_nr_ways)
+		bitmap_clear(candidates, PCACHE_ASSOCIATIVITY - pcache_huge_nr_ways,
+			     pcache_huge_nr_ways);
+#endif
+	return !bitmap_empty(candidates, PCACHE_ASSOCIATIVITY);
+}
+
+/* Take the preferred ways first, unless there is nothing else */
+static inline struct pcache_meta *
+__dequeue_free_way(struct pcache_set *pset)
 {
-	list_add(&pcm->free_list, &pset->free_head);
+	DECLARE_BITMAP(candidates, PCACHE_ASSOCIATIVITY);
+	struct pcache_meta *pcm;
+
+	if (__preferred_free_ways(pset, candidates)) {
+		pcm = __dequeue_way_among(pset, candidates);
+		if (pcm)
+			return pcm;
+	}
+	return __dequeue_any_free_way(pset);
 }
+#else
+static inline struct pcache_meta *
+__dequeue_free_way(struct pcache_set *pset)
+{
+	return __dequeue_any_free_way(pset);
+}
+#endif
 
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
 static inline struct pcache_meta *
-__dequeue_free_list_head(struct pcache_set *pset)
+__dequeue_zeroed_way(struct pcache_set *pset)
 {
-        struct pcache_meta *pcm;
+	DECLARE_BITMAP(candidates, PCACHE_ASSOCIATIVITY);
 
-        pcm = list_first_entry(&pset->free_head, struct pcache_meta, free_list);
-        list_del(&pcm->free_list);
-        return pcm;
+	if (!bitmap_and(candidates, pset->free_map, pset->zero_map,
+			PCACHE_ASSOCIATIVITY))
+		return NULL;
+	return __dequeue_way_among(pset, candidates);
 }
 
+/*
+ * The way is ours now. kzerofilld sets the zero bit before the free bit,
+ * so if the line was zeroed, we must see it here.
+ */
+static inline void
+pcache_claim_zeroed(struct pcache_meta *pcm, struct pcache_set *pset)
+{
+	if (test_and_clear_bit(pcache_meta_to_way(pcm), pset->zero_map))
+		SetPcacheZeroed(pcm);
+}
+#else
+static inline void
+pcache_claim_zeroed(struct pcache_meta *pcm, struct pcache_set *pset) { }
+#endif
+
 /*
  * This is the ultimate free function.
  * At the time of calling, @pcm has been removed from LRU list.
@@ -122,6 +238,8 @@ void __put_pcache_nolru(struct pcache_meta *pcm)
 	struct pcache_set *pset;
 
 	pcache_free_check(pcm);
+	pcache_twin_free(pcm);
+	pcache_clock_free(pcm);
 	dec_pcache_used();
 
 	/*
@@ -132,9 +250,7 @@ void __put_pcache_nolru(struct pcache_meta *pcm)
 		return;
 
 	pset = pcache_meta_to_pcache_set(pcm);
-	spin_lock(&pset->free_lock);
-	__enqueue_free_list_head(pcm, pset);
-	spin_unlock(&pset->free_lock);
+	__enqueue_free_way(pcm, pset);
 }
 
 /*
@@ -165,6 +281,30 @@ static inline void prep_new_pcache_meta(struct pcache_meta *pcm)
 	init_pcache_ref_count(pcm);
 }
 
+static inline void prep_new_pcache(struct pcache_meta *pcm,
+				   struct pcache_set *pset)
+{
+	prep_new_pcache_meta(pcm);
+	add_to_lru_list(pcm, pset);
+	inc_pcache_used();
+}
+
+/* Grab a line from @pset free list, return NULL if it is empty */
+static inline struct pcache_meta *
+pcache_alloc_freelist(struct pcache_set *pset)
+{
+	struct pcache_meta *pcm;
+
+	pcm = __dequeue_free_way(pset);
+	if (!pcm)
+		return NULL;
+
+	pcache_reset_flags(pcm);
+	pcache_claim_zeroed(pcm, pset);
+	prep_new_pcache(pcm, pset);
+	return pcm;
+}
+
 static inline struct pcache_meta *
 pcache_alloc_fastpath(struct pcache_set *pset)
 {
@@ -175,24 +315,91 @@ pcache_alloc_fastpath(struct pcache_set *pset)
 		/* Also clear the Cached flag */
 		pcache_reset_flags(pcm);
 		SetPcachePiggyback(pcm);
-		goto prep;
+		prep_new_pcache(pcm, pset);
+		return pcm;
 	}
 
-	spin_lock(&pset->free_lock);
-	if (list_empty(&pset->free_head)) {
-		spin_unlock(&pset->free_lock);
+	return pcache_alloc_freelist(pset);
+}
+
+/**
+ * pcache_alloc_noevict
+ * @address: user virtual address
+ *
+ * Allocate a free line from the pset @address maps to, without
+ * falling back to eviction or taking the per-cpu piggyback line.
+ * Used by speculative fills (e.g. prefetch), which should only
+ * use free slots and never push out demand-fetched lines.
+ *
+ * Return NULL if the set is full.
+ */
+struct pcache_meta *pcache_alloc_noevict(unsigned long address)
+{
+	struct pcache_set *pset;
+	struct pcache_meta *pcm;
+
+	pset = user_vaddr_to_pcache_set(address);
+	pcm = pcache_alloc_freelist(pset);
+	if (pcm)
+		inc_pset_event(pset, PSET_ALLOC);
+	return pcm;
+}
+
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
+/**
+ * pcache_alloc_zeroed
+ * @address: user virtual address
+ *
+ * Allocate a pre-zeroed free line from the pset @address maps to.
+ * The returned line has PC_zeroed set. Like pcache_alloc_noevict(),
+ * this never evicts.
+ *
+ * Return NULL if the set has no pre-zeroed line.
+ */
+struct pcache_meta *pcache_alloc_zeroed(unsigned long address)
+{
+	struct pcache_set *pset;
+	struct pcache_meta *pcm;
+
+	pset = user_vaddr_to_pcache_set(address);
+	pcm = __dequeue_zeroed_way(pset);
+	if (!pcm)
 		return NULL;
-	}
-	pcm = __dequeue_free_list_head(pset);
-	spin_unlock(&pset->free_lock);
 
 	pcache_reset_flags(pcm);
-prep:
-	prep_new_pcache_meta(pcm);
-	add_to_lru_list(pcm, pset);
-	inc_pcache_used();
+	pcache_claim_zeroed(pcm, pset);
+	prep_new_pcache(pcm, pset);
+	inc_pset_event(pset, PSET_ALLOC);
+	return pcm;
+}
+#endif
+
+#ifdef CONFIG_PCACHE_HUGE_LINE
+/**
+ * pcache_alloc_way
+ * @pset: the pcache set
+ * @way: the way within @pset
+ *
+ * Allocate exactly @way of @pset if it is free. Used to build huge lines,
+ * which need the same way across consecutive sets. Never evicts.
+ *
+ * Return NULL if @way is in use.
+ */
+struct pcache_meta *pcache_alloc_way(struct pcache_set *pset, unsigned int way)
+{
+	struct pcache_meta *pcm;
+
+	if (!test_and_clear_bit(way, pset->free_map))
+		return NULL;
+
+	pcm = pcache_set_way_to_pcache_meta(pset, way);
+	pcache_reset_flags(pcm);
+	pcache_claim_zeroed(pcm, pset);
+	prep_new_pcache(pcm, pset);
+	inc_pset_event(pset, PSET_ALLOC);
 	return pcm;
 }
+#endif
 
 DEFINE_PROFILE_POINT(pcache_alloc)
 DEFINE_PROFILE_POINT(pcache_alloc_evict)
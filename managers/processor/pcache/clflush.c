@@ -43,15 +43,18 @@ DEFINE_PROFILE_POINT(pcache_flush_net)
  *
  * Replication is done the at the end, if configured.
  *
- * TODO:
- * Instead of having a per-cpu message array and doing a memcpy,
- * we should use IB sg list to send both metadate and in-place cache data out.
+ * The cache line is sent in place, as the second piece of an IB sg list,
+ * right after the message header. No memcpy into the message.
+ *
+ * Return 0 on success, -EIO if the network failed,
+ * otherwise the error replied by memory.
  */
-void __clflush_one(pid_t tgid, unsigned long user_va,
-		   unsigned int m_nid, unsigned int rep_nid, void *cache_addr)
+int __clflush_one(pid_t tgid, unsigned long user_va,
+		  unsigned int m_nid, unsigned int rep_nid, void *cache_addr)
 {
-	int reply, cpu;
+	int reply, cpu, ret;
 	struct p2m_flush_msg *msg;
+	struct fit_sglist iov[2];
 	PROFILE_POINT_TIME(pcache_flush_net)
 
 	/*
@@ -66,17 +69,23 @@ void __clflush_one(pid_t tgid, unsigned long user_va,
 	fill_common_header(msg, P2M_PCACHE_FLUSH);
 	msg->pid = tgid;
 	msg->user_va = user_va & PCACHE_LINE_MASK;
-	memcpy(msg->pcacheline, cache_addr, PCACHE_LINE_SIZE);
 	barrier();
 
+	iov[0].addr = msg;
+	iov[0].len = offsetof(struct p2m_flush_msg, pcacheline);
+	iov[1].addr = cache_addr;
+	iov[1].len = PCACHE_LINE_SIZE;
+
 	clflush_debug("I m_nid:%d tgid:%u user_va:%#lx cache_kva:%p",
 		m_nid, msg->pid, msg->user_va, cache_addr);
 
 	/* Network */
 	PROFILE_START(pcache_flush_net);
-	ibapi_send_reply_timeout(m_nid, msg, sizeof(*msg),
-				 &reply, sizeof(reply), false, DEF_NET_TIMEOUT);
+	ret = ibapi_send_reply_iov(m_nid, iov, ARRAY_SIZE(iov),
+				   &reply, sizeof(reply), false, DEF_NET_TIMEOUT);
 	PROFILE_LEAVE(pcache_flush_net);
+	if (unlikely(ret != sizeof(reply)))
+		reply = -EIO;
 	clflush_debug("O tgid:%u user_va:%#lx cache_kva:%p reply:%d %s",
 		msg->pid, msg->user_va, cache_addr, reply, perror(reply));
 
@@ -91,6 +100,7 @@ void __clflush_one(pid_t tgid, unsigned long user_va,
 	replicate(tgid, user_va, m_nid, rep_nid, cache_addr);
 
 	put_cpu();
+	return reply;
 }
 
 /*
@@ -112,15 +122,279 @@ void clflush_one(struct task_struct *tsk, unsigned long user_va, void *cache_add
 	__clflush_one(tsk->tgid, user_va, m_nid, rep_nid, cache_addr);
 }
 
+/**
+ * pcache_dirty_to_iov
+ * @line: the line content
+ * @dirty: its dirty chunks, may be set to all by us
+ * @nr_chunks: number of bits set in @dirty, updated with @dirty
+ * @iov: where to describe the chunks
+ * @room: max pieces in @iov, at least 1
+ *
+ * Describe the dirty chunks of @line in @iov, one piece for each run of
+ * contiguous chunks, in order. If that needs more than @room pieces, the
+ * whole line is described instead, which is always correct.
+ *
+ * Return the number of pieces used.
+ */
+int pcache_dirty_to_iov(void *line, unsigned long *dirty, int *nr_chunks,
+			struct fit_sglist *iov, int room)
+{
+	int start, end, nr = 0;
+
+	if (*nr_chunks == PCACHE_LINE_NR_CHUNKS)
+		goto whole;
+
+	start = find_first_bit(dirty, PCACHE_LINE_NR_CHUNKS);
+	while (start < PCACHE_LINE_NR_CHUNKS) {
+		if (nr == room)
+			goto whole;
+
+		end = find_next_zero_bit(dirty, PCACHE_LINE_NR_CHUNKS, start);
+		iov[nr].addr = line + start * PCACHE_CHUNK_SIZE;
+		iov[nr].len = (end - start) * PCACHE_CHUNK_SIZE;
+		nr++;
+
+		start = find_next_bit(dirty, PCACHE_LINE_NR_CHUNKS, end);
+	}
+	return nr;
+
+whole:
+	bitmap_fill(dirty, PCACHE_LINE_NR_CHUNKS);
+	*nr_chunks = PCACHE_LINE_NR_CHUNKS;
+	iov[0].addr = line;
+	iov[0].len = PCACHE_LINE_SIZE;
+	return 1;
+}
+
+/*
+ * clflush_range() keeps this many P2M_PCACHE_FLUSH_BATCH
+ * in flight, each carrying up to PCACHE_FLUSH_BATCH_MAX lines.
+ */
+#define CLFLUSH_RANGE_NR_INFLIGHT	(8)
+
+struct clflush_range_batch {
+	struct fit_async_req	req;
+	unsigned long		user_va;
+	void			*cache_addr;
+	unsigned int		m_nid;
+	int			nr;
+	int			reply;
+	char			msg[P2M_FLUSH_BATCH_MSG_SIZE(0)] __aligned(8);
+};
+
+/* The lines are contiguous, one piece after the header carries them all */
+static int clflush_range_post(struct task_struct *tsk, struct clflush_range_batch *b)
+{
+	struct p2m_flush_batch_msg *msg = (void *)b->msg;
+	struct fit_sglist iov[2];
+	int i;
+
+	fill_common_header(msg, P2M_PCACHE_FLUSH_BATCH);
+	msg->nr_lines = b->nr;
+	for (i = 0; i < b->nr; i++) {
+		msg->lines[i].pid = tsk->tgid;
+		msg->lines[i].user_va = b->user_va + i * PCACHE_LINE_SIZE;
+		bitmap_fill(msg->lines[i].dirty, PCACHE_LINE_NR_CHUNKS);
+	}
+
+	iov[0].addr = msg;
+	iov[0].len = P2M_FLUSH_BATCH_MSG_SIZE(0);
+	iov[1].addr = b->cache_addr;
+	iov[1].len = b->nr * PCACHE_LINE_SIZE;
+
+	return ibapi_send_reply_iov_async(b->m_nid, iov, ARRAY_SIZE(iov), &b->reply,
+					  sizeof(b->reply), false, &b->req);
+}
+
+/* Flush lines of @b one by one, used if the batch can not make it */
+static void clflush_range_slow(struct task_struct *tsk, struct clflush_range_batch *b)
+{
+	int i;
+
+	for (i = 0; i < b->nr; i++)
+		clflush_one(tsk, b->user_va + i * PCACHE_LINE_SIZE,
+			    b->cache_addr + i * PCACHE_LINE_SIZE);
+}
+
+static void clflush_range_complete(struct task_struct *tsk,
+				   struct clflush_range_batch *b, int ret)
+{
+	unsigned long user_va;
+	int i;
+
+	/* @b goes away once we return */
+	if (unlikely(ret == -ETIMEDOUT))
+		ret = ibapi_abandon_reply(&b->req);
+
+	if (unlikely(ret != sizeof(b->reply) || b->reply)) {
+		inc_pcache_event(PCACHE_CLFLUSH_FAIL);
+		clflush_range_slow(tsk, b);
+		return;
+	}
+
+	add_pcache_event(PCACHE_CLFLUSH, b->nr);
+	for (i = 0; i < b->nr; i++) {
+		user_va = b->user_va + i * PCACHE_LINE_SIZE;
+		replicate(tsk->tgid, user_va, b->m_nid,
+			  get_replica_node_by_addr(tsk, user_va),
+			  b->cache_addr + i * PCACHE_LINE_SIZE);
+	}
+}
+
+/**
+ * clflush_range
+ * @tsk: the task these lines belong to, must stay alive
+ * @user_va: user virtual address of the first line
+ * @cache_addr: kernel virtual address of the first line
+ * @nr_lines: number of lines
+ *
+ * Flush lines that are contiguous both in user space and in pcache,
+ * e.g. a huge line. They are sent in place with P2M_PCACHE_FLUSH_BATCH,
+ * up to CLFLUSH_RANGE_NR_INFLIGHT messages at a time. A batch that
+ * fails is flushed again line by line. Return once all lines are written.
+ */
+void clflush_range(struct task_struct *tsk, unsigned long user_va,
+		   void *cache_addr, unsigned int nr_lines)
+{
+	struct clflush_range_batch *batches, *b;
+	unsigned int head = 0, tail = 0;
+	int ret;
+
+	batches = kmalloc(sizeof(*batches) * CLFLUSH_RANGE_NR_INFLIGHT, GFP_KERNEL);
+
+	while (nr_lines || head != tail) {
+		while (nr_lines && tail - head < CLFLUSH_RANGE_NR_INFLIGHT) {
+			struct clflush_range_batch slow;
+
+			b = batches ? &batches[tail % CLFLUSH_RANGE_NR_INFLIGHT] : &slow;
+			b->user_va = user_va;
+			b->cache_addr = cache_addr;
+			b->m_nid = get_memory_node(tsk, user_va);
+
+			/* One message only goes to one memory node */
+			b->nr = 1;
+			while (b->nr < min_t(unsigned int, nr_lines, PCACHE_FLUSH_BATCH_MAX) &&
+			       get_memory_node(tsk, user_va + b->nr * PCACHE_LINE_SIZE) == b->m_nid)
+				b->nr++;
+
+			ret = batches ? clflush_range_post(tsk, b) : -ENOMEM;
+			if (ret == -EBUSY && head != tail)
+				break;
+			if (unlikely(ret))
+				clflush_range_slow(tsk, b);
+			else
+				tail++;
+
+			user_va += b->nr * PCACHE_LINE_SIZE;
+			cache_addr += b->nr * PCACHE_LINE_SIZE;
+			nr_lines -= b->nr;
+		}
+
+		if (head == tail)
+			continue;
+
+		/* Retire in order, the oldest is likely to finish first */
+		b = &batches[head % CLFLUSH_RANGE_NR_INFLIGHT];
+		ret = ibapi_wait_reply(&b->req, DEF_NET_TIMEOUT);
+		clflush_range_complete(tsk, b, ret);
+		head++;
+	}
+	kfree(batches);
+}
+
+#ifdef CONFIG_PCACHE_DELTA_FLUSH
+static void *clflush_delta_msg_array;
+
+#define CLFLUSH_DELTA_MSG_SIZE	P2M_FLUSH_BATCH_MSG_SIZE(0)
+
+/*
+ * Same as __clflush_one(), but only send the chunks set in @dirty.
+ * It uses a single-line P2M_PCACHE_FLUSH_BATCH. The chunks are sent
+ * in place from the line, only the header lives in the message.
+ */
+static void __clflush_delta(pid_t tgid, unsigned long user_va,
+			    unsigned int m_nid, unsigned int rep_nid,
+			    void *cache_addr, unsigned long *dirty, int nr_chunks)
+{
+	int reply, cpu, ret, nr_iov;
+	struct p2m_flush_batch_msg *msg;
+	struct fit_sglist iov[FIT_MAX_IOV];
+	PROFILE_POINT_TIME(pcache_flush_net)
+
+	cpu = get_cpu();
+	msg = clflush_delta_msg_array + cpu * CLFLUSH_DELTA_MSG_SIZE;
+
+	iov[0].addr = msg;
+	iov[0].len = CLFLUSH_DELTA_MSG_SIZE;
+	nr_iov = 1 + pcache_dirty_to_iov(cache_addr, dirty, &nr_chunks,
+					 &iov[1], FIT_MAX_IOV - 1);
+
+	fill_common_header(msg, P2M_PCACHE_FLUSH_BATCH);
+	msg->nr_lines = 1;
+	msg->lines[0].pid = tgid;
+	msg->lines[0].user_va = user_va & PCACHE_LINE_MASK;
+	bitmap_copy(msg->lines[0].dirty, dirty, PCACHE_LINE_NR_CHUNKS);
+	barrier();
+
+	PROFILE_START(pcache_flush_net);
+	ret = ibapi_send_reply_iov(m_nid, iov, nr_iov, &reply, sizeof(reply),
+				   false, DEF_NET_TIMEOUT);
+	PROFILE_LEAVE(pcache_flush_net);
+	if (unlikely(ret != sizeof(reply)))
+		reply = -EIO;
+
+	clflush_debug("O tgid:%u user_va:%#lx nr_chunks:%d reply:%d",
+		tgid, user_va, nr_chunks, reply);
+
+	inc_pcache_event(PCACHE_CLFLUSH);
+	inc_pcache_event_cond(PCACHE_CLFLUSH_FAIL, !!reply);
+	add_pcache_event(PCACHE_DELTA_CHUNKS, nr_chunks);
+
+	replicate(tgid, user_va, m_nid, rep_nid, cache_addr);
+
+	put_cpu();
+}
+
+static void __init init_pcache_clflush_delta_buffer(void)
+{
+	clflush_delta_msg_array = kmalloc(CLFLUSH_DELTA_MSG_SIZE * nr_cpus, GFP_KERNEL);
+	if (!clflush_delta_msg_array)
+		panic("Unable to allocate clflush delta message array");
+}
+#else
+static inline void
+__clflush_delta(pid_t tgid, unsigned long user_va,
+		unsigned int m_nid, unsigned int rep_nid,
+		void *cache_addr, unsigned long *dirty, int nr_chunks)
+{
+	BUG();
+}
+static inline void init_pcache_clflush_delta_buffer(void) { }
+#endif
+
+struct pcache_flush_info {
+	int		nr_flushed;
+	int		nr_chunks;
+	DECLARE_BITMAP(dirty, PCACHE_LINE_NR_CHUNKS);
+};
+
 static int __pcache_flush_one(struct pcache_meta *pcm,
 			      struct pcache_rmap *rmap, void *arg)
 {
-	int *nr_flushed = arg;
+	struct pcache_flush_info *info = arg;
+	struct task_struct *tsk = rmap->owner_process;
+	unsigned long user_va = rmap->address;
 
-	clflush_one(rmap->owner_process, rmap->address,
-		    pcache_meta_to_kva(pcm));
+	if (likely(info->nr_chunks == PCACHE_LINE_NR_CHUNKS))
+		clflush_one(tsk, user_va, pcache_meta_to_kva(pcm));
+	else
+		__clflush_delta(tsk->tgid, user_va,
+				get_memory_node(tsk, user_va),
+				get_replica_node_by_addr(tsk, user_va),
+				pcache_meta_to_kva(pcm),
+				info->dirty, info->nr_chunks);
 
-	(*nr_flushed)++;
+	info->nr_flushed++;
 	return PCACHE_RMAP_AGAIN;
 }
 
@@ -135,9 +409,11 @@ static int __pcache_flush_one(struct pcache_meta *pcm,
  */
 int pcache_flush_one(struct pcache_meta *pcm)
 {
-	int nr_flushed = 0;
+	struct pcache_flush_info info = {
+		.nr_flushed = 0,
+	};
 	struct rmap_walk_control rwc = {
-		.arg = &nr_flushed,
+		.arg = &info,
 		.rmap_one = __pcache_flush_one,
 	};
 
@@ -154,6 +430,7 @@ int pcache_flush_one(struct pcache_meta *pcm)
 	PCACHE_BUG_ON_PCM(!PcacheReclaim(pcm), pcm);
 
 	SetPcacheWriteback(pcm);
+	info.nr_chunks = pcache_delta_dirty_map(pcm, info.dirty);
 	rmap_walk(pcm, &rwc);
 	ClearPcacheWriteback(pcm);
 
@@ -168,4 +445,6 @@ void __init init_pcache_clflush_buffer(void)
 
 	pr_info("%s(): clflush array at %p, nr_entries: %d\n",
 		__func__, clflush_msg_array, nr_cpus);
+
+	init_pcache_clflush_delta_buffer();
 }
@@ -23,7 +23,12 @@
 	{1UL << PC_reclaim,		"reclaim"	},	\
 	{1UL << PC_writeback,		"writeback"	},	\
 	{1UL << PC_piggyback,		"piggyback"	},	\
-	{1UL << PC_piggyback,		"piggybackC"	}
+	{1UL << PC_piggyback_cached,	"piggybackC"	},	\
+	{1UL << PC_twinable,		"twinable"	},	\
+	{1UL << PC_hot,			"hot"		},	\
+	{1UL << PC_test,		"test"		},	\
+	{1UL << PC_zeroed,		"zeroed"	},	\
+	{1UL << PC_huge,		"huge"		}
 
 const struct trace_print_flags pcacheflag_names[] = {
 	__def_pcacheflag_names,
@@ -54,6 +59,9 @@ static const char *RMAP_CALLER_NAME[] = {
 	"cow",
 	"fork",
 	"mremap_slowpath",
+	"prefetch",
+	"huge_fill",
+	"huge_split",
 };
 
 /**
@@ -66,11 +74,21 @@ void dump_pcache_rmap(struct pcache_rmap *rmap, const char *reason)
 {
 	pte_t *ptep = rmap->page_table;
 
+	if (RmapHuge(rmap)) {
+		pr_debug("rmap:%p flags:%#lx owner-tgid:%u user_va:%#lx pmd:%p (%#lx) caller: %s\n",
+			rmap, rmap->flags, rmap->owner_process->pid, rmap->address,
+			rmap->pmd, (unsigned long)pmd_val(*rmap->pmd),
+			RMAP_CALLER_NAME[rmap->caller]);
+		goto out;
+	}
+
 	pr_debug("rmap:%p flags:%#lx owner-tgid:%u user_va:%#lx ptep:%p caller: %s\n",
 		rmap, rmap->flags, rmap->owner_process->pid, rmap->address, ptep,
 		RMAP_CALLER_NAME[rmap->caller]);
 	dump_pte(ptep, NULL);
 
+out:
+
 	if (reason)
 		pr_debug("pcache_rmap dumped because: %s\n", reason);
 }
@@ -103,25 +121,26 @@ static DEFINE_SPINLOCK(dump_pset_lock);
 void dump_pset(struct pcache_set *pset)
 {
 	struct pcache_meta *pcm;
+	unsigned int way;
 
 	spin_lock(&dump_pset_lock);
 
 	pr_debug("pset:%p set_idx: %lu nr_lru:%d\n",
 		pset, pcache_set_to_set_index(pset),
-		IS_ENABLED(CONFIG_PCACHE_EVICT_LRU) ? atomic_read(&pset->nr_lru) : 0);
+		pset_nr_lru(pset));
 
 	pcm = this_cpu_read(piggybacker);
 	if (pcm)
 		dump_pcache_meta(pcm, "This is piggybacker");
 
 	pr_info("Free List\n");
-	spin_lock(&pset->free_lock);
-	list_for_each_entry(pcm, &pset->free_head, free_list) {
+	for_each_set_bit(way, pset->free_map, PCACHE_ASSOCIATIVITY) {
+		pcm = pcache_set_way_to_pcache_meta(pset, way);
 		dump_pcache_meta(pcm, NULL);
 		dump_pcache_rmaps(pcm);
 	}
-	spin_unlock(&pset->free_lock);
 
+#ifdef CONFIG_PCACHE_EVICT_LRU
 	pr_info("LRU List\n");
 	spin_lock(&pset->lru_lock);
 	list_for_each_entry(pcm, &pset->lru_list, lru) {
@@ -129,6 +148,7 @@ void dump_pset(struct pcache_set *pset)
 		dump_pcache_rmaps(pcm);
 	}
 	spin_unlock(&pset->lru_lock);
+#endif
 	spin_unlock(&dump_pset_lock);
 }
 
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Sub-line dirty tracking (twin/diff)
+ *
+ * A twin is a clean copy of a pcache line, taken at a point where the line
+ * content is known to be the same as memory: right after fill for write
+ * faults, or at the first write for lines filled by read faults. At flush
+ * time the line is compared with its twin in PCACHE_CHUNK_SIZE chunks, and
+ * only dirty chunks are sent to memory.
+ *
+ * Twins come from a fixed pool. If it runs out, the line simply does not
+ * have a twin and is flushed in full, which is always correct.
+ */
+
+#include <lego/mm.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/spinlock.h>
+#include <lego/memblock.h>
+#include <processor/pcache.h>
+
+/* Indexed by pcm index, same trick as pcache_rmap_map */
+static void **pcache_twin_map;
+
+/* Free twins, used as a stack */
+static void **twin_free_stack;
+static unsigned long nr_free_twins;
+static DEFINE_SPINLOCK(twin_lock);
+
+static inline void **pcm_to_twin_slot(struct pcache_meta *pcm)
+{
+	return &pcache_twin_map[__pcache_meta_index(pcm)];
+}
+
+void *pcache_twin(struct pcache_meta *pcm)
+{
+	return *pcm_to_twin_slot(pcm);
+}
+
+/*
+ * Snapshot current content of @pcm as its twin.
+ * Caller must make sure the content equals memory.
+ */
+void pcache_twin_alloc(struct pcache_meta *pcm)
+{
+	void **slot = pcm_to_twin_slot(pcm);
+	void *twin = NULL;
+
+	if (unlikely(*slot))
+		return;
+
+	spin_lock(&twin_lock);
+	if (likely(nr_free_twins))
+		twin = twin_free_stack[--nr_free_twins];
+	spin_unlock(&twin_lock);
+
+	if (unlikely(!twin)) {
+		inc_pcache_event(PCACHE_DELTA_TWIN_FAIL);
+		return;
+	}
+
+	memcpy(twin, pcache_meta_to_kva(pcm), PCACHE_LINE_SIZE);
+	*slot = twin;
+	inc_pcache_event(PCACHE_DELTA_TWIN_ALLOC);
+}
+
+/* Called when @pcm is freed */
+void pcache_twin_free(struct pcache_meta *pcm)
+{
+	void **slot = pcm_to_twin_slot(pcm);
+	void *twin = *slot;
+
+	ClearPcacheTwinable(pcm);
+	if (!twin)
+		return;
+	*slot = NULL;
+
+	spin_lock(&twin_lock);
+	twin_free_stack[nr_free_twins++] = twin;
+	spin_unlock(&twin_lock);
+}
+
+/* Return true if @pcm has a twin and nothing changed since */
+bool pcache_twin_unchanged(struct pcache_meta *pcm)
+{
+	void *twin = pcache_twin(pcm);
+
+	if (!twin)
+		return false;
+	return !memcmp(twin, pcache_meta_to_kva(pcm), PCACHE_LINE_SIZE);
+}
+
+/**
+ * pcache_delta_dirty_map
+ * @pcm: the line to flush
+ * @dirty: bitmap of PCACHE_LINE_NR_CHUNKS bits
+ *
+ * Set a bit in @dirty for each chunk that differs from the twin.
+ * If @pcm has no twin, all chunks are dirty.
+ * Return the number of dirty chunks.
+ */
+int pcache_delta_dirty_map(struct pcache_meta *pcm, unsigned long *dirty)
+{
+	void *twin = pcache_twin(pcm);
+	void *data = pcache_meta_to_kva(pcm);
+	int i, nr = 0;
+
+	if (!twin) {
+		bitmap_fill(dirty, PCACHE_LINE_NR_CHUNKS);
+		return PCACHE_LINE_NR_CHUNKS;
+	}
+
+	bitmap_zero(dirty, PCACHE_LINE_NR_CHUNKS);
+	for (i = 0; i < PCACHE_LINE_NR_CHUNKS; i++) {
+		unsigned long offset = i * PCACHE_CHUNK_SIZE;
+
+		if (memcmp(data + offset, twin + offset, PCACHE_CHUNK_SIZE)) {
+			__set_bit(i, dirty);
+			nr++;
+		}
+	}
+	return nr;
+}
+
+void __init alloc_pcache_twin_map(void)
+{
+	unsigned long i;
+	void *twins;
+
+	pcache_twin_map = memblock_virt_alloc(sizeof(void *) * nr_cachelines,
+					      PAGE_SIZE);
+	twin_free_stack = memblock_virt_alloc(sizeof(void *) * PCACHE_DELTA_NR_TWINS,
+					      PAGE_SIZE);
+	twins = memblock_virt_alloc(PCACHE_LINE_SIZE * PCACHE_DELTA_NR_TWINS,
+				    PAGE_SIZE);
+	if (!pcache_twin_map || !twin_free_stack || !twins)
+		panic("Unable to allocate pcache twins!");
+
+	for (i = 0; i < PCACHE_DELTA_NR_TWINS; i++)
+		twin_free_stack[i] = twins + i * PCACHE_LINE_SIZE;
+	nr_free_twins = PCACHE_DELTA_NR_TWINS;
+
+	pr_info("%s(): nr_twins: %lu, total reserved: %lu B, at %p\n",
+		__func__, PCACHE_DELTA_NR_TWINS,
+		PCACHE_LINE_SIZE * PCACHE_DELTA_NR_TWINS, twins);
+}
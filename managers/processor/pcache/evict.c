@@ -37,6 +37,8 @@ evict_find_line(struct pcache_set *pset)
 	return evict_find_line_fifo(pset);
 #elif defined(CONFIG_PCACHE_EVICT_LRU)
 	return evict_find_line_lru(pset);
+#elif defined(CONFIG_PCACHE_EVICT_CLOCK)
+	return evict_find_line_clock(pset);
 #endif
 }
 
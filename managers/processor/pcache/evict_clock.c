@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * CLOCK eviction algorithm
+ *
+ * Each pcache set has a clock hand that walks over its ways. The hand
+ * uses the PTE accessed bits (through pcache_referenced_trylock()) as the
+ * reference bit: a referenced line has its accessed bits cleared and gets
+ * a second chance, an unreferenced line is selected. Nothing is done on
+ * the fill path, so there is no list to maintain and no lock to take
+ * for every new line.
+ *
+ * With CONFIG_PCACHE_EVICT_CLOCK_PRO, lines are further split into hot
+ * and cold. New lines start cold. A cold line referenced during two
+ * consecutive hand passes (its test period) is promoted to hot. The hand
+ * only evicts cold lines, and demotes unreferenced hot lines to cold.
+ * Thus a one-time scan can only push out cold lines, while the working
+ * set stays hot. This is CLOCK-Pro without the non-resident entries,
+ * and with a fixed cap on the number of hot lines per set.
+ */
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/bitmap.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+/* Hand passes needed to demote, test, and evict a hot line */
+#define CLOCK_MAX_SCAN		(PCACHE_ASSOCIATIVITY * 3)
+
+/* Always leave at least a quarter of the set cold */
+#define CLOCK_PRO_MAX_HOT	(PCACHE_ASSOCIATIVITY - PCACHE_ASSOCIATIVITY / 4)
+#else
+#define CLOCK_MAX_SCAN		(PCACHE_ASSOCIATIVITY * 2)
+#endif
+
+static inline struct pcache_meta *clock_advance_hand(struct pcache_set *pset)
+{
+	unsigned int way;
+
+	way = (unsigned int)atomic_inc_return(&pset->clock_hand);
+	way %= PCACHE_ASSOCIATIVITY;
+	return pcache_set_way_to_pcache_meta(pset, way);
+}
+
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+/*
+ * Age @pcm by one hand pass, return true if it should be evicted.
+ * @pcm is locked by caller, hot/test bits are only changed here.
+ */
+static bool clock_age_line(struct pcache_set *pset, struct pcache_meta *pcm,
+			   int referenced)
+{
+	if (PcacheHot(pcm)) {
+		if (!referenced) {
+			ClearPcacheHot(pcm);
+			ClearPcacheTest(pcm);
+			atomic_dec(&pset->nr_hot);
+			inc_pcache_event(PCACHE_CLOCK_DEMOTE);
+		}
+		return false;
+	}
+
+	if (!referenced)
+		return true;
+
+	/* First reference within test period, wait for the next pass */
+	if (!PcacheTest(pcm)) {
+		SetPcacheTest(pcm);
+		inc_pcache_event(PCACHE_CLOCK_SECOND_CHANCE);
+		return false;
+	}
+
+	ClearPcacheTest(pcm);
+	if (atomic_add_unless(&pset->nr_hot, 1, CLOCK_PRO_MAX_HOT)) {
+		SetPcacheHot(pcm);
+		inc_pcache_event(PCACHE_CLOCK_PROMOTE);
+	} else
+		inc_pcache_event(PCACHE_CLOCK_SECOND_CHANCE);
+	return false;
+}
+
+void pcache_clock_free(struct pcache_meta *pcm)
+{
+	struct pcache_set *pset;
+
+	if (TestClearPcacheHot(pcm)) {
+		pset = pcache_meta_to_pcache_set(pcm);
+		atomic_dec(&pset->nr_hot);
+	}
+}
+#else
+static inline bool clock_age_line(struct pcache_set *pset,
+				  struct pcache_meta *pcm, int referenced)
+{
+	if (referenced) {
+		inc_pcache_event(PCACHE_CLOCK_SECOND_CHANCE);
+		return false;
+	}
+	return true;
+}
+#endif /* CONFIG_PCACHE_EVICT_CLOCK_PRO */
+
+/*
+ * The returned pcache is Locked, Reclaim, ref inc'ed 1 by us.
+ * Concurrent callers on the same set are fine: each of them
+ * moves the shared hand and looks at different ways.
+ */
+struct pcache_meta *evict_find_line_clock(struct pcache_set *pset)
+{
+	struct pcache_meta *pcm;
+	int nr_scan, referenced, contention;
+
+	for (nr_scan = 0; nr_scan < CLOCK_MAX_SCAN; nr_scan++) {
+		pcm = clock_advance_hand(pset);
+		inc_pcache_event(PCACHE_CLOCK_SCAN);
+
+		/*
+		 * Free, or cached by piggybacker, or just being allocated.
+		 * If someone freed a line into this set, let caller retry.
+		 */
+		if (unlikely(!get_pcache_unless_zero(pcm))) {
+			if (!bitmap_empty(pset->free_map, PCACHE_ASSOCIATIVITY))
+				return ERR_PTR(-EAGAIN);
+			continue;
+		}
+
+		/*
+		 * This means pcache is within common_do_fill_page(),
+		 * before pte and rmap are both setup.
+		 * Do not race with normal pgfault code
+		 */
+		if (unlikely(!PcacheValid(pcm)))
+			goto put_pcache;
+
+		/* Huge lines are evicted as a whole, see huge.c */
+		if (unlikely(PcacheHuge(pcm)))
+			goto put_pcache;
+
+		if (!trylock_pcache(pcm))
+			goto put_pcache;
+
+		if (PcacheWriteback(pcm))
+			goto unlock_pcache;
+
+		/*
+		 * 1 for original allocation
+		 * 1 for get_pcache_unless_zero above
+		 * Otherwise, it is used by others.
+		 */
+		if (unlikely(pcache_ref_count(pcm) > 2))
+			goto unlock_pcache;
+
+		/* pte lock contention means someone is using it */
+		pcache_referenced_trylock(pcm, &referenced, &contention);
+		if (contention)
+			goto unlock_pcache;
+
+		if (!clock_age_line(pset, pcm, referenced))
+			goto unlock_pcache;
+
+		/*
+		 * Yeah! We have a candidate that is:
+		 * 0) Valid, mapped to user pgtable
+		 * 1) locked by us
+		 * 2) not under writeback
+		 * 3) not used by others
+		 * 4) not referenced since last hand pass
+		 */
+		SetPcacheReclaim(pcm);
+		return pcm;
+
+unlock_pcache:
+		unlock_pcache(pcm);
+put_pcache:
+		/* Someone else put_pcache() in the middle */
+		if (unlikely(put_pcache_testzero(pcm))) {
+			__put_pcache(pcm);
+			return ERR_PTR(-EAGAIN);
+		}
+	}
+
+	return ERR_PTR(-EAGAIN);
+}
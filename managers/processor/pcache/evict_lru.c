@@ -110,6 +110,10 @@ struct pcache_meta *evict_find_line_lru(struct pcache_set *pset)
 		if (unlikely(!PcacheValid(pcm)))
 			goto put_pcache;
 
+		/* Huge lines are evicted as a whole, see huge.c */
+		if (unlikely(PcacheHuge(pcm)))
+			goto put_pcache;
+
 		if (!trylock_pcache(pcm))
 			goto put_pcache;
 
@@ -226,6 +230,10 @@ static void sweep_pset(struct pcache_set *pset)
 		if (unlikely(!PcacheValid(pcm)))
 			goto put_pcache;
 
+		/* Huge lines are evicted as a whole, see huge.c */
+		if (unlikely(PcacheHuge(pcm)))
+			goto put_pcache;
+
 		/* Do not race with other normal operations. */
 		if (!trylock_pcache(pcm))
 			goto put_pcache;
@@ -68,6 +68,10 @@ struct pcache_meta *evict_find_line_random(struct pcache_set *pset)
 			/* within timeframe t10-t12 above */
 			if (unlikely(!PcacheValid(pcm)))
 				goto put;
+
+			/* Huge lines are evicted as a whole, see huge.c */
+			if (unlikely(PcacheHuge(pcm)))
+				goto put;
 		}
 
 		if (!trylock_pcache(pcm))
@@ -114,7 +114,12 @@ int common_do_fill_page(struct mm_struct *mm, unsigned long address,
 	pte_t entry;
 	int ret;
 
-	pcm = pcache_alloc(address, piggyback);
+	/* Zerofill prefers a pre-zeroed line if there is one */
+	pcm = NULL;
+	if (caller == RMAP_ZEROFILL)
+		pcm = pcache_alloc_zeroed(address);
+	if (!pcm)
+		pcm = pcache_alloc(address, piggyback);
 	if (unlikely(!pcm))
 		return VM_FAULT_OOM;
 
@@ -152,6 +157,9 @@ int common_do_fill_page(struct mm_struct *mm, unsigned long address,
 		goto out;
 	}
 
+	/* Content equals memory now, prepare sub-line dirty tracking */
+	entry = pcache_delta_fill_pte(pcm, entry, flags);
+
 	/*
 	 * Set pte before adding rmap,
 	 * cause rmap may need to validate pte.
@@ -208,6 +216,7 @@ __pcache_do_fill_page(unsigned long address, unsigned long flags,
 	if (PcachePiggyback(pcm)) {
 		struct p2m_pcache_miss_flush_combine_msg *pb_msg;
 		struct piggyback_info *pb = &pcm->pb;
+		struct fit_sglist iov[2];
 
 		/*
 		 * Okay. Flush and miss belong to different nodes.
@@ -243,13 +252,23 @@ __pcache_do_fill_page(unsigned long address, unsigned long flags,
 		/* The piggyback flush part */
 		pb_msg->flush.pid = pb->tgid;
 		pb_msg->flush.user_va = pb->user_addr;
-		memcpy(pb_msg->flush.pcacheline, va_cache, PCACHE_LINE_SIZE);
 		smp_wmb();
 
+		/*
+		 * The dirty line is sent in place. The reply lands in the
+		 * same line, which is fine: remote replies only after the
+		 * whole message, including the line, has arrived.
+		 */
+		iov[0].addr = pb_msg;
+		iov[0].len = offsetof(struct p2m_pcache_miss_flush_combine_msg,
+				      flush.pcacheline);
+		iov[1].addr = va_cache;
+		iov[1].len = PCACHE_LINE_SIZE;
+
 		PROFILE_START(__pcache_fill_remote_piggyback_net);
-		len = ibapi_send_reply_timeout(dst_nid, pb_msg, sizeof(*pb_msg),
-					       va_cache, PCACHE_LINE_SIZE, false,
-					       DEF_NET_TIMEOUT);
+		len = ibapi_send_reply_iov(dst_nid, iov, ARRAY_SIZE(iov),
+					   va_cache, PCACHE_LINE_SIZE, false,
+					   DEF_NET_TIMEOUT);
 		PROFILE_LEAVE(__pcache_fill_remote_piggyback_net);
 
 		/*
@@ -307,6 +326,80 @@ out:
 	return ret;
 }
 
+DEFINE_PROFILE_POINT(__pcache_fill_remote_batch_net)
+
+/**
+ * pcache_fill_remote_batch
+ * @tsk: lines are filled on behalf of this thread
+ * @dst_nid: the memory node all lines are homed at
+ * @fb: the batch descriptor
+ * @flags: fault flags
+ *
+ * Fill @fb->nr_lines lines from remote memory within one round-trip.
+ * Lines are scattered from @fb->reply into their pcache lines, and
+ * @fb->filled[] is set accordingly. Caller is responsible for the
+ * page table: it should hold the pte lock(s) the same way as
+ * common_do_fill_page() does.
+ *
+ * Return 0 if the request went through (some lines may still fail),
+ * negative value if the whole batch failed.
+ */
+int pcache_fill_remote_batch(struct task_struct *tsk, int dst_nid,
+			     struct pcache_fill_batch *fb, unsigned long flags)
+{
+	struct p2m_pcache_miss_batch_msg msg;
+	struct p2m_pcache_miss_batch_reply *reply = fb->reply;
+	unsigned int i, nr_filled = 0;
+	int len;
+	PROFILE_POINT_TIME(__pcache_fill_remote_batch_net)
+
+	if (WARN_ON_ONCE(!fb->nr_lines || fb->nr_lines > PCACHE_MISS_BATCH_MAX))
+		return -EINVAL;
+
+	fill_common_header(&msg, P2M_PCACHE_MISS_BATCH);
+	msg.pid = tsk->pid;
+	msg.tgid = tsk->tgid;
+	msg.flags = flags;
+	msg.nr_lines = fb->nr_lines;
+	for (i = 0; i < fb->nr_lines; i++)
+		msg.missing_vaddr[i] = fb->address[i];
+
+	PROFILE_START(__pcache_fill_remote_batch_net);
+	len = ibapi_send_reply_timeout(dst_nid, &msg, sizeof(msg), reply,
+				       PCACHE_MISS_BATCH_REPLY_SIZE(fb->nr_lines),
+				       false, DEF_NET_TIMEOUT);
+	PROFILE_LEAVE(__pcache_fill_remote_batch_net);
+
+	inc_pcache_event(PCACHE_FILL_BATCH);
+
+	if (unlikely(len != PCACHE_MISS_BATCH_REPLY_SIZE(fb->nr_lines))) {
+		memset(fb->filled, 0, sizeof(fb->filled));
+		if (likely(len == sizeof(int)))
+			return -EFAULT;
+		else if (len < 0) {
+			WARN_ON_ONCE(1);
+			return len;
+		}
+		WARN(1, "Invalid reply length: %d\n", len);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < fb->nr_lines; i++) {
+		if (unlikely(reply->status[i])) {
+			fb->filled[i] = false;
+			continue;
+		}
+
+		memcpy(pcache_meta_to_kva(fb->pcm[i]), reply->data[i],
+		       PCACHE_LINE_SIZE);
+		fb->filled[i] = true;
+		nr_filled++;
+	}
+
+	add_pcache_event(PCACHE_FILL_BATCH_LINES, nr_filled);
+	return 0;
+}
+
 /*
  * This function handles normal cache line misses.
  * We enter with pte unlocked, we return with pte unlocked.
@@ -315,6 +408,12 @@ static inline int
 pcache_do_fill_page(struct mm_struct *mm, unsigned long address,
 		    pte_t *page_table, pte_t orig_pte, pmd_t *pmd, unsigned long flags)
 {
+	/*
+	 * Kick prefetch before our own fill goes out,
+	 * so the following lines overlap with this miss.
+	 */
+	pcache_prefetch_detect(current, address);
+
 	return common_do_fill_page(mm, address, page_table, orig_pte, pmd, flags,
 			__pcache_do_fill_page, NULL, RMAP_FILL_PAGE_REMOTE,
 			ENABLE_PIGGYBACK);
@@ -323,17 +422,25 @@ pcache_do_fill_page(struct mm_struct *mm, unsigned long address,
 #ifdef CONFIG_PCACHE_ZEROFILL
 DEFINE_PROFILE_POINT(__pcache_fill_zerofill)
 
+/* Clear a newly allocated line, unless it is pre-zeroed already */
+static inline void zerofill_pcache_line(struct pcache_meta *pcm)
+{
+	if (TestClearPcacheZeroed(pcm)) {
+		inc_pcache_event(PCACHE_ZEROFILL_POOL_HIT);
+		return;
+	}
+	memset(pcache_meta_to_kva(pcm), 0, PCACHE_LINE_SIZE);
+}
+
 static int
 __pcache_do_zerofill_page(unsigned long address, unsigned long flags,
 			  struct pcache_meta *pcm, void *unused)
 {
-	void *pcache_kva;
 	PROFILE_POINT_TIME(__pcache_fill_zerofill)
 
 	PROFILE_START(__pcache_fill_zerofill);
 
-	pcache_kva = pcache_meta_to_kva(pcm);
-	memset(pcache_kva, 0, PCACHE_LINE_SIZE);
+	zerofill_pcache_line(pcm);
 
 	/*
 	 * Notify remote memory about this zerofill.
@@ -348,6 +455,87 @@ __pcache_do_zerofill_page(unsigned long address, unsigned long flags,
 	return 0;
 }
 
+#if CONFIG_PCACHE_ZEROFILL_AROUND > 0
+#define PCACHE_ZEROFILL_AROUND_LINES	(CONFIG_PCACHE_ZEROFILL_AROUND)
+
+/*
+ * Zerofill fault-around
+ *
+ * First touch of a large anonymous region faults on every line. Once one
+ * of them faults, the following lines that are still marked as zerofill
+ * are cleared and mapped as well, up to the end of the pte page. They are
+ * cleared before taking the pte lock, and mapped under a single lock.
+ * Only free lines are used, so this never evicts anything. Lines are
+ * mapped old, so eviction picks the unused ones first.
+ */
+static void pcache_zerofill_around(struct mm_struct *mm, unsigned long address,
+				   pmd_t *pmd, unsigned long flags)
+{
+	struct pcache_meta *pcm[PCACHE_ZEROFILL_AROUND_LINES];
+	pte_t *ptep[PCACHE_ZEROFILL_AROUND_LINES];
+	pte_t orig_pte[PCACHE_ZEROFILL_AROUND_LINES];
+	unsigned long addr, end;
+	unsigned int i, nr;
+	spinlock_t *ptl;
+	pte_t entry;
+
+	address &= PCACHE_LINE_MASK;
+	end = pmd_addr_end(address,
+			   address + (PCACHE_ZEROFILL_AROUND_LINES + 1) * PCACHE_LINE_SIZE);
+
+	nr = 0;
+	for (addr = address + PCACHE_LINE_SIZE; addr < end; addr += PCACHE_LINE_SIZE) {
+		ptep[nr] = pte_offset(pmd, addr);
+		orig_pte[nr] = *ptep[nr];
+
+		/* Stop at the first line that was touched or is not anonymous */
+		if (pte_present(orig_pte[nr]) || !pte_zerofill(orig_pte[nr]))
+			break;
+
+		pcm[nr] = pcache_alloc_zeroed(addr);
+		if (!pcm[nr])
+			pcm[nr] = pcache_alloc_noevict(addr);
+		if (!pcm[nr])
+			break;
+
+		zerofill_pcache_line(pcm[nr]);
+		nr++;
+	}
+	if (!nr)
+		return;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	for (i = 0, addr = address + PCACHE_LINE_SIZE; i < nr;
+	     i++, addr += PCACHE_LINE_SIZE) {
+		/* Faulted in by others after we looked */
+		if (unlikely(!pte_same(*ptep[i], orig_pte[i])))
+			goto put;
+
+		entry = pcache_mk_pte(pcm[i], PAGE_SHARED_EXEC);
+		entry = pte_mkold(entry);
+		entry = pcache_delta_fill_pte(pcm[i], entry, 0);
+		pte_set(ptep[i], entry);
+
+		if (unlikely(pcache_add_rmap(pcm[i], ptep[i], addr, mm,
+					     current->group_leader, RMAP_ZEROFILL))) {
+			pte_clear(ptep[i]);
+			goto put;
+		}
+
+		submit_zerofill_notify_work(current, addr, flags);
+		inc_pcache_event(PCACHE_ZEROFILL_AROUND);
+		continue;
+put:
+		put_pcache(pcm[i]);
+	}
+	spin_unlock(ptl);
+}
+#else
+static inline void pcache_zerofill_around(struct mm_struct *mm, unsigned long address,
+					  pmd_t *pmd, unsigned long flags) { }
+#endif
+
 /*
  * This function handles Anonymous Zero Fill page.
  * - Clear the pcache line
@@ -357,14 +545,20 @@ static inline int
 pcache_do_zerofill_page(struct mm_struct *mm, unsigned long address,
 		    pte_t *page_table, pte_t orig_pte, pmd_t *pmd, unsigned long flags)
 {
+	int ret;
+
 	if (unlikely(!pte_zerofill(orig_pte))) {
 		dump_pte(page_table, "bad pte");
 		print_bad_pte(mm, address, orig_pte, NULL);
 		return VM_FAULT_SIGBUS;
 	}
-	return common_do_fill_page(mm, address, page_table, orig_pte, pmd, flags,
+
+	ret = common_do_fill_page(mm, address, page_table, orig_pte, pmd, flags,
 			__pcache_do_zerofill_page, NULL, RMAP_ZEROFILL,
 			DISABLE_PIGGYBACK);
+	if (likely(!ret))
+		pcache_zerofill_around(mm, address, pmd, flags);
+	return ret;
 }
 #else
 /*
@@ -468,6 +662,9 @@ static int pcache_do_wp_page(struct mm_struct *mm, unsigned long address,
 	if (pcache_mapcount(old_pcm) == 1) {
 		pte_t entry;
 
+		/* First write to a line filled by read fault */
+		pcache_delta_wp_reuse(old_pcm);
+
 		entry = pte_mkyoung(orig_pte);
 		entry = pte_mkdirty(entry);
 		entry = pte_mkwrite(entry);
@@ -629,7 +826,7 @@ int pcache_handle_fault(struct mm_struct *mm,
 {
 	pgd_t *pgd;
 	pud_t *pud;
-	pmd_t *pmd;
+	pmd_t *pmd, orig_pmd;
 	pte_t *pte;
 
 	pgd = pgd_offset(mm, address);
@@ -639,6 +836,19 @@ int pcache_handle_fault(struct mm_struct *mm,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
+
+	/*
+	 * Only madvise() puts huge line bits on a plain pmd, so deciding
+	 * on one snapshot is enough. A huge pmd here means the huge line
+	 * was just filled by another thread: just retry.
+	 */
+	orig_pmd = READ_ONCE(*pmd);
+	if (pmd_huge_line(orig_pmd))
+		return 0;
+	if (pmd_huge_line_allowed(orig_pmd) &&
+	    !pcache_huge_fault(mm, address, pmd, flags))
+		return 0;
+
 	pte = pte_alloc(mm, pmd, address);
 	if (!pte)
 		return VM_FAULT_OOM;
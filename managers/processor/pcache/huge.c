@@ -0,0 +1,725 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Pcache huge lines
+ *
+ * Lines of one way are laid out by set index, and a 2MB aligned user
+ * range maps into 512 consecutive sets. So if the same way of those sets
+ * is used, the range is cached by 2MB of contiguous and aligned pcache,
+ * which can be mapped by a single pmd: one fault and one TLB entry
+ * instead of 512. Only the last pcache_huge_nr_ways ways are used.
+ *
+ * Opt-in is per range, by madvise(MADV_HUGEPAGE). It sets _PAGE_HUGE_LINE
+ * on the pte-table pmds fully covered by the range. The first fault within
+ * such a pmd builds a huge line. If the pte table already maps lines, or
+ * there is no huge slot, it drops the opt-in and falls back to normal lines.
+ *
+ * Fill: zerofill lines are cleared locally, the others are fetched with
+ * P2M_PCACHE_MISS_BATCH, so memory component sees normal line misses.
+ *
+ * Eviction: normal algorithms skip PC_huge lines. A new huge line evicts
+ * the old one in the same slot, unless the pmd accessed bit says it was
+ * used since last time (second chance). Dirty huge lines are written back
+ * with batched flush messages, several in flight, while the pmd is swapped
+ * for an empty pte table.
+ *
+ * fork(), mremap(), partial munmap() and MADV_NOHUGEPAGE split a huge line
+ * into 512 normal lines, which then behave like any other line.
+ *
+ * Locking: only the head line has rmap. A huge pmd is only changed with
+ * its head line locked, then the pmd lock. Hardware sets accessed and dirty
+ * bits behind our back, so a huge pmd is only taken down by pmdp_xchg().
+ * _PAGE_HUGE_LINE_BUSY keeps other faults within the pmd retrying while a
+ * huge line is being filled, evicted or split. Normal lines are only filled
+ * into pte tables whose pmd has no huge line bits, and only madvise() puts
+ * the bits back on such a pmd, so nobody else uses the pte table we are
+ * about to free.
+ *
+ * Same as munmap(), madvise() must not race with the first touch of the
+ * range it covers.
+ */
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/mmap.h>
+#include <lego/kernel.h>
+#include <lego/pgfault.h>
+#include <processor/pcache.h>
+#include <processor/distvm.h>
+#include <processor/processor.h>
+
+#include <asm/pgalloc.h>
+#include <asm/tlbflush.h>
+
+unsigned int pcache_huge_nr_ways __read_mostly;
+
+#define for_each_huge_way(way)						\
+	for (way = PCACHE_ASSOCIATIVITY - pcache_huge_nr_ways;		\
+	     way < PCACHE_ASSOCIATIVITY; way++)
+
+static inline void flush_tlb_huge_line(struct mm_struct *mm, unsigned long haddr)
+{
+	flush_tlb_mm_range(mm, haddr, haddr + PCACHE_HUGE_LINE_SIZE);
+}
+
+/*
+ * Swap the huge pmd for the empty pte table @table, marked busy, so that
+ * accesses fault and retry until caller is done with the huge line.
+ * Return the old huge pmd, with all accessed and dirty bits set so far.
+ * The pmd is locked when called.
+ */
+static pmd_t huge_pmd_take_down(struct mm_struct *mm, pmd_t *pmd,
+				unsigned long haddr, struct page *table,
+				pmd_t *table_pmd)
+{
+	pmd_t orig_pmd;
+
+	pmd_populate(mm, table_pmd, table);
+	orig_pmd = pmdp_xchg(pmd, pmd_mkhuge_line_busy(pmd_mkhuge_line(*table_pmd)));
+	flush_tlb_huge_line(mm, haddr);
+	return orig_pmd;
+}
+
+/*
+ * Drop the huge line whose lines are all mapped by nobody now.
+ * @head is locked on entry, and unlocked on return.
+ */
+static void huge_line_release(struct pcache_meta *head)
+{
+	unsigned int i;
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++)
+		ClearPcacheHuge(head + i);
+	unlock_pcache(head);
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++)
+		put_pcache(head + i);
+}
+
+/*
+ * Lock the head line of the huge line mapped by @pmd, then the pmd.
+ * Return NULL if @pmd does not map a huge line.
+ */
+static struct pcache_meta *
+lock_huge_pmd(struct mm_struct *mm, pmd_t *pmd, spinlock_t **ptlp)
+{
+	struct pcache_meta *head;
+	spinlock_t *ptl;
+	pmd_t orig_pmd;
+
+again:
+	ptl = pmd_lock(mm, pmd);
+	orig_pmd = *pmd;
+	if (!pmd_huge_line(orig_pmd)) {
+		spin_unlock(ptl);
+		return NULL;
+	}
+
+	head = pfn_to_pcache_meta(pmd_pfn(orig_pmd));
+	BUG_ON(!head);
+
+	/* See comments on pcache_zap_pte */
+	if (unlikely(!trylock_pcache(head))) {
+		get_pcache(head);
+		spin_unlock(ptl);
+
+		lock_pcache(head);
+		spin_lock(ptl);
+
+		if (!pmd_huge_line(*pmd) || pmd_pfn(*pmd) != pmd_pfn(orig_pmd)) {
+			unlock_pcache(head);
+			spin_unlock(ptl);
+			put_pcache(head);
+			goto again;
+		}
+		put_pcache(head);
+	}
+
+	*ptlp = ptl;
+	return head;
+}
+
+/*
+ * Evict the huge line in slot @head, unless it was referenced since last
+ * time we looked. Return true if the slot is free now.
+ */
+static bool huge_line_evict(struct pcache_meta *head)
+{
+	struct task_struct *owner;
+	struct pcache_rmap *rmap;
+	struct mm_struct *mm;
+	struct page *table;
+	unsigned long haddr;
+	spinlock_t *ptl;
+	pmd_t *pmd, orig_pmd, table_pmd;
+
+	if (!PcacheHuge(head) || !get_pcache_unless_zero(head))
+		return false;
+
+	/* Still being filled, split or zapped */
+	if (!trylock_pcache(head))
+		goto put;
+	if (!PcacheHuge(head) || !PcacheValid(head))
+		goto unlock;
+
+	rmap = list_first_entry(&head->rmap, struct pcache_rmap, next);
+	if (WARN_ON_ONCE(!RmapHuge(rmap)))
+		goto unlock;
+	mm = rmap->owner_mm;
+	pmd = rmap->pmd;
+	haddr = rmap->address;
+	owner = rmap->owner_process;
+
+	/* The range is mapped by a new pte table once the huge line is gone */
+	table = pte_alloc_one(mm, haddr);
+	if (!table)
+		goto unlock;
+
+	ptl = pmd_lock(mm, pmd);
+	orig_pmd = *pmd;
+	if (WARN_ON_ONCE(!pmd_huge_line(orig_pmd) ||
+			 pmd_pfn(orig_pmd) != pcache_meta_to_pfn(head))) {
+		spin_unlock(ptl);
+		goto free_table;
+	}
+
+	if (pmdp_test_and_clear_young(pmd)) {
+		flush_tlb_huge_line(mm, haddr);
+		spin_unlock(ptl);
+		inc_pcache_event(PCACHE_HUGE_SECOND_CHANCE);
+		goto free_table;
+	}
+
+	orig_pmd = huge_pmd_take_down(mm, pmd, haddr, table, &table_pmd);
+	pcache_remove_huge_rmap(head, pmd, haddr, mm);
+	spin_unlock(ptl);
+
+	if (pmd_dirty(orig_pmd)) {
+		clflush_range(owner, haddr, pcache_meta_to_kva(head),
+			      PCACHE_HUGE_LINE_NR_LINES);
+		inc_pcache_event(PCACHE_HUGE_EVICT_DIRTY);
+	}
+
+	/* Keep the opt-in, so next fault builds a huge line again */
+	ptl = pmd_lock(mm, pmd);
+	pmd_set(pmd, pmd_mkhuge_line(table_pmd));
+	spin_unlock(ptl);
+
+	huge_line_release(head);
+	put_pcache(head);
+	inc_pcache_event(PCACHE_HUGE_EVICT);
+	return true;
+
+free_table:
+	pte_free(mm, table);
+unlock:
+	unlock_pcache(head);
+put:
+	put_pcache(head);
+	return false;
+}
+
+/*
+ * Claim @way of the 512 sets starting at @pset.
+ * Return the head line, or NULL if any of them is in use.
+ */
+static struct pcache_meta *huge_line_claim(struct pcache_set *pset, unsigned int way)
+{
+	struct pcache_meta *pcm;
+	unsigned int i;
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++) {
+		pcm = pcache_alloc_way(pset + i, way);
+		if (!pcm)
+			goto rollback;
+
+		/* Keep eviction algorithms and other huge faults away */
+		SetPcacheHuge(pcm);
+	}
+	return pcache_set_way_to_pcache_meta(pset, way);
+
+rollback:
+	while (i--) {
+		pcm = pcache_set_way_to_pcache_meta(pset + i, way);
+		ClearPcacheHuge(pcm);
+		put_pcache(pcm);
+	}
+	return NULL;
+}
+
+static struct pcache_meta *huge_line_alloc(unsigned long haddr)
+{
+	struct pcache_set *pset = user_vaddr_to_pcache_set(haddr);
+	struct pcache_meta *head;
+	unsigned int way;
+
+	for_each_huge_way(way) {
+		head = huge_line_claim(pset, way);
+		if (head)
+			return head;
+	}
+
+	for_each_huge_way(way) {
+		if (!huge_line_evict(pcache_set_way_to_pcache_meta(pset, way)))
+			continue;
+		head = huge_line_claim(pset, way);
+		if (head)
+			return head;
+	}
+	return NULL;
+}
+
+/*
+ * Lines that were just evicted may still be on their way to memory,
+ * fetching them now would return stale data.
+ */
+static inline bool line_in_eviction(unsigned long address)
+{
+#ifdef CONFIG_PCACHE_EVICTION_PERSET_LIST
+	return pset_find_eviction(address, current);
+#elif defined(CONFIG_PCACHE_EVICTION_VICTIM)
+	return victim_may_hit(address);
+#else
+	return false;
+#endif
+}
+
+/* Return true if all lines of the pte table can be filled into a huge line */
+static bool huge_line_fillable(pte_t *ptes, unsigned long haddr)
+{
+	unsigned int i;
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++) {
+		pte_t ptent = ptes[i];
+
+		if (pte_none(ptent)) {
+			if (line_in_eviction(haddr + i * PCACHE_LINE_SIZE))
+				return false;
+			continue;
+		}
+
+		if (pte_present(ptent) || !pte_zerofill(ptent) ||
+		    pte_zerofill_locked(ptent))
+			return false;
+	}
+	return true;
+}
+
+static int huge_line_fill_batch(struct pcache_fill_batch *fb, int nid,
+				unsigned long flags)
+{
+	unsigned int i;
+	int ret;
+
+	ret = pcache_fill_remote_batch(current, nid, fb, flags);
+	for (i = 0; !ret && i < fb->nr_lines; i++) {
+		if (unlikely(!fb->filled[i]))
+			ret = -EFAULT;
+	}
+	fb->nr_lines = 0;
+	return ret;
+}
+
+/*
+ * Fill the huge line @head, according to the old pte table @ptes.
+ * Lines homed at the same memory node are fetched in batches.
+ */
+static int huge_line_fill(struct pcache_meta *head, pte_t *ptes,
+			  unsigned long haddr, unsigned long flags)
+{
+	struct pcache_fill_batch fb;
+	unsigned int i, nr_zerofill = 0;
+	int nid = 0, ret = 0;
+
+	fb.nr_lines = 0;
+	fb.reply = kmalloc(sizeof(*fb.reply), GFP_KERNEL);
+	if (!fb.reply)
+		return -ENOMEM;
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++) {
+		unsigned long address = haddr + i * PCACHE_LINE_SIZE;
+		struct pcache_meta *pcm = head + i;
+		int node;
+
+		if (pte_zerofill(ptes[i])) {
+			if (!TestClearPcacheZeroed(pcm))
+				memset(pcache_meta_to_kva(pcm), 0, PCACHE_LINE_SIZE);
+			nr_zerofill++;
+			continue;
+		}
+
+		node = get_memory_node(current, address);
+		if (fb.nr_lines &&
+		    (node != nid || fb.nr_lines == PCACHE_MISS_BATCH_MAX)) {
+			ret = huge_line_fill_batch(&fb, nid, flags);
+			if (ret)
+				goto out;
+		}
+
+		nid = node;
+		fb.address[fb.nr_lines] = address;
+		fb.pcm[fb.nr_lines] = pcm;
+		fb.nr_lines++;
+	}
+
+	if (fb.nr_lines)
+		ret = huge_line_fill_batch(&fb, nid, flags);
+
+	if (nr_zerofill == PCACHE_HUGE_LINE_NR_LINES)
+		inc_pcache_event(PCACHE_HUGE_FILL_ZEROFILL);
+out:
+	kfree(fb.reply);
+	return ret;
+}
+
+/**
+ * pcache_huge_fault
+ * @mm: address space in question
+ * @address: the missing virtual address
+ * @pmd: the pmd of @address, which allows huge lines
+ * @flags: how the page fault happens
+ *
+ * Try to cache the 2MB range of @address by one huge line.
+ *
+ * Return 0 if the fault is handled, or it should be retried.
+ * Otherwise the opt-in was dropped, and caller should fall back to
+ * normal lines.
+ */
+int pcache_huge_fault(struct mm_struct *mm, unsigned long address,
+		      pmd_t *pmd, unsigned long flags)
+{
+	unsigned long haddr = address & PCACHE_HUGE_LINE_MASK;
+	struct pcache_meta *head;
+	spinlock_t *ptl;
+	pmd_t orig_pmd, busy_pmd, entry;
+	pte_t *ptes;
+	int ret;
+
+	ptl = pmd_lock(mm, pmd);
+	orig_pmd = *pmd;
+	if (pmd_huge_line(orig_pmd) || pmd_huge_line_busy(orig_pmd)) {
+		spin_unlock(ptl);
+		return 0;
+	}
+	if (!pmd_huge_line_allowed(orig_pmd)) {
+		spin_unlock(ptl);
+		return -EAGAIN;
+	}
+	busy_pmd = pmd_mkhuge_line_busy(orig_pmd);
+	pmd_set(pmd, busy_pmd);
+	spin_unlock(ptl);
+
+	inc_pcache_event(PCACHE_HUGE_FAULT);
+
+	ptes = (pte_t *)pmd_page_vaddr(orig_pmd);
+	if (!huge_line_fillable(ptes, haddr)) {
+		ret = -EBUSY;
+		goto fallback;
+	}
+
+	head = huge_line_alloc(haddr);
+	if (!head) {
+		ret = -ENOMEM;
+		goto fallback;
+	}
+
+	ret = huge_line_fill(head, ptes, haddr, flags);
+	if (ret)
+		goto free;
+
+	entry = pcache_mk_pmd(head, PAGE_SHARED_EXEC);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = pmd_mkdirty(entry);
+
+	ptl = pmd_lock(mm, pmd);
+	if (unlikely(!pmd_same(*pmd, busy_pmd))) {
+		spin_unlock(ptl);
+		ret = -EAGAIN;
+		goto free;
+	}
+	ret = pcache_add_huge_rmap(head, pmd, haddr, mm,
+				   current->group_leader, RMAP_HUGE_FILL);
+	if (unlikely(ret)) {
+		spin_unlock(ptl);
+		goto free;
+	}
+	pmd_set(pmd, entry);
+	spin_unlock(ptl);
+
+	/* Nobody can reach the old table now */
+	pte_free(mm, pmd_page(orig_pmd));
+
+	inc_pcache_event(PCACHE_HUGE_FILL);
+	return 0;
+
+free:
+	lock_pcache(head);
+	huge_line_release(head);
+fallback:
+	ptl = pmd_lock(mm, pmd);
+	if (pmd_same(*pmd, busy_pmd))
+		pmd_set(pmd, pmd_clear_huge_line(busy_pmd));
+	spin_unlock(ptl);
+
+	inc_pcache_event(PCACHE_HUGE_FALLBACK);
+	return ret;
+}
+
+static pte_t huge_split_pte(struct pcache_meta *pcm, pmd_t orig_pmd)
+{
+	pte_t entry = pcache_mk_pte(pcm, PAGE_SHARED_EXEC);
+
+	if (!pmd_young(orig_pmd))
+		entry = pte_mkold(entry);
+	if (pmd_dirty(orig_pmd))
+		entry = pte_mkdirty(entry);
+	if (!pmd_write(orig_pmd))
+		entry = pte_wrprotect(entry);
+	return entry;
+}
+
+/**
+ * pcache_split_huge_pmd
+ * @mm: address space in question
+ * @pmd: the pmd that may map a huge line
+ * @address: any user virtual address within @pmd
+ *
+ * Remap the huge line mapped by @pmd with a pte table, so that its
+ * lines become normal lines. Nothing happens if @pmd is not huge.
+ *
+ * Return 0 on success, -ENOMEM if the pte table can not be allocated.
+ */
+int pcache_split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long haddr = address & PCACHE_HUGE_LINE_MASK;
+	struct task_struct *owner;
+	struct pcache_meta *head;
+	struct pcache_rmap *rmap;
+	struct page *table;
+	spinlock_t *ptl, *pte_ptl;
+	pmd_t orig_pmd, table_pmd;
+	pte_t *ptes;
+	unsigned int i;
+
+	table = pte_alloc_one(mm, haddr);
+	if (!table)
+		return -ENOMEM;
+
+	head = lock_huge_pmd(mm, pmd, &ptl);
+	if (!head) {
+		pte_free(mm, table);
+		return 0;
+	}
+
+	rmap = list_first_entry(&head->rmap, struct pcache_rmap, next);
+	owner = rmap->owner_process;
+
+	orig_pmd = huge_pmd_take_down(mm, pmd, haddr, table, &table_pmd);
+
+	ptes = page_address(table);
+	pte_ptl = ptlock_ptr(table);
+	spin_lock(pte_ptl);
+
+	/*
+	 * Lines stay PC_huge until all of them have rmap,
+	 * so that eviction algorithms do not pick them early.
+	 */
+	pcache_split_huge_rmap(head, pmd, haddr, mm, ptes);
+	pte_set(ptes, huge_split_pte(head, orig_pmd));
+
+	for (i = 1; i < PCACHE_HUGE_LINE_NR_LINES; i++) {
+		unsigned long addr = haddr + i * PCACHE_LINE_SIZE;
+
+		pte_set(ptes + i, huge_split_pte(head + i, orig_pmd));
+		if (unlikely(pcache_add_rmap(head + i, ptes + i, addr,
+					     mm, owner, RMAP_HUGE_SPLIT))) {
+			pte_clear(ptes + i);
+			flush_tlb_mm_range(mm, addr, addr + PCACHE_LINE_SIZE);
+			ClearPcacheHuge(head + i);
+			put_pcache(head + i);
+		}
+	}
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++)
+		ClearPcacheHuge(head + i);
+	unlock_pcache(head);
+
+	pmd_set(pmd, table_pmd);
+	spin_unlock(pte_ptl);
+	spin_unlock(ptl);
+
+	inc_pcache_event(PCACHE_HUGE_SPLIT);
+	return 0;
+}
+
+/**
+ * pcache_zap_huge_pmd
+ * @mm: address space in question
+ * @pmd: the pmd that may map a huge line
+ * @address: any user virtual address within @pmd
+ *
+ * Unmap and free the huge line mapped by @pmd. Like normal lines,
+ * dirty content is dropped. Nothing happens if @pmd is not huge.
+ */
+void pcache_zap_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long haddr = address & PCACHE_HUGE_LINE_MASK;
+	struct pcache_meta *head;
+	spinlock_t *ptl;
+
+	head = lock_huge_pmd(mm, pmd, &ptl);
+	if (!head)
+		return;
+
+	pmd_clear(pmd);
+	flush_tlb_huge_line(mm, haddr);
+	pcache_remove_huge_rmap(head, pmd, haddr, mm);
+	spin_unlock(ptl);
+
+	huge_line_release(head);
+	inc_pcache_event(PCACHE_HUGE_ZAP);
+}
+
+/* Allow huge line for the pmd of @addr, if nothing is mapped there yet */
+static int huge_line_allow(struct mm_struct *mm, unsigned long addr)
+{
+	spinlock_t *ptl;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	unsigned int i;
+
+	pgd = pgd_offset(mm, addr);
+	pud = pud_alloc(mm, pgd, addr);
+	if (!pud)
+		return -ENOMEM;
+	pmd = pmd_alloc(mm, pud, addr);
+	if (!pmd)
+		return -ENOMEM;
+	if (pmd_huge_line(*pmd))
+		return 0;
+	pte = pte_alloc(mm, pmd, addr);
+	if (!pte)
+		return -ENOMEM;
+
+	ptl = pmd_lock(mm, pmd);
+	if (pmd_huge_line(*pmd) || pmd_huge_line_allowed(*pmd))
+		goto unlock;
+
+	for (i = 0; i < PCACHE_HUGE_LINE_NR_LINES; i++) {
+		if (pte_present(pte[i]) || pte_zerofill_locked(pte[i]))
+			goto unlock;
+	}
+	pmd_set(pmd, pmd_mkhuge_line(*pmd));
+
+unlock:
+	spin_unlock(ptl);
+	return 0;
+}
+
+/*
+ * Drop the huge line opt-in of @pmd.
+ * A fill in progress is left alone, see comments on top.
+ */
+void pcache_huge_disallow(struct mm_struct *mm, pmd_t *pmd)
+{
+	spinlock_t *ptl;
+
+	ptl = pmd_lock(mm, pmd);
+	if (pmd_huge_line_allowed(*pmd) && !pmd_huge_line_busy(*pmd))
+		pmd_set(pmd, pmd_clear_huge_line(*pmd));
+	spin_unlock(ptl);
+}
+
+static int huge_line_disallow(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, addr);
+	if (pgd_none_or_clear_bad(pgd))
+		return 0;
+	pud = pud_offset(pgd, addr);
+	if (pud_none_or_clear_bad(pud))
+		return 0;
+	pmd = pmd_offset(pud, addr);
+
+	if (pmd_huge_line(*pmd) && pcache_split_huge_pmd(mm, pmd, addr))
+		return -ENOMEM;
+	pcache_huge_disallow(mm, pmd);
+	return 0;
+}
+
+/**
+ * pcache_madvise_huge
+ * @tsk: the thread calling madvise()
+ * @start: start of the user range
+ * @len: length of the user range
+ * @behavior: MADV_HUGEPAGE or MADV_NOHUGEPAGE
+ *
+ * MADV_HUGEPAGE allows huge lines for every 2MB block fully covered by
+ * the range and not touched yet. MADV_NOHUGEPAGE disallows huge lines for
+ * every 2MB block overlapping the range, and splits the present ones.
+ */
+int pcache_madvise_huge(struct task_struct *tsk, unsigned long start,
+			size_t len, int behavior)
+{
+	struct mm_struct *mm = tsk->mm;
+	unsigned long addr, end;
+	int ret = 0;
+
+	if (start & ~PAGE_MASK)
+		return -EINVAL;
+	len = PAGE_ALIGN(len);
+	end = start + len;
+	if (end < start || end > TASK_SIZE)
+		return -EINVAL;
+	if (!pcache_huge_nr_ways || !len)
+		return 0;
+
+	if (behavior == MADV_HUGEPAGE) {
+		addr = ALIGN(start, PCACHE_HUGE_LINE_SIZE);
+		for (; addr < end && end - addr >= PCACHE_HUGE_LINE_SIZE;
+		     addr += PCACHE_HUGE_LINE_SIZE) {
+			ret = huge_line_allow(mm, addr);
+			if (ret)
+				break;
+		}
+	} else {
+		addr = start & PCACHE_HUGE_LINE_MASK;
+		for (; addr < end; addr += PCACHE_HUGE_LINE_SIZE) {
+			ret = huge_line_disallow(mm, addr);
+			if (ret)
+				break;
+		}
+	}
+	return ret;
+}
+
+int __init pcache_huge_init(void)
+{
+	unsigned int nr_ways = CONFIG_PCACHE_HUGE_LINE_WAYS;
+
+	if (nr_cachesets < PCACHE_HUGE_LINE_NR_LINES ||
+	    !IS_ALIGNED(phys_start_cacheline, PCACHE_HUGE_LINE_SIZE)) {
+		pr_info("pcache: huge line disabled, needs %lu sets and 2MB aligned pcache\n",
+			PCACHE_HUGE_LINE_NR_LINES);
+		return 0;
+	}
+
+	nr_ways = min_t(unsigned int, nr_ways, PCACHE_ASSOCIATIVITY / 2);
+	pcache_huge_nr_ways = max_t(unsigned int, nr_ways, 1);
+
+	pr_info("pcache: huge line enabled, using last %u ways\n",
+		pcache_huge_nr_ways);
+	return 0;
+}
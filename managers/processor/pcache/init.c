@@ -11,11 +11,15 @@
 #include <lego/slab.h>
 #include <lego/log2.h>
 #include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/profile.h>
 #include <lego/pgfault.h>
+#include <lego/completion.h>
 #include <lego/syscalls.h>
 #include <lego/memblock.h>
 
 #include <processor/pcache.h>
+#include <processor/zerofill.h>
 #include <processor/processor.h>
 
 #include <asm/io.h>
@@ -143,68 +147,178 @@ void __init pcache_early_init(void)
 	alloc_pcache_set_map();
 	alloc_pcache_rmap_map();
 	alloc_pcache_perset_map();
+	alloc_pcache_twin_map();
 	victim_cache_early_init();
 }
 
-static void __init init_pcache_set_free_list(void)
+/* Init one pcache_set, and free all its ways into its free list */
+static void __init init_pcache_set(struct pcache_set *pset)
 {
-	struct pcache_set *pset;
-	struct pcache_meta *pcm;
-	int setidx, way;
+	int j;
 
-	pcache_for_each_set(pset, setidx) {
-		pcache_for_each_way_set(pcm, pset, way) {
-			list_add_tail(&pcm->free_list, &pset->free_head);
-		}
-	}
-}
-
-/* Init pcache_set array */
-static void __init init_pcache_set_map(void)
-{
-	struct pcache_set *pset;
-	int setidx, j;
-
-	pcache_for_each_set(pset, setidx) {
-		/* Head of free pcache line */
-		INIT_LIST_HEAD(&pset->free_head);
-		spin_lock_init(&pset->free_lock);
+	bitmap_zero(pset->free_map, PCACHE_ASSOCIATIVITY);
 
-		/* Eviction Algorithm Specific */
+	/* Eviction Algorithm Specific */
 #ifdef CONFIG_PCACHE_EVICT_LRU
-		INIT_LIST_HEAD(&pset->lru_list);
-		spin_lock_init(&pset->lru_lock);
-		atomic_set(&pset->nr_lru, 0);
+	INIT_LIST_HEAD(&pset->lru_list);
+	spin_lock_init(&pset->lru_lock);
+	atomic_set(&pset->nr_lru, 0);
+#endif
+#ifdef CONFIG_PCACHE_EVICT_CLOCK
+	atomic_set(&pset->clock_hand, 0);
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+	atomic_set(&pset->nr_hot, 0);
+#endif
 #endif
 
-		/* Eviction Mechanism Specific */
+	/* Eviction Mechanism Specific */
 #ifdef CONFIG_PCACHE_EVICTION_VICTIM
-		atomic_set(&pset->nr_victims, 0);
+	atomic_set(&pset->nr_victims, 0);
 #elif defined(CONFIG_PCACHE_EVICTION_PERSET_LIST)
-		INIT_LIST_HEAD(&pset->eviction_list);
-		spin_lock_init(&pset->eviction_list_lock);
-		atomic_set(&pset->nr_eviction_entries, 0);
+	INIT_LIST_HEAD(&pset->eviction_list);
+	spin_lock_init(&pset->eviction_list_lock);
+	atomic_set(&pset->nr_eviction_entries, 0);
 #endif
 
-		for (j = 0; j < NR_PSET_STAT_ITEMS; j++)
-			atomic_set(&pset->stat[j], 0);
-	}
+	for (j = 0; j < NR_PSET_STAT_ITEMS; j++)
+		atomic_set(&pset->stat[j], 0);
+
+	bitmap_set(pset->free_map, 0, PCACHE_ASSOCIATIVITY);
+
+#ifdef CONFIG_PCACHE_ZEROFILL_POOL
+	/* All lines were just cleared by pcache_clear_slice() */
+	bitmap_set(pset->zero_map, 0, PCACHE_ASSOCIATIVITY);
+#endif
+}
+
+/* Init one pcache_meta */
+static void __init init_pcache_meta(struct pcache_meta *pcm)
+{
+	pcm->bits = 0;
+	INIT_LIST_HEAD(&pcm->rmap);
+	pcache_mapcount_reset(pcm);
+	pcache_ref_count_set(pcm, 0);
+	init_pcache_lru(pcm);
+}
+
+/*
+ * Clearing pcache and building its metadata used to run on the boot CPU
+ * only, which takes seconds with tens of GB pcache. Instead, each active
+ * CPU runs a worker that takes one slice of every range. Metadata lives
+ * in the range being cleared, so it is done in a second round.
+ */
+struct pcache_init_work {
+	void			(*fn)(unsigned int id, unsigned int nr);
+	unsigned int		id;
+	unsigned int		nr;
+	u64			ns;		/* time spent by this worker */
+	atomic_t		*nr_running;
+	struct completion	*done;
+};
+
+/* Slice @id out of @nr over [0, @total) */
+static inline void __init
+pcache_init_slice(u64 total, unsigned int id, unsigned int nr, u64 *start, u64 *end)
+{
+	*start = div64_u64(total * id, nr);
+	*end = div64_u64(total * (id + 1), nr);
+}
+
+/*
+ * Clear any stale value.
+ * This may happen if running on QEMU.
+ * Not sure about physical machine.
+ */
+static void __init pcache_clear_slice(unsigned int id, unsigned int nr)
+{
+	u64 start, end;
+
+	pcache_init_slice(pcache_registered_size >> PAGE_SHIFT, id, nr, &start, &end);
+	memset((void *)(virt_start_cacheline + start * PAGE_SIZE), 0,
+	       (end - start) * PAGE_SIZE);
+}
+
+/*
+ * Init our most important data structures
+ * and free all pcache lines into their set free list
+ */
+static void __init pcache_init_meta_slice(unsigned int id, unsigned int nr)
+{
+	u64 i, start, end;
+
+	pcache_init_slice(nr_cachelines, id, nr, &start, &end);
+	for (i = start; i < end; i++)
+		init_pcache_meta(pcache_meta_map + i);
+
+	pcache_init_slice(nr_cachesets, id, nr, &start, &end);
+	for (i = start; i < end; i++)
+		init_pcache_set(pcache_set_map + i);
 }
 
-/* Init pcache_meta array */
-static void __init init_pcache_meta_map(void)
+static int __init pcache_init_worker(void *_work)
 {
-	struct pcache_meta *pcm;
-	int nr;
-
-	pcache_for_each_way(pcm, nr) {
-		pcm->bits = 0;
-		INIT_LIST_HEAD(&pcm->free_list);
-		INIT_LIST_HEAD(&pcm->rmap);
-		pcache_mapcount_reset(pcm);
-		pcache_ref_count_set(pcm, 0);
-		init_pcache_lru(pcm);
+	struct pcache_init_work *work = _work;
+	unsigned long long start;
+
+	start = profile_clock();
+	work->fn(work->id, work->nr);
+	work->ns = profile_clock() - start;
+
+	if (atomic_dec_and_test(work->nr_running))
+		complete(work->done);
+	return 0;
+}
+
+/*
+ * Run @fn on all active CPUs and wait for them. CPUs pinned by FIT
+ * polling threads are inactive, workers bound there would never run.
+ * Return the wall time, and the time summed over all workers in @cpu_ns.
+ */
+static u64 __init
+pcache_init_parallel(void (*fn)(unsigned int, unsigned int), u64 *cpu_ns)
+{
+	struct pcache_init_work *works;
+	struct completion done;
+	struct task_struct *p;
+	unsigned long long start;
+	unsigned int nr, id = 0;
+	atomic_t nr_running;
+	int cpu;
+
+	nr = num_active_cpus();
+	works = kcalloc(nr, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		panic("Pcache: fail to allocate init works!");
+
+	start = profile_clock();
+	init_completion(&done);
+	atomic_set(&nr_running, nr);
+	for_each_active_cpu(cpu) {
+		struct pcache_init_work *work = &works[id];
+
+		work->fn = fn;
+		work->id = id;
+		work->nr = nr;
+		work->nr_running = &nr_running;
+		work->done = &done;
+		id++;
+
+		p = kthread_create_on_cpu(pcache_init_worker, work, cpu, "pcache_init/%u");
+		if (IS_ERR(p)) {
+			/* Do it ourselves then */
+			pcache_init_worker(work);
+			continue;
+		}
+		wake_up_process(p);
 	}
+	wait_for_completion(&done);
+
+	*cpu_ns = 0;
+	for (id = 0; id < nr; id++)
+		*cpu_ns += works[id].ns;
+	kfree(works);
+
+	return profile_clock() - start;
 }
 
 /*
@@ -213,6 +327,7 @@ static void __init init_pcache_meta_map(void)
  */
 void __init pcache_post_init(void)
 {
+	u64 wall_ns, cpu_ns;
 	int ret;
 
 	/*
@@ -230,24 +345,13 @@ void __init pcache_post_init(void)
 			pcache_registered_start + pcache_registered_size);
 #endif
 
-	/*
-	 * Clear any stale value.
-	 * This may happen if running on QEMU.
-	 * Not sure about physical machine.
-	 */
-	pr_info("before: memset: %#llx %#llx\n", virt_start_cacheline, pcache_registered_size);
-	memset((void *)virt_start_cacheline, 0, pcache_registered_size);
-	pr_info("After: memset: %#llx %#llx\n", virt_start_cacheline, pcache_registered_size);
-
 	pcache_meta_map = (struct pcache_meta *)(virt_start_cacheline + nr_pages_cacheline * PAGE_SIZE);
 
-	/*
-	 * Init our most important data structures
-	 * and free all pcache lines into their set free list
-	 */
-	init_pcache_meta_map();
-	init_pcache_set_map();
-	init_pcache_set_free_list();
+	wall_ns = pcache_init_parallel(pcache_clear_slice, &cpu_ns);
+	boot_profile_parallel("pcache clear", num_active_cpus(), wall_ns, cpu_ns);
+
+	wall_ns = pcache_init_parallel(pcache_init_meta_slice, &cpu_ns);
+	boot_profile_parallel("pcache metadata", num_active_cpus(), wall_ns, cpu_ns);
 
 	init_pcache_clflush_buffer();
 
@@ -259,6 +363,26 @@ void __init pcache_post_init(void)
 	if (ret)
 		panic("Pcache: fail to create evict sweep threads!");
 
+	/* Create writeback thread if configured */
+	ret = pcache_writeback_init();
+	if (ret)
+		panic("Pcache: fail to create writeback thread!");
+
+	/* Create prefetch thread if configured */
+	ret = pcache_prefetch_init();
+	if (ret)
+		panic("Pcache: fail to create prefetch thread!");
+
+	/* Create zerofill pool thread if configured */
+	ret = pcache_zerofill_pool_init();
+	if (ret)
+		panic("Pcache: fail to create zerofill pool thread!");
+
+	/* Reserve ways for huge lines if configured */
+	ret = pcache_huge_init();
+	if (ret)
+		panic("Pcache: fail to init huge lines!");
+
 	pcache_print_info();
 }
 
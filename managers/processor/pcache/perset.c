@@ -204,6 +204,42 @@ void pset_remove_eviction(struct pcache_set *pset,
 	BUG_ON(nr_added);
 }
 
+/*
+ * Detach the eviction entry from @pcm, used when the flush is handed over to
+ * writeback engine. The entry stays in the list, so that pgfault still waits
+ * for the in-flight flush, while @pcm itself can be reused immediately.
+ * Caller must ensure @pcm only has one entry.
+ */
+struct pset_eviction_entry *
+pset_detach_eviction(struct pcache_set *pset, struct pcache_meta *pcm)
+{
+	struct pset_eviction_entry *pos, *found = NULL;
+
+	spin_lock(&pset->eviction_list_lock);
+	list_for_each_entry(pos, &pset->eviction_list, next) {
+		if (pos->pcm == pcm) {
+			pos->pcm = NULL;
+			found = pos;
+			break;
+		}
+	}
+	spin_unlock(&pset->eviction_list_lock);
+
+	BUG_ON(!found);
+	return found;
+}
+
+/* Counterpart of pset_detach_eviction(), called once flush is done */
+void pset_remove_eviction_entry(struct pcache_set *pset,
+				struct pset_eviction_entry *pee)
+{
+	spin_lock(&pset->eviction_list_lock);
+	__pset_del_eviction_entry(pee, pset);
+	spin_unlock(&pset->eviction_list_lock);
+
+	free_pset_eviction_entry(pee);
+}
+
 DEFINE_PROFILE_POINT(evict_line_perset_unmap)
 DEFINE_PROFILE_POINT(evict_line_perset_flush)
 
@@ -245,6 +281,12 @@ int evict_line_perset_list(struct pcache_set *pset, struct pcache_meta *pcm,
 	dirty = pcache_try_to_unmap_reserve_check_dirty(pcm);
 	PROFILE_LEAVE(evict_line_perset_unmap);
 
+	/* Written, but content is the same as when it was filled */
+	if (dirty && pcache_twin_unchanged(pcm)) {
+		dirty = false;
+		inc_pcache_event(PCACHE_DELTA_CLEAN);
+	}
+
 	if (likely(dirty)) {
 		if (likely((nr_added == 1) && (piggyback == ENABLE_PIGGYBACK))) {
 			set_per_cpu_piggybacker(pcm);
@@ -254,6 +296,17 @@ int evict_line_perset_list(struct pcache_set *pset, struct pcache_meta *pcm,
 			return 0;
 		}
 
+		/*
+		 * Hand over to writeback engine, which copies the data out.
+		 * The eviction entry is removed once the flush is done, so
+		 * we do not wait for the network here. It falls back to
+		 * the sync flush below if the engine is busy.
+		 */
+		if (likely(nr_added == 1) && !pcache_writeback_submit(pset, pcm)) {
+			pcache_free_reserved_rmap(pcm);
+			return 0;
+		}
+
 		PROFILE_START(evict_line_perset_flush);
 		pcache_flush_one(pcm);
 		PROFILE_LEAVE(evict_line_perset_flush);
@@ -9,6 +9,24 @@
 
 /*
  * Prefetch facilities
+ *
+ * Each thread has a small access pattern detector, which is fed by remote
+ * pcache misses (pcache_prefetch_detect()). Once the detector sees the same
+ * stride twice in a row, it submits a window of the next @depth lines along
+ * that stride. Sequential, strided and reverse streams are all the same to
+ * the detector, only the sign and size of the stride differ.
+ *
+ * Windows are queued into a ring and filled by kprefetchd, which only uses
+ * free slots of the target pcache set. Prefetch never triggers eviction,
+ * thus it can not push demand-fetched lines out of pcache. Lines of a window
+ * are fetched with P2M_PCACHE_MISS_BATCH, one round-trip per pte page.
+ *
+ * Adaptive depth:
+ * A successful prefetch removes misses, so the detector does not see hits.
+ * What it does see is the next miss right after the window (the frontier):
+ * that means the whole window was consumed, and the depth is doubled.
+ * A miss within the window means prefetch was late, and the depth stays.
+ * Anything else breaks the stream and resets the depth.
  */
 
 #include <lego/mm.h>
@@ -17,9 +35,418 @@
 #include <lego/log2.h>
 #include <lego/hash.h>
 #include <lego/kernel.h>
+#include <lego/kthread.h>
 #include <lego/pgfault.h>
 #include <lego/syscalls.h>
 #include <lego/jiffies.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
 #include <processor/pcache.h>
+#include <processor/distvm.h>
 #include <processor/processor.h>
 
+#define NR_PREFETCH_WORK	(256)
+
+/*
+ * HEAD is advanced by faulting threads, TAIL is only advanced by kprefetchd
+ * after a work is fully handled. So HEAD - TAIL is always the number of
+ * slots in use, and submitters can safely drop a window if the ring is full.
+ */
+static atomic_long_t HEAD;
+static long TAIL;
+static struct pcache_prefetch_work prefetch_work_ring[NR_PREFETCH_WORK];
+static struct task_struct *prefetch_task;
+
+static struct pcache_prefetch_work *alloc_prefetch_work(void)
+{
+	long head;
+
+	do {
+		head = atomic_long_read(&HEAD);
+		if (unlikely(head - READ_ONCE(TAIL) >= NR_PREFETCH_WORK))
+			return NULL;
+	} while (atomic_long_cmpxchg(&HEAD, head, head + 1) != head);
+
+	return prefetch_work_ring + (head % NR_PREFETCH_WORK);
+}
+
+static inline struct pcache_prefetch_info *
+task_prefetch_info(struct task_struct *tsk)
+{
+	return &tsk->pm_data.prefetch;
+}
+
+static inline void reset_prefetch_stream(struct pcache_prefetch_info *info)
+{
+	info->depth = PCACHE_PREFETCH_MIN_DEPTH;
+	info->window_start = 0;
+	info->frontier = 0;
+}
+
+static inline bool in_prefetch_window(struct pcache_prefetch_info *info,
+				      unsigned long address)
+{
+	if (info->stride > 0)
+		return address >= info->window_start && address < info->frontier;
+	return address <= info->window_start && address > info->frontier;
+}
+
+static inline unsigned int
+prefetch_window_nr_lines(struct pcache_prefetch_info *info)
+{
+	long len = info->frontier - info->window_start;
+
+	return len / info->stride;
+}
+
+/*
+ * Clip the window so that it stays within user address space.
+ * Return the number of lines we can prefetch, 0 if none.
+ */
+static unsigned int clip_prefetch_window(unsigned long start, long stride,
+					 unsigned int nr_lines)
+{
+	unsigned int nr;
+
+	for (nr = 0; nr < nr_lines; nr++) {
+		unsigned long addr = start + nr * stride;
+
+		/* Overflow or underflow both land here */
+		if (addr < PCACHE_LINE_SIZE || addr >= TASK_SIZE)
+			break;
+	}
+	return nr;
+}
+
+static void submit_prefetch_window(struct task_struct *tsk,
+				   struct pcache_prefetch_info *info,
+				   unsigned long start)
+{
+	struct pcache_prefetch_work *pw;
+	unsigned int nr_lines;
+
+	nr_lines = clip_prefetch_window(start, info->stride, info->depth);
+	if (!nr_lines)
+		goto drop;
+
+	if (atomic_read(&info->nr_inflight) >= PCACHE_PREFETCH_MAX_INFLIGHT)
+		goto drop;
+
+	pw = alloc_prefetch_work();
+	if (unlikely(!pw))
+		goto drop;
+
+	pw->tsk = tsk;
+	pw->start = start;
+	pw->stride = info->stride;
+	pw->nr_lines = nr_lines;
+	atomic_inc(&info->nr_inflight);
+
+	/* Inform kprefetchd */
+	SetPrefetchWorkUsed(pw);
+
+	info->window_start = start;
+	info->frontier = start + nr_lines * info->stride;
+	inc_pcache_event(PCACHE_PREFETCH_TRIGGERED);
+	return;
+
+drop:
+	info->window_start = 0;
+	info->frontier = 0;
+	inc_pcache_event(PCACHE_PREFETCH_DROPPED);
+}
+
+/**
+ * pcache_prefetch_detect
+ * @tsk: the faulting thread, must be current
+ * @address: the user virtual address that missed in pcache
+ *
+ * Feed one remote pcache miss into @tsk's pattern detector, and submit a
+ * prefetch window if a stream is detected. This is called before the demand
+ * fill goes to network, thus the prefetch overlaps with the demand miss.
+ */
+void pcache_prefetch_detect(struct task_struct *tsk, unsigned long address)
+{
+	struct pcache_prefetch_info *info = task_prefetch_info(tsk);
+	unsigned long line = address & PCACHE_LINE_MASK;
+	long delta = line - info->last_addr;
+
+	if (info->frontier) {
+		if (line == info->frontier) {
+			/* The whole window was consumed, go deeper */
+			add_pcache_event(PCACHE_PREFETCH_USEFUL,
+					 prefetch_window_nr_lines(info));
+			info->depth = min_t(unsigned int, info->depth * 2,
+					    PCACHE_PREFETCH_MAX_DEPTH);
+			submit_prefetch_window(tsk, info, line + info->stride);
+			goto out;
+		}
+
+		if (in_prefetch_window(info, line)) {
+			/* Window is still being filled, or was dropped */
+			inc_pcache_event(PCACHE_PREFETCH_LATE);
+			goto out;
+		}
+
+		/* Stream is broken */
+		info->window_start = 0;
+		info->frontier = 0;
+	}
+
+	if (delta && delta == info->stride &&
+	    abs(delta) <= PCACHE_PREFETCH_MAX_STRIDE * PCACHE_LINE_SIZE) {
+		submit_prefetch_window(tsk, info, line + info->stride);
+	} else {
+		info->stride = delta;
+		reset_prefetch_stream(info);
+	}
+
+out:
+	info->last_addr = line;
+}
+
+/*
+ * Lines of a window are collected into one batch as long as they share
+ * the same pte page and memory node. Thus a single pte lock and a single
+ * P2M_PCACHE_MISS_BATCH round-trip cover all of them.
+ *
+ * Only kprefetchd touches this.
+ */
+struct prefetch_batch {
+	struct pcache_fill_batch	fb;
+	pte_t				*pte[PCACHE_MISS_BATCH_MAX];
+	pte_t				orig_pte[PCACHE_MISS_BATCH_MAX];
+	pmd_t				*pmd;
+	int				dst_nid;
+};
+
+static struct prefetch_batch prefetch_batch;
+
+/*
+ * This mirrors the demand fill path in common_do_fill_page():
+ * the pte lock is held across the fill, so that racing faults on
+ * the same ptes serialize with us.
+ */
+static void prefetch_batch_flush(struct task_struct *tsk,
+				 struct prefetch_batch *pb)
+{
+	struct mm_struct *mm = tsk->mm;
+	struct pcache_fill_batch *fb = &pb->fb;
+	struct pcache_meta *pcm;
+	unsigned int i, nr;
+	spinlock_t *ptl;
+	pte_t entry;
+
+	if (!fb->nr_lines)
+		return;
+
+	ptl = pte_lockptr(mm, pb->pmd);
+	spin_lock(ptl);
+
+	/* Drop lines that were faulted in after we looked */
+	for (i = 0, nr = 0; i < fb->nr_lines; i++) {
+		if (unlikely(!pte_same(*pb->pte[i], pb->orig_pte[i]))) {
+			put_pcache(fb->pcm[i]);
+			inc_pcache_event(PCACHE_PREFETCH_SKIPPED);
+			continue;
+		}
+		fb->address[nr] = fb->address[i];
+		fb->pcm[nr] = fb->pcm[i];
+		pb->pte[nr] = pb->pte[i];
+		nr++;
+	}
+	fb->nr_lines = nr;
+	if (!nr)
+		goto unlock;
+
+	add_pcache_event(PCACHE_PREFETCH_ISSUED, nr);
+	pcache_fill_remote_batch(tsk, pb->dst_nid, fb,
+				 FAULT_FLAG_USER | FAULT_FLAG_PREFETCH);
+
+	for (i = 0; i < nr; i++) {
+		pcm = fb->pcm[i];
+		if (unlikely(!fb->filled[i]))
+			goto fail;
+
+		/*
+		 * Leave the accessed bit clear, so eviction algorithms
+		 * will pick up prefetched but unused lines first.
+		 */
+		entry = pcache_mk_pte(pcm, PAGE_SHARED_EXEC);
+		entry = pte_mkold(entry);
+		entry = pcache_delta_fill_pte(pcm, entry, 0);
+		pte_set(pb->pte[i], entry);
+
+		if (unlikely(pcache_add_rmap(pcm, pb->pte[i], fb->address[i], mm,
+					     tsk->group_leader, RMAP_PREFETCH))) {
+			pte_clear(pb->pte[i]);
+			goto fail;
+		}
+
+		inc_pset_event(pcache_meta_to_pcache_set(pcm), PSET_FILL_MEMORY);
+		inc_pcache_event(PCACHE_PREFETCH_FILLED);
+		continue;
+fail:
+		put_pcache(pcm);
+		inc_pcache_event(PCACHE_PREFETCH_FAIL);
+	}
+
+unlock:
+	spin_unlock(ptl);
+	fb->nr_lines = 0;
+}
+
+static void prefetch_one_line(struct task_struct *tsk,
+			      struct prefetch_batch *pb, unsigned long address)
+{
+	struct mm_struct *mm = tsk->mm;
+	struct pcache_fill_batch *fb = &pb->fb;
+	struct pcache_meta *pcm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, orig_pmd;
+	pte_t *pte;
+	int dst_nid;
+
+	pgd = pgd_offset(mm, address);
+	pud = pud_alloc(mm, pgd, address);
+	if (!pud)
+		goto skipped;
+	pmd = pmd_alloc(mm, pud, address);
+	if (!pmd)
+		goto skipped;
+
+	/* Huge lines are only filled by faults */
+	orig_pmd = READ_ONCE(*pmd);
+	if (pmd_huge_line(orig_pmd) || pmd_huge_line_allowed(orig_pmd))
+		goto skipped;
+
+	pte = pte_alloc(mm, pmd, address);
+	if (!pte)
+		goto skipped;
+
+	/* Already mapped, or a zerofill line which is cheap anyway */
+	if (!pte_none(*pte))
+		goto skipped;
+
+#ifdef CONFIG_PCACHE_EVICTION_PERSET_LIST
+	if (pset_find_eviction(address, tsk))
+		goto skipped;
+#elif defined(CONFIG_PCACHE_EVICTION_VICTIM)
+	if (victim_may_hit(address))
+		goto skipped;
+#endif
+
+	dst_nid = get_memory_node(tsk, address);
+	if (fb->nr_lines &&
+	    (pmd != pb->pmd || dst_nid != pb->dst_nid ||
+	     fb->nr_lines == PCACHE_MISS_BATCH_MAX))
+		prefetch_batch_flush(tsk, pb);
+
+	pcm = pcache_alloc_noevict(address);
+	if (!pcm) {
+		inc_pcache_event(PCACHE_PREFETCH_NO_SLOT);
+		return;
+	}
+
+	pb->pmd = pmd;
+	pb->dst_nid = dst_nid;
+	pb->pte[fb->nr_lines] = pte;
+	pb->orig_pte[fb->nr_lines] = *pte;
+	fb->address[fb->nr_lines] = address;
+	fb->pcm[fb->nr_lines] = pcm;
+	fb->nr_lines++;
+	return;
+
+skipped:
+	inc_pcache_event(PCACHE_PREFETCH_SKIPPED);
+}
+
+static void do_prefetch_work(struct pcache_prefetch_work *pw)
+{
+	struct task_struct *tsk = pw->tsk;
+	struct prefetch_batch *pb = &prefetch_batch;
+	unsigned long address = pw->start;
+	unsigned int i;
+
+	for (i = 0; i < pw->nr_lines; i++, address += pw->stride)
+		prefetch_one_line(tsk, pb, address);
+	prefetch_batch_flush(tsk, pb);
+
+	/*
+	 * @tsk may exit right after this, since
+	 * pcache_prefetch_thread_exit() waits for this counter.
+	 */
+	smp_mb__before_atomic();
+	atomic_dec(&task_prefetch_info(tsk)->nr_inflight);
+}
+
+static int kprefetchd(void *unused)
+{
+	struct pcache_prefetch_work *pw;
+
+	if (pin_current_thread())
+		panic("Fail to pin kprefetchd");
+
+	pr_info("pcache: kprefetchd CPU%d UP\n", smp_processor_id());
+
+	for (;;) {
+		while (TAIL == atomic_long_read(&HEAD))
+			cpu_relax();
+
+		/* Submitter may still be filling this work */
+		pw = prefetch_work_ring + (TAIL % NR_PREFETCH_WORK);
+		while (!PrefetchWorkUsed(pw))
+			cpu_relax();
+
+		do_prefetch_work(pw);
+		ClearPrefetchWorkUsed(pw);
+
+		/* Only now the slot can be reused */
+		smp_wmb();
+		WRITE_ONCE(TAIL, TAIL + 1);
+	}
+	BUG();
+	return 0;
+}
+
+/* Called when a new thread is created */
+void pcache_prefetch_fork(struct task_struct *new)
+{
+	struct pcache_prefetch_info *info = task_prefetch_info(new);
+
+	info->last_addr = 0;
+	info->stride = 0;
+	reset_prefetch_stream(info);
+	atomic_set(&info->nr_inflight, 0);
+}
+
+/*
+ * Called when a thread exits or execs. kprefetchd fills lines on behalf of
+ * @tsk using @tsk->mm, so we must wait until all its windows are done
+ * before the mm goes away.
+ */
+void pcache_prefetch_thread_exit(struct task_struct *tsk)
+{
+	struct pcache_prefetch_info *info = task_prefetch_info(tsk);
+
+	while (atomic_read(&info->nr_inflight))
+		cpu_relax();
+	reset_prefetch_stream(info);
+}
+
+int __init pcache_prefetch_init(void)
+{
+	atomic_long_set(&HEAD, 0);
+	TAIL = 0;
+
+	prefetch_batch.fb.reply = kmalloc(sizeof(*prefetch_batch.fb.reply),
+					  GFP_KERNEL);
+	if (!prefetch_batch.fb.reply)
+		return -ENOMEM;
+
+	prefetch_task = kthread_run(kprefetchd, NULL, "kprefetchd");
+	if (IS_ERR(prefetch_task))
+		return PTR_ERR(prefetch_task);
+	return 0;
+}
@@ -544,6 +544,112 @@ void pcache_remove_rmap(struct pcache_meta *pcm, pte_t *ptep, unsigned long addr
 	 */
 }
 
+#ifdef CONFIG_PCACHE_HUGE_LINE
+/**
+ * pcache_add_huge_rmap
+ * @pcm: head line of a huge line
+ * @pmd: the pmd that maps the huge line
+ * @address: user virtual address mapped to @pcm
+ * @owner_mm: the mm that owns @pmd
+ * @owner_process: the process that owns @owner_mm
+ *
+ * Huge lines are only mapped by one pmd, and only the head line has rmap.
+ * @pmd is locked when called. @pcm must NOT be locked on entry.
+ */
+int pcache_add_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+			 unsigned long address, struct mm_struct *owner_mm,
+			 struct task_struct *owner_process,
+			 enum rmap_caller caller)
+{
+	struct pcache_rmap *rmap;
+	int ret = 0;
+
+	PCACHE_BUG_ON_PCM(PcacheLocked(pcm), pcm);
+	PCACHE_BUG_ON_PCM(!PcacheHuge(pcm), pcm);
+	PCACHE_BUG_ON(caller >= NR_RMAP_CALLER);
+	BUG_ON(!thread_group_leader(owner_process));
+
+	lock_pcache(pcm);
+	PCACHE_BUG_ON_PCM(!list_empty(&pcm->rmap), pcm);
+
+	rmap = alloc_pcache_rmap(pcm);
+	if (!rmap) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	SetRmapHuge(rmap);
+	rmap->pmd = pmd;
+	rmap->address = address & PCACHE_HUGE_LINE_MASK;
+	rmap->owner_mm = owner_mm;
+	rmap->owner_process = owner_process;
+	rmap->caller = caller;
+
+	list_add(&rmap->next, &pcm->rmap);
+	atomic_inc(&pcm->mapcount);
+	SetPcacheValid(pcm);
+out:
+	unlock_pcache(pcm);
+	return ret;
+}
+
+static struct pcache_rmap *
+find_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+	       unsigned long address, struct mm_struct *owner_mm)
+{
+	struct pcache_rmap *rmap;
+
+	list_for_each_entry(rmap, &pcm->rmap, next) {
+		if (RmapHuge(rmap) && rmap->pmd == pmd &&
+		    rmap->owner_mm == owner_mm &&
+		    rmap->address == (address & PCACHE_HUGE_LINE_MASK))
+			return rmap;
+	}
+
+	dump_pcache_meta(pcm, "fail to find huge rmap");
+	WARN_ON_ONCE(1);
+	return NULL;
+}
+
+/*
+ * @pcm is locked when called
+ */
+void pcache_remove_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+			     unsigned long address, struct mm_struct *owner_mm)
+{
+	struct pcache_rmap *rmap;
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+
+	rmap = find_huge_rmap(pcm, pmd, address, owner_mm);
+	if (rmap) {
+		ClearRmapHuge(rmap);
+		__pcache_remove_rmap(pcm, rmap);
+	}
+}
+
+/*
+ * Turn the huge rmap of head line @pcm into a normal rmap, since @pcm is
+ * mapped by @page_table from now on. Mapcount does not change, so @pcm
+ * stays Valid all along. @pcm is locked when called.
+ */
+void pcache_split_huge_rmap(struct pcache_meta *pcm, pmd_t *pmd,
+			    unsigned long address, struct mm_struct *owner_mm,
+			    pte_t *page_table)
+{
+	struct pcache_rmap *rmap;
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+
+	rmap = find_huge_rmap(pcm, pmd, address, owner_mm);
+	if (rmap) {
+		ClearRmapHuge(rmap);
+		rmap->page_table = page_table;
+		rmap->caller = RMAP_HUGE_SPLIT;
+	}
+}
+#endif
+
 struct pcache_move_pte_info {
 	struct mm_struct *mm;
 	pte_t *old_pte;
@@ -22,6 +22,17 @@ static const char *const pcache_event_text[] = {
 	"nr_clflush_fail",
 	"nr_clflush_piggyback_fallback",
 
+	"nr_writeback_submitted",
+	"nr_writeback_fallback_busy",
+	"nr_writeback_fallback_noentry",
+	"nr_writeback_batch",
+	"nr_writeback_retry",
+
+	"nr_delta_twin_alloc",
+	"nr_delta_twin_fail",
+	"nr_delta_clean",
+	"nr_delta_chunks",
+
 	/* write-protection fault */
 	"nr_pgfault_wp",
 	"nr_pgfault_wp_cow",
@@ -30,10 +41,16 @@ static const char *const pcache_event_text[] = {
 	"nr_pgfault_due_to_concurrent_eviction",	/* perset list specific */
 
 	"nr_pcache_fill_zerofill",
+	"nr_zerofill_pool_hit",
+	"nr_zerofill_pool_refill",
+	"nr_zerofill_around",
 	"nr_pcache_fill_from_memory",
 	"nr_pcache_fill_from_memory_piggyback",
 	"nr_pcache_fill_from_memory_piggyback_fallback",
 	"nr_pcache_fill_from_victim",			/* victim cache specific */
+	"nr_pcache_fill_batch",
+	"nr_pcache_fill_batch_lines",
+	"nr_pcache_alloc_free_race",
 
 	"nr_pcache_eviction_triggered",
 	"nr_pcache_eviction_eagain_freeable",
@@ -63,11 +80,39 @@ static const char *const pcache_event_text[] = {
 	"nr_victim_flush_async_run",
 	"nr_victim_flush_sync",
 
+	/* prefetch */
+	"nr_prefetch_triggered",
+	"nr_prefetch_dropped",
+	"nr_prefetch_issued",
+	"nr_prefetch_filled",
+	"nr_prefetch_skipped",
+	"nr_prefetch_no_slot",
+	"nr_prefetch_fail",
+	"nr_prefetch_useful",
+	"nr_prefetch_late",
+
+	/* huge lines */
+	"nr_huge_fault",
+	"nr_huge_fill",
+	"nr_huge_fill_zerofill",
+	"nr_huge_fallback",
+	"nr_huge_evict",
+	"nr_huge_evict_dirty",
+	"nr_huge_second_chance",
+	"nr_huge_split",
+	"nr_huge_zap",
+
 	/* sweep */
 	"nr_sweep_run",
 	"nr_sweep_nr_pset",
 	"nr_sweep_nr_moved_pcm",
 
+	/* clock */
+	"nr_clock_scan",
+	"nr_clock_second_chance",
+	"nr_clock_promote",
+	"nr_clock_demote",
+
 	"nr_mremap_pset_same",
 	"nr_mremap_pset_diff",
 
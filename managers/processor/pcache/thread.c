@@ -79,6 +79,9 @@ void pcache_process_exit(struct task_struct *tsk)
 {
 	/* will also free rmap */
 	release_pgtable(tsk, PAGE_SIZE, TASK_SIZE);
+
+	/* Eviction entries in flight still point to us */
+	pcache_writeback_drain();
 }
 
 /*
@@ -88,5 +91,5 @@ void pcache_process_exit(struct task_struct *tsk)
  */
 void pcache_thread_exit(struct task_struct *tsk)
 {
-
+	pcache_prefetch_thread_exit(tsk);
 }
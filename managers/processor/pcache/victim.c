@@ -17,6 +17,8 @@
 #include <lego/pgfault.h>
 #include <lego/jiffies.h>
 #include <lego/kthread.h>
+#include <lego/percpu.h>
+#include <lego/seqlock.h>
 #include <lego/memblock.h>
 #include <lego/completion.h>
 #include <processor/node.h>
@@ -139,9 +141,24 @@
  * (victim_check_hit_entry() and find_victim_to_evict())
  *
  * E)
+ * Lookup index:
+ * Every hit entry is also hashed by (tgid, address) into victim_hash_table,
+ * so pcache fill path finds its victim without walking all of them.
+ * Readers do not lock, each bucket has a seqlock to detect writers.
+ * Hit entries are never returned to slab, they are recycled through
+ * victim_hit_free_list instead. Thus a reader racing with removal
+ * always reads a valid entry, at worst on another chain, and retries.
+ * The index only gives a candidate, victim_check_hit_entry() decides.
+ *
+ * An entry is unhashed when its victim is about to be consumed by fill
+ * (Nohit set), or freed. Before that it stays hashed, so a lookup never
+ * misses a victim that may still hold dirty data.
+ *
+ * F)
  * Lock ordering:
  *  usable_victims_lock
  *   .. victim->lock
+ *     .. victim_hash_table[].lock
  */
 
 #ifdef CONFIG_DEBUG_PCACHE_VICTIM
@@ -152,9 +169,22 @@
 static inline void victim_debug(const char *fmt, ...) { }
 #endif
 
-struct pcache_victim_meta pcache_victim_meta_map[VICTIM_NR_ENTRIES] __read_mostly;
+struct pcache_victim_meta *pcache_victim_meta_map __read_mostly;
 void *pcache_victim_data_map __read_mostly;
 
+struct victim_index_bucket {
+	seqlock_t		lock;
+	struct hlist_head	head;
+};
+
+static struct victim_index_bucket victim_hash_table[VICTIM_HASH_SIZE];
+
+static LIST_HEAD(victim_hit_free_list);
+static DEFINE_SPINLOCK(victim_hit_free_lock);
+
+/* Where each CPU starts searching for a free victim */
+static DEFINE_PER_CPU(unsigned int, victim_alloc_hint);
+
 static atomic_t nr_usable_victims = ATOMIC_INIT(0);
 static LIST_HEAD(usable_victims);
 static DEFINE_SPINLOCK(usable_victims_lock);
@@ -380,14 +410,25 @@ static inline void prep_new_victim(struct pcache_victim_meta *victim)
 	INIT_LIST_HEAD(&victim->hits);
 }
 
+/*
+ * Each CPU starts from where it found a free victim last time,
+ * and CPUs start from different places, so they rarely race
+ * for the same entry even if the victim cache is large.
+ */
 static __always_inline struct pcache_victim_meta *
 victim_alloc_fastpath(void)
 {
-	int index;
+	unsigned int i, index;
 	struct pcache_victim_meta *v;
 
-	for_each_victim(v, index) {
+	index = this_cpu_read(victim_alloc_hint);
+	for (i = 0; i < VICTIM_NR_ENTRIES; i++, index++) {
+		if (unlikely(index >= VICTIM_NR_ENTRIES))
+			index = 0;
+
+		v = pcache_victim_meta_map + index;
 		if (likely(!TestSetVictimAllocated(v))) {
+			this_cpu_write(victim_alloc_hint, index + 1);
 			prep_new_victim(v);
 
 			/*
@@ -474,7 +515,7 @@ retry:
 			jiffies_to_msecs(jiffies - alloc_start),
 			atomic_read(&nr_usable_victims),
 			pcache_set_to_set_index(pset), pcache_set_victim_nr(pset),
-			IS_ENABLED(CONFIG_PCACHE_EVICT_LRU) ? atomic_read(&pset->nr_lru) : 0,
+			pset_nr_lru(pset),
 			address);
 
 		/*
@@ -507,22 +548,126 @@ victim_alloc(struct pcache_set *pset, unsigned long address)
 	return NULL;
 }
 
-/* We might consider kmemcache here */
+/*
+ * Hit entries are recycled, never freed to slab.
+ * Lockless index readers may still be looking at them.
+ */
 static inline struct pcache_victim_hit_entry *
 alloc_victim_hit_entry(void)
 {
-	struct pcache_victim_hit_entry *entry;
+	struct pcache_victim_hit_entry *entry = NULL;
 
-	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
-	if (entry) {
-		INIT_LIST_HEAD(&entry->next);
+	spin_lock(&victim_hit_free_lock);
+	if (!list_empty(&victim_hit_free_list)) {
+		entry = list_first_entry(&victim_hit_free_list,
+					 struct pcache_victim_hit_entry, next);
+		list_del(&entry->next);
 	}
+	spin_unlock(&victim_hit_free_lock);
+
+	if (!entry) {
+		entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+		if (!entry)
+			return NULL;
+	}
+
+	INIT_LIST_HEAD(&entry->next);
+	INIT_HLIST_NODE(&entry->hnode);
 	return entry;
 }
 
 static inline void free_victim_hit_entry(struct pcache_victim_hit_entry *entry)
 {
-	kfree(entry);
+	spin_lock(&victim_hit_free_lock);
+	list_add(&entry->next, &victim_hit_free_list);
+	spin_unlock(&victim_hit_free_lock);
+}
+
+static inline unsigned int victim_index_hash(pid_t tgid, unsigned long address)
+{
+	return hash_long((address >> PAGE_SHIFT) ^ tgid, VICTIM_HASH_BITS);
+}
+
+static void victim_index_insert(struct pcache_victim_hit_entry *entry)
+{
+	struct victim_index_bucket *b;
+
+	entry->bucket = victim_index_hash(entry->tgid, entry->address);
+	b = &victim_hash_table[entry->bucket];
+
+	write_seqlock(&b->lock);
+	hlist_add_head(&entry->hnode, &b->head);
+	write_sequnlock(&b->lock);
+}
+
+/*
+ * Unhash @entry, if it is hashed.
+ * Its ->next is left intact, so a reader standing on it can move on.
+ */
+static void victim_index_remove(struct pcache_victim_hit_entry *entry)
+{
+	struct victim_index_bucket *b;
+
+	if (hlist_unhashed(&entry->hnode))
+		return;
+
+	b = &victim_hash_table[entry->bucket];
+	write_seqlock(&b->lock);
+	__hlist_del(&entry->hnode);
+	entry->hnode.pprev = NULL;
+	write_sequnlock(&b->lock);
+}
+
+/* Caller holds victim->lock */
+static void victim_index_remove_all(struct pcache_victim_meta *victim)
+{
+	struct pcache_victim_hit_entry *entry;
+
+	list_for_each_entry(entry, &victim->hits, next)
+		victim_index_remove(entry);
+}
+
+/*
+ * Find the victim that may have @address of @tgid, other than @skip.
+ * The result is only a hint, which must be verified
+ * by victim_check_hit_entry().
+ */
+static struct pcache_victim_meta *
+victim_index_lookup(pid_t tgid, unsigned long address,
+		    struct pcache_victim_meta *skip)
+{
+	struct pcache_victim_hit_entry *entry;
+	struct pcache_victim_meta *victim;
+	struct victim_index_bucket *b;
+	unsigned int hash, seq, walked;
+
+	hash = victim_index_hash(tgid, address);
+	b = &victim_hash_table[hash];
+
+	do {
+		seq = read_seqbegin(&b->lock);
+		victim = NULL;
+		walked = 0;
+
+		hlist_for_each_entry(entry, &b->head, hnode) {
+			/*
+			 * Entry was moved to another chain under us,
+			 * or the chain is changing too fast, retry:
+			 */
+			if (unlikely(READ_ONCE(entry->bucket) != hash ||
+				     ++walked > VICTIM_HASH_SIZE))
+				break;
+
+			if (READ_ONCE(entry->address) == address &&
+			    READ_ONCE(entry->tgid) == tgid &&
+			    READ_ONCE(entry->victim) != skip) {
+				victim = READ_ONCE(entry->victim);
+				break;
+			}
+		}
+	} while (read_seqretry(&b->lock, seq));
+
+	return victim;
 }
 
 static void victim_free_hit_entries(struct pcache_victim_meta *victim)
@@ -541,6 +686,7 @@ static void victim_free_hit_entries(struct pcache_victim_meta *victim)
 		entry = list_entry(victim->hits.next,
 				   struct pcache_victim_hit_entry, next);
 		list_del(&entry->next);
+		victim_index_remove(entry);
 		free_victim_hit_entry(entry);
 	}
 	spin_unlock(&victim->lock);
@@ -561,6 +707,7 @@ static int victim_insert_hit_entry(struct pcache_meta *pcm,
 
 	hit->address = rmap->address;
 	hit->tgid = rmap->owner_process->tgid;
+	hit->victim = victim;
 
 	/*
 	 * This rmap belongs the current evicted pcm
@@ -577,6 +724,7 @@ static int victim_insert_hit_entry(struct pcache_meta *pcm,
 
 	spin_lock(&victim->lock);
 	list_add(&hit->next, &victim->hits);
+	victim_index_insert(hit);
 	spin_unlock(&victim->lock);
 
 	return PCACHE_RMAP_AGAIN;
@@ -675,11 +823,14 @@ void victim_finish_insert(struct pcache_victim_meta *victim, bool dirty)
 	/*
 	 * Safely copy the pcache line to victim cache
 	 * The pcache line was already unmapped and no changes
-	 * would be made during memcpy:
+	 * would be made during memcpy.
+	 *
+	 * Victim is only read back on a later refill, or by flush,
+	 * so keep it out of CPU cache:
 	 */
 	src = pcache_meta_to_kva(pcm);
 	dst = pcache_victim_to_kva(victim);
-	memcpy(dst, src, PCACHE_LINE_SIZE);
+	copy_pages_nocache(dst, src, PCACHE_LINE_NR_PAGES);
 
 	victim->pcm = NULL;
 	smp_wmb();
@@ -805,7 +956,9 @@ out:
 
 /*
  * Try to find if victim contains cache line maps to @address and current.
- * We walk through all allocated victim cache lines and check one by one.
+ * Candidates come from the lookup index, and are verified one by one.
+ * A candidate that is going away is skipped, its entries will be
+ * unhashed soon, which may expose another candidate behind it.
  *
  * Return 0 on success, otherwise on failures
  */
@@ -813,17 +966,23 @@ int victim_try_fill_pcache(struct mm_struct *mm, unsigned long address,
 			   pte_t *page_table, pte_t orig_pte, pmd_t *pmd,
 			   unsigned long flags)
 {
-	struct pcache_victim_meta *v, *safer;
+	struct pcache_victim_meta *v, *skip = NULL;
 	enum victim_check_status result;
 	int ret = 1;
 
 	inc_pcache_event(PCACHE_VICTIM_LOOKUP);
 
-	spin_lock(&usable_victims_lock);
-	list_for_each_entry_safe(v, safer, &usable_victims, next) {
-		PCACHE_BUG_ON_VICTIM(VictimReclaim(v), v);
-		if (unlikely(!get_victim_unless_zero(v)))
+	for (;;) {
+		v = victim_index_lookup(current->tgid, address & PAGE_MASK, skip);
+		if (!v)
+			break;
+
+		if (unlikely(!get_victim_unless_zero(v))) {
+			skip = v;
+			cpu_relax();
 			continue;
+		}
+		PCACHE_BUG_ON_VICTIM(VictimReclaim(v), v);
 
 		result = victim_check_hit_entry(v, address, current, true);
 		if (result == VICTIM_HIT) {
@@ -833,10 +992,8 @@ int victim_try_fill_pcache(struct mm_struct *mm, unsigned long address,
 			 * If pcache is already full, it will evict one to victim.
 			 * If victim is also full, victim needs to evict one, too.
 			 * This eventually goes to find_victim_to_evict().
-			 * So, _don't_ hold the same lock:
+			 * So, _don't_ hold any victim lock here.
 			 */
-			spin_unlock(&usable_victims_lock);
-
 			inc_pcache_event(PCACHE_VICTIM_HIT);
 			ret = victim_fill_pcache(mm, address, page_table, orig_pte,
 						 pmd, flags, v);
@@ -877,6 +1034,9 @@ int victim_try_fill_pcache(struct mm_struct *mm, unsigned long address,
 					BUG();
 				}
 
+				/* No more hits, stop lookups from finding it */
+				victim_index_remove_all(v);
+
 				if (likely(!ret)) {
 					/*
 					 * Once we have dec the fill counter to 0
@@ -902,27 +1062,34 @@ int victim_try_fill_pcache(struct mm_struct *mm, unsigned long address,
 			goto out;
 		} else if (result == VICTIM_MISS) {
 			/*
-			 * If it is miss, we do not need to release the lock.
-			 * But we do need to decrement 1 reference. Meanwhile
-			 * there might be another thread having a hit and tried
+			 * The index raced with a free, or this victim has
+			 * been consumed. Drop our reference, meanwhile there
+			 * might be another thread having a hit and tried
 			 * to free the pcache line:
 			 */
-			if (unlikely(put_victim_testzero(v))) {
-				__dequeue_usable_victim(v);
-				__put_victim_nolist(v);
-			}
+			put_victim(v);
+			skip = v;
 			continue;
 		} else
 			BUG();
 	}
-	spin_unlock(&usable_victims_lock);
 out:
 	return ret;
 }
 
 static void __init victim_cache_init_meta_map(void)
 {
-	int i;
+	int i, cpu;
+
+	for (i = 0; i < VICTIM_HASH_SIZE; i++) {
+		seqlock_init(&victim_hash_table[i].lock);
+		INIT_HLIST_HEAD(&victim_hash_table[i].head);
+	}
+
+	/* Spread out where CPUs start looking for free victims */
+	for_each_possible_cpu(cpu)
+		per_cpu(victim_alloc_hint, cpu) =
+			(cpu * (VICTIM_NR_ENTRIES / NR_CPUS)) % VICTIM_NR_ENTRIES;
 
 	/* Initialize each victim meta */
 	for (i = 0; i < VICTIM_NR_ENTRIES; i++) {
@@ -957,5 +1124,11 @@ void __init victim_cache_early_init(void)
 		panic("Unable to allocate victim data map!");
 	memset(pcache_victim_data_map, 0, size);
 
+	/* and their metadata */
+	size = VICTIM_NR_ENTRIES * sizeof(struct pcache_victim_meta);
+	pcache_victim_meta_map = memblock_virt_alloc(size, L1_CACHE_BYTES);
+	if (!pcache_victim_meta_map)
+		panic("Unable to allocate victim meta map!");
+
 	victim_cache_init_meta_map();
 }
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Asynchronous dirty line write-back for per-set eviction list.
+ *
+ * Eviction copies a dirty line into a writeback entry and returns right
+ * away, instead of waiting a full network RTT in __clflush_one(). Entries
+ * are queued per memory node, and kwritebackd coalesces each queue into
+ * P2M_PCACHE_FLUSH_BATCH messages of up to PCACHE_FLUSH_BATCH_MAX lines.
+ * The dirty chunks are sent from the entries in place, as an IB sg list.
+ * Up to PCACHE_WB_NR_INFLIGHT messages per node are in flight, a failed
+ * one is sent again synchronously. If that keeps failing, its lines are
+ * flushed one by one, until the network delivers them.
+ *
+ * Correctness relies on the per-set eviction entry: it stays in the pset
+ * list until the flush is acked by memory, so pcache fill path will wait
+ * for in-flight lines exactly as it does for sync flush.
+ *
+ * Each node can have at most PCACHE_WB_MAX_PER_NODE lines pending.
+ * Beyond that, or if the entry pool is empty, eviction falls back to
+ * the synchronous flush, which naturally throttles the evictors.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/net.h>
+#include <lego/kthread.h>
+#include <lego/profile.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <processor/pcache.h>
+#include <processor/distvm.h>
+#include <processor/processor.h>
+#include <processor/replication.h>
+
+#ifdef CONFIG_DEBUG_PCACHE_FLUSH
+#define writeback_debug(fmt, ...)	\
+	pr_debug("%s(): " fmt "\n", __func__, __VA_ARGS__)
+#else
+static inline void writeback_debug(const char *fmt, ...) { }
+#endif
+
+static struct pcache_wb_queue wb_queues[MAX_NODE];
+
+/* Number of entries sitting in all queues, not including in-flight ones */
+static atomic_t nr_queued = ATOMIC_INIT(0);
+
+static struct pcache_wb_entry *wb_entry_pool;
+static LIST_HEAD(wb_free_list);
+static DEFINE_SPINLOCK(wb_free_lock);
+
+static struct task_struct *writeback_task;
+
+static struct pcache_wb_entry *alloc_wb_entry(void)
+{
+	struct pcache_wb_entry *wbe = NULL;
+
+	spin_lock(&wb_free_lock);
+	if (likely(!list_empty(&wb_free_list))) {
+		wbe = list_first_entry(&wb_free_list, struct pcache_wb_entry, next);
+		list_del(&wbe->next);
+	}
+	spin_unlock(&wb_free_lock);
+	return wbe;
+}
+
+static void free_wb_entry(struct pcache_wb_entry *wbe)
+{
+	spin_lock(&wb_free_lock);
+	list_add(&wbe->next, &wb_free_list);
+	spin_unlock(&wb_free_lock);
+}
+
+/**
+ * pcache_writeback_submit
+ * @pset: the pcache set @pcm belongs to
+ * @pcm: the dirty line being evicted
+ *
+ * Copy @pcm out and queue it for write-back. Called by per-set eviction
+ * after @pcm is unmapped, and @pcm must have exactly one eviction entry,
+ * whose information is saved in @pcm->pb.
+ *
+ * Return 0 if queued, and the eviction entry is owned by us from now on.
+ * Otherwise caller needs to flush synchronously.
+ */
+int pcache_writeback_submit(struct pcache_set *pset, struct pcache_meta *pcm)
+{
+	struct piggyback_info *pb = &pcm->pb;
+	struct pcache_wb_queue *q;
+	struct pcache_wb_entry *wbe;
+
+	if (WARN_ON_ONCE(pb->memory_nid >= MAX_NODE))
+		return -EINVAL;
+	q = &wb_queues[pb->memory_nid];
+
+	if (unlikely(atomic_inc_return(&q->nr_pending) > PCACHE_WB_MAX_PER_NODE)) {
+		atomic_dec(&q->nr_pending);
+		inc_pcache_event(PCACHE_WB_FALLBACK_BUSY);
+		return -EBUSY;
+	}
+
+	wbe = alloc_wb_entry();
+	if (unlikely(!wbe)) {
+		atomic_dec(&q->nr_pending);
+		inc_pcache_event(PCACHE_WB_FALLBACK_NOENTRY);
+		return -ENOMEM;
+	}
+
+	wbe->pset = pset;
+	wbe->tgid = pb->tgid;
+	wbe->user_va = pb->user_addr & PCACHE_LINE_MASK;
+	wbe->m_nid = pb->memory_nid;
+	wbe->rep_nid = pb->replication_nid;
+	wbe->nr_chunks = pcache_delta_dirty_map(pcm, wbe->dirty);
+	/* Only read by the HCA, keep it out of CPU cache */
+	copy_pages_nocache(wbe->data, pcache_meta_to_kva(pcm), PCACHE_LINE_NR_PAGES);
+	wbe->pee = pset_detach_eviction(pset, pcm);
+
+	spin_lock(&q->lock);
+	list_add_tail(&wbe->next, &q->head);
+	q->nr_submitted++;
+	spin_unlock(&q->lock);
+	atomic_inc(&nr_queued);
+
+	writeback_debug("tgid:%u user_va:%#lx m_nid:%u",
+		wbe->tgid, wbe->user_va, wbe->m_nid);
+
+	inc_pcache_event(PCACHE_WB_SUBMITTED);
+	return 0;
+}
+
+/*
+ * Move queued entries into @b, as many as one message can carry.
+ * Return the number of entries taken.
+ */
+static int writeback_fill_batch(struct pcache_wb_queue *q, struct pcache_wb_batch *b)
+{
+	struct p2m_flush_batch_msg *msg = b->msg;
+	struct pcache_wb_entry *wbe;
+	int room;
+
+	b->nr = 0;
+	b->nr_chunks = 0;
+	b->iov[0].addr = msg;
+	b->iov[0].len = P2M_FLUSH_BATCH_MSG_SIZE(0);
+	b->nr_iov = 1;
+
+	spin_lock(&q->lock);
+	while (!list_empty(&q->head) && b->nr < PCACHE_FLUSH_BATCH_MAX) {
+		room = FIT_MAX_IOV - b->nr_iov;
+		if (!room)
+			break;
+
+		wbe = list_first_entry(&q->head, struct pcache_wb_entry, next);
+		list_del(&wbe->next);
+
+		b->nr_iov += pcache_dirty_to_iov(wbe->data, wbe->dirty, &wbe->nr_chunks,
+						 &b->iov[b->nr_iov], room);
+		b->nr_chunks += wbe->nr_chunks;
+		b->entries[b->nr++] = wbe;
+	}
+	spin_unlock(&q->lock);
+
+	if (b->nr)
+		atomic_sub(b->nr, &nr_queued);
+	return b->nr;
+}
+
+/* Put entries of a batch that could not be posted back, in order */
+static void writeback_unfill_batch(struct pcache_wb_queue *q, struct pcache_wb_batch *b)
+{
+	int i;
+
+	spin_lock(&q->lock);
+	for (i = b->nr - 1; i >= 0; i--)
+		list_add(&b->entries[i]->next, &q->head);
+	spin_unlock(&q->lock);
+	atomic_add(b->nr, &nr_queued);
+}
+
+/*
+ * Build the header of @b and post it, without waiting for the reply.
+ * Return 0 if posted, -EBUSY if FIT has no room now.
+ */
+static int writeback_post_batch(struct pcache_wb_batch *b, int nid)
+{
+	struct p2m_flush_batch_msg *msg = b->msg;
+	struct pcache_wb_entry *wbe;
+	int i, ret;
+
+	fill_common_header(msg, P2M_PCACHE_FLUSH_BATCH);
+	msg->nr_lines = b->nr;
+	for (i = 0; i < b->nr; i++) {
+		wbe = b->entries[i];
+		msg->lines[i].pid = wbe->tgid;
+		msg->lines[i].user_va = wbe->user_va;
+		bitmap_copy(msg->lines[i].dirty, wbe->dirty, PCACHE_LINE_NR_CHUNKS);
+	}
+
+	b->done = false;
+	b->start_time = jiffies;
+	ret = ibapi_send_reply_iov_async(nid, b->iov, b->nr_iov, &b->reply,
+					 sizeof(b->reply), false, &b->req);
+	if (likely(!ret))
+		inc_pcache_event(PCACHE_WB_BATCH);
+	return ret;
+}
+
+/*
+ * The batch failed or timed out. Send it again synchronously,
+ * lines must not be dropped. Rewriting lines already written
+ * by the failed attempt is harmless.
+ */
+static int writeback_retry_batch(struct pcache_wb_batch *b, int nid)
+{
+	int i, ret, reply = -EIO;
+
+	for (i = 0; i < PCACHE_WB_MAX_RETRY; i++) {
+		inc_pcache_event(PCACHE_WB_RETRY);
+		ret = ibapi_send_reply_iov(nid, b->iov, b->nr_iov, &b->reply,
+					   sizeof(b->reply), false, DEF_NET_TIMEOUT);
+		reply = (ret == sizeof(b->reply)) ? b->reply : -EIO;
+		if (!reply)
+			break;
+	}
+	return reply;
+}
+
+/*
+ * Last resort of a batch that could not be written: flush each line
+ * on its own, as a whole, and keep trying while the network fails.
+ * A line memory refuses, e.g. its task or vma is gone there, has
+ * nobody left to read it.
+ */
+static void writeback_flush_lines(struct pcache_wb_batch *b, int nid, int reply)
+{
+	struct pcache_wb_entry *wbe;
+	int i;
+
+	WARN(1, "pcache: writeback to node %d failed, reply: %d. Flush %d lines one by one\n",
+		nid, reply, b->nr);
+
+	for (i = 0; i < b->nr; i++) {
+		wbe = b->entries[i];
+
+		/* __clflush_one() replicates as well */
+		while ((reply = __clflush_one(wbe->tgid, wbe->user_va, wbe->m_nid,
+					      wbe->rep_nid, wbe->data)) == -EIO)
+			schedule();
+
+		if (unlikely(reply))
+			pr_err("pcache: node %d refused line tgid:%u user_va:%#lx, reply: %d\n",
+				nid, wbe->tgid, wbe->user_va, reply);
+	}
+}
+
+static void writeback_complete_batch(struct pcache_wb_batch *b, int nid, int ret)
+{
+	struct pcache_wb_entry *wbe;
+	int i, reply;
+
+	reply = (ret == sizeof(b->reply)) ? b->reply : -EIO;
+	if (unlikely(reply))
+		reply = writeback_retry_batch(b, nid);
+
+	add_pcache_event(PCACHE_CLFLUSH, b->nr);
+	add_pcache_event(PCACHE_DELTA_CHUNKS, b->nr_chunks);
+	inc_pcache_event_cond(PCACHE_CLFLUSH_FAIL, !!reply);
+
+	writeback_debug("nid:%d nr:%d reply:%d", nid, b->nr, reply);
+
+	if (unlikely(reply))
+		writeback_flush_lines(b, nid, reply);
+
+	for (i = 0; i < b->nr; i++) {
+		wbe = b->entries[i];
+
+		if (likely(!reply))
+			replicate(wbe->tgid, wbe->user_va, wbe->m_nid,
+				  wbe->rep_nid, wbe->data);
+
+		/* Concurrent pgfault on this line is now safe to go */
+		pset_remove_eviction_entry(wbe->pset, wbe->pee);
+		free_wb_entry(wbe);
+	}
+	b->done = true;
+}
+
+static inline struct pcache_wb_batch *
+wb_batch(struct pcache_wb_queue *q, unsigned int i)
+{
+	return &q->batches[i % PCACHE_WB_NR_INFLIGHT];
+}
+
+/*
+ * Collect replies of in-flight batches of @q, then post new ones
+ * until PCACHE_WB_NR_INFLIGHT are in flight or the queue is empty.
+ * Return the number of batches still in flight.
+ */
+static unsigned int writeback_progress_queue(struct pcache_wb_queue *q, int nid)
+{
+	struct pcache_wb_batch *b;
+	unsigned int i;
+	int ret;
+
+	for (i = q->batch_head; i != q->batch_tail; i++) {
+		b = wb_batch(q, i);
+		if (b->done)
+			continue;
+
+		ret = ibapi_poll_reply(&b->req);
+		if (ret == -EAGAIN) {
+			if (likely(!time_after(jiffies, b->start_time + DEF_NET_TIMEOUT * HZ)))
+				continue;
+
+			/* @b will be reused, drop its late reply */
+			ret = ibapi_abandon_reply(&b->req);
+		}
+		writeback_complete_batch(b, nid, ret);
+	}
+
+	/* Retire in order, so drain sees a FIFO */
+	while (q->batch_head != q->batch_tail) {
+		b = wb_batch(q, q->batch_head);
+		if (!b->done)
+			break;
+
+		smp_wmb();
+		WRITE_ONCE(q->nr_completed, q->nr_completed + b->nr);
+		atomic_sub(b->nr, &q->nr_pending);
+		q->batch_head++;
+	}
+
+	while (q->batch_tail - q->batch_head < PCACHE_WB_NR_INFLIGHT) {
+		b = wb_batch(q, q->batch_tail);
+		if (!writeback_fill_batch(q, b))
+			break;
+
+		if (writeback_post_batch(b, nid)) {
+			writeback_unfill_batch(q, b);
+			break;
+		}
+		q->batch_tail++;
+	}
+	return q->batch_tail - q->batch_head;
+}
+
+static int kwritebackd(void *unused)
+{
+	unsigned int nr_inflight;
+	int nid;
+
+	if (pin_current_thread())
+		panic("Fail to pin kwritebackd");
+
+	pr_info("pcache: kwritebackd CPU%d UP\n", smp_processor_id());
+
+	for (;;) {
+		nr_inflight = 0;
+		for (nid = 0; nid < MAX_NODE; nid++)
+			nr_inflight += writeback_progress_queue(&wb_queues[nid], nid);
+
+		if (!nr_inflight) {
+			while (!atomic_read(&nr_queued))
+				cpu_relax();
+		}
+	}
+	BUG();
+	return 0;
+}
+
+/*
+ * Wait until all lines queued before this call are flushed.
+ * Eviction entries point to their owner tasks, so process exit
+ * calls this before the tasks go away.
+ */
+void pcache_writeback_drain(void)
+{
+	struct pcache_wb_queue *q;
+	unsigned long target;
+	int nid;
+
+	for (nid = 0; nid < MAX_NODE; nid++) {
+		q = &wb_queues[nid];
+
+		spin_lock(&q->lock);
+		target = q->nr_submitted;
+		spin_unlock(&q->lock);
+
+		while (READ_ONCE(q->nr_completed) < target)
+			cpu_relax();
+	}
+}
+
+int __init pcache_writeback_init(void)
+{
+	int i, j;
+
+	for (i = 0; i < MAX_NODE; i++) {
+		struct pcache_wb_queue *q = &wb_queues[i];
+
+		spin_lock_init(&q->lock);
+		INIT_LIST_HEAD(&q->head);
+		atomic_set(&q->nr_pending, 0);
+
+		/* Only the header part, the lines are sent in place */
+		q->batches = kzalloc(sizeof(*q->batches) * PCACHE_WB_NR_INFLIGHT,
+				     GFP_KERNEL);
+		if (!q->batches)
+			return -ENOMEM;
+		for (j = 0; j < PCACHE_WB_NR_INFLIGHT; j++) {
+			q->batches[j].msg = kmalloc(P2M_FLUSH_BATCH_MSG_SIZE(0), GFP_KERNEL);
+			if (!q->batches[j].msg)
+				return -ENOMEM;
+		}
+	}
+
+	wb_entry_pool = kzalloc(sizeof(*wb_entry_pool) * PCACHE_WB_NR_ENTRIES,
+				GFP_KERNEL);
+	if (!wb_entry_pool)
+		return -ENOMEM;
+
+	/* One line each, a single buffer for all could be megabytes */
+	for (i = 0; i < PCACHE_WB_NR_ENTRIES; i++) {
+		wb_entry_pool[i].data = (void *)__get_free_pages(GFP_KERNEL,
+						get_order(PCACHE_LINE_SIZE));
+		if (!wb_entry_pool[i].data)
+			return -ENOMEM;
+		list_add_tail(&wb_entry_pool[i].next, &wb_free_list);
+	}
+
+	writeback_task = kthread_run(kwritebackd, NULL, "kwritebackd");
+	if (IS_ERR(writeback_task))
+		return PTR_ERR(writeback_task);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Pre-zeroed pcache line pool
+ *
+ * kzerofilld walks all sets, and keeps up to PCACHE_ZEROFILL_POOL_LINES
+ * free ways of each set zeroed, tracked by pset->zero_map. A way is taken
+ * off free_map while it is being cleared, so allocation never sees a half
+ * cleared line. Lines are cleared with non-temporal stores, they will not
+ * be touched until some zerofill fault, and there is no point in pulling
+ * them into CPU cache now.
+ *
+ * Allocation claims the zero bit together with the way, check
+ * pcache_claim_zeroed().
+ */
+
+#include <lego/mm.h>
+#include <lego/delay.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/comp_common.h>
+#include <processor/pcache.h>
+#include <processor/zerofill.h>
+#include <processor/processor.h>
+
+#define PCACHE_ZEROFILL_POOL_LINES	(CONFIG_PCACHE_ZEROFILL_POOL_LINES)
+
+/* How long kzerofilld idles after a pass found nothing to do */
+#define ZEROFILL_POOL_IDLE_MSEC		(10)
+
+static struct task_struct *zerofill_pool_task;
+
+/* Return the number of lines zeroed */
+static unsigned int refill_pset(struct pcache_set *pset)
+{
+	DECLARE_BITMAP(candidates, PCACHE_ASSOCIATIVITY);
+	struct pcache_meta *pcm;
+	unsigned int way, nr_zeroed, nr = 0;
+
+	nr_zeroed = bitmap_weight(pset->zero_map, PCACHE_ASSOCIATIVITY);
+	if (nr_zeroed >= PCACHE_ZEROFILL_POOL_LINES)
+		return 0;
+
+	if (!bitmap_andnot(candidates, pset->free_map, pset->zero_map,
+			   PCACHE_ASSOCIATIVITY))
+		return 0;
+
+	for_each_set_bit(way, candidates, PCACHE_ASSOCIATIVITY) {
+		if (nr_zeroed + nr >= PCACHE_ZEROFILL_POOL_LINES)
+			break;
+
+		/* Lost to allocation, fine */
+		if (!test_and_clear_bit(way, pset->free_map))
+			continue;
+
+		pcm = pcache_set_way_to_pcache_meta(pset, way);
+		clear_pages_nocache(pcache_meta_to_kva(pcm), PCACHE_LINE_NR_PAGES);
+
+		/* Zero bit must be visible before the way is free again */
+		set_bit(way, pset->zero_map);
+		smp_mb__after_atomic();
+		set_bit(way, pset->free_map);
+		nr++;
+	}
+	return nr;
+}
+
+static int kzerofilld(void *unused)
+{
+	struct pcache_set *pset;
+	unsigned long setidx;
+	unsigned int nr;
+
+	if (pin_current_thread())
+		panic("Fail to pin kzerofilld");
+
+	pr_info("pcache: kzerofilld CPU%d UP\n", smp_processor_id());
+
+	for (;;) {
+		nr = 0;
+		pcache_for_each_set(pset, setidx)
+			nr += refill_pset(pset);
+
+		if (nr)
+			add_pcache_event(PCACHE_ZEROFILL_POOL_REFILL, nr);
+		else
+			mdelay(ZEROFILL_POOL_IDLE_MSEC);
+	}
+	BUG();
+	return 0;
+}
+
+int __init pcache_zerofill_pool_init(void)
+{
+	zerofill_pool_task = kthread_run(kzerofilld, NULL, "kzerofilld");
+	if (IS_ERR(zerofill_pool_task))
+		return PTR_ERR(zerofill_pool_task);
+	return 0;
+}
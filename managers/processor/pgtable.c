@@ -62,9 +62,14 @@ static inline void free_pmd_range(struct mm_struct *mm, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* Huge lines are gone within zap_pmd_range() already */
+		if (pmd_huge_line(*pmd))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		free_pte_range(mm, pmd, addr, next);
+		if (next - addr == PMD_SIZE)
+			pcache_huge_disallow(mm, pmd);
 	} while (pmd++, addr = next, addr != end);
 }
 
@@ -184,6 +189,14 @@ zap_pmd_range(struct mm_struct *mm, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_huge_line(*pmd)) {
+			if (next - addr == PMD_SIZE) {
+				pcache_zap_huge_pmd(mm, pmd, addr);
+				continue;
+			}
+			if (WARN_ON_ONCE(pcache_split_huge_pmd(mm, pmd, addr)))
+				continue;
+		}
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		next = zap_pte_range(mm, pmd, addr, next);
@@ -407,6 +420,10 @@ pcache_copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* Huge lines are not shared, parent keeps normal lines */
+		if (pmd_huge_line(*src_pmd) &&
+		    pcache_split_huge_pmd(src_mm, src_pmd, addr))
+			return -ENOMEM;
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (pcache_copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -621,14 +638,23 @@ unsigned long move_page_tables(struct task_struct *tsk,
 		old_pmd = get_old_pmd(mm, old_addr);
 		if (!old_pmd)
 			continue;
+		if (pmd_huge_line(*old_pmd) &&
+		    WARN_ON_ONCE(pcache_split_huge_pmd(mm, old_pmd, old_addr)))
+			break;
 
 		new_pmd = alloc_new_pmd(mm, new_addr);
 		if (WARN_ON_ONCE(!new_pmd))
 			break;
+		if (pmd_huge_line(*new_pmd) &&
+		    WARN_ON_ONCE(pcache_split_huge_pmd(mm, new_pmd, new_addr)))
+			break;
 
 		if (WARN_ON_ONCE(!pte_alloc(mm, new_pmd, new_addr)))
 			break;
 
+		/* Moved lines are normal lines */
+		pcache_huge_disallow(mm, new_pmd);
+
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
@@ -686,6 +712,8 @@ zerofill_set_pmd_range(struct mm_struct *mm, pud_t *pud,
 
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_huge_line(*pmd) && pcache_split_huge_pmd(mm, pmd, addr))
+			return -ENOMEM;
 		next = zerofill_set_pte_range(mm, pmd, addr, next);
 		if (unlikely(next == -ENOMEM))
 			return -ENOMEM;
@@ -7,9 +7,25 @@
  * (at your option) any later version.
  */
 
+/*
+ * Boot time RPC benchmark.
+ *
+ * Each case is described by mode, send size, reply size, number of
+ * threads, number of target nodes and pipeline depth. Threads send
+ * P2M_TEST or P2M_TEST_NOREPLY messages, spreading them over the target
+ * nodes in round-robin. The memory side replies with reply_len bytes.
+ *
+ * Every case prints one comma separated line, prefixed by "rpc_bench,".
+ * Latency percentiles come from a histogram with 8 sub-buckets per
+ * power of two, thus they are within 12.5%. CPU cost is the scheduler
+ * accounted runtime of all threads divided by the number of ops.
+ * For send-only mode, latency is the local time to post the message.
+ */
+
 #include <lego/slab.h>
 #include <lego/math64.h>
 #include <lego/timer.h>
+#include <lego/sched.h>
 #include <lego/kernel.h>
 #include <lego/kthread.h>
 #include <lego/syscalls.h>
@@ -21,136 +37,541 @@
 #include <processor/vnode.h>
 #include <processor/pcache.h>
 
-#define MAX_SEND_LEN	(PAGE_SIZE * 4)
-#define MAX_REPLY_LEN	(PAGE_SIZE * 4)
-#define NR_TESTS	(100000)
+/* Each case moves this many bytes, within [MIN_OPS, MAX_OPS] ops */
+#define RPC_BENCH_BYTES		(1UL << 30)
+#define RPC_BENCH_MIN_OPS	(100)
+#define RPC_BENCH_MAX_OPS	(100000)
+
+#define RPC_BENCH_DEPTH		(8)
+#define RPC_BENCH_TIMEOUT_SEC	(10)
+
+#define LAT_SUB_BITS		(3)
+#define LAT_SUB_BUCKETS		(1 << LAT_SUB_BITS)
+#define LAT_BUCKETS		(64 * LAT_SUB_BUCKETS)
+
+enum rpc_bench_mode {
+	RPC_BENCH_SEND,
+	RPC_BENCH_SEND_REPLY,
+	RPC_BENCH_PIPELINED,
+};
+
+static const char *rpc_bench_mode_str[] = {
+	[RPC_BENCH_SEND]	= "send",
+	[RPC_BENCH_SEND_REPLY]	= "send_reply",
+	[RPC_BENCH_PIPELINED]	= "pipelined",
+};
+
+/*
+ * Message sizes, for both send and reply.
+ * Send sizes are at least sizeof(struct p2m_test_msg).
+ * Sizes are capped at what the transport takes in one message,
+ * FIT is about 2MB, so the last entry runs at that cap.
+ */
+static unsigned int bench_size[] = {
+	8,
+	64,
+	512,
+	4096,
+	32768,
+	262144,
+	1048576,
+	4194304,
+};
+
+static unsigned int bench_threads[] = {
+	1,
+	2,
+	4,
+	8,
+};
+
+/* Cases use the first 1, 2, .. of these nodes */
+static unsigned int bench_nodes[] = {
+	CONFIG_DEFAULT_MEM_NODE,
+};
+
+struct rpc_bench_case {
+	char			*desc;
+	enum rpc_bench_mode	mode;
+	int			send_len, reply_len;
+	int			nr_threads, nr_nodes, depth;
+	unsigned long		nr_ops;
+};
+
+struct rpc_bench_thread {
+	struct rpc_bench_case	*c;
+	int			id;
+	void			*send_buf, *reply_buf;
+	void			*rx_buf, *tx_buf;	/* loopback only */
+
+	struct fit_async_req	reqs[RPC_BENCH_DEPTH];
+	unsigned long long	post_ns[RPC_BENCH_DEPTH];
+
+	unsigned long		nr_ops, nr_errors;
+	unsigned long long	start_ns, end_ns, cpu_ns;
+	u32			lat[LAT_BUCKETS];
+};
+
+/*
+ * The transport a benchmark runs against.
+ * Same semantics as the ibapi_ functions of the same name.
+ */
+struct rpc_bench_transport {
+	const char *name;
+	int (*send)(struct rpc_bench_thread *t, int nid, void *msg, int len);
+	int (*send_reply)(struct rpc_bench_thread *t, int nid, void *msg, int len,
+			  void *reply, int max_reply);
+	int (*send_reply_async)(struct rpc_bench_thread *t, int nid, void *msg, int len,
+				void *reply, int max_reply, struct fit_async_req *req);
+	int (*wait_any_reply)(struct rpc_bench_thread *t, struct fit_async_req **reqs, int nr);
+	int (*abandon_reply)(struct rpc_bench_thread *t, struct fit_async_req *req);
+	int (*max_size)(void);
+};
+
+#ifndef CONFIG_PROFILING_BOOT_RPC_LOOPBACK
+static int fit_bench_send(struct rpc_bench_thread *t, int nid, void *msg, int len)
+{
+	return ibapi_send(nid, msg, len);
+}
+
+static int fit_bench_send_reply(struct rpc_bench_thread *t, int nid, void *msg, int len,
+				void *reply, int max_reply)
+{
+	return ibapi_send_reply_timeout(nid, msg, len, reply, max_reply,
+					false, RPC_BENCH_TIMEOUT_SEC);
+}
+
+static int fit_bench_send_reply_async(struct rpc_bench_thread *t, int nid, void *msg,
+				      int len, void *reply, int max_reply,
+				      struct fit_async_req *req)
+{
+	int ret;
+
+	/* -EBUSY only means the ring or reply slots are full */
+	while ((ret = ibapi_send_reply_async(nid, msg, len, reply, max_reply,
+					     false, req)) == -EBUSY)
+		cpu_relax();
+	return ret;
+}
+
+static int fit_bench_wait_any_reply(struct rpc_bench_thread *t,
+				    struct fit_async_req **reqs, int nr)
+{
+	return ibapi_wait_any_reply(reqs, nr, RPC_BENCH_TIMEOUT_SEC);
+}
+
+static int fit_bench_abandon_reply(struct rpc_bench_thread *t,
+				   struct fit_async_req *req)
+{
+	return ibapi_abandon_reply(req);
+}
+
+static struct rpc_bench_transport rpc_bench_transport = {
+	.name			= "fit",
+	.send			= fit_bench_send,
+	.send_reply		= fit_bench_send_reply,
+	.send_reply_async	= fit_bench_send_reply_async,
+	.wait_any_reply		= fit_bench_wait_any_reply,
+	.abandon_reply		= fit_bench_abandon_reply,
+	.max_size		= ibapi_max_msg_size,
+};
+#else
+/*
+ * Local stand-in of FIT and memory manager.
+ * The message is copied into rx_buf, as RDMA would write it into the
+ * remote ring, and the reply is copied from tx_buf, as handle_p2m_test()
+ * would return it.
+ */
+static int loopback_handle(struct rpc_bench_thread *t, void *msg, int len,
+			   void *reply, int max_reply)
+{
+	struct p2m_test_msg *rx = t->rx_buf;
+	int reply_len;
+
+	memcpy(t->rx_buf, msg, len);
+	reply_len = min_t(int, rx->reply_len, max_reply);
+	memcpy(reply, t->tx_buf, reply_len);
+	return reply_len;
+}
+
+static int loopback_send(struct rpc_bench_thread *t, int nid, void *msg, int len)
+{
+	memcpy(t->rx_buf, msg, len);
+	return 0;
+}
+
+static int loopback_send_reply(struct rpc_bench_thread *t, int nid, void *msg, int len,
+			       void *reply, int max_reply)
+{
+	return loopback_handle(t, msg, len, reply, max_reply);
+}
+
+static int loopback_send_reply_async(struct rpc_bench_thread *t, int nid, void *msg,
+				     int len, void *reply, int max_reply,
+				     struct fit_async_req *req)
+{
+	req->target_node = nid;
+	req->max_ret_size = max_reply;
+	req->ret = loopback_handle(t, msg, len, reply, max_reply);
+	req->done = false;
+	return 0;
+}
 
-static void profile_case_noreply(char *desc, int send_len, int reply_len,
-				 void *send_buf, void *reply_buf,
-				 unsigned int dst_nid)
+static int loopback_wait_any_reply(struct rpc_bench_thread *t,
+				   struct fit_async_req **reqs, int nr)
 {
 	int i;
-	struct p2m_test_msg *msg;
-	unsigned long start_ns, end_ns, total_ns, avg_ns;
 
-	msg = send_buf;
-	fill_common_header(msg, P2M_TEST_NOREPLY);
-	msg->send_len = send_len;
-	msg->reply_len = reply_len;
+	for (i = 0; i < nr; i++) {
+		if (!reqs[i]->done) {
+			reqs[i]->done = true;
+			return i;
+		}
+	}
+	return -ENOENT;
+}
+
+/* Replies are in place once posted, none is ever late */
+static int loopback_abandon_reply(struct rpc_bench_thread *t,
+				  struct fit_async_req *req)
+{
+	req->done = true;
+	return req->ret;
+}
+
+/* Buffers are local, nothing to cap */
+static int loopback_max_size(void)
+{
+	return INT_MAX;
+}
+
+static struct rpc_bench_transport rpc_bench_transport = {
+	.name			= "loopback",
+	.send			= loopback_send,
+	.send_reply		= loopback_send_reply,
+	.send_reply_async	= loopback_send_reply_async,
+	.wait_any_reply		= loopback_wait_any_reply,
+	.abandon_reply		= loopback_abandon_reply,
+	.max_size		= loopback_max_size,
+};
+#endif /* CONFIG_PROFILING_BOOT_RPC_LOOPBACK */
+
+static inline int lat_bucket(u64 ns)
+{
+	int msb;
+
+	if (ns < LAT_SUB_BUCKETS)
+		return ns;
+
+	msb = fls64(ns) - 1;
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) |
+	       ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+/* The largest value that falls into bucket @b */
+static inline u64 lat_bucket_max(int b)
+{
+	int shift;
+
+	if (b < LAT_SUB_BUCKETS)
+		return b;
+
+	shift = (b >> LAT_SUB_BITS) - 1;
+	return ((u64)(LAT_SUB_BUCKETS + (b & (LAT_SUB_BUCKETS - 1)) + 1) << shift) - 1;
+}
+
+static u64 lat_percentile(u64 *lat, u64 total, int permille)
+{
+	u64 sum = 0, target;
+	int b;
+
+	if (!total)
+		return 0;
 
-	start_ns = sched_clock();
-	for (i = 0; i < NR_TESTS; i++) {
-		ibapi_send(dst_nid, msg, msg->send_len);
+	target = div64_u64(total * permille + 999, 1000);
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		sum += lat[b];
+		if (sum >= target)
+			break;
+	}
+	return lat_bucket_max(min(b, LAT_BUCKETS - 1));
+}
+
+static inline void rpc_bench_record(struct rpc_bench_thread *t, u64 ns, int ret)
+{
+	if (unlikely(ret < 0)) {
+		t->nr_errors++;
+		return;
 	}
-	end_ns = sched_clock();
+	t->lat[lat_bucket(ns)]++;
+	t->nr_ops++;
+}
 
-	total_ns = end_ns - start_ns;
-	avg_ns = total_ns / NR_TESTS;
+static inline int rpc_bench_nid(struct rpc_bench_thread *t, unsigned long i)
+{
+	return bench_nodes[(t->id + i) % t->c->nr_nodes];
+}
 
-	pr_info("    CPU%2d Profile: %s. Avg: %lu ns.\n",
-		smp_processor_id(), desc, avg_ns);
+static void rpc_bench_run_sync(struct rpc_bench_thread *t)
+{
+	struct rpc_bench_transport *tp = &rpc_bench_transport;
+	struct rpc_bench_case *c = t->c;
+	unsigned long long start;
+	unsigned long i;
+	int ret;
+
+	for (i = 0; i < c->nr_ops; i++) {
+		start = profile_clock();
+		if (c->mode == RPC_BENCH_SEND)
+			ret = tp->send(t, rpc_bench_nid(t, i), t->send_buf, c->send_len);
+		else
+			ret = tp->send_reply(t, rpc_bench_nid(t, i), t->send_buf, c->send_len,
+					     t->reply_buf, c->reply_len);
+		rpc_bench_record(t, profile_clock() - start, ret);
+
+		/* The late reply may still land in reply_buf, never free it */
+		if (unlikely(ret == -ETIMEDOUT))
+			t->reply_buf = NULL;
+
+		/* Unsupported size or broken peer, no need to keep trying */
+		if (unlikely(ret < 0))
+			break;
+	}
 }
 
-static void profile_case(char *desc, int send_len, int reply_len,
-		      void *send_buf, void *reply_buf, unsigned int dst_nid)
+/*
+ * Give up the requests still in flight after a timeout, @t is freed
+ * once we return. Their late replies may land in reply_buf anytime,
+ * so it is left allocated.
+ */
+static void rpc_bench_abandon(struct rpc_bench_thread *t,
+			      struct fit_async_req **reqs, int nr)
 {
+	struct rpc_bench_transport *tp = &rpc_bench_transport;
+	bool in_flight = false;
 	int i;
-	struct p2m_test_msg *msg;
-	unsigned long start_ns, end_ns, total_ns, avg_ns;
 
-	msg = send_buf;
-	fill_common_header(msg, P2M_TEST);
-	msg->send_len = send_len;
-	msg->reply_len = reply_len;
+	for (i = 0; i < nr; i++) {
+		if (reqs[i]->done)
+			continue;
+		if (tp->abandon_reply(t, reqs[i]) == -ETIMEDOUT)
+			in_flight = true;
+	}
+
+	if (in_flight)
+		t->reply_buf = NULL;
+}
 
-	start_ns = sched_clock();
-	for (i = 0; i < NR_TESTS; i++) {
-		ibapi_send_reply_timeout(dst_nid,
-				 	msg, msg->send_len,
-					reply_buf, MAX_REPLY_LEN,
-					false, 10);
+/*
+ * Keep c->depth requests in flight. All of them reply into the
+ * same buffer, the content is never checked.
+ */
+static void rpc_bench_run_pipelined(struct rpc_bench_thread *t)
+{
+	struct rpc_bench_transport *tp = &rpc_bench_transport;
+	struct rpc_bench_case *c = t->c;
+	struct fit_async_req *reqs[RPC_BENCH_DEPTH];
+	unsigned long posted = 0;
+	int i, ret;
+
+	for (i = 0; i < c->depth; i++) {
+		reqs[i] = &t->reqs[i];
+		reqs[i]->done = true;
 	}
-	end_ns = sched_clock();
 
-	total_ns = end_ns - start_ns;
-	avg_ns = total_ns / NR_TESTS;
+	while (1) {
+		for (i = 0; i < c->depth && posted < c->nr_ops; i++) {
+			if (!reqs[i]->done)
+				continue;
+
+			t->post_ns[i] = profile_clock();
+			ret = tp->send_reply_async(t, rpc_bench_nid(t, posted), t->send_buf,
+						   c->send_len, t->reply_buf, c->reply_len,
+						   reqs[i]);
+			posted++;
+			if (unlikely(ret < 0)) {
+				reqs[i]->done = true;
+				rpc_bench_record(t, 0, ret);
+				posted = c->nr_ops;
+			}
+		}
 
-	pr_info("    CPU%2d Profile: %s. Avg: %lu ns.\n",
-		smp_processor_id(), desc, avg_ns);
+		i = tp->wait_any_reply(t, reqs, c->depth);
+		if (i < 0) {
+			if (i == -ETIMEDOUT) {
+				t->nr_errors++;
+				rpc_bench_abandon(t, reqs, c->depth);
+			}
+			break;
+		}
+		rpc_bench_record(t, profile_clock() - t->post_ns[i], reqs[i]->ret);
+	}
 }
 
-struct profile_info {
-	char *desc;
-	int send_len, reply_len;
-	void *send_buf, *reply_buf;
-	unsigned int dst_nid;
-	int nr_threads;
-};
-
 static atomic_t barrier;
 static atomic_t exit_barrier;
 
-static int __profile_case_threads(void *_info)
+static int rpc_bench_thread_fn(void *_t)
 {
-	struct profile_info *info = _info;
+	struct rpc_bench_thread *t = _t;
+	u64 runtime;
 
 	/* A simple barrier to sync between threads */
 	atomic_dec(&barrier);
 	while (atomic_read(&barrier))
 		schedule();
 
+	runtime = current->se.sum_exec_runtime;
+	t->start_ns = profile_clock();
 
-	profile_case(info->desc, info->send_len, info->reply_len,
-		     info->send_buf, info->reply_buf, info->dst_nid);
-	profile_case_noreply(info->desc, info->send_len, info->reply_len,
-		     info->send_buf, info->reply_buf, info->dst_nid);
+	if (t->c->mode == RPC_BENCH_PIPELINED)
+		rpc_bench_run_pipelined(t);
+	else
+		rpc_bench_run_sync(t);
+
+	t->end_ns = profile_clock();
+	t->cpu_ns = current->se.sum_exec_runtime - runtime;
 
 	atomic_dec(&exit_barrier);
 	return 0;
 }
 
-static void
-profile_case_threads(char *desc, int send_len, int reply_len,
-		     unsigned int dst_nid, unsigned int nr_threads)
+static void free_bench_threads(struct rpc_bench_thread *threads, int nr)
 {
-	struct task_struct *tsk;
-	struct profile_info *info;
-	void *send_buf, *reply_buf;
 	int i;
 
-	pr_info("RPC Profile. [Peer node: %d. nr_threads: %d. nr_run/case: %d. send: %d reply %d]\n",
-		dst_nid, nr_threads, NR_TESTS, send_len, reply_len);
+	for (i = 0; i < nr; i++) {
+		kfree(threads[i].send_buf);
+		kfree(threads[i].reply_buf);
+		kfree(threads[i].rx_buf);
+		kfree(threads[i].tx_buf);
+	}
+	kfree(threads);
+}
 
-	info = kmalloc(nr_threads * sizeof(*info), GFP_KERNEL);
-	if (!info) {
-		pr_err("Fail to alloc info\n");
-		return;
+static int alloc_bench_thread(struct rpc_bench_thread *t)
+{
+	struct rpc_bench_case *c = t->c;
+	struct p2m_test_msg *msg;
+
+	t->send_buf = kzalloc(c->send_len, GFP_KERNEL);
+	t->reply_buf = kmalloc(max(c->reply_len, 1), GFP_KERNEL);
+	if (!t->send_buf || !t->reply_buf)
+		return -ENOMEM;
+
+#ifdef CONFIG_PROFILING_BOOT_RPC_LOOPBACK
+	t->rx_buf = kmalloc(c->send_len, GFP_KERNEL);
+	t->tx_buf = kzalloc(max(c->reply_len, 1), GFP_KERNEL);
+	if (!t->rx_buf || !t->tx_buf)
+		return -ENOMEM;
+#endif
+
+	msg = t->send_buf;
+	if (c->mode == RPC_BENCH_SEND)
+		fill_common_header(msg, P2M_TEST_NOREPLY);
+	else
+		fill_common_header(msg, P2M_TEST);
+	msg->send_len = c->send_len;
+	msg->reply_len = c->reply_len;
+	return 0;
+}
+
+static void rpc_bench_report(struct rpc_bench_case *c,
+			     struct rpc_bench_thread *threads)
+{
+	static u64 lat[LAT_BUCKETS];
+	unsigned long nr_ops = 0, nr_errors = 0;
+	unsigned long long start = ULLONG_MAX, end = 0, cpu = 0, wall;
+	u64 kops = 0, mbps = 0, cpu_per_op = 0;
+	int i, b;
+
+	memset(lat, 0, sizeof(lat));
+	for (i = 0; i < c->nr_threads; i++) {
+		struct rpc_bench_thread *t = &threads[i];
+
+		nr_ops += t->nr_ops;
+		nr_errors += t->nr_errors;
+		cpu += t->cpu_ns;
+		start = min(start, t->start_ns);
+		end = max(end, t->end_ns);
+		for (b = 0; b < LAT_BUCKETS; b++)
+			lat[b] += t->lat[b];
+	}
+
+	wall = end > start ? end - start : 1;
+	if (nr_ops) {
+		kops = div64_u64((u64)nr_ops * NSEC_PER_SEC / 1000, wall);
+		mbps = div64_u64((u64)nr_ops * (c->send_len + c->reply_len) * 1000, wall);
+		cpu_per_op = div64_u64(cpu, nr_ops);
+	}
+
+	pr_info("rpc_bench,%s,%s,%s,%d,%d,%d,%d,%d,%lu,%lu,%Lu,%Lu,%Lu,%Lu,%Lu,%Lu,%Lu\n",
+		rpc_bench_transport.name, rpc_bench_mode_str[c->mode], c->desc,
+		c->send_len, c->reply_len, c->nr_threads, c->nr_nodes, c->depth,
+		nr_ops, nr_errors, wall, kops, mbps,
+		lat_percentile(lat, nr_ops, 500),
+		lat_percentile(lat, nr_ops, 990),
+		lat_percentile(lat, nr_ops, 999),
+		cpu_per_op);
+}
+
+static void rpc_bench_case(struct rpc_bench_case *c)
+{
+	struct rpc_bench_thread *threads;
+	struct task_struct *tsk;
+	unsigned long bytes;
+	int i, max_size, nr_started = 0;
+
+	c->send_len = max_t(int, c->send_len, sizeof(struct p2m_test_msg));
+	if (c->mode == RPC_BENCH_SEND)
+		c->reply_len = 0;
+
+	max_size = rpc_bench_transport.max_size();
+	if (c->send_len > max_size || c->reply_len > max_size) {
+		pr_info("rpc_bench: cap send %d reply %d at %s max message size %d\n",
+			c->send_len, c->reply_len, rpc_bench_transport.name, max_size);
+		c->send_len = min(c->send_len, max_size);
+		c->reply_len = min(c->reply_len, max_size);
 	}
+	if (c->mode != RPC_BENCH_PIPELINED)
+		c->depth = 1;
 
-	atomic_set(&barrier, nr_threads);
-	atomic_set(&exit_barrier, nr_threads);
+	bytes = c->send_len + c->reply_len;
+	c->nr_ops = clamp_t(unsigned long, RPC_BENCH_BYTES / bytes,
+			    RPC_BENCH_MIN_OPS, RPC_BENCH_MAX_OPS);
 
-	for (i = 0; i < nr_threads; i++) {
-		send_buf = kmalloc(MAX_SEND_LEN, GFP_KERNEL);
-		reply_buf = kmalloc(MAX_REPLY_LEN, GFP_KERNEL);
-		if (!send_buf || !reply_buf) {
-			pr_err("Fail to alloc buf\n");
-			return;
+	threads = kzalloc(c->nr_threads * sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		pr_err("rpc_bench: fail to alloc threads\n");
+		return;
+	}
+
+	for (i = 0; i < c->nr_threads; i++) {
+		threads[i].c = c;
+		threads[i].id = i;
+		if (alloc_bench_thread(&threads[i])) {
+			pr_err("rpc_bench: fail to alloc buf. send: %d reply: %d\n",
+				c->send_len, c->reply_len);
+			goto out;
 		}
+	}
 
-		info[i].desc = desc;
-		info[i].send_len = send_len;
-		info[i].reply_len = reply_len;
-		info[i].send_buf = send_buf;
-		info[i].reply_buf = reply_buf;
-		info[i].dst_nid = dst_nid;
-		info[i].nr_threads = nr_threads;
+	atomic_set(&barrier, c->nr_threads);
+	atomic_set(&exit_barrier, c->nr_threads);
 
-		tsk = kthread_run(__profile_case_threads, &info[i], "rpc_profile_thread");
+	for (i = 0; i < c->nr_threads; i++) {
+		tsk = kthread_run(rpc_bench_thread_fn, &threads[i], "rpc_profile_thread");
 		if (IS_ERR(tsk)) {
-			pr_err("Fail to create profile thread");
-			return;
+			pr_err("rpc_bench: fail to create profile thread\n");
+			break;
 		}
+		nr_started++;
+	}
+
+	/* Let the started ones go if we failed in the middle */
+	if (nr_started < c->nr_threads) {
+		atomic_sub(c->nr_threads - nr_started, &exit_barrier);
+		atomic_sub(c->nr_threads - nr_started, &barrier);
 	}
 
 	/*
@@ -164,70 +585,86 @@ profile_case_threads(char *desc, int send_len, int reply_len,
 	 */
 	while (atomic_read(&exit_barrier))
 		schedule();
-}
-
-static unsigned int send_size[] = {
-	32,	/* has to be larger than p2m_test_msg */
-	128,
-	256,
-	512,
-	1024,
-	2048,
-	4096,
-	4200,	/* pcache_flush send case. reply is 4B */
-};
 
-static unsigned int reply_size[] = {
-	4,
-	32,
-	128,
-	256,
-	512,
-	1024,
-	2048,
-	4096,	/* pcache_miss reply case. send is around 20B */
-};
+	if (nr_started == c->nr_threads)
+		rpc_bench_report(c, threads);
+out:
+	free_bench_threads(threads, c->nr_threads);
+}
 
-void rpc_profile_node(unsigned int nid)
+static void rpc_bench_sweep(int nr_nodes)
 {
-	void *send_buf, *reply_buf;
-	int i, j, send, reply;
-	char desc[128];
-
-	send_buf = kmalloc(MAX_SEND_LEN, GFP_KERNEL);
-	reply_buf = kmalloc(MAX_REPLY_LEN, GFP_KERNEL);
-	if (!send_buf || !reply_buf) {
-		pr_err("OOM!");
-		return;
+	struct rpc_bench_case c;
+	int i, j, mode;
+
+	/* Send size sweep, with the smallest reply */
+	for (mode = RPC_BENCH_SEND; mode <= RPC_BENCH_PIPELINED; mode++) {
+		for (i = 0; i < ARRAY_SIZE(bench_size); i++) {
+			for (j = 0; j < ARRAY_SIZE(bench_threads); j++) {
+				c = (struct rpc_bench_case) {
+					.desc		= "send_sweep",
+					.mode		= mode,
+					.send_len	= bench_size[i],
+					.reply_len	= bench_size[0],
+					.nr_threads	= bench_threads[j],
+					.nr_nodes	= nr_nodes,
+					.depth		= RPC_BENCH_DEPTH,
+				};
+				rpc_bench_case(&c);
+			}
+		}
 	}
 
-	/*
-	 * We have three variables
-	 * - send length
-	 * - reply length
-	 * - nr_threads
-	 */
-	for (i = 0; i < ARRAY_SIZE(send_size); i++) {
-		for (j = 0; j < ARRAY_SIZE(reply_size); j++) {
-			send = send_size[i];
-			reply = reply_size[j];
-
-			memset(desc, 0, 128);
-			snprintf(desc, 128, "s%4d-r%4d", send, reply);
-
-			profile_case_threads(desc, send, reply, nid, 1);
-			profile_case_threads(desc, send, reply, nid, 2);
-			profile_case_threads(desc, send, reply, nid, 4);
+	/* Reply size sweep, with the smallest send */
+	for (mode = RPC_BENCH_SEND_REPLY; mode <= RPC_BENCH_PIPELINED; mode++) {
+		for (i = 0; i < ARRAY_SIZE(bench_size); i++) {
+			for (j = 0; j < ARRAY_SIZE(bench_threads); j++) {
+				c = (struct rpc_bench_case) {
+					.desc		= "reply_sweep",
+					.mode		= mode,
+					.send_len	= bench_size[0],
+					.reply_len	= bench_size[i],
+					.nr_threads	= bench_threads[j],
+					.nr_nodes	= nr_nodes,
+					.depth		= RPC_BENCH_DEPTH,
+				};
+				rpc_bench_case(&c);
+			}
 		}
 	}
+}
 
-	profile_case("pcache_miss",
-		  sizeof(struct p2m_pcache_miss_msg), PCACHE_LINE_SIZE,
-		  send_buf, reply_buf, nid);
-
-	profile_case("pcache_flush",
-		  sizeof(struct p2m_flush_msg), sizeof(int),
-		  send_buf, reply_buf, nid);
+static void rpc_profile_node(void)
+{
+	struct rpc_bench_case c;
+	int nr_nodes;
+
+	pr_info("rpc_bench,transport,mode,desc,send,reply,threads,nodes,depth,"
+		"ops,errors,wall_ns,kops,mbps,p50_ns,p99_ns,p999_ns,cpu_ns_per_op\n");
+
+	for (nr_nodes = 1; nr_nodes <= ARRAY_SIZE(bench_nodes); nr_nodes++)
+		rpc_bench_sweep(nr_nodes);
+
+	/* The two most common ones */
+	c = (struct rpc_bench_case) {
+		.desc		= "pcache_miss",
+		.mode		= RPC_BENCH_SEND_REPLY,
+		.send_len	= sizeof(struct p2m_pcache_miss_msg),
+		.reply_len	= PCACHE_LINE_SIZE,
+		.nr_threads	= 1,
+		.nr_nodes	= 1,
+	};
+	rpc_bench_case(&c);
+
+	c = (struct rpc_bench_case) {
+		.desc		= "pcache_flush",
+		.mode		= RPC_BENCH_SEND_REPLY,
+		.send_len	= sizeof(struct p2m_flush_msg),
+		.reply_len	= sizeof(int),
+		.nr_threads	= 1,
+		.nr_nodes	= 1,
+	};
+	rpc_bench_case(&c);
 }
 
 enum _rpc_profile_state {
@@ -242,7 +679,7 @@ void rpc_profile(void)
 {
 	rpc_profile_state = RPC_PROFILE_WIP;
 
-	rpc_profile_node(CONFIG_DEFAULT_MEM_NODE);
+	rpc_profile_node();
 
 	rpc_profile_state = RPC_PROFILE_DONE;
 }
@@ -102,7 +102,7 @@
 #define IMM_GET_OPCODE		0x0f000000
 #define IMM_GET_OPCODE_NUMBER(imm) (imm<<4)>>28
 #define IMM_DATA_BIT 32
-#define IMM_NUM_OF_SEMAPHORE 64
+#define IMM_NUM_OF_SEMAPHORE 512
 #define IMM_MAX_PORT 64
 #define IMM_RING_SIZE 1024*1024*4
 #define IMM_MAX_SIZE IMM_RING_SIZE/NUM_OF_CORES
@@ -125,6 +125,8 @@
 #define SEND_REPLY_PORT_IS_FULL -104
 #define SEND_REPLY_SIZE_TOO_BIG -105
 #define SEND_REPLY_FAIL -106
+/* Receiver had no room for the request, try again. Sent as an empty reply. */
+#define SEND_REPLY_BUSY -107
 #define SEND_REPLY_ACK 0
 
 enum mode {
@@ -370,6 +372,39 @@ struct _lego_context_pad {
 
 #define CTX_PADDING(name)	struct _lego_context_pad name;
 
+/* Max outstanding messages to one peer */
+#define FIT_CREDIT_SLOTS	1024
+
+/*
+ * The ring slot of an abandoned request is returned after this long,
+ * even if its late reply never arrives.
+ */
+#define FIT_ABANDON_GRACE_SEC	5
+
+/* Backoff before posting a request again after SEND_REPLY_BUSY */
+#define FIT_BUSY_RETRY_US	10
+
+/*
+ * Sender side flow control of one peer's RDMA ring.
+ *
+ * Ring positions are linear u32 values, the ring offset is the position
+ * modulo RDMA_RING_SIZE. Both head and tail pack (seq << 32 | position).
+ * Each reservation takes one seq, and tail only moves over slots that
+ * are returned, in seq order. Thus [tail, head) covers every byte that
+ * may still be in use at the receiver, and it never exceeds the ring.
+ */
+struct fit_peer_credit {
+	atomic64_t	head;
+	atomic64_t	tail;
+	atomic_long_t	nr_stalls;
+	atomic_long_t	nr_busy;
+	u32		slot_end[FIT_CREDIT_SLOTS];
+	int		slot_done[FIT_CREDIT_SLOTS];
+} ____cacheline_aligned;
+
+/* No credit attached to a reply indicator */
+#define FIT_NO_CREDIT		(-1L)
+
 struct lego_context {
 	struct ib_context	*context;
 	struct ib_comp_channel *channel;
@@ -409,7 +444,6 @@ struct lego_context {
 
 	int			*send_cq_queued_sends;
 	int *recv_num;
-	atomic_t *atomic_request_num;
 	atomic_t parallel_thread_num;
     
 	enum s_state {
@@ -440,9 +474,8 @@ struct lego_context {
 	int *atomic_buffer_cur_length;
 
 	void **local_rdma_recv_rings;
-	int *remote_rdma_ring_mrs_offset;
+	struct fit_peer_credit *peer_credits;
 	int *remote_last_ack_index;
-	spinlock_t *remote_imm_offset_lock;
 	struct fit_ibv_mr *local_rdma_ring_mrs;
 	int *local_last_ack_index;
 	spinlock_t *local_last_ack_index_lock;
@@ -494,6 +527,19 @@ struct lego_context {
 	spinlock_t	indicators_lock;
 	void		*reply_ready_indicators[IMM_NUM_OF_SEMAPHORE];
 	DECLARE_BITMAP(reply_ready_indicators_bitmap, IMM_NUM_OF_SEMAPHORE);
+	/* (node << 32 | seq) of the ring slot each reply returns */
+	long		reply_credits[IMM_NUM_OF_SEMAPHORE];
+	/* Late replies of abandoned requests land here */
+	int		reply_discard;
+	/* When each indicator was abandoned in jiffies, 0 if it is not */
+	unsigned long	reply_abandoned_at[IMM_NUM_OF_SEMAPHORE];
+	/* Reply buffers freed once the late reply has landed */
+	void		*reply_discard_bufs[IMM_NUM_OF_SEMAPHORE];
+	unsigned long	next_abandon_scan;
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+	/* Threads sleeping on the indicators, see fit_adaptive_wait() */
+	struct task_struct *reply_waiters[IMM_NUM_OF_SEMAPHORE];
+#endif
 
 	CTX_PADDING(_pad3_)
 
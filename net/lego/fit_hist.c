@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * send_reply latency and ring queue depth histograms.
+ *
+ * Latency is counted from the time a request is posted, to the time
+ * its sender sees the reply. Each CPU has its own log2 buckets for
+ * every (node, opcode) pair, so recording is a single this_cpu_inc.
+ * Opcodes get their slots at first use, the last slot collects
+ * everything that does not fit.
+ */
+
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/string.h>
+#include <lego/bitops.h>
+#include <lego/cpumask.h>
+#include <rdma/ib_verbs.h>
+#include <lego/fit_ibapi.h>
+#include "fit.h"
+#include "fit_internal.h"
+
+#define FIT_HIST_OPCODES	16
+#define FIT_HIST_OTHER		(FIT_HIST_OPCODES - 1)
+#define FIT_HIST_BUCKETS	32
+#define FIT_HIST_DEPTH_BUCKETS	12
+#define FIT_HIST_NO_OPCODE	0xffffffffU
+
+struct fit_lat_hist {
+	u32	lat[MAX_NODE][FIT_HIST_OPCODES][FIT_HIST_BUCKETS];
+	u32	depth[MAX_NODE][FIT_HIST_DEPTH_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct fit_lat_hist, fit_lat_hist);
+
+static u32 fit_hist_opcodes[FIT_HIST_OPCODES] = {
+	[0 ... FIT_HIST_OPCODES - 1] = FIT_HIST_NO_OPCODE,
+};
+
+static int fit_hist_opcode_slot(u32 opcode)
+{
+	u32 tag;
+	int i;
+
+	for (i = 0; i < FIT_HIST_OTHER; i++) {
+		tag = READ_ONCE(fit_hist_opcodes[i]);
+		if (tag == FIT_HIST_NO_OPCODE)
+			tag = cmpxchg(&fit_hist_opcodes[i], FIT_HIST_NO_OPCODE, opcode);
+		if (tag == FIT_HIST_NO_OPCODE || tag == opcode)
+			return i;
+	}
+	return FIT_HIST_OTHER;
+}
+
+/* Bucket b counts values in [2^(b-1), 2^b) */
+static inline int fit_hist_bucket(u64 val, int nr_buckets)
+{
+	int b = fls64(val);
+
+	return min(b, nr_buckets - 1);
+}
+
+void fit_hist_record_latency(int node, u32 opcode, u64 ns)
+{
+	int slot, b;
+
+	if (unlikely(node < 0 || node >= MAX_NODE))
+		return;
+
+	slot = fit_hist_opcode_slot(opcode);
+	b = fit_hist_bucket(ns, FIT_HIST_BUCKETS);
+	this_cpu_inc(fit_lat_hist.lat[node][slot][b]);
+}
+
+void fit_hist_record_depth(int node, u32 depth)
+{
+	int b;
+
+	if (unlikely(node < 0 || node >= MAX_NODE))
+		return;
+
+	b = fit_hist_bucket(depth, FIT_HIST_DEPTH_BUCKETS);
+	this_cpu_inc(fit_lat_hist.depth[node][b]);
+}
+
+/* Upper bound of the bucket where @permille of @total falls in */
+static u64 fit_hist_percentile(u64 *buckets, int nr_buckets, u64 total, int permille)
+{
+	u64 sum = 0, target;
+	int b;
+
+	target = div64_u64(total * permille + 999, 1000);
+	for (b = 0; b < nr_buckets; b++) {
+		sum += buckets[b];
+		if (sum >= target)
+			break;
+	}
+	return 1ULL << min(b, nr_buckets - 1);
+}
+
+static u64 fit_hist_sum_lat(int node, int slot, u64 *buckets)
+{
+	struct fit_lat_hist *h;
+	u64 total = 0;
+	int cpu, b;
+
+	memset(buckets, 0, sizeof(u64) * FIT_HIST_BUCKETS);
+	for_each_possible_cpu(cpu) {
+		h = per_cpu_ptr(&fit_lat_hist, cpu);
+		for (b = 0; b < FIT_HIST_BUCKETS; b++)
+			buckets[b] += h->lat[node][slot][b];
+	}
+	for (b = 0; b < FIT_HIST_BUCKETS; b++)
+		total += buckets[b];
+	return total;
+}
+
+static u64 fit_hist_sum_depth(int node, u64 *buckets)
+{
+	struct fit_lat_hist *h;
+	u64 total = 0;
+	int cpu, b;
+
+	memset(buckets, 0, sizeof(u64) * FIT_HIST_DEPTH_BUCKETS);
+	for_each_possible_cpu(cpu) {
+		h = per_cpu_ptr(&fit_lat_hist, cpu);
+		for (b = 0; b < FIT_HIST_DEPTH_BUCKETS; b++)
+			buckets[b] += h->depth[node][b];
+	}
+	for (b = 0; b < FIT_HIST_DEPTH_BUCKETS; b++)
+		total += buckets[b];
+	return total;
+}
+
+void fit_dump_latency_hist(void)
+{
+	u64 buckets[FIT_HIST_BUCKETS];
+	char name[16];
+	u64 total;
+	int node, slot;
+
+	pr_info("  send_reply latency (ns, upper bound of log2 bucket):\n");
+	pr_info("    node     opcode        count        p50        p99      p99.9\n");
+	for (node = 0; node < MAX_NODE; node++) {
+		for (slot = 0; slot < FIT_HIST_OPCODES; slot++) {
+			total = fit_hist_sum_lat(node, slot, buckets);
+			if (!total)
+				continue;
+
+			if (slot == FIT_HIST_OTHER)
+				strcpy(name, "other");
+			else
+				sprintf(name, "%#x", READ_ONCE(fit_hist_opcodes[slot]));
+
+			pr_info("    %4d %10s %12Lu %10Lu %10Lu %10Lu\n",
+				node, name, total,
+				fit_hist_percentile(buckets, FIT_HIST_BUCKETS, total, 500),
+				fit_hist_percentile(buckets, FIT_HIST_BUCKETS, total, 990),
+				fit_hist_percentile(buckets, FIT_HIST_BUCKETS, total, 999));
+		}
+	}
+
+	pr_info("  ring queue depth at reservation:\n");
+	pr_info("    node        count        p50        p99        max\n");
+	for (node = 0; node < MAX_NODE; node++) {
+		total = fit_hist_sum_depth(node, buckets);
+		if (!total)
+			continue;
+
+		pr_info("    %4d %12Lu %10Lu %10Lu %10Lu\n", node, total,
+			fit_hist_percentile(buckets, FIT_HIST_DEPTH_BUCKETS, total, 500),
+			fit_hist_percentile(buckets, FIT_HIST_DEPTH_BUCKETS, total, 990),
+			fit_hist_percentile(buckets, FIT_HIST_DEPTH_BUCKETS, total, 1000));
+	}
+}
+
+/*
+ * Clear all buckets. Opcode slots are kept, so concurrent
+ * recorders never see a slot change its owner.
+ */
+void fit_reset_latency_hist(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&fit_lat_hist, cpu), 0, sizeof(struct fit_lat_hist));
+}
@@ -10,10 +10,12 @@
 #include <lego/net.h>
 #include <lego/slab.h>
 #include <lego/sched.h>
+#include <lego/jiffies.h>
 #include <rdma/ib_verbs.h>
 #include <lego/fit_ibapi.h>
 #include <lego/completion.h>
 #include <lego/profile.h>
+#include <lego/syscalls.h>
 #include "fit.h"
 #include "fit_internal.h"
 
@@ -88,9 +90,39 @@ void dump_ib_stats(void)
 		pr_info("      recvcq[0] CQEs: %15lu\n", nr_recvcq_cqes[i]);
 	pr_info("    nr_bytes_tx:      %15ld\n", COUNTER_nr_bytes_tx());
 	pr_info("    nr_bytes_rx:      %15ld\n", COUNTER_nr_bytes_rx());
+	pr_info("  Ring credits:\n");
+	fit_dump_credits(FIT_ctx);
+	fit_dump_latency_hist();
+}
+
+void reset_ib_stats(void)
+{
+	atomic_long_set(&nr_ib_send_reply, 0);
+	atomic_long_set(&nr_ib_send, 0);
+	atomic_long_set(&nr_bytes_tx, 0);
+	atomic_long_set(&nr_bytes_rx, 0);
+	fit_reset_credits(FIT_ctx);
+	fit_reset_latency_hist();
 }
 #endif
 
+/*
+ * Runtime access to IB stats,
+ * they are only there if CONFIG_COUNTER_FIT_IB is enabled.
+ */
+SYSCALL_DEFINE1(fit_stat, int, cmd)
+{
+	switch (cmd) {
+	case FIT_STAT_DUMP:
+		dump_ib_stats();
+		return 0;
+	case FIT_STAT_RESET:
+		reset_ib_stats();
+		return 0;
+	}
+	return -EINVAL;
+}
+
 DEFINE_PROFILE_POINT(ibapi_send_reply)
 
 static inline int
@@ -162,17 +194,275 @@ int ibapi_send_reply_timeout(int target_node, void *addr, int size, void *ret_ad
 			__builtin_return_address(0));
 }
 
+static int __ibapi_send_reply_post(int target_node, struct fit_sglist *iov,
+				   int nr_iov, void *ret_addr, int max_ret_size,
+				   int if_use_ret_phys_addr, struct fit_async_req *req,
+				   bool can_wait, void *caller)
+{
+	int ret;
+
+	if (unlikely(target_node >= CONFIG_FIT_NR_NODES)) {
+		pr_info("target_node: %d\n", target_node);
+		BUG();
+	}
+
+	lock_ib();
+	ret = fit_send_reply_post(FIT_ctx, target_node, iov, nr_iov, ret_addr,
+				  max_ret_size, if_use_ret_phys_addr, req,
+				  can_wait, caller);
+	unlock_ib();
+
+	if (unlikely(ret))
+		return ret;
+
+	req->max_ret_size = max_ret_size;
+#ifdef CONFIG_COUNTER_FIT_IB
+	atomic_long_inc(&nr_ib_send_reply);
+	for (ret = 0; ret < nr_iov; ret++)
+		atomic_long_add(iov[ret].len, &nr_bytes_tx);
+#endif
+	return 0;
+}
+
+/**
+ * ibapi_send_reply_async
+ * @target_node: target node id
+ * @addr: message to send
+ * @size: size of message
+ * @ret_addr: where the reply lands, must stay valid until completion
+ * @max_ret_size: max size of reply
+ * @if_use_ret_phys_addr: if @ret_addr is a physical address
+ * @req: request handle, filled by us
+ *
+ * Post a request and return without waiting for the reply. Completion
+ * is collected by ibapi_poll_reply(), ibapi_wait_reply() or
+ * ibapi_wait_any_reply(). Every posted request must be collected,
+ * or given up by ibapi_abandon_reply() after a timeout, otherwise
+ * its reply indicator is leaked.
+ *
+ * Return:
+ * 0 on success, the request is in flight
+ * -EBUSY if there are too many outstanding requests
+ * Other negative values on failure
+ */
+int ibapi_send_reply_async(int target_node, void *addr, int size, void *ret_addr,
+			   int max_ret_size, int if_use_ret_phys_addr,
+			   struct fit_async_req *req)
+{
+	struct fit_sglist iov = {
+		.addr	= addr,
+		.len	= size,
+	};
+
+	return __ibapi_send_reply_post(target_node, &iov, 1, ret_addr,
+				       max_ret_size, if_use_ret_phys_addr, req,
+				       false, __builtin_return_address(0));
+}
+
+static inline void ibapi_async_done(struct fit_async_req *req, int ret)
+{
+	if (unlikely(ret > req->max_ret_size)) {
+		pr_info("ret: %d, max_ret_size: %d\n", ret, req->max_ret_size);
+		BUG();
+	}
+
+#ifdef CONFIG_COUNTER_FIT_IB
+	if (ret > 0)
+		atomic_long_add(ret, &nr_bytes_rx);
+#endif
+}
+
+/**
+ * ibapi_poll_reply
+ * @req: request posted by ibapi_send_reply_async()
+ *
+ * Return -EAGAIN if the reply has not arrived yet, -EBUSY if the
+ * receiver had no room and dropped the request, which can be posted
+ * again, otherwise the reply length. Never blocks.
+ */
+int ibapi_poll_reply(struct fit_async_req *req)
+{
+	bool was_done = req->done;
+	int ret;
+
+	ret = fit_send_reply_poll(FIT_ctx, req);
+	if (ret != -EAGAIN && !was_done)
+		ibapi_async_done(req, ret);
+	return ret;
+}
+
+static int __ibapi_wait_reply(struct fit_async_req *req, unsigned long timeout_sec,
+			      bool may_sleep)
+{
+	bool was_done = req->done;
+	int ret;
+
+	ret = fit_send_reply_wait(FIT_ctx, req, timeout_sec, may_sleep);
+	if (ret != -ETIMEDOUT && !was_done)
+		ibapi_async_done(req, ret);
+	return ret;
+}
+
+/**
+ * ibapi_wait_reply
+ * @req: request posted by ibapi_send_reply_async()
+ * @timeout_sec: counted from post time, 0 means the maximum
+ *
+ * Busy wait for the reply, safe with spinlocks held.
+ * Return the reply length, -EBUSY as ibapi_poll_reply(), or -ETIMEDOUT.
+ * A timed out request is still pending and can be waited again.
+ */
+int ibapi_wait_reply(struct fit_async_req *req, unsigned long timeout_sec)
+{
+	return __ibapi_wait_reply(req, timeout_sec, false);
+}
+
+/**
+ * ibapi_wait_reply_sleep
+ * @req: request posted by ibapi_send_reply_async()
+ * @timeout_sec: counted from post time, 0 means the maximum
+ *
+ * Same as ibapi_wait_reply(), but with CONFIG_FIT_ADAPTIVE_WAIT it
+ * sleeps once the reply is later than usual. Caller must not hold
+ * spinlocks or per-CPU state.
+ */
+int ibapi_wait_reply_sleep(struct fit_async_req *req, unsigned long timeout_sec)
+{
+	return __ibapi_wait_reply(req, timeout_sec, true);
+}
+
+/**
+ * ibapi_abandon_reply
+ * @req: timed out request posted by ibapi_send_reply_async()
+ *
+ * Stop waiting for @req, it may be freed afterwards. Its reply indicator
+ * and ring slot are released when the late reply arrives and is dropped.
+ * The reply data still lands in @ret_addr given at post time.
+ *
+ * Return -ETIMEDOUT if @req is abandoned, otherwise the reply
+ * arrived meanwhile and its length is returned.
+ */
+int ibapi_abandon_reply(struct fit_async_req *req)
+{
+	return ibapi_abandon_reply_free(req, NULL);
+}
+
+/**
+ * ibapi_abandon_reply_free
+ * @req: timed out request posted by ibapi_send_reply_async()
+ * @ret_buf: kmalloc'ed reply buffer of @req, may be NULL
+ *
+ * Same as ibapi_abandon_reply(), and hand @ret_buf over to FIT.
+ * It is kfree'd once the late reply has been written into it.
+ * If the reply arrived meanwhile, @ret_buf still belongs to the caller.
+ */
+int ibapi_abandon_reply_free(struct fit_async_req *req, void *ret_buf)
+{
+	bool was_done = req->done;
+	int ret;
+
+	ret = fit_send_reply_abandon(FIT_ctx, req, ret_buf);
+	if (ret != -ETIMEDOUT && !was_done)
+		ibapi_async_done(req, ret);
+	return ret;
+}
+
+/**
+ * ibapi_send_reply_iov
+ * @target_node: target node id
+ * @iov: message pieces, at most FIT_MAX_IOV
+ * @nr_iov: number of pieces in @iov
+ * @ret_addr, @max_ret_size, @if_use_ret_phys_addr: same as ibapi_send_reply_timeout()
+ * @timeout_sec: 0 means the maximum
+ *
+ * Send the pieces of @iov as one message, without copying them into a
+ * staging buffer. The receiver gets them concatenated, in order.
+ * The pieces must be kernel direct mapped memory, and must not change
+ * until this returns.
+ *
+ * Return the reply length, or negative values on failure.
+ */
+int ibapi_send_reply_iov(int target_node, struct fit_sglist *iov, int nr_iov,
+			 void *ret_addr, int max_ret_size, int if_use_ret_phys_addr,
+			 unsigned long timeout_sec)
+{
+	struct fit_async_req req;
+	unsigned long start_time = jiffies;
+	int ret;
+
+	do {
+		ret = __ibapi_send_reply_post(target_node, iov, nr_iov, ret_addr,
+					      max_ret_size, if_use_ret_phys_addr, &req,
+					      true, __builtin_return_address(0));
+		if (unlikely(ret))
+			return ret;
+
+		ret = ibapi_wait_reply(&req, timeout_sec);
+	} while (unlikely(ret == -EBUSY) && fit_busy_retry(start_time, timeout_sec));
+	if (unlikely(ret == -ETIMEDOUT))
+		ret = ibapi_abandon_reply(&req);
+	return ret;
+}
+
+/**
+ * ibapi_send_reply_iov_async
+ * @target_node: target node id
+ * @iov: message pieces, at most FIT_MAX_IOV
+ * @nr_iov: number of pieces in @iov
+ * @ret_addr, @max_ret_size, @if_use_ret_phys_addr: same as ibapi_send_reply_async()
+ * @req: request handle, filled by us
+ *
+ * The async version of ibapi_send_reply_iov(). @iov itself can go away
+ * once this returns, but the pieces must not change until the reply
+ * of @req is collected.
+ *
+ * Return 0 if posted, -EBUSY if there are too many outstanding requests,
+ * other negative values on failure.
+ */
+int ibapi_send_reply_iov_async(int target_node, struct fit_sglist *iov, int nr_iov,
+			       void *ret_addr, int max_ret_size, int if_use_ret_phys_addr,
+			       struct fit_async_req *req)
+{
+	return __ibapi_send_reply_post(target_node, iov, nr_iov, ret_addr,
+				       max_ret_size, if_use_ret_phys_addr, req,
+				       false, __builtin_return_address(0));
+}
+
+/**
+ * ibapi_wait_any_reply
+ * @reqs: array of requests posted by ibapi_send_reply_async()
+ * @nr: number of requests in @reqs
+ * @timeout_sec: 0 means the maximum
+ *
+ * Wait until one of the not yet completed requests has its reply.
+ * Return its index in @reqs, the reply length is in reqs[i]->ret.
+ * -ENOENT if all requests were completed before, -ETIMEDOUT on timeout.
+ */
+int ibapi_wait_any_reply(struct fit_async_req **reqs, int nr,
+			 unsigned long timeout_sec)
+{
+	int i;
+
+	i = fit_send_reply_wait_any(FIT_ctx, reqs, nr, timeout_sec);
+	if (i >= 0)
+		ibapi_async_done(reqs[i], reqs[i]->ret);
+	return i;
+}
+
 static inline int
 __ibapi_send_reply_timeout_w_private_bits(int target_node, void *addr, int size, void *ret_addr,
 			   int max_ret_size, int *private_bits, int if_use_ret_phys_addr,
 			   unsigned long timeout_sec, void *caller)
 {
 	ppc *ctx = FIT_ctx;
+	unsigned long start_time = jiffies;
 	int ret;
 
-	ret = fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ctx, target_node, addr,
-			size, ret_addr, max_ret_size, private_bits, 0, if_use_ret_phys_addr,
-			timeout_sec, caller);
+	do {
+		ret = fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ctx, target_node, addr,
+				size, ret_addr, max_ret_size, private_bits, 0, if_use_ret_phys_addr,
+				timeout_sec, caller);
+	} while (unlikely(ret == -EBUSY) && fit_busy_retry(start_time, timeout_sec));
 
 	return ret;
 }
@@ -341,6 +631,17 @@ int ibapi_num_connected_nodes(void)
 	return atomic_read(&FIT_ctx->num_alive_nodes);
 }
 
+/**
+ * ibapi_max_msg_size
+ *
+ * Return the largest payload a single message or reply may carry,
+ * which is one receive ring slot minus the FIT message header.
+ */
+int ibapi_max_msg_size(void)
+{
+	return IMM_MAX_SIZE - sizeof(struct imm_message_metadata);
+}
+
 int ibapi_get_node_id(void)
 {
 	ppc *ctx;
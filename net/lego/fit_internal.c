@@ -172,6 +172,52 @@ static inline void *get_reply_ready_ptr(ppc *ctx, unsigned int index)
 	return ptr;
 }
 
+static inline void fit_return_reply_credit(ppc *ctx, unsigned int index);
+static inline void free_reply_indicator(ppc *ctx, unsigned int idx);
+
+/*
+ * Publish @value to the waiter of reply indicator @index.
+ * If the waiter went to sleep, wake it up.
+ */
+static inline void fit_set_reply_ready(ppc *ctx, unsigned int index, int value)
+{
+	void *dst_ptr;
+
+	get_reply_ready_ptr(ctx, index);
+
+	/* Claim it, a timed out waiter may be abandoning it */
+	dst_ptr = xchg(&ctx->reply_ready_indicators[index], NULL);
+
+	/* Before waiter could free and reuse this indicator */
+	fit_return_reply_credit(ctx, index);
+
+	/* Nobody waits for this one anymore, see fit_abandon_reply_indicator() */
+	if (unlikely(dst_ptr == &ctx->reply_discard)) {
+		WRITE_ONCE(ctx->reply_abandoned_at[index], 0);
+		kfree(xchg(&ctx->reply_discard_bufs[index], NULL));
+		free_reply_indicator(ctx, index);
+		return;
+	}
+	memcpy(dst_ptr, &value, sizeof(int));
+
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+	{
+		struct task_struct *waiter;
+
+		/*
+		 * Pairs with set_current_state() in fit_adaptive_wait().
+		 * Taking the waiter also takes its task reference.
+		 */
+		smp_mb();
+		waiter = xchg(&ctx->reply_waiters[index], NULL);
+		if (waiter) {
+			wake_up_process(waiter);
+			put_task_struct(waiter);
+		}
+	}
+#endif
+}
+
 static inline void free_reply_indicator(ppc *ctx, unsigned int idx)
 {
 	unsigned long *bitmap = ctx->reply_ready_indicators_bitmap;
@@ -194,25 +240,41 @@ static inline void free_reply_indicator(ppc *ctx, unsigned int idx)
 
 /*
  * @addr: must be a valid kernel virtual address
+ * Return -EBUSY if all indicators are in use.
  */
-static inline unsigned int alloc_index_and_set_reply_indicator(ppc *ctx, void *addr)
+static inline int try_alloc_index_and_set_reply_indicator(ppc *ctx, void *addr)
 {
 	int idx;
 	unsigned long *bitmap = ctx->reply_ready_indicators_bitmap;
 
-retry:
 	spin_lock(&ctx->indicators_lock);
 	for_each_clear_bit(idx, bitmap, IMM_NUM_OF_SEMAPHORE) {
 		set_bit(idx, bitmap);
 		ctx->reply_ready_indicators[idx] = addr;
+		ctx->reply_credits[idx] = FIT_NO_CREDIT;
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+		ctx->reply_waiters[idx] = NULL;
+#endif
 		spin_unlock(&ctx->indicators_lock);
 		return idx;
 	}
 	spin_unlock(&ctx->indicators_lock);
+	return -EBUSY;
+}
+
+static inline unsigned int alloc_index_and_set_reply_indicator(ppc *ctx, void *addr)
+{
+	int idx;
+
+retry:
+	idx = try_alloc_index_and_set_reply_indicator(ctx, addr);
+	if (likely(idx >= 0))
+		return idx;
 
 	/*
-	 * All full? Given the fact that we are using sync RPC,
-	 * the maximum outstanding requests will equal to nr_cpus.
+	 * All full? With sync RPC only, the maximum outstanding
+	 * requests will equal to nr_cpus. Async requests may hold
+	 * more, but they never wait for a free indicator.
 	 * Show correct warnings here.
 	 */
 	if (likely(IMM_NUM_OF_SEMAPHORE <= nr_cpus)) {
@@ -366,11 +428,6 @@ struct lego_context *fit_init_ctx(ppc *ctx, int size, int rx_depth, int port,
 	ctx->recv_num = kmalloc(ctx->num_connections*sizeof(int), GFP_KERNEL);
 	memset(ctx->recv_num, 0, ctx->num_connections*sizeof(int));
 
-	ctx->atomic_request_num = kmalloc(ctx->num_node*sizeof(atomic_t), GFP_KERNEL);
-	memset(ctx->atomic_request_num, 0, ctx->num_node*sizeof(atomic_t));
-	for(i=0;i<ctx->num_node;i++)
-		atomic_set(&ctx->atomic_request_num[i], -1);
-
 	atomic_set(&ctx->parallel_thread_num,0);
 	atomic_set(&ctx->alive_connection, 0);
 	atomic_set(&ctx->num_completed_threads, 0);
@@ -1205,17 +1262,318 @@ int fit_send_message_with_rdma_write_with_imm_request(ppc *ctx, int connection_i
 	return 0;
 }
 
-inline int fit_get_connection_by_atomic_number(ppc *ctx, int target_node, int priority)
+/*
+ * Same as the FIT_SEND_MESSAGE_HEADER_AND_IMM mode above, except the
+ * message is gathered from @iov. Each entry is posted as its own SGE,
+ * so callers do not need to copy header and payload into one buffer.
+ * The receiver sees them as one flat message.
+ */
+int fit_send_message_iov_with_rdma_write_with_imm_request(ppc *ctx, int connection_id,
+		uint32_t input_mr_rkey, uintptr_t input_mr_addr,
+		struct fit_sglist *iov, int nr_iov, int offset, uint32_t imm,
+		struct imm_message_metadata *header, int if_poll_now)
+{
+	struct ib_send_wr wr, *bad_wr = NULL;
+	struct ib_sge sge[FIT_MAX_IOV + 1];
+	int poll_status = SEND_REPLY_WAIT;
+	int i, ret;
+
+	if (unlikely(nr_iov > FIT_MAX_IOV))
+		return -EINVAL;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.sg_list = sge;
+	wr.wr.rdma.remote_addr = (uintptr_t)(input_mr_addr + offset);
+	wr.wr.rdma.rkey = input_mr_rkey;
+
+	if (header->reply_indicator_index == -1)
+		wr.wr_id = -1;
+	else
+		wr.wr_id = (u64)get_reply_ready_ptr(ctx, header->reply_indicator_index);
+
+	wr.opcode = IB_WR_RDMA_WRITE_WITH_IMM;
+	wr.ex.imm_data = imm;
+	wr.send_flags = IB_SEND_SIGNALED;
+	wr.num_sge = nr_iov + 1;
+
+	sge[0].addr = fit_ib_reg_mr_addr(ctx, header, sizeof(*header));
+	sge[0].length = sizeof(struct imm_message_metadata);
+	sge[0].lkey = ctx->proc->lkey;
+
+	for (i = 0; i < nr_iov; i++) {
+		sge[i + 1].addr = fit_ib_reg_mr_addr(ctx, iov[i].addr, iov[i].len);
+		sge[i + 1].length = iov[i].len;
+		sge[i + 1].lkey = ctx->proc->lkey;
+	}
+
+	ret = ib_post_send(ctx->qp[connection_id], &wr, &bad_wr);
+	if (unlikely(ret)) {
+		pr_info_once("Fail to post send to con:%d ret:%d\n",
+			connection_id, ret);
+		WARN_ON_ONCE(1);
+		return ret;
+	}
+
+	fit_internal_poll_sendcq(ctx, ctx->send_cq[connection_id],
+				 connection_id, &poll_status, if_poll_now);
+	return 0;
+}
+
+/*
+ * Each CPU always sends through the same QP of a peer. Concurrent
+ * senders on different CPUs spread over all QPs, and there is no
+ * shared round-robin counter bouncing between them.
+ */
+inline int fit_get_connection_by_cpu(ppc *ctx, int target_node, int priority)
 {
+	int cpu = smp_processor_id();
+
 #ifdef CONFIG_SOCKET_O_IB
-	return atomic_inc_return(&ctx->atomic_request_num[target_node]) % (atomic_read(&ctx->num_alive_connection[target_node]))
+	return cpu % atomic_read(&ctx->num_alive_connection[target_node])
 			+ (NUM_PARALLEL_CONNECTION +1) * target_node;
 #else
-	return atomic_inc_return(&ctx->atomic_request_num[target_node]) % (atomic_read(&ctx->num_alive_connection[target_node]))
+	return cpu % atomic_read(&ctx->num_alive_connection[target_node])
 			+ NUM_PARALLEL_CONNECTION * target_node;
 #endif
 }
 
+static void fit_reclaim_abandoned_credits(ppc *ctx);
+
+/*
+ * Reserve @real_size bytes in the RDMA ring of @target_node.
+ * If it hits the end of ring, write starts from 0 directly.
+ *
+ * We only reserve if all bytes between the oldest unreturned slot and
+ * the end of this one fit into the ring, and there is a free slot.
+ * Otherwise there is no credit: return -EBUSY if @can_wait is false,
+ * or wait until some slot is returned.
+ *
+ * Return the starting offset of the reserved space, and its seq
+ * in @seqp, to be passed to fit_credit_return().
+ */
+static int fit_credit_reserve(ppc *ctx, int target_node, int real_size,
+			      bool can_wait, u32 *seqp)
+{
+	struct fit_peer_credit *c = &ctx->peer_credits[target_node];
+	u32 seq, pos, off, need, tail_seq, tail_pos;
+	long old, new, tail;
+	bool stalled = false;
+
+	while (1) {
+		old = atomic64_read(&c->head);
+		seq = (u32)(old >> 32);
+		pos = (u32)old;
+
+		off = pos % RDMA_RING_SIZE;
+		need = real_size;
+		if (off + real_size >= RDMA_RING_SIZE) {
+			/* The tail of ring is skipped, account it to this slot */
+			need += RDMA_RING_SIZE - off;
+			off = 0;
+		}
+
+		tail = atomic64_read(&c->tail);
+		tail_seq = (u32)(tail >> 32);
+		tail_pos = (u32)tail;
+
+		if (unlikely(pos + need - tail_pos > RDMA_RING_SIZE ||
+			     seq - tail_seq >= FIT_CREDIT_SLOTS)) {
+			fit_reclaim_abandoned_credits(ctx);
+			if (!can_wait) {
+				atomic_long_inc(&c->nr_busy);
+				return -EBUSY;
+			}
+			if (!stalled) {
+				atomic_long_inc(&c->nr_stalls);
+				stalled = true;
+			}
+			schedule();
+			continue;
+		}
+
+		new = ((long)(u32)(seq + 1) << 32) | (u32)(pos + need);
+		if (atomic64_cmpxchg(&c->head, old, new) == old)
+			break;
+	}
+
+	c->slot_end[seq % FIT_CREDIT_SLOTS] = pos + need;
+	smp_wmb();
+
+	fit_hist_record_depth(target_node, seq + 1 - tail_seq);
+
+	*seqp = seq;
+	return off;
+}
+
+/*
+ * Return the ring slot @seq of @target_node.
+ * Slots can be returned in any order, tail moves over the
+ * leading returned ones. Whoever claims a slot moves tail over it.
+ */
+static void fit_credit_return(ppc *ctx, int target_node, u32 seq)
+{
+	struct fit_peer_credit *c = &ctx->peer_credits[target_node];
+	u32 tail_seq, idx;
+	long tail;
+
+	WRITE_ONCE(c->slot_done[seq % FIT_CREDIT_SLOTS], 1);
+	smp_mb();
+
+	while (1) {
+		tail = atomic64_read(&c->tail);
+		tail_seq = (u32)(tail >> 32);
+		if (tail_seq == (u32)(atomic64_read(&c->head) >> 32))
+			break;
+
+		idx = tail_seq % FIT_CREDIT_SLOTS;
+		if (cmpxchg(&c->slot_done[idx], 1, 0) != 1)
+			break;
+
+		atomic64_set(&c->tail, ((long)(u32)(tail_seq + 1) << 32) |
+				       c->slot_end[idx]);
+		/* Pairs with the smp_mb() above */
+		smp_mb();
+	}
+}
+
+/*
+ * Attach ring slot @seq to reply indicator @index. It will be
+ * returned once the reply arrives, the reply is the credit return.
+ */
+static inline void fit_set_reply_credit(ppc *ctx, unsigned int index,
+					int target_node, u32 seq)
+{
+	ctx->reply_credits[index] = ((long)target_node << 32) | seq;
+}
+
+static inline void fit_return_reply_credit(ppc *ctx, unsigned int index)
+{
+	long credit;
+
+	credit = xchg(&ctx->reply_credits[index], FIT_NO_CREDIT);
+	if (credit != FIT_NO_CREDIT)
+		fit_credit_return(ctx, (int)(credit >> 32), (u32)credit);
+}
+
+/*
+ * Stop waiting on reply indicator @index, whose reply lands in @ptr.
+ * The indicator and its ring slot stay reserved, the late reply is
+ * discarded and releases both in fit_set_reply_ready(), together with
+ * @ret_buf if it is not NULL. If the reply
+ * never comes, the ring slot is returned after FIT_ABANDON_GRACE_SEC
+ * by fit_reclaim_abandoned_credits().
+ *
+ * Return false if the reply is being delivered right now,
+ * the caller has to wait for @ptr to be set.
+ */
+static inline bool fit_abandon_reply_indicator(ppc *ctx, unsigned int index,
+					       void *ptr, void *ret_buf)
+{
+	/* Stamp it first, the late reply may clear it right after cmpxchg */
+	WRITE_ONCE(ctx->reply_abandoned_at[index], jiffies | 1);
+	WRITE_ONCE(ctx->reply_discard_bufs[index], ret_buf);
+	if (cmpxchg(&ctx->reply_ready_indicators[index], ptr,
+		    (void *)&ctx->reply_discard) == ptr)
+		return true;
+
+	WRITE_ONCE(ctx->reply_discard_bufs[index], NULL);
+	WRITE_ONCE(ctx->reply_abandoned_at[index], 0);
+	return false;
+}
+
+/*
+ * Return the ring slots of requests abandoned more than
+ * FIT_ABANDON_GRACE_SEC ago, whose replies are most likely lost.
+ * Otherwise a single lost reply pins the tail of that peer's ring,
+ * and all senders to it stall forever.
+ *
+ * The indicators stay reserved: a very late reply must still
+ * find the discard word instead of a new waiter.
+ * Called by senders that found no credit, at most every HZ/10.
+ */
+static void fit_reclaim_abandoned_credits(ppc *ctx)
+{
+	unsigned long now = jiffies, at;
+	long credit;
+	int i;
+
+	if (time_before(now, READ_ONCE(ctx->next_abandon_scan)))
+		return;
+	WRITE_ONCE(ctx->next_abandon_scan, now + HZ / 10);
+
+	for (i = 0; i < IMM_NUM_OF_SEMAPHORE; i++) {
+		at = READ_ONCE(ctx->reply_abandoned_at[i]);
+		if (!at || time_before(now, at + FIT_ABANDON_GRACE_SEC * HZ))
+			continue;
+
+		if (READ_ONCE(ctx->reply_ready_indicators[i]) != &ctx->reply_discard)
+			continue;
+		smp_rmb();
+		if (READ_ONCE(ctx->reply_abandoned_at[i]) != at)
+			continue;
+
+		credit = xchg(&ctx->reply_credits[i], FIT_NO_CREDIT);
+		if (credit == FIT_NO_CREDIT)
+			continue;
+
+		pr_warn("FIT: reclaim ring slot of node %d, reply %d lost\n",
+			(int)(credit >> 32), i);
+		fit_credit_return(ctx, (int)(credit >> 32), (u32)credit);
+	}
+}
+
+/*
+ * Flow control for messages without reply, i.e. ibapi_send().
+ * Their slots are returned right after posting, these messages
+ * still rely on the ACK from receiver to not be overwritten.
+ */
+static void fit_wait_remote_last_ack(ppc *ctx, int target_node,
+				     int tar_offset_start, int real_size)
+{
+	int last_ack;
+
+	while (1) {
+		last_ack = ctx->remote_last_ack_index[target_node];
+		if (tar_offset_start < last_ack && tar_offset_start + real_size > last_ack)
+			schedule();
+		else
+			break;
+	}
+}
+
+#ifdef CONFIG_COUNTER_FIT_IB
+void fit_dump_credits(ppc *ctx)
+{
+	struct fit_peer_credit *c;
+	long head, tail;
+	int i;
+
+	for (i = 0; i < MAX_NODE; i++) {
+		c = &ctx->peer_credits[i];
+		head = atomic64_read(&c->head);
+		tail = atomic64_read(&c->tail);
+		if (!head)
+			continue;
+
+		pr_info("    node %2d: inflight_msgs %5u inflight_bytes %8u stalls %8ld busy %8ld\n",
+			i, (u32)(head >> 32) - (u32)(tail >> 32),
+			(u32)head - (u32)tail,
+			atomic_long_read(&c->nr_stalls),
+			atomic_long_read(&c->nr_busy));
+	}
+}
+
+void fit_reset_credits(ppc *ctx)
+{
+	int i;
+
+	for (i = 0; i < MAX_NODE; i++) {
+		atomic_long_set(&ctx->peer_credits[i].nr_stalls, 0);
+		atomic_long_set(&ctx->peer_credits[i].nr_busy, 0);
+	}
+}
+#endif
+
 int fit_receive_message_no_reply(ppc *ctx, unsigned int port, void *ret_addr, int receive_size, int userspace_flag)
 {
 	//This ret_addr is
@@ -1295,32 +1653,13 @@ int fit_receive_message_no_reply(ppc *ctx, unsigned int port, void *ret_addr, in
 
 #ifdef CONFIG_COMP_MEMORY
 /*
- * Callback for thread pool
+ * Step II of handling a request: FIT internal ACK,
+ * which lets the sender reuse its part of our ring.
  */
-void fit_ack_reply_callback(struct thpool_buffer *b)
+static void fit_ack_request(ppc *ctx, int node_id, int offset)
 {
 	int last_ack, ack_flag = 0;
-	int reply_size, node_id, offset;
-	int reply_connection_id;
-	void *reply_data;
-	ppc *ctx;
-	struct imm_message_metadata *request_metadata;
 
-	ctx = b->fit_ctx;
-	request_metadata = b->fit_imm;
-	node_id = b->fit_node_id;
-	offset = b->fit_offset;
-
-	if (ThpoolBufferPrivateTX(b))
-		reply_data = b->private_tx;
-	else
-		reply_data = b->tx;
-	reply_size = b->tx_size;
-
-	/*
-	 * Step II
-	 * FIT internal ACK
-	 */
 	spin_lock(&ctx->local_last_ack_index_lock[node_id]);
 	last_ack = ctx->local_last_ack_index[node_id];
 	if ((offset>= last_ack && offset - last_ack >= IMM_ACK_FREQ) ||
@@ -1345,6 +1684,35 @@ void fit_ack_reply_callback(struct thpool_buffer *b)
 
 		enqueue_wq(pass);
         }
+}
+
+/*
+ * Callback for thread pool
+ */
+void fit_ack_reply_callback(struct thpool_buffer *b)
+{
+	int reply_size, node_id, offset;
+	int reply_connection_id;
+	void *reply_data;
+	ppc *ctx;
+	struct imm_message_metadata *request_metadata;
+
+	ctx = b->fit_ctx;
+	request_metadata = b->fit_imm;
+	node_id = b->fit_node_id;
+	offset = b->fit_offset;
+
+	if (ThpoolBufferPrivateTX(b))
+		reply_data = b->private_tx;
+	else
+		reply_data = b->tx;
+	reply_size = b->tx_size;
+
+	/*
+	 * Step II
+	 * FIT internal ACK
+	 */
+	fit_ack_request(ctx, node_id, offset);
 
 	/* Comes from ibapi_send() */
 	if (ThpoolBufferNoreply(b))
@@ -1354,7 +1722,7 @@ void fit_ack_reply_callback(struct thpool_buffer *b)
 	 * Step III
 	 * Reply message
 	 */
-        reply_connection_id = fit_get_connection_by_atomic_number(ctx, node_id, LOW_PRIORITY);
+        reply_connection_id = fit_get_connection_by_cpu(ctx, node_id, LOW_PRIORITY);
 
 	/* Send it out. It is really a mess. */
 	fit_send_message_with_rdma_write_with_imm_request(ctx, reply_connection_id,
@@ -1364,6 +1732,42 @@ void fit_ack_reply_callback(struct thpool_buffer *b)
 			request_metadata->reply_indicator_index | IMM_SEND_REPLY_RECV,
                         FIT_SEND_MESSAGE_IMM_ONLY, NULL, 1);
 }
+
+/*
+ * Return true if the request is from ibapi_send(),
+ * whose sender does not wait for any reply.
+ */
+bool fit_request_is_noreply(void *fit_imm)
+{
+	struct imm_message_metadata *request_metadata = fit_imm;
+
+	return request_metadata->reply_indicator_index == -1;
+}
+
+/*
+ * Callback for thread pool, which has no room to queue a request.
+ * The request is acked and dropped, and an empty reply tells the
+ * sender to try again, see SEND_REPLY_BUSY. Requests from
+ * ibapi_send() are just acked, and lost.
+ */
+void fit_busy_reply_callback(void *fit_ctx, void *fit_imm, int node_id, int offset)
+{
+	ppc *ctx = fit_ctx;
+	struct imm_message_metadata *request_metadata = fit_imm;
+	int reply_connection_id;
+
+	fit_ack_request(ctx, node_id, offset);
+	if (fit_request_is_noreply(fit_imm))
+		return;
+
+        reply_connection_id = fit_get_connection_by_cpu(ctx, node_id, LOW_PRIORITY);
+	fit_send_message_with_rdma_write_with_imm_request(ctx, reply_connection_id,
+			request_metadata->reply_rkey,
+                        request_metadata->reply_addr,
+			NULL, 0, 0,
+			request_metadata->reply_indicator_index | IMM_SEND_REPLY_RECV,
+			FIT_SEND_ACK_IMM_ONLY, NULL, 1);
+}
 #endif
 
 int fit_receive_message(ppc *ctx, unsigned int port, void *ret_addr, int receive_size, uintptr_t *reply_descriptor, int userspace_flag)
@@ -1462,7 +1866,7 @@ int fit_receive_message(ppc *ctx, unsigned int port, void *ret_addr, int receive
 int fit_reply_message(ppc *ctx, void *addr, int size, uintptr_t descriptor, int userspace_flag, int if_poll_now)
 {
 	struct imm_message_metadata *tmp = (struct imm_message_metadata *)descriptor;
-	int re_connection_id = fit_get_connection_by_atomic_number(ctx, tmp->source_node_id, LOW_PRIORITY);
+	int re_connection_id = fit_get_connection_by_cpu(ctx, tmp->source_node_id, LOW_PRIORITY);
 
 	fit_debug("re_connection_id: %d, tmp->source_node_id: %d\n",
 		re_connection_id, tmp->source_node_id);
@@ -1481,7 +1885,7 @@ int fit_reply_message_w_extra_bits(ppc *ctx, void *addr, int size, int private_b
 {
 	int imm_data;
 	struct imm_message_metadata *tmp = (struct imm_message_metadata *)descriptor;
-	int re_connection_id = fit_get_connection_by_atomic_number(ctx, tmp->source_node_id, LOW_PRIORITY);
+	int re_connection_id = fit_get_connection_by_cpu(ctx, tmp->source_node_id, LOW_PRIORITY);
 
 	fit_debug("re_connection_id: %d, tmp->source_node_id: %d\n",
 		re_connection_id, tmp->source_node_id);
@@ -1848,6 +2252,9 @@ static int fit_poll_recv_cq(void *_info)
 	struct ib_wc *wc;
 	struct ib_cq *target_cq;
 	struct thread_pass_struct *info = _info;
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+	unsigned int nr_idle_polls = 0;
+#endif
 
 	/* Info passedd down by creater */
 	ctx = info->ctx;
@@ -1857,8 +2264,16 @@ static int fit_poll_recv_cq(void *_info)
 	wc = kmalloc(sizeof(*wc) * NUM_PARALLEL_CONNECTION, GFP_KERNEL);
 	BUG_ON(!wc);
 
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+	/*
+	 * Stay on this CPU, but do not take it exclusively,
+	 * application threads can run here while we are idle.
+	 */
+	set_cpus_allowed_ptr(current, get_cpu_mask(smp_processor_id()));
+#else
 	if (pin_current_thread())
 		panic("Fail to pin poll_cq");
+#endif
 
 	while(1) {
 		/* We keep polling this CQ */
@@ -1868,7 +2283,16 @@ static int fit_poll_recv_cq(void *_info)
 				fit_err("poll_cq error: %d", ne);
 				return ne;
 			}
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+			if (!ne && ++nr_idle_polls >= FIT_RECVCQ_IDLE_POLLS) {
+				nr_idle_polls = 0;
+				cond_resched();
+			}
+#endif
 		} while (ne < 1);
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+		nr_idle_polls = 0;
+#endif
 
 		/* Update stats */
 		nr_recvcq_cqes[recvcq_id] += ne;
@@ -1950,8 +2374,6 @@ static int fit_poll_recv_cq(void *_info)
 					 * This is the sender's handling reply part.
 					 * The incoming message is the reply sent by remote.
 					 */
-					void *dst_ptr;
-
 					length = wc[i].byte_len;
 					reply_indicator_index = wc[i].ex.imm_data & IMM_GET_REPLY_INDICATOR_INDEX;
 					if (unlikely(reply_indicator_index <= 0 ||
@@ -1961,12 +2383,15 @@ static int fit_poll_recv_cq(void *_info)
 						continue;
 					}
 
+					/* Handlers never reply empty, see fit_busy_reply_callback() */
+					if (unlikely(!length))
+						length = SEND_REPLY_BUSY;
+
 					/*
 					 * The thread who did ibapi_send_reply() is busy polling
-					 * this shared memory. This memcpy will release it.
+					 * this shared memory. This will release it.
 					 */
-					dst_ptr = get_reply_ready_ptr(ctx, reply_indicator_index);
-					memcpy(dst_ptr, &length, sizeof(int));
+					fit_set_reply_ready(ctx, reply_indicator_index, length);
 				} else if (wc[i].ex.imm_data & IMM_ACK || wc[i].byte_len == 0) {
 					struct send_and_reply_format *recv;
 
@@ -1986,7 +2411,6 @@ static int fit_poll_recv_cq(void *_info)
 				} else if (wc[i].ex.imm_data & IMM_REPLY_W_EXTRA_BITS) {
 					/* Handle reply with extra bits */
 					int reply_data, private_bits;
-					void *dst_ptr;
 
 					length = wc[i].byte_len;
 					reply_indicator_index = wc[i].ex.imm_data & IMM_GET_REPLY_INDICATOR_INDEX;
@@ -1997,8 +2421,7 @@ static int fit_poll_recv_cq(void *_info)
 						reply_indicator_index, wc[i].byte_len, private_bits,
 						ctx->reply_ready_indicators[reply_indicator_index]);
 
-					dst_ptr = get_reply_ready_ptr(ctx, reply_indicator_index);
-					memcpy(dst_ptr, &reply_data, sizeof(int));
+					fit_set_reply_ready(ctx, reply_indicator_index, reply_data);
 				} else {
 					fit_err("Unknown wc.ex.imm_data: %#lx", wc[i].ex.imm_data);
 					WARN_ON_ONCE(1);
@@ -2323,7 +2746,7 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 	uint32_t remote_rkey;
 	struct fit_ibv_mr *remote_mr;
 	struct imm_message_metadata msg_header;
-	int last_ack;
+	u32 seq;
 	int ret;
 
 	BUG_ON(!addr);
@@ -2334,30 +2757,14 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 		return -EINVAL;
 	}
 
-	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
-	/* If hits the end of ring, write start from 0 directly */
-	if (ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)
-		/* Record the last point */
-		ctx->remote_rdma_ring_mrs_offset[target_node] = real_size;
-	else
-		ctx->remote_rdma_ring_mrs_offset[target_node] += real_size;
-
-	/* Trace back to the real starting point */
-	tar_offset_start = ctx->remote_rdma_ring_mrs_offset[target_node] - real_size;
-	spin_unlock(&ctx->remote_imm_offset_lock[target_node]);
+	tar_offset_start = fit_credit_reserve(ctx, target_node, real_size, true, &seq);
 
 	/* Make sure we do not write beyond lastack */
-	while (1) {
-		last_ack = ctx->remote_last_ack_index[target_node];
-		if (tar_offset_start < last_ack && tar_offset_start + real_size > last_ack)
-			schedule();
-		else
-			break;
-	}
+	fit_wait_remote_last_ack(ctx, target_node, tar_offset_start, real_size);
 
 	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
 
-	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
+	connection_id = fit_get_connection_by_cpu(ctx, target_node, LOW_PRIORITY);
 
 	imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
@@ -2377,145 +2784,427 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 			(uintptr_t)remote_addr, addr, size, tar_offset_start, imm_data,
 			FIT_SEND_MESSAGE_HEADER_AND_IMM, &msg_header, 0);
 
+	/* No reply to return the credit, see fit_wait_remote_last_ack() */
+	fit_credit_return(ctx, target_node, seq);
 	return ret;
 }
 
 /*
- * This is one major function, it is used by ibapi_send_reply().
- * This function is blocking, it uses busy polling to get reply.
+ * Post a send_reply request, without waiting for its reply.
+ * The reply length is written into @req->reply_ready by recv_cq
+ * polling thread, use fit_send_reply_poll/wait() to collect it.
  *
- * Return:
- * Negative values on failues
- * Positive values indicate the reply message length
+ * If @can_wait is false, return -EBUSY if no reply indicator is free.
  */
-int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
-					       int size, void *ret_addr, int max_ret_size,
-					       int userspace_flag, int if_use_ret_phys_addr,
-					       unsigned long timeout_sec, void *caller)
+int fit_send_reply_post(ppc *ctx, int target_node, struct fit_sglist *iov, int nr_iov,
+			void *ret_addr, int max_ret_size, int if_use_ret_phys_addr,
+			struct fit_async_req *req, bool can_wait, void *caller)
 {
 	int tar_offset_start;
 	int connection_id;
 	int reply_indicator_index;
 	int imm_data;
-	int real_size;
+	int real_size, size, i;
 	void *remote_addr;
 	uint32_t remote_rkey;
 	struct fit_ibv_mr *remote_mr;
-	struct imm_message_metadata msg_header;
-	int last_ack;
-	unsigned long start_time;
-	int reply_length;
+	struct imm_message_metadata *msg_header;
+	u32 seq;
 
-	int local_reply_ready_checker = SEND_REPLY_WAIT;
+	/*
+	 * The send_cq may be polled later, the header must outlive
+	 * this function. @req lives until the reply arrives.
+	 */
+	BUILD_BUG_ON(sizeof(*msg_header) > sizeof(req->header));
+	msg_header = (struct imm_message_metadata *)req->header;
 
-	if (unlikely(!addr)) {
-		fit_err("BUG: NULL addr. Caller: %pS", caller);
+	if (unlikely(nr_iov < 1 || nr_iov > FIT_MAX_IOV)) {
+		fit_err("BUG: nr_iov %d. Caller: %pS", nr_iov, caller);
 		return -EINVAL;
 	}
 
+	for (i = 0, size = 0; i < nr_iov; i++) {
+		if (unlikely(!iov[i].addr)) {
+			fit_err("BUG: NULL addr. Caller: %pS", caller);
+			return -EINVAL;
+		}
+		size += iov[i].len;
+	}
+
 	real_size = size + sizeof(struct imm_message_metadata);
 	if (unlikely(real_size > IMM_MAX_SIZE)) {
 		fit_err("Size %d + header > %d", size, IMM_MAX_SIZE);
 		return -EINVAL;
 	}
 
-	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
-	/* If hits the end of ring, write start from 0 directly */
-	if (ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)
-		/* Record the last point */
-		ctx->remote_rdma_ring_mrs_offset[target_node] = real_size;
-	else
-		ctx->remote_rdma_ring_mrs_offset[target_node] += real_size;
+	req->reply_ready = SEND_REPLY_WAIT;
+	req->target_node = target_node;
+	req->caller = caller;
+	req->done = false;
 
-	/* Trace back to the real starting point */
-	tar_offset_start = ctx->remote_rdma_ring_mrs_offset[target_node] - real_size;
-	spin_unlock(&ctx->remote_imm_offset_lock[target_node]);
+	/* Take the indicator first, nothing to undo if we fail */
+	if (can_wait)
+		reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &req->reply_ready);
+	else {
+		reply_indicator_index = try_alloc_index_and_set_reply_indicator(ctx, &req->reply_ready);
+		if (unlikely(reply_indicator_index < 0))
+			return reply_indicator_index;
+	}
+	req->reply_indicator_index = reply_indicator_index;
 
-	/* Make sure we do not write beyond lastack */
-	while (1) {
-		last_ack = ctx->remote_last_ack_index[target_node];
-		if (tar_offset_start < last_ack && tar_offset_start + real_size > last_ack)
-			schedule();
-		else
-			break;
+	/* No credit means backpressure, async callers see -EBUSY */
+	tar_offset_start = fit_credit_reserve(ctx, target_node, real_size, can_wait, &seq);
+	if (unlikely(tar_offset_start < 0)) {
+		free_reply_indicator(ctx, reply_indicator_index);
+		return tar_offset_start;
 	}
+	fit_set_reply_credit(ctx, reply_indicator_index, target_node, seq);
 
-	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
+	/* One-way messages in the ring are only protected by this */
+	fit_wait_remote_last_ack(ctx, target_node, tar_offset_start, real_size);
 
-	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
+	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
 
-	reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker);
+	connection_id = fit_get_connection_by_cpu(ctx, target_node, LOW_PRIORITY);
+	req->connection_id = connection_id;
 
 	imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
 	if (if_use_ret_phys_addr == 1)
-		msg_header.reply_addr = fit_ib_reg_mr_addr_phys(ctx, ret_addr, max_ret_size);
+		msg_header->reply_addr = fit_ib_reg_mr_addr_phys(ctx, ret_addr, max_ret_size);
 	else
-		msg_header.reply_addr = fit_ib_reg_mr_addr(ctx, ret_addr, max_ret_size);
+		msg_header->reply_addr = fit_ib_reg_mr_addr(ctx, ret_addr, max_ret_size);
 
-	msg_header.reply_rkey = ctx->proc->rkey;
-	msg_header.reply_indicator_index = reply_indicator_index;
-	msg_header.source_node_id = ctx->node_id;
-	msg_header.size = size;
+	msg_header->reply_rkey = ctx->proc->rkey;
+	msg_header->reply_indicator_index = reply_indicator_index;
+	msg_header->source_node_id = ctx->node_id;
+	msg_header->size = size;
 	remote_addr = remote_mr->addr;
 	remote_rkey = remote_mr->rkey;
 
 	fit_debug("send imm-%x addr-%x rkey-%x oaddr-%x orkey-%x\n",
-		imm_data, remote_addr, remote_rkey, msg_header.reply_addr, msg_header.reply_rkey);
+		imm_data, remote_addr, remote_rkey, msg_header->reply_addr, msg_header->reply_rkey);
 
 	/* for send reply, no need to poll the send now, since we have reply already */
-	fit_send_message_with_rdma_write_with_imm_request(ctx, connection_id, remote_rkey,
-			(uintptr_t)remote_addr, addr, size, tar_offset_start, imm_data,
-			FIT_SEND_MESSAGE_HEADER_AND_IMM, &msg_header, 0);
+	fit_send_message_iov_with_rdma_write_with_imm_request(ctx, connection_id,
+			remote_rkey, (uintptr_t)remote_addr, iov, nr_iov,
+			tar_offset_start, imm_data, msg_header, 0);
 
-	/*
-	 * Default model
-	 *
-	 * And we don't want to stuck here forever.
-	 * So we add timeout checking here.
-	 *
-	 * Side note:
-	 * This is where make our network requests all synchronous.
-	 * If we want to change the behaviour, we need to change here.
-	 */
+	req->opcode = iov[0].len >= sizeof(u32) ? *(u32 *)iov[0].addr : 0;
+	req->start_time = jiffies;
+	req->start_ns = profile_clock();
+	return 0;
+}
+
+/*
+ * Check if the reply of @req has arrived, never blocks.
+ *
+ * Return:
+ * -EAGAIN if the reply is not here yet
+ * -EBUSY if the receiver dropped the request, it can be posted again
+ * Otherwise the reply length (or error from remote)
+ */
+int fit_send_reply_poll(ppc *ctx, struct fit_async_req *req)
+{
+	int reply_length;
+
+	if (req->done)
+		return req->ret;
+
+	reply_length = READ_ONCE(req->reply_ready);
+	if (reply_length == SEND_REPLY_WAIT)
+		return -EAGAIN;
+
+	free_reply_indicator(ctx, req->reply_indicator_index);
+	fit_hist_record_latency(req->target_node, req->opcode,
+				profile_clock() - req->start_ns);
+
+	if (unlikely(reply_length == SEND_REPLY_BUSY)) {
+		/* Not handled at all, caller may post it again */
+		reply_length = -EBUSY;
+	} else if (unlikely(reply_length < 0)) {
+		fit_err("connection-%d inbox-%d reply-length-%d",
+			req->connection_id, req->reply_indicator_index, reply_length);
+	}
+
+	req->ret = reply_length;
+	req->done = true;
+	return reply_length;
+}
+
+static void fit_send_reply_timeout(struct fit_async_req *req)
+{
+	pr_warn("ibapi_send_reply() CPU:%d PID:%d timeout (%u ms), caller: %pS\n",
+		smp_processor_id(), current->pid,
+		jiffies_to_msecs(jiffies - req->start_time), req->caller);
+}
+
+static inline unsigned long fit_clamp_timeout(unsigned long timeout_sec)
+{
 	/* Caller does not specify an timeout, use the maximum */
-	if (timeout_sec == 0)
+	if (timeout_sec == 0 || timeout_sec > FIT_MAX_TIMEOUT_SEC)
 		timeout_sec = FIT_MAX_TIMEOUT_SEC;
+	return timeout_sec;
+}
 
-	if (timeout_sec > FIT_MAX_TIMEOUT_SEC)
-		timeout_sec = FIT_MAX_TIMEOUT_SEC;
+/*
+ * The receiver replied SEND_REPLY_BUSY to a synchronous request.
+ * Back off a little, and tell if it is still worth posting again
+ * for a caller that started at @start_time.
+ */
+bool fit_busy_retry(unsigned long start_time, unsigned long timeout_sec)
+{
+	udelay(FIT_BUSY_RETRY_US);
+	return time_before(jiffies, start_time + fit_clamp_timeout(timeout_sec) * HZ);
+}
 
-	start_time = jiffies;
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+/*
+ * Expected round trip time of each opcode, in ns.
+ * Opcodes are hashed into slots, updated as an EWMA of 1/8.
+ * Races between updaters are fine, it is just a hint.
+ */
+#define FIT_RTT_SLOTS		64
+#define FIT_MIN_SPIN_NS		(2 * NSEC_PER_USEC)
+#define FIT_MAX_SPIN_NS		(200 * NSEC_PER_USEC)
+
+static unsigned long fit_expected_rtt_ns[FIT_RTT_SLOTS];
+
+static inline unsigned long *fit_rtt_slot(u32 opcode)
+{
+	return &fit_expected_rtt_ns[opcode % FIT_RTT_SLOTS];
+}
+
+static inline unsigned long fit_spin_budget(u32 opcode)
+{
+	unsigned long budget = READ_ONCE(*fit_rtt_slot(opcode)) * 2;
+
+	return clamp_t(unsigned long, budget, FIT_MIN_SPIN_NS, FIT_MAX_SPIN_NS);
+}
+
+static inline void fit_update_rtt(u32 opcode, unsigned long rtt)
+{
+	unsigned long *slot = fit_rtt_slot(opcode);
+	unsigned long old = READ_ONCE(*slot);
+
+	if (!old)
+		WRITE_ONCE(*slot, rtt);
+	else
+		WRITE_ONCE(*slot, old - old / 8 + rtt / 8);
+}
+
+/*
+ * Stop being the sleeper of indicator @idx, before it is freed.
+ * Whoever takes the task out of reply_waiters drops its reference,
+ * so a late wake_up_process() never sees a dead task.
+ */
+static inline void fit_clear_reply_waiter(ppc *ctx, unsigned int idx)
+{
+	struct task_struct *waiter;
+
+	waiter = xchg(&ctx->reply_waiters[idx], NULL);
+	if (waiter)
+		put_task_struct(waiter);
+}
+
+/*
+ * Spin for about twice the expected rtt of this opcode, which covers
+ * most of the replies. Then sleep until recv_cq polling thread wakes
+ * us up in fit_set_reply_ready(). The timed sleep is only a safety net.
+ * Only used when caller says it may sleep, many callers wait with
+ * spinlocks held or on per-CPU buffers.
+ */
+static int fit_adaptive_wait(ppc *ctx, struct fit_async_req *req,
+			     unsigned long timeout_sec)
+{
+	unsigned long long deadline;
+	unsigned int idx = req->reply_indicator_index;
+	int ret;
+
+	deadline = req->start_ns + fit_spin_budget(req->opcode);
+	while ((ret = fit_send_reply_poll(ctx, req)) == -EAGAIN) {
+		if (profile_clock() > deadline)
+			break;
+		cpu_relax();
+	}
+
+	if (ret == -EAGAIN) {
+		get_task_struct(current);
+		WRITE_ONCE(ctx->reply_waiters[idx], current);
+		while (1) {
+			set_current_state(TASK_UNINTERRUPTIBLE);
+
+			/* Do not poll, that frees the indicator */
+			if (READ_ONCE(req->reply_ready) != SEND_REPLY_WAIT)
+				break;
+
+			if (unlikely(time_after(jiffies, req->start_time + timeout_sec * HZ))) {
+				__set_current_state(TASK_RUNNING);
+				fit_clear_reply_waiter(ctx, idx);
+				fit_send_reply_timeout(req);
+				return -ETIMEDOUT;
+			}
+			schedule_timeout(1);
+		}
+		__set_current_state(TASK_RUNNING);
+
+		/* Before the indicator goes to its next user */
+		fit_clear_reply_waiter(ctx, idx);
+		ret = fit_send_reply_poll(ctx, req);
+	}
+
+	fit_update_rtt(req->opcode, profile_clock() - req->start_ns);
+	return ret;
+}
+#endif /* CONFIG_FIT_ADAPTIVE_WAIT */
+
+/*
+ * Wait for the reply of @req. The timeout is counted from
+ * the time @req was posted. On timeout, @req stays pending and
+ * can be waited again. Busy wait, unless @may_sleep.
+ */
+int fit_send_reply_wait(ppc *ctx, struct fit_async_req *req,
+			unsigned long timeout_sec, bool may_sleep)
+{
+	int ret;
+
+	timeout_sec = fit_clamp_timeout(timeout_sec);
+
+#ifdef CONFIG_FIT_ADAPTIVE_WAIT
+	if (may_sleep && !req->done)
+		return fit_adaptive_wait(ctx, req, timeout_sec);
+#endif
 
 	/*
-	 * The local_reply_ready_checker will be set by
+	 * The reply_ready will be set by
 	 * recv_cq polling thread, when it gets the reply.
 	 */
-	while (local_reply_ready_checker == SEND_REPLY_WAIT) {
+	while ((ret = fit_send_reply_poll(ctx, req)) == -EAGAIN) {
+		cpu_relax();
+		if (unlikely(time_after(jiffies, req->start_time + timeout_sec * HZ))) {
+			fit_send_reply_timeout(req);
+			return -ETIMEDOUT;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Give up a timed out @req. After this, @req may go away, its reply
+ * is discarded when it arrives. The reply data itself still lands
+ * in the ret_addr given at post time, so @ret_buf, if not NULL, is
+ * kfree'd only after that.
+ *
+ * Return -ETIMEDOUT if @req is abandoned, or its reply if it raced in.
+ * In the latter case @ret_buf still belongs to the caller.
+ */
+int fit_send_reply_abandon(ppc *ctx, struct fit_async_req *req, void *ret_buf)
+{
+	int ret;
+
+	if (req->done)
+		return req->ret;
+
+	if (fit_abandon_reply_indicator(ctx, req->reply_indicator_index,
+					&req->reply_ready, ret_buf))
+		return -ETIMEDOUT;
+
+	while ((ret = fit_send_reply_poll(ctx, req)) == -EAGAIN)
+		cpu_relax();
+	return ret;
+}
+
+/*
+ * Busy wait until any of the @nr requests has its reply.
+ * Requests completed before are skipped.
+ *
+ * Return the index of the completed request, whose reply length
+ * is in reqs[i]->ret. -ENOENT if all are completed already,
+ * -ETIMEDOUT if nothing arrives in time.
+ */
+int fit_send_reply_wait_any(ppc *ctx, struct fit_async_req **reqs, int nr,
+			    unsigned long timeout_sec)
+{
+	unsigned long start_time = jiffies;
+	int i, nr_pending, ret;
+
+	timeout_sec = fit_clamp_timeout(timeout_sec);
+
+	while (1) {
+		nr_pending = 0;
+		for (i = 0; i < nr; i++) {
+			if (reqs[i]->done)
+				continue;
+
+			nr_pending++;
+			ret = fit_send_reply_poll(ctx, reqs[i]);
+			if (ret != -EAGAIN)
+				return i;
+		}
+
+		if (!nr_pending)
+			return -ENOENT;
+
 		cpu_relax();
 		if (unlikely(time_after(jiffies, start_time + timeout_sec * HZ))) {
-			pr_warn("ibapi_send_reply() CPU:%d PID:%d timeout (%u ms), caller: %pS\n",
-				smp_processor_id(), current->pid,
-				jiffies_to_msecs(jiffies - start_time), caller);
-			print_pcache_events();
-			print_profile_points();
-			dump_ib_stats();
+			for (i = 0; i < nr; i++) {
+				if (!reqs[i]->done) {
+					fit_send_reply_timeout(reqs[i]);
+					break;
+				}
+			}
 			return -ETIMEDOUT;
 		}
 	}
-	free_reply_indicator(ctx, reply_indicator_index);
-	reply_length = local_reply_ready_checker;
+}
 
-	if (unlikely(reply_length < 0)) {
-		fit_err("connection-%d inbox-%d reply-length-%d",
-			connection_id, reply_indicator_index, reply_length);
+/*
+ * This is one major function, it is used by ibapi_send_reply().
+ * This function is blocking, it uses busy polling to get reply.
+ *
+ * Return:
+ * Negative values on failues
+ * Positive values indicate the reply message length
+ */
+int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
+					       int size, void *ret_addr, int max_ret_size,
+					       int userspace_flag, int if_use_ret_phys_addr,
+					       unsigned long timeout_sec, void *caller)
+{
+	struct fit_async_req req;
+	struct fit_sglist iov = {
+		.addr	= addr,
+		.len	= size,
+	};
+	unsigned long start_time = jiffies;
+	int ret;
+
+	do {
+		ret = fit_send_reply_post(ctx, target_node, &iov, 1, ret_addr,
+					  max_ret_size, if_use_ret_phys_addr, &req,
+					  true, caller);
+		if (unlikely(ret))
+			return ret;
+
+		ret = fit_send_reply_wait(ctx, &req, timeout_sec, false);
+	} while (unlikely(ret == -EBUSY) && fit_busy_retry(start_time, timeout_sec));
+
+	/* Nobody will wait again, @req is on our stack */
+	if (unlikely(ret == -ETIMEDOUT)) {
+		ret = fit_send_reply_abandon(ctx, &req, NULL);
+		if (ret == -ETIMEDOUT) {
+			print_pcache_events();
+			print_profile_points();
+			dump_ib_stats();
+		}
 	}
-	return reply_length;
+	return ret;
 }
 
 /*
  * send data and reply with extra bits
  * Return:
+ * -EBUSY if the receiver had no room for it
  * Negative values on failues
  * Positive values indicate the reply message length
  */
@@ -2534,8 +3223,9 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 	uint32_t remote_rkey;
 	struct fit_ibv_mr *remote_mr;
 	struct imm_message_metadata msg_header;
-	int last_ack;
+	u32 seq;
 	unsigned long start_time;
+	unsigned long long start_ns;
 	int reply_length;
 
 	real_size = size + sizeof(struct imm_message_metadata);
@@ -2545,32 +3235,17 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 		return -1;
 	}
 
-	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
-	if(ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)//If hits the end of ring, write start from 0 directly
-		ctx->remote_rdma_ring_mrs_offset[target_node] = real_size;//Record the last point
-	else
-		ctx->remote_rdma_ring_mrs_offset[target_node] += real_size;
-	tar_offset_start = ctx->remote_rdma_ring_mrs_offset[target_node] - real_size;//Trace back to the real starting point
-	spin_unlock(&ctx->remote_imm_offset_lock[target_node]);
-
-	//printk(KERN_CRIT "%s tar_offset_start %d real_size %d last_ack_index %d\n",
-	//		__func__, tar_offset_start, real_size, ctx->remote_last_ack_index[target_node]);
+	tar_offset_start = fit_credit_reserve(ctx, target_node, real_size, true, &seq);
 
 	/* make sure we do not write beyond lastack */
-	while(1)
-	{
-		last_ack = ctx->remote_last_ack_index[target_node];
-		if(tar_offset_start < last_ack && tar_offset_start + real_size > last_ack)
-			schedule();
-		else
-			break;
-	}
+	fit_wait_remote_last_ack(ctx, target_node, tar_offset_start, real_size);
 
 	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
 
-	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
+	connection_id = fit_get_connection_by_cpu(ctx, target_node, LOW_PRIORITY);
 
 	reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker);
+	fit_set_reply_credit(ctx, reply_indicator_index, target_node, seq);
 
 	imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
@@ -2597,6 +3272,7 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 	fit_send_message_with_rdma_write_with_imm_request(ctx, connection_id, remote_rkey,
 			(uintptr_t)remote_addr, addr, size, tar_offset_start, imm_data,
 			FIT_SEND_MESSAGE_HEADER_AND_IMM, &msg_header, 0);
+	start_ns = profile_clock();
 
 #ifdef SCHEDULE_MODEL
 	schedule();
@@ -2620,9 +3296,17 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 	while (local_reply_ready_checker == SEND_REPLY_WAIT) {
 		cpu_relax();
 		if (unlikely(time_after(jiffies, start_time + timeout_sec * HZ))) {
-			pr_warn("ibapi_send_reply() polling timeout (%u ms), caller: %pS\n",
-				jiffies_to_msecs(jiffies - start_time), caller);
-			return -ETIMEDOUT;
+			if (fit_abandon_reply_indicator(ctx, reply_indicator_index,
+							&local_reply_ready_checker, NULL)) {
+				pr_warn("ibapi_send_reply() polling timeout (%u ms), caller: %pS\n",
+					jiffies_to_msecs(jiffies - start_time), caller);
+				return -ETIMEDOUT;
+			}
+
+			/* The reply is being delivered right now */
+			while (READ_ONCE(local_reply_ready_checker) == SEND_REPLY_WAIT)
+				cpu_relax();
+			break;
 		}
 	}
 	free_reply_indicator(ctx, reply_indicator_index);
@@ -2661,6 +3345,15 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 	*ret_private_bits = local_reply_ready_checker & 0xff;
 #endif
 
+	/* The empty busy reply carries no private bits */
+	if (unlikely(local_reply_ready_checker == SEND_REPLY_BUSY)) {
+		*ret_private_bits = 0;
+		return -EBUSY;
+	}
+
+	fit_hist_record_latency(target_node, size >= sizeof(u32) ? *(u32 *)addr : 0,
+				profile_clock() - start_ns);
+
 	if (reply_length < 0)
 	{
 		printk(KERN_CRIT "%s: [significant error] send-reply-imm fail with connection-%d inbox-%d reply-length-%d\n",
@@ -2693,7 +3386,7 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 	uint32_t remote_rkey;
 	struct fit_ibv_mr *remote_mr;
 	struct imm_message_metadata *msg_header;
-	int last_ack;
+	u32 seq;
 	unsigned long start_time;
         int ret = 0;
 
@@ -2728,26 +3421,13 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 			goto out;
 		}
 
-		spin_lock(&ctx->remote_imm_offset_lock[target_node[i]]);
-		if(ctx->remote_rdma_ring_mrs_offset[target_node[i]] + real_size >= RDMA_RING_SIZE)//If hits the end of ring, write start from 0 directly
-			ctx->remote_rdma_ring_mrs_offset[target_node[i]] = real_size;//Record the last point
-		else
-			ctx->remote_rdma_ring_mrs_offset[target_node[i]] += real_size;
-		tar_offset_start = ctx->remote_rdma_ring_mrs_offset[target_node[i]] - real_size;//Trace back to the real starting point
-		spin_unlock(&ctx->remote_imm_offset_lock[target_node[i]]);
+		tar_offset_start = fit_credit_reserve(ctx, target_node[i], real_size, true, &seq);
 
 		/* make sure we do not write beyond lastack */
-		while(1)
-		{
-			last_ack = ctx->remote_last_ack_index[target_node[i]];
-			if(tar_offset_start < last_ack && tar_offset_start + real_size > last_ack)
-				schedule();
-			else
-				break;
-		}
+		fit_wait_remote_last_ack(ctx, target_node[i], tar_offset_start, real_size);
 
 		remote_mr = &(ctx->remote_rdma_ring_mrs[target_node[i]]);
-		connection_id = fit_get_connection_by_atomic_number(ctx, target_node[i], LOW_PRIORITY);
+		connection_id = fit_get_connection_by_cpu(ctx, target_node[i], LOW_PRIORITY);
 		reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker[i]);
                 imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
@@ -2768,6 +3448,9 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 		fit_send_message_with_rdma_write_with_imm_request(ctx, connection_id, remote_rkey,
 				(uintptr_t)remote_addr, sglist[i].addr, sglist[i].len, tar_offset_start, imm_data,
 				FIT_SEND_MESSAGE_HEADER_AND_IMM, &msg_header[i], 0);
+
+		/* Multicast does not track replies per slot */
+		fit_credit_return(ctx, target_node[i], seq);
 	}
 
 	/* Caller does not specify an timeout, use the maximum */
@@ -3040,15 +3723,13 @@ retry:
 
 	/* array to store rdma ring mr for all remote nodes */
 	ctx->remote_rdma_ring_mrs = (struct fit_ibv_mr *)kmalloc(MAX_NODE * sizeof(struct fit_ibv_mr), GFP_KERNEL);
-	ctx->remote_rdma_ring_mrs_offset = (int *)kzalloc(MAX_NODE * sizeof(int), GFP_KERNEL);
+	ctx->peer_credits = kzalloc(MAX_NODE * sizeof(struct fit_peer_credit), GFP_KERNEL);
+	ctx->next_abandon_scan = jiffies;
 	ctx->remote_last_ack_index = (int *)kzalloc(MAX_NODE * sizeof(int), GFP_KERNEL);
 	ctx->local_last_ack_index = (int *)kzalloc(MAX_NODE * sizeof(int), GFP_KERNEL);
 	ctx->local_last_ack_index_lock = (spinlock_t *)kmalloc(MAX_NODE * sizeof(spinlock_t), GFP_KERNEL);
-	ctx->remote_imm_offset_lock = (spinlock_t *)kmalloc(MAX_NODE * sizeof(spinlock_t), GFP_KERNEL);
-	for(i=0; i<MAX_NODE; i++) {
-		spin_lock_init(&ctx->remote_imm_offset_lock[i]);
+	for(i=0; i<MAX_NODE; i++)
 		spin_lock_init(&ctx->local_last_ack_index_lock[i]);
-	}
 
 #ifdef CONFIG_SOCKET_O_IB
 	/*
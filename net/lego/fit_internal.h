@@ -22,6 +22,12 @@
  */
 #define NUM_POLLING_THREADS		(CONFIG_FIT_NR_RECVCQ_POLLING_THREADS)
 
+/*
+ * With CONFIG_FIT_ADAPTIVE_WAIT, recv_cq polling thread
+ * yields its CPU after this many empty polls in a row.
+ */
+#define FIT_RECVCQ_IDLE_POLLS		(1024)
+
 /* THREAD_HANDLER_MODEL - CHOOSE ONE*/
 #define WAITING_QUEUE_IMPLEMENTATION
 //#define IMPLEMENTATION_THREAD_SPAWN
@@ -50,6 +56,18 @@ int fit_cleanup_module(void);
 //int fit_query_port(ppc *ctx, int target_node, int desigend_port, int requery_flag);
 
 struct fit_sglist;
+struct fit_async_req;
+
+int fit_send_reply_post(ppc *ctx, int target_node, struct fit_sglist *iov, int nr_iov,
+			void *ret_addr, int max_ret_size, int if_use_ret_phys_addr,
+			struct fit_async_req *req, bool can_wait, void *caller);
+int fit_send_reply_poll(ppc *ctx, struct fit_async_req *req);
+int fit_send_reply_wait(ppc *ctx, struct fit_async_req *req, unsigned long timeout_sec,
+			bool may_sleep);
+int fit_send_reply_abandon(ppc *ctx, struct fit_async_req *req, void *ret_buf);
+bool fit_busy_retry(unsigned long start_time, unsigned long timeout_sec);
+int fit_send_reply_wait_any(ppc *ctx, struct fit_async_req **reqs, int nr,
+			    unsigned long timeout_sec);
 
 int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 				int size, void *ret_addr, int max_ret_size, int userspace_flag,
@@ -71,6 +89,24 @@ int fit_reply_message(ppc *ctx, void *addr, int size, uintptr_t descriptor, int
 int fit_reply_message_w_extra_bits(ppc *ctx, void *addr, int size, int private_bits, uintptr_t descriptor, int userspace_flag, int if_poll_now);
 int fit_receive_message(ppc *ctx, unsigned int port, void *ret_addr, int receive_size, uintptr_t *reply_descriptor, int userspace_flag);
 
+#ifdef CONFIG_COUNTER_FIT_IB
+void fit_dump_credits(ppc *ctx);
+void fit_reset_credits(ppc *ctx);
+#endif
+
+/* fit_hist.c */
+#ifdef CONFIG_COUNTER_FIT_IB_LATENCY
+void fit_hist_record_latency(int node, u32 opcode, u64 ns);
+void fit_hist_record_depth(int node, u32 depth);
+void fit_dump_latency_hist(void);
+void fit_reset_latency_hist(void);
+#else
+static inline void fit_hist_record_latency(int node, u32 opcode, u64 ns) { }
+static inline void fit_hist_record_depth(int node, u32 depth) { }
+static inline void fit_dump_latency_hist(void) { }
+static inline void fit_reset_latency_hist(void) { }
+#endif
+
 int fit_internal_init(void);
 int fit_internal_cleanup(void);
 